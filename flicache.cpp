@@ -0,0 +1,206 @@
+#include "flicache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <iostream>
+
+#define FLICACHE_MAGIC "FLICACHE"
+#define FLICACHE_FORMAT_VERSION (1)
+// sanity limit for table sizes read back from a (possibly corrupted) file
+#define FLICACHE_MAX_ENTRIES (4096)
+
+//--------------------------------------------------------------
+// small helpers for the binary file format
+// all values are written in host byte order - the cache never leaves the station PC
+
+static bool writeU32( FILE* fp, uint32_t value )
+{
+  return (fwrite( &value, sizeof(value), 1, fp ) == 1);
+}
+
+static bool readU32( FILE* fp, uint32_t* value )
+{
+  return (fread( value, sizeof(*value), 1, fp ) == 1);
+}
+
+static bool writeString( FILE* fp, const std::string& str )
+{
+  return writeU32( fp, str.length() )
+    && (fwrite( str.c_str(), 1, str.length(), fp ) == str.length());
+}
+
+static bool readString( FILE* fp, std::string* str )
+{
+  uint32_t len;
+  if( !readU32( fp, &len ) || (len > FLICACHE_MAX_ENTRIES) )
+    {
+      return false;
+    }
+  str->resize( len );
+  return (len == 0) || (fread( &((*str)[0]), 1, len, fp ) == len);
+}
+
+template <typename T> static bool writeTable( FILE* fp, const std::vector<T>& table )
+{
+  return writeU32( fp, table.size() )
+    && (table.empty() || (fwrite( table.data(), sizeof(T), table.size(), fp ) == table.size()));
+}
+
+template <typename T> static bool readTable( FILE* fp, std::vector<T>* table )
+{
+  uint32_t num;
+  if( !readU32( fp, &num ) || (num > FLICACHE_MAX_ENTRIES) )
+    {
+      return false;
+    }
+  table->resize( num );
+  return (num == 0) || (fread( table->data(), sizeof(T), num, fp ) == num);
+}
+
+//--------------------------------------------------------------
+
+FliCacheC::FliCacheC()
+{
+  str_folder = defaultFolder();
+}
+
+//--------------------------------------------------------------
+/// $XDG_CACHE_HOME/flictl or ~/.cache/flictl
+std::string FliCacheC::defaultFolder()
+{
+  const char* xdg = getenv( "XDG_CACHE_HOME" );
+  if( (xdg != NULL) && (xdg[0] != '\0') )
+    {
+      return std::string( xdg ) + "/flictl";
+    }
+  const char* home = getenv( "HOME" );
+  if( (home != NULL) && (home[0] != '\0') )
+    {
+      return std::string( home ) + "/.cache/flictl";
+    }
+  return "/tmp/flictl-cache";
+}
+
+//--------------------------------------------------------------
+
+void FliCacheC::setFolder( const std::string& folder )
+{
+  str_folder = folder;
+}
+
+//--------------------------------------------------------------
+
+std::string FliCacheC::fileName( const std::string& serial )
+{
+  std::string name = serial;
+  // serial numbers come from the camera, keep them out of the path syntax
+  for( size_t i = 0; i < name.length(); i++ )
+    {
+      if( name[i] == '/' || name[i] == '.' || name[i] == ' ' )
+	{
+	  name[i] = '_';
+	}
+    }
+  return str_folder + "/" + name + ".cache";
+}
+
+//--------------------------------------------------------------
+/// load cached camera description
+/// return true if a valid entry for this serial and firmware version exists
+bool FliCacheC::load( const std::string& serial, const std::string& version,
+		      FPROCAP* capabilities,
+		      std::vector<FPROGAINVALUE>* gainTableLow,
+		      std::vector<FPROGAINVALUE>* gainTableHigh,
+		      std::vector<FPROSENSMODE>* modes )
+{
+  FILE* fp = fopen( fileName( serial ).c_str(), "rb" );
+  if( fp == NULL )
+    {
+      return false;
+    }
+
+  char magic[sizeof(FLICACHE_MAGIC)];
+  uint32_t formatVersion, capSize, gainSize, modeSize;
+  std::string cachedVersion;
+  FPROCAP cap;
+  std::vector<FPROGAINVALUE> low, high;
+  std::vector<FPROSENSMODE> modeList;
+
+  // struct sizes guard against a libflipro upgrade changing the layout
+  bool ok = (fread( magic, 1, sizeof(magic), fp ) == sizeof(magic))
+    && (memcmp( magic, FLICACHE_MAGIC, sizeof(magic) ) == 0)
+    && readU32( fp, &formatVersion ) && (formatVersion == FLICACHE_FORMAT_VERSION)
+    && readU32( fp, &capSize ) && (capSize == sizeof(FPROCAP))
+    && readU32( fp, &gainSize ) && (gainSize == sizeof(FPROGAINVALUE))
+    && readU32( fp, &modeSize ) && (modeSize == sizeof(FPROSENSMODE))
+    && readString( fp, &cachedVersion ) && (cachedVersion == version)
+    && (fread( &cap, sizeof(cap), 1, fp ) == 1)
+    && readTable( fp, &low ) && readTable( fp, &high ) && readTable( fp, &modeList );
+  fclose( fp );
+
+  if( !ok )
+    {
+      std::cout << "FliCacheC::load() DEBUG: no valid cache entry for camera " << serial
+		<< " version " << version << std::endl;
+      return false;
+    }
+  *capabilities = cap;
+  gainTableLow->swap( low );
+  gainTableHigh->swap( high );
+  modes->swap( modeList );
+  return true;
+}
+
+//--------------------------------------------------------------
+/// store camera description, written to a temporary file and renamed,
+/// so concurrent flictl processes never see a partial file
+/// return true if succeeded, false if failed
+bool FliCacheC::save( const std::string& serial, const std::string& version,
+		      const FPROCAP& capabilities,
+		      const std::vector<FPROGAINVALUE>& gainTableLow,
+		      const std::vector<FPROGAINVALUE>& gainTableHigh,
+		      const std::vector<FPROSENSMODE>& modes )
+{
+  // mkdir -p
+  for( size_t pos = 1; pos != std::string::npos; )
+    {
+      pos = str_folder.find( '/', pos + 1 );
+      std::string dir = str_folder.substr( 0, pos );
+      if( (mkdir( dir.c_str(), 0755 ) < 0) && (errno != EEXIST) )
+	{
+	  std::cerr << "FliCacheC::save() ERROR: cannot create folder " << dir << ", errno=" << errno << std::endl;
+	  return false;
+	}
+    }
+
+  std::string name = fileName( serial );
+  char pidStr[32];
+  snprintf( pidStr, sizeof(pidStr), ".%d", (int)getpid() );
+  std::string tmpName = name + pidStr;
+  FILE* fp = fopen( tmpName.c_str(), "wb" );
+  if( fp == NULL )
+    {
+      std::cerr << "FliCacheC::save() ERROR: cannot create " << tmpName << ", errno=" << errno << std::endl;
+      return false;
+    }
+  bool ok = (fwrite( FLICACHE_MAGIC, 1, sizeof(FLICACHE_MAGIC), fp ) == sizeof(FLICACHE_MAGIC))
+    && writeU32( fp, FLICACHE_FORMAT_VERSION )
+    && writeU32( fp, sizeof(FPROCAP) )
+    && writeU32( fp, sizeof(FPROGAINVALUE) )
+    && writeU32( fp, sizeof(FPROSENSMODE) )
+    && writeString( fp, version )
+    && (fwrite( &capabilities, sizeof(capabilities), 1, fp ) == 1)
+    && writeTable( fp, gainTableLow ) && writeTable( fp, gainTableHigh ) && writeTable( fp, modes );
+  ok = (fclose( fp ) == 0) && ok;
+  if( !ok || (rename( tmpName.c_str(), name.c_str() ) < 0) )
+    {
+      std::cerr << "FliCacheC::save() ERROR: failed to write " << name << std::endl;
+      unlink( tmpName.c_str() );
+      return false;
+    }
+  return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "libflipro.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// On-disk cache of the static camera description: capabilities, gain tables
+/// and the list of sensor modes. Fetching these takes several USB transactions
+/// on every start, but they only change with the camera firmware, so the cache
+/// is keyed by camera serial number and firmware/FPGA versions.
+/// One file per camera: <folder>/<serial>.cache
+class FliCacheC
+{
+ private:
+  std::string str_folder;
+
+  std::string fileName( const std::string& serial );
+
+ public:
+  FliCacheC();
+
+  void setFolder( const std::string& folder );
+  static std::string defaultFolder();
+
+  bool load( const std::string& serial, const std::string& version,
+	     FPROCAP* capabilities,
+	     std::vector<FPROGAINVALUE>* gainTableLow,
+	     std::vector<FPROGAINVALUE>* gainTableHigh,
+	     std::vector<FPROSENSMODE>* modes );
+  bool save( const std::string& serial, const std::string& version,
+	     const FPROCAP& capabilities,
+	     const std::vector<FPROGAINVALUE>& gainTableLow,
+	     const std::vector<FPROGAINVALUE>& gainTableHigh,
+	     const std::vector<FPROSENSMODE>& modes );
+};
@@ -1,4 +1,12 @@
 #include "flicamera.h"
+#include "flithread.h"
+#include "flilog.h"
+#include "flichecksum.h"
+#include "flicodec.h"
+#include "flitrace.h"
+
+#include <fcntl.h>
+#include <errno.h>
 
 //--------------------------------------------------------------
 
@@ -6,8 +14,8 @@ FliCameraC::FliCameraC():
   uiNumDetectedDevices(FLICAMERA_MAX_SUPPORTED_CAMERAS)
 {
   pFrame = NULL;
-  pNewTableLow = NULL;
-  pNewTableHigh = NULL;
+  weKnowGainTables = false;
+  isCacheEnabled = true;
   uiCamCapSize = sizeof(FPROCAP);
   weKnowCapabilities = false;
   sensorTemp = 0;
@@ -15,6 +23,22 @@ FliCameraC::FliCameraC():
   baseTemp = 0;
   coolerTemp = 0;
   isDeviceOpen = false;
+  uiDeviceIndex = 0;
+  uiFrameSizeInBytes = 0;
+  uiLastSizeGrabbed = 0;
+  isLastFrameTimedOut = false;
+  isLastFrameAborted = false;
+  isAbortRequested = false;
+  isWatchdogRunning = false;
+  isWatchdogArmed = false;
+  isWatchdogExit = false;
+  isWatchdogFired = false;
+  isReplayRealTime = true;
+  uiReplayPos = 0;
+  replayFirstArrivalNs = 0;
+  uiTimeoutMarginMs = FLICAMERA_DEFAULT_TIMEOUT_MARGIN_MS;
+  uiExtTriggerTimeoutMs = 0;
+  frameCounterOffset = -1;
   isExternalTriggerEnabled = false;
   // default coordinates - Perth, Curtin Bentley campus
   latitude = -32.00720;
@@ -32,6 +56,15 @@ FliCameraC::FliCameraC():
   
   str_fileNameFrameTimeStamp = "";
   str_siteLocation = "lab";
+  uiStackNumFrames = 0;
+  str_stackMode = "";
+  uiBracketIndex = 0;
+  uiBracketNum = 0;
+  for( int i = 0; i < FLICAMERA_FITS_TEMPLATES; i++ )
+    {
+      fitsTemplateWidth[i] = 0;
+      fitsTemplateHeight[i] = 0;
+    }
   
   // default exposure time setting of FLI camera power-on seems to be ~ 1/500s
   // (it's actially 2010960 nanoseconds)
@@ -44,9 +77,19 @@ FliCameraC::FliCameraC():
 
 FliCameraC::~FliCameraC()
 {
+  if( isWatchdogRunning )
+    {
+      {
+	std::lock_guard<std::mutex> lock( mtxWatchdog );
+	isWatchdogExit = true;
+      }
+      cvWatchdog.notify_all();
+      watchdog.join();
+    }
   std::cout << "FliCameraC::destructor DEBUG: ";
   std::cout.flush();
-  if( pFrame != NULL )
+  // a replayed frame belongs to the mapping of the recording
+  if( (pFrame != NULL) && ! replay.isOpen() )
     {
       std::cout << "freeing pFrame... ";
       std::cout.flush();
@@ -90,10 +133,25 @@ bool FliCameraC::listDevices()
 /// open 1st device on the list
 /// return 1 if succeeded, 0 if failed 
 bool FliCameraC::openDevice()
+{
+  return openDevice( 0 );
+}
+
+//--------------------------------------------------------------
+/// open device number deviceIndex of the list filled by listDevices()
+/// return 1 if succeeded, 0 if failed 
+bool FliCameraC::openDevice( uint32_t deviceIndex )
 {
   int32_t iResult = -1;
+  if( deviceIndex >= uiNumDetectedDevices )
+    {
+      std::cerr << "FliCameraC::openDevice(): device index " << deviceIndex
+		<< " out of range, detected " << uiNumDetectedDevices << " device(s)." << std::endl;
+      return false;
+    }
+  uiDeviceIndex = deviceIndex;
   siDeviceHandle = -1;
-  iResult = FPROCam_Open(&(s_camDeviceInfo[0]), &siDeviceHandle);
+  iResult = FPROCam_Open(&(s_camDeviceInfo[uiDeviceIndex]), &siDeviceHandle);
   if( iResult < 0 )
     {
       std::cerr << "FliCameraC::openDevice(): failed. FPROCam_Open() retval=" << iResult << std::endl;
@@ -104,15 +162,134 @@ bool FliCameraC::openDevice()
 		<< "\tFPROCam_Open() siDeviceHandle=" << siDeviceHandle << std::endl;
     }
   isDeviceOpen = ((iResult >= 0) && (siDeviceHandle >= 0));
+  if( isDeviceOpen && isCacheEnabled )
+    {
+      isCacheEnabled = readCacheKey();
+    }
   return isDeviceOpen;
 }
 
+//--------------------------------------------------------------
+/// use a raw recording (flictl --rawdump) instead of a camera: capabilities,
+/// pixel format and mode are taken from the recording, getImage() delivers
+/// its frames in order, in real time at the recorded intervals or as fast
+/// as they are taken. Camera settings cannot be changed then.
+/// return true if succeeded, false if failed
+bool FliCameraC::openReplay( const std::string& filename, bool isRealTime )
+{
+  if( ! replay.open( filename ) )
+    {
+      return false;
+    }
+  const FliRawFileHeaderC& header = replay.getHeader();
+  s_camCapabilities = header.capabilities;
+  weKnowCapabilities = true;
+  sensor.fromCapabilities( s_camCapabilities );
+  uiPixelDepth = header.pixelDepth;
+  uiPixelLSB = header.pixelLsb;
+  sensor.pixelDepth = uiPixelDepth;
+  sensor.isHdrInterleaved = (header.isHdr != 0);
+  uiNumDetectedDevices = 1;
+  uiDeviceIndex = 0;
+  isCacheEnabled = false;
+  isDeviceOpen = true;
+  isReplayRealTime = isRealTime;
+  uiReplayPos = 0;
+  std::cout << "Replay " << filename << ": " << replay.getNumFrames() << " frames of camera " << getSerial()
+	    << (sensor.isHdrInterleaved ? " (HDR)" : " (single channel)")
+	    << (isRealTime ? ", recorded timing" : ", as fast as possible") << std::endl;
+  return true;
+}
+
+//--------------------------------------------------------------
+/// true if frames come from a raw recording, see openReplay()
+bool FliCameraC::isReplay()
+{
+  return replay.isOpen();
+}
+
+//--------------------------------------------------------------
+/// frames in the raw recording, 0 ... no replay
+uint64_t FliCameraC::getReplayNumFrames()
+{
+  return replay.isOpen() ? replay.getNumFrames() : 0;
+}
+
+//--------------------------------------------------------------
+/// libflipro reports serial numbers and versions as wide strings (ASCII content)
+static std::string wideToString( const wchar_t* wstr )
+{
+  std::string str;
+  for( ; *wstr != L'\0'; wstr++ )
+    {
+      str += (char)*wstr;
+    }
+  return str;
+}
+
+//--------------------------------------------------------------
+/// cache entries are keyed by serial number and firmware versions,
+/// reading the versions is a single USB transaction
+/// return true if succeeded, false if failed
+bool FliCameraC::readCacheKey()
+{
+  int32_t iResult = -1;
+  FPRODEVICEVERS version;
+
+  iResult = FPROCam_GetDeviceVersion( siDeviceHandle, &version );
+  if( iResult < 0 )
+    {
+      std::cerr << "FliCameraC::readCacheKey(): FPROCam_GetDeviceVersion() failed, retval=" << iResult
+		<< ", capabilities cache disabled." << std::endl;
+      return false;
+    }
+  str_cacheSerial = getSerial();
+  str_cacheVersion = "fw " + wideToString( version.cFirmwareVersion )
+    + " fpga " + wideToString( version.cFPGAVersion )
+    + " ctrl " + wideToString( version.cControllerVersion );
+  return !str_cacheSerial.empty();
+}
+
+//--------------------------------------------------------------
+/// serial number of the open device
+std::string FliCameraC::getSerial()
+{
+  if( replay.isOpen() )
+    {
+      const FliRawFileHeaderC& header = replay.getHeader();
+      return std::string( header.serial, strnlen( header.serial, sizeof(header.serial) ) );
+    }
+  return wideToString( s_camDeviceInfo[uiDeviceIndex].cSerialNo );
+}
+
+//--------------------------------------------------------------
+/// set folder of the capabilities cache (default ~/.cache/flictl)
+void FliCameraC::setCacheFolder( const std::string& folder )
+{
+  cache.setFolder( folder );
+}
+
+//--------------------------------------------------------------
+/// always read capabilities, gain tables and modes from the camera
+/// must be called before openDevice()
+void FliCameraC::disableCache()
+{
+  isCacheEnabled = false;
+}
+
 //--------------------------------------------------------------
 /// open 1st device on the list
 /// return 1 if succeeded, 0 if failed 
 bool FliCameraC::closeDevice()
 {
   int32_t iResult = -1;
+  if( replay.isOpen() )
+    {
+      pFrame = NULL;
+      replay.close();
+      isDeviceOpen = false;
+      return true;
+    }
   iResult = FPROCam_Close( siDeviceHandle );
   if(iResult >= 0)
     {
@@ -133,15 +310,135 @@ bool FliCameraC::getCapabilities()
 {
   int32_t iResult = -1;
   weKnowCapabilities = false;
+  if( isCacheEnabled
+      && cache.load( str_cacheSerial, str_cacheVersion, &s_camCapabilities, &gainTableLow, &gainTableHigh, &modeList ) )
+    {
+      weKnowCapabilities = true;
+      weKnowGainTables = true;
+      sensor.fromCapabilities( s_camCapabilities );
+      return true;
+    }
+  uiCamCapSize = sizeof(FPROCAP);
   iResult = FPROSensor_GetCapabilities(siDeviceHandle, &s_camCapabilities, &uiCamCapSize);
   if( iResult < 0 )
     {
       std::cerr << "FliCameraC::getCapabilities(): failed. FPROSensor_GetCapabilities() retval=" << iResult << std::endl;
     }    
   weKnowCapabilities = (iResult >=0);
+  if( weKnowCapabilities )
+    {
+      sensor.fromCapabilities( s_camCapabilities );
+    }
+  // first run with this camera / firmware: fill the cache for the next start
+  if( weKnowCapabilities && isCacheEnabled && getGainTables() && getModeList() )
+    {
+      cache.save( str_cacheSerial, str_cacheVersion, s_camCapabilities, gainTableLow, gainTableHigh, modeList );
+    }
   return weKnowCapabilities;
 }
 
+//--------------------------------------------------------------
+/// fetch low and high channel gain tables, once per session
+/// return true if succeeded, false if failed
+bool FliCameraC::getGainTables()
+{
+  int32_t iResult = -1;
+  uint32_t uiGainEntries;
+
+  if( weKnowGainTables )
+    {
+      return true;
+    }
+  if( !weKnowCapabilities && !getCapabilities() )
+    {
+      return false;
+    }
+  if( weKnowGainTables )
+    {
+      // getCapabilities() found them in the cache
+      return true;
+    }
+  // First make sure you have allocated enough memory for the gain table you
+  // would like to retrieve. Each entry is a FPROGAINVALUE.
+  uiGainEntries = s_camCapabilities.uiLowGain;
+  gainTableLow.resize( uiGainEntries );
+  if( uiGainEntries > 0 )
+    {
+      iResult = FPROSensor_GetGainTable(siDeviceHandle, FPRO_GAIN_TABLE_LOW_CHANNEL, gainTableLow.data(), &uiGainEntries);
+      if( iResult < 0 )
+	{
+	  std::cerr << "FliCameraC::getGainTables(): FPROSensor_GetGainTable() for low gain channel failed, reval=" << iResult << std::endl;
+	  gainTableLow.clear();
+	  return false;
+	}
+      gainTableLow.resize( uiGainEntries );
+    }
+  uiGainEntries = s_camCapabilities.uiHighGain;
+  gainTableHigh.resize( uiGainEntries );
+  if( uiGainEntries > 0 )
+    {
+      iResult = FPROSensor_GetGainTable(siDeviceHandle, FPRO_GAIN_TABLE_HIGH_CHANNEL, gainTableHigh.data(), &uiGainEntries);
+      if( iResult < 0 )
+	{
+	  std::cerr << "FliCameraC::getGainTables(): FPROSensor_GetGainTable() for high gain channel failed, reval=" << iResult << std::endl;
+	  gainTableLow.clear();
+	  gainTableHigh.clear();
+	  return false;
+	}
+      gainTableHigh.resize( uiGainEntries );
+    }
+  weKnowGainTables = true;
+  return true;
+}
+
+//--------------------------------------------------------------
+/// fetch the list of sensor modes, once per session
+/// return true if succeeded, false if failed
+bool FliCameraC::getModeList()
+{
+  int32_t  iResult;
+  uint32_t uiModeCount;
+  uint32_t uiCurrentMode;
+
+  if( !modeList.empty() )
+    {
+      return true;
+    }
+  iResult = FPROSensor_GetModeCount(siDeviceHandle, &uiModeCount, &uiCurrentMode);
+  if( iResult < 0 )
+    {
+      std::cerr << "FliCameraC::getModeList() ERROR: FPROSensor_GetModeCount() failed." << std::endl;
+      return false;
+    }
+  modeList.resize( uiModeCount );
+  for( uint32_t i = 0; i < uiModeCount; ++i )
+    {
+      iResult = FPROSensor_GetMode(siDeviceHandle, i, &modeList[i]);
+      if( iResult < 0 )
+	{
+	  std::cerr << "FliCameraC::getModeList() ERROR: FPROSensor_GetMode() failed." << std::endl;
+	  modeList.clear();
+	  return false;
+	}
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+/// return position of deviceIndex in the gain table, table.size() if not found
+uint32_t FliCameraC::findGainTableIndex( const std::vector<FPROGAINVALUE>& table, uint32_t deviceIndex )
+{
+  uint32_t index;
+  for( index = 0; index < table.size(); index++ )
+    {
+      if( deviceIndex == table[index].uiDeviceIndex )
+	{
+	  break;
+	}
+    }
+  return index;
+}
+
 //--------------------------------------------------------------
 /// return 1 if succeeded, 0 if failed 
 bool FliCameraC::getPixelConfig()
@@ -155,16 +452,64 @@ bool FliCameraC::getPixelConfig()
      }
    else
      {
+       sensor.pixelDepth = uiPixelDepth;
        return true;
      }
 }
 
+//--------------------------------------------------------------
+/// image geometry and pixel format, see FliSensorLayoutC
+const FliSensorLayoutC& FliCameraC::getSensorLayout()
+{
+  return sensor;
+}
+
+//--------------------------------------------------------------
+/// width of one channel [pixels]
+uint32_t FliCameraC::getImageWidth()
+{
+  return sensor.width;
+}
+
+//--------------------------------------------------------------
+/// height of one channel [pixels]
+uint32_t FliCameraC::getImageHeight()
+{
+  return sensor.height;
+}
+
+//--------------------------------------------------------------
+/// restrict conversion to the sky area, see FliSkyMaskC, for the image size
+/// of the sensor layout (call after getCapabilities()), empty spec ... no mask
+/// return true if succeeded, false if failed (no mask then)
+bool FliCameraC::setSkyMask( const std::string& spec )
+{
+  std::lock_guard<std::mutex> lock( mtxFitsTemplate );
+  // the mask cards are part of the header templates
+  for( int k = 0; k < FLICAMERA_FITS_TEMPLATES; k++ )
+    {
+      fitsTemplate[k].clear();
+    }
+  if( spec.empty() )
+    {
+      skyMask.clear();
+      return true;
+    }
+  return skyMask.parse( spec, sensor.width, sensor.height );
+}
+
+//--------------------------------------------------------------
+
+const FliSkyMaskC& FliCameraC::getSkyMask()
+{
+  return skyMask;
+}
+
 //--------------------------------------------------------------
 /// return 1 if succeeded, 0 if failed 
 void FliCameraC::printCapabilities()
 {
   int32_t iResult = -1;
-  uint32_t uiGainEntries;
   uint32_t uiGainIndex;
   float    fGainValue;
 
@@ -222,63 +567,29 @@ void FliCameraC::printCapabilities()
       printf("  uiPreFrameReferenceRows: %d\n", s_camCapabilities.uiPreFrameReferenceRows);
       printf("  uiPostFrameReferenceRows: %d\n", s_camCapabilities.uiPostFrameReferenceRows);
       printf("  uiMetaDataSize: %d\n", s_camCapabilities.uiMetaDataSize);
+      sensor.print();
 
       printf("Gain tables:\n");
 
-      if (s_camCapabilities.uiLowGain > 0)
+      if ((s_camCapabilities.uiLowGain > 0) && getGainTables())
 	{
-	  printf ("  Low gain channel gain table size: %d\n",s_camCapabilities.uiLowGain );
-	  // First make sure you have allocated enough memory for the gain table you
-	  // would like to retrieve- here we are getting the LDR Table.  Each entry is
-	  // a uint32_t value so we allocate an array of uint32_t
-	  uiGainEntries = s_camCapabilities.uiLowGain;
-	  pNewTableLow = new FPROGAINVALUE[s_camCapabilities.uiLowGain];
-	  iResult = FPROSensor_GetGainTable(siDeviceHandle, FPRO_GAIN_TABLE_LOW_CHANNEL, pNewTableLow, &uiGainEntries);
-	  if ( iResult < 0)
-	    {
-	      std::cerr << "FliCameraC::printCapabilities(): FPROSensor_GetGainTable() for low gain channel failed, reval=" << iResult << std::endl;
-	    }
-	  else
-	    {
-	      printf("  Low gain channel gain table: [tableIndex, deviceIndex, gain]\n");
-	      // now that you have the table entries you can process them
-	      for (uint32_t i = 0; i < uiGainEntries; ++i)
-		{
-		  // Each gain value is scaled by the camera to produce an integer.  To return the value
-		  // to a floating point representation, apply the scale factor
-		  fGainValue = (float)pNewTableLow[i].uiValue / (float)FPRO_GAIN_SCALE_FACTOR;
-		  // Here you could populate a drop down list for a GUI with the Gain value.
-		  // Be aware that the gain values are set by there index in the table (pNewTable[i].uiDeviceIndex)
-		  // just retrieved.  So you could populate a GUI drop down list, but just make sure to
-		  // maintin the map between your list and this list you just received so you can prpoerly
-                            // set gain indeces using FPROSensor_SetGainIndex().
-		  printf ("    %d: %d = %5.3f\n", i, pNewTableLow[i].uiDeviceIndex , fGainValue );
-		}
-	    }
-	  printf ("  High gain channel gain table size: %d\n",s_camCapabilities.uiHighGain );
-	  uiGainEntries = s_camCapabilities.uiHighGain;
-	  pNewTableHigh = new FPROGAINVALUE[s_camCapabilities.uiHighGain];
-	  iResult = FPROSensor_GetGainTable(siDeviceHandle, FPRO_GAIN_TABLE_HIGH_CHANNEL, pNewTableHigh, &uiGainEntries);
-	  if ( iResult < 0)
+	  printf ("  Low gain channel gain table size: %d\n", (int)gainTableLow.size() );
+	  printf("  Low gain channel gain table: [tableIndex, deviceIndex, gain]\n");
+	  for (uint32_t i = 0; i < gainTableLow.size(); ++i)
 	    {
-	      std::cerr << "FliCameraC::printCapabilities(): FPROSensor_GetGainTable() for high gain channel failed, reval=" << iResult << std::endl;	      
+	      // Each gain value is scaled by the camera to produce an integer.  To return the value
+	      // to a floating point representation, apply the scale factor
+	      fGainValue = (float)gainTableLow[i].uiValue / (float)FPRO_GAIN_SCALE_FACTOR;
+	      // Be aware that the gain values are set by there index in the table (uiDeviceIndex),
+	      // set gain indeces using FPROSensor_SetGainIndex().
+	      printf ("    %d: %d = %5.3f\n", i, gainTableLow[i].uiDeviceIndex , fGainValue );
 	    }
-	  else
+	  printf ("  High gain channel gain table size: %d\n", (int)gainTableHigh.size() );
+	  printf("  High gain channel gain table: [tableIndex, deviceIndex, gain]\n");
+	  for (uint32_t i = 0; i < gainTableHigh.size(); ++i)
 	    {
-	      printf("  High gain channel gain table: [tableIndex, deviceIndex, gain]\n");
-	      // now that you have the table entries you can process them
-	      for (uint32_t i = 0; i < uiGainEntries; ++i)
-		{
-		  // Each gain value is scaled by the camera to produce an integer.  To return the value
-		  // to a floating point representation, apply the scale factor
-		  fGainValue = (float)pNewTableHigh[i].uiValue / (float)FPRO_GAIN_SCALE_FACTOR;
-		  // Here you could populate a drop down list for a GUI with the Gain value.
-		  // Be aware that the gain values are set by there index in the table (pNewTable[i].uiDeviceIndex)
-		  // just retrieved.  So you could populate a GUI drop down list, but just make sure to
-		  // maintin the map between your list and this list you just received so you can prpoerly
-		  // set gain indeces using FPROSensor_SetGainIndex().
-		  printf ("    %d: %d = %5.3f\n", i, pNewTableHigh[i].uiDeviceIndex , fGainValue );
-		}
+	      fGainValue = (float)gainTableHigh[i].uiValue / (float)FPRO_GAIN_SCALE_FACTOR;
+	      printf ("    %d: %d = %5.3f\n", i, gainTableHigh[i].uiDeviceIndex , fGainValue );
 	    }
 
 	  iResult = FPROSensor_GetGainIndex(siDeviceHandle, FPRO_GAIN_TABLE_LOW_CHANNEL, &uiGainIndex);
@@ -286,36 +597,28 @@ void FliCameraC::printCapabilities()
 	    {
 	      std::cerr << "FliCameraC::printCapabilities(): FPROSensor_GetGainIndex() for low gain table failed, reval=" << iResult << std::endl;
 	    }
-	  
-	  uint32_t lowIndex;
-	  for( lowIndex=0; lowIndex<s_camCapabilities.uiLowGain; lowIndex++ )
+	  else
 	    {
-	      if( uiGainIndex == pNewTableLow[lowIndex].uiDeviceIndex )
-		{
-		  break;
-		}
+	      uint32_t lowIndex = findGainTableIndex( gainTableLow, uiGainIndex );
+	      fGainValue = (lowIndex < gainTableLow.size()) ?
+		(float)gainTableLow[lowIndex].uiValue / (float)FPRO_GAIN_SCALE_FACTOR : NAN;
+	      printf( "Current low gain index setting is %d, which corresponds to device index %d and gain %5.3f\n",
+		      lowIndex, uiGainIndex, fGainValue );
 	    }
-	  fGainValue = (float)pNewTableLow[lowIndex].uiValue / (float)FPRO_GAIN_SCALE_FACTOR;
-	  printf( "Current low gain index setting is %d, which corresponds to device index %d and gain %5.3f\n",
-		  lowIndex, uiGainIndex, fGainValue );
 
 	  iResult = FPROSensor_GetGainIndex(siDeviceHandle, FPRO_GAIN_TABLE_HIGH_CHANNEL, &uiGainIndex);
 	  if ( iResult < 0)
 	    {
 	      std::cerr << "FliCameraC::printCapabilities(): FPROSensor_GetGainIndex() for high gain table failed, reval=" << iResult << std::endl;
 	    }
-	  
-	  uint32_t highIndex;
-	  for( highIndex=0; highIndex<s_camCapabilities.uiLowGain; highIndex++ )
+	  else
 	    {
-	      if( uiGainIndex == pNewTableLow[highIndex].uiDeviceIndex )
-		{
-		  break;
-		}
-	    }
-	  fGainValue = (float)pNewTableHigh[highIndex].uiValue / (float)FPRO_GAIN_SCALE_FACTOR;
-	  printf( "Current high gain index setting is %d, which corresponds to device index %d and gain %5.3f\n",
+	      uint32_t highIndex = findGainTableIndex( gainTableHigh, uiGainIndex );
+	      fGainValue = (highIndex < gainTableHigh.size()) ?
+		(float)gainTableHigh[highIndex].uiValue / (float)FPRO_GAIN_SCALE_FACTOR : NAN;
+	      printf( "Current high gain index setting is %d, which corresponds to device index %d and gain %5.3f\n",
 		      highIndex, uiGainIndex, fGainValue );
+	    }
 	}
       else
 	{
@@ -433,6 +736,31 @@ bool FliCameraC::setExternalTriggerEnable(bool bEnable, FPROEXTTRIGTYPE pTrigTyp
     }  
 }
 
+//--------------------------------------------------------------
+/// read temperatures and cooler set point without touching the members,
+/// used by the telemetry thread while another thread captures; waits until
+/// a frame being read out has arrived, the camera is only asked between frames
+/// return true if succeeded, false if failed
+bool FliCameraC::readTemperatures( double* ambient, double* base, double* cooler, double* setPoint )
+{
+  int32_t iResult = -1;
+  std::lock_guard<std::mutex> lock( mtxReadout );
+
+  iResult = FPROCtrl_GetTemperatures( siDeviceHandle, ambient, base, cooler );
+  if( iResult < 0 )
+    {
+      std::cerr << "FliCameraC::readTemperatures() ERROR: FPROCtrl_GetTemperatures() failed, retval=" << iResult << std::endl;
+      return false;
+    }
+  iResult = FPROCtrl_GetTemperatureSetPoint( siDeviceHandle, setPoint );
+  if( iResult < 0 )
+    {
+      std::cerr << "FliCameraC::readTemperatures() ERROR: FPROCtrl_GetTemperatureSetPoint() failed, retval=" << iResult << std::endl;
+      return false;
+    }
+  return true;
+}
+
 //--------------------------------------------------------------
 /// return true if succeeded, false if failed
 bool FliCameraC::getAllTemperatures()
@@ -477,37 +805,26 @@ bool FliCameraC::printModes()
   int32_t      iResult;
   uint32_t     uiModeCount;
   uint32_t     uiCurrentMode;
-  FPROSENSMODE modeInfo;
   uint32_t     i;
 
   // Get the numer of available modes and the current mode setting (index)
   iResult= FPROSensor_GetModeCount(siDeviceHandle, &uiModeCount, &uiCurrentMode);
 
-  if( iResult >= 0 )
+  if( (iResult >= 0) && getModeList() )
     {
-      printf( "List of avaliable camera modes (number of modes: %d)\n", uiModeCount);
-      // get each of the modes- and process
-      for( i = 0; (i < uiModeCount) && (iResult >= 0); ++i )
+      printf( "List of avaliable camera modes (number of modes: %d)\n", (int)modeList.size());
+      for( i = 0; i < modeList.size(); ++i )
 	{
-	  iResult = FPROSensor_GetMode(siDeviceHandle, i, &modeInfo);
-	  if( iResult < 0 )
-	    {
-	      std::cerr << "FliCameraC::printModes() ERROR: FPROSensor_GetMode() failed." << std::endl;
-	      continue;
-	    }
-	  if( iResult >= 0 )
-	    {
-	      // You now have the name of the mode for index 'i'
-	      // For convenience, the index of the mode is also returned in the
-	      // FPROSENSMODE structure.  It is this index you will use in FPROSensor_SetMode()
-	      printf( "  List index: %d device mode index: %d mode name: %s\n", i, modeInfo.uiModeIndex, (char* )(modeInfo.wcModeName) );
-	    }
+	  // For convenience, the index of the mode is also returned in the
+	  // FPROSENSMODE structure.  It is this index you will use in FPROSensor_SetMode()
+	  printf( "  List index: %d device mode index: %d mode name: %s\n", i, modeList[i].uiModeIndex, (char* )(modeList[i].wcModeName) );
 	}
       printf( "Current camera mode: %d\n", uiCurrentMode );
     }
   else
     {
        std::cerr << "FliCameraC::printModes() ERROR: FPROSensor_GetModeCount() failed." << std::endl;
+       iResult = -1;
     }
     
   return (iResult >= 0);
@@ -533,12 +850,18 @@ bool FliCameraC::setMode(uint32_t mode)
       if( mode < uiModeCount )
 	{
 	  iResult = FPROSensor_SetMode( siDeviceHandle, mode );
-	  return (iResult >= 0);
+	  if( iResult < 0 )
+	    {
+	      std::cerr << "FliCameraC::setMode() ERROR: FPROSensor_SetMode() failed, retval=" << iResult << std::endl;
+	      return false;
+	    }
+	  // HDR and single channel modes differ in the frame layout
+	  return readHdrEnable();
 	}
       else
 	{
-	  std::cerr << "FliCameraC::setMode() ERROR: FPROSensor_SetMode() index %d is out of range 0..%d"
-		    << mode << uiModeCount << std::endl;	  
+	  std::cerr << "FliCameraC::setMode() ERROR: FPROSensor_SetMode() index " << mode
+		    << " is out of range 0.." << uiModeCount - 1 << std::endl;
 	  return false;
 	}
     }
@@ -549,6 +872,28 @@ bool FliCameraC::setMode(uint32_t mode)
   return false;
 }
 
+//--------------------------------------------------------------
+/// take over from the camera whether the current mode sends LDR and HDR rows
+/// interleaved or a single channel
+/// return true if succeeded, false if failed (the layout is kept)
+bool FliCameraC::readHdrEnable()
+{
+  bool isHdrEnabled = false;
+  if( replay.isOpen() )
+    {
+      // the mode of the recording
+      return true;
+    }
+  int32_t iResult = FPROSensor_GetHDREnable( siDeviceHandle, &isHdrEnabled );
+  if( iResult < 0 )
+    {
+      std::cerr << "FliCameraC::readHdrEnable() ERROR: FPROSensor_GetHDREnable() failed, retval=" << iResult << std::endl;
+      return false;
+    }
+  sensor.isHdrInterleaved = isHdrEnabled;
+  return true;
+}
+
 //--------------------------------------------------------------
 /// return true if succeeded, false if failed
 bool FliCameraC::setTemperatureSetPoint( double dblSetPoint )
@@ -740,170 +1085,237 @@ bool FliCameraC::setExpDelay(uint64_t exposureDelay)
 }
 
 //--------------------------------------------------------------
-/// set exposure delay in nanoseconds
+/// set low gain channel gain, gainIndex is the index into the gain table
 /// return true if succeeded, false if failed
 bool FliCameraC::setLowGain(uint32_t gainIndex)
 {
-  int32_t iResult = -1;
-  uint32_t uiGainDeviceIndex;
-  uint32_t uiNumGainEntries;
-  
-  if( !weKnowCapabilities )
+  return setGain( FPRO_GAIN_TABLE_LOW_CHANNEL, gainIndex );
+}
+
+//--------------------------------------------------------------
+/// set high gain channel gain, gainIndex is the index into the gain table
+/// return true if succeeded, false if failed
+bool FliCameraC::setHighGain(uint32_t gainIndex)
+{
+  return setGain( FPRO_GAIN_TABLE_HIGH_CHANNEL, gainIndex );
+}
+
+//--------------------------------------------------------------
+/// check the gain indexes of a bracketing point against the gain tables,
+/// so that a bad point fails before the capture rather than in the middle
+/// return true if valid, false if not
+bool FliCameraC::checkBracketPoint( const FliBracketPointC& point )
+{
+  if( !getGainTables() )
     {
-      getCapabilities();
+      return false;
     }
-  if( !weKnowCapabilities )
+  if( (point.lowGainIndex >= 0) && ((size_t)point.lowGainIndex >= gainTableLow.size()) )
     {
+      std::cerr << "FliCameraC::checkBracketPoint() ERROR: low gain index " << point.lowGainIndex
+		<< " is out of range 0.." << gainTableLow.size() - 1 << std::endl;
       return false;
     }
-  if (s_camCapabilities.uiLowGain <= 0)
+  if( (point.highGainIndex >= 0) && ((size_t)point.highGainIndex >= gainTableHigh.size()) )
     {
+      std::cerr << "FliCameraC::checkBracketPoint() ERROR: high gain index " << point.highGainIndex
+		<< " is out of range 0.." << gainTableHigh.size() - 1 << std::endl;
       return false;
     }
-  pNewTableLow = new FPROGAINVALUE[s_camCapabilities.uiLowGain];
-  uiNumGainEntries = s_camCapabilities.uiLowGain;
-  iResult = FPROSensor_GetGainTable(siDeviceHandle, FPRO_GAIN_TABLE_LOW_CHANNEL, pNewTableLow, &uiNumGainEntries);
-  if( iResult < 0)
+  return true;
+}
+
+//--------------------------------------------------------------
+/// switch to the next bracketing point between two frames with as few
+/// camera round trips as possible: only changed values are sent and nothing
+/// is read back (getImage() reads the exposure time of each frame anyway)
+/// return true if succeeded, false if failed
+bool FliCameraC::setBracketPoint( const FliBracketPointC& point )
+{
+  int32_t iResult = -1;
+
+  if( point.exposureTime != this->exposureTime )
+    {
+      iResult = FPROCtrl_SetExposure( siDeviceHandle, point.exposureTime, this->frameDelay, false );
+      if( iResult < 0 )
+	{
+	  std::cerr << "FliCameraC::setBracketPoint() ERROR: FPROCtrl_SetExposure() failed, retval=" << iResult << std::endl;
+	  return false;
+	}
+      this->exposureTime = point.exposureTime;
+    }
+  if( (point.lowGainIndex >= 0) && ((uint32_t)point.lowGainIndex != uiLowGainIndex)
+      && ! setGain( FPRO_GAIN_TABLE_LOW_CHANNEL, point.lowGainIndex, false ) )
     {
-      std::cerr << "FliCameraC::setLowGain() ERROR: FPROSensor_GetGainTable() failed. retval=" << iResult << std::endl;
-      delete [] pNewTableLow;
       return false;
     }
-  else
+  if( (point.highGainIndex >= 0) && ((uint32_t)point.highGainIndex != uiHighGainIndex)
+      && ! setGain( FPRO_GAIN_TABLE_HIGH_CHANNEL, point.highGainIndex, false ) )
     {
-      // check the index is not out of bounds
-      if( gainIndex < uiNumGainEntries )
-	{
-	  this->uiLowGainIndex = gainIndex;
-	  // Set the gain index for low channel - need to retreive device index for given index first
-	  iResult = FPROSensor_SetGainIndex(siDeviceHandle, FPRO_GAIN_TABLE_LOW_CHANNEL, pNewTableLow[gainIndex].uiDeviceIndex);
-	  if( iResult < 0 )
-	    {
-	      std::cerr <<  "FliCameraC::setLowGain() ERROR: FPROSensor_SetGainIndex failed. retval=" << iResult << std::endl;
-	      delete [] pNewTableLow;
-	      return false;	      
-	    }
-	  // Read it back - verification - should be the same as what was set
-	  iResult = FPROSensor_GetGainIndex(siDeviceHandle, FPRO_GAIN_TABLE_LOW_CHANNEL, &uiGainDeviceIndex);
-	  if( iResult < 0 )
-	    {
-	      std::cerr <<  "FliCameraC::setLowGain() ERROR: FPROSensor_GetGainIndex failed. retval=" << iResult << std::endl;
-	      delete [] pNewTableLow;
-	      return false;	      
-	    }
-	  
-	  uint32_t lowIndex;
-	  for( lowIndex=0; lowIndex<s_camCapabilities.uiLowGain; lowIndex++ )
-	    {
-	      if( uiGainDeviceIndex == pNewTableLow[lowIndex].uiDeviceIndex )
-		{
-		  break;
-		}
-	    }
-	  if( lowIndex != gainIndex )
-	    {
-	       std::cerr << "FliCameraC::setLowGain() ERROR: requested gain index " << gainIndex
-			 << ", but read back " << lowIndex << "." << std::endl;
-	    }
-	  this->fLowGainValue = (float)pNewTableLow[gainIndex].uiValue / (float)FPRO_GAIN_SCALE_FACTOR;
-	  printf( "Current low gain index setting is %d, which corresponds to device index %d and gain %5.3f\n",
-		  gainIndex, uiGainDeviceIndex, this->fLowGainValue );
-	  // return true only if read-back is identical
-	  delete [] pNewTableLow;
-	  return (uiGainDeviceIndex == pNewTableLow[gainIndex].uiDeviceIndex);
-	}
-      else
-	{
-	  std::cerr << "FliCameraC::setLowGain() ERROR: index " << gainIndex <<
-	    " is out of range 0.." << s_camCapabilities.uiLowGain << std::endl;
-	  delete [] pNewTableLow;
-	  return false;
-	}
+      return false;
     }
+  return true;
 }
 
 //--------------------------------------------------------------
 /// return true if succeeded, false if failed
-bool FliCameraC::setHighGain(uint32_t gainIndex)
+bool FliCameraC::setGain( FPROGAINTABLE table, uint32_t gainIndex, bool doVerify )
 {
   int32_t iResult = -1;
-  uint32_t uiNumGainEntries;
   uint32_t uiGainDeviceIndex;
-  
-  if( !weKnowCapabilities )
+  bool isLow = (table == FPRO_GAIN_TABLE_LOW_CHANNEL);
+  const char* fname = isLow ? "FliCameraC::setLowGain()" : "FliCameraC::setHighGain()";
+
+  if( !getGainTables() )
     {
-      getCapabilities();
+      return false;
     }
-  if( !weKnowCapabilities )
+  const std::vector<FPROGAINVALUE>& gainTable = isLow ? gainTableLow : gainTableHigh;
+  // check the index is not out of bounds
+  if( gainIndex >= gainTable.size() )
     {
+      std::cerr << fname << " ERROR: index " << gainIndex <<
+	" is out of range 0.." << gainTable.size() << std::endl;
       return false;
     }
-  if (s_camCapabilities.uiHighGain <= 0)
+  // Set the gain index - need to retreive device index for given index first
+  iResult = FPROSensor_SetGainIndex(siDeviceHandle, table, gainTable[gainIndex].uiDeviceIndex);
+  if( iResult < 0 )
     {
-      /// TODO !@#$$%^ TRENKY add err print
+      std::cerr << fname << " ERROR: FPROSensor_SetGainIndex failed. retval=" << iResult << std::endl;
       return false;
     }
-  pNewTableHigh = new FPROGAINVALUE[s_camCapabilities.uiHighGain];
-  uiNumGainEntries = s_camCapabilities.uiHighGain;
-  iResult = FPROSensor_GetGainTable(siDeviceHandle, FPRO_GAIN_TABLE_HIGH_CHANNEL, pNewTableHigh, &uiNumGainEntries);
-  if( iResult < 0)
+  // Read it back - verification - should be the same as what was set
+  uiGainDeviceIndex = gainTable[gainIndex].uiDeviceIndex;
+  if( doVerify )
     {
-      std::cerr << "FliCameraC::setHighGain() ERROR: FPROSensor_GetGainTable() failed. retval=" << iResult << std::endl;
-      delete [] pNewTableLow;
-      return false;
+      iResult = FPROSensor_GetGainIndex(siDeviceHandle, table, &uiGainDeviceIndex);
+      if( iResult < 0 )
+	{
+	  std::cerr << fname << " ERROR: FPROSensor_GetGainIndex failed. retval=" << iResult << std::endl;
+	  return false;
+	}
+      uint32_t readIndex = findGainTableIndex( gainTable, uiGainDeviceIndex );
+      if( readIndex != gainIndex )
+	{
+	  std::cerr << fname << " ERROR: requested gain index " << gainIndex
+		    << ", but read back " << readIndex << "." << std::endl;
+	}
+    }
+  double gainValue = (float)gainTable[gainIndex].uiValue / (float)FPRO_GAIN_SCALE_FACTOR;
+  if( isLow )
+    {
+      this->uiLowGainIndex = gainIndex;
+      this->fLowGainValue = gainValue;
     }
   else
     {
-      // check the index is not out of bounds
-      if( gainIndex < uiNumGainEntries )
+      this->uiHighGainIndex = gainIndex;
+      this->fHighGainValue = gainValue;
+    }
+  if( doVerify )
+    {
+      printf( "Current %s gain index setting is %d, which corresponds to device index %d and gain %5.3f\n",
+	      isLow ? "low" : "high", gainIndex, uiGainDeviceIndex, gainValue );
+    }
+  // return true only if read-back is identical
+  return (uiGainDeviceIndex == gainTable[gainIndex].uiDeviceIndex);
+}
+
+//--------------------------------------------------------------
+/// copy mode, exposure, gains, cooler set point, trigger setting, FITS location
+/// and sky mask
+/// from another open camera of the same model, used to run several cameras
+/// with one config
+/// return true if succeeded, false if failed
+bool FliCameraC::applyConfigFrom( FliCameraC* master )
+{
+  int32_t iResult = -1;
+  uint64_t masterExposure = 0, masterDelay = 0;
+  bool immediate = false;
+  uint32_t uiGainDeviceIndex = 0;
+  double setPoint = 0.0;
+  bool ok = true;
+
+  setFitsLocation( master->latitude, master->longitude, master->altitude, master->str_siteLocation );
+  ok = setSkyMask( master->skyMask.getSpec() ) && ok;
+  uiTimeoutMarginMs = master->uiTimeoutMarginMs;
+  uiExtTriggerTimeoutMs = master->uiExtTriggerTimeoutMs;
+  frameCounterOffset = master->frameCounterOffset;
+
+  uint32_t uiModeCount = 0, uiMasterMode = 0, uiCurrentMode = 0;
+  iResult = FPROSensor_GetModeCount( master->siDeviceHandle, &uiModeCount, &uiMasterMode );
+  if( iResult >= 0 )
+    {
+      iResult = FPROSensor_GetModeCount( siDeviceHandle, &uiModeCount, &uiCurrentMode );
+    }
+  if( iResult < 0 )
+    {
+      std::cerr << "FliCameraC::applyConfigFrom() ERROR: reading the camera mode failed, retval=" << iResult << std::endl;
+      ok = false;
+    }
+  else if( uiCurrentMode != uiMasterMode )
+    {
+      ok = setMode( uiMasterMode ) && ok;
+    }
+
+  iResult = FPROCtrl_GetExposure( master->siDeviceHandle, &masterExposure, &masterDelay, &immediate );
+  if( iResult >= 0 )
+    {
+      iResult = FPROCtrl_SetExposure( siDeviceHandle, masterExposure, masterDelay, immediate );
+    }
+  if( iResult >= 0 )
+    {
+      iResult = FPROCtrl_GetExposure( siDeviceHandle, &(this->exposureTime), &(this->frameDelay), &immediate );
+    }
+  if( iResult < 0 )
+    {
+      std::cerr << "FliCameraC::applyConfigFrom() ERROR: copying exposure failed, retval=" << iResult << std::endl;
+      ok = false;
+    }
+
+  const FPROGAINTABLE tables[2] = { FPRO_GAIN_TABLE_LOW_CHANNEL, FPRO_GAIN_TABLE_HIGH_CHANNEL };
+  for( int i = 0; i < 2; i++ )
+    {
+      iResult = FPROSensor_GetGainIndex( master->siDeviceHandle, tables[i], &uiGainDeviceIndex );
+      if( (iResult < 0) || !getGainTables() )
 	{
-	  this->uiHighGainIndex = gainIndex;
-	  // Set the gain index for high channel - need to retreive device index for given index first
-	  iResult = FPROSensor_SetGainIndex(siDeviceHandle, FPRO_GAIN_TABLE_HIGH_CHANNEL, pNewTableHigh[gainIndex].uiDeviceIndex);
-	  if( iResult < 0 )
-	    {
-	      std::cerr <<  "FliCameraC::setHighGain() ERROR: FPROSensor_SetGainIndex failed. retval=" << iResult << std::endl;
-	      delete [] pNewTableLow;
-	      return false;	      
-	    }
-	  // Read it back - verification - should be the same as what was set
-	  iResult = FPROSensor_GetGainIndex(siDeviceHandle, FPRO_GAIN_TABLE_HIGH_CHANNEL, &uiGainDeviceIndex);
-	  if( iResult < 0 )
-	    {
-	      std::cerr <<  "FliCameraC::setHighGain() ERROR: FPROSensor_GetGainIndex failed. retval=" << iResult << std::endl;
-	      delete [] pNewTableLow;
-	      return false;	      
-	    }
-	  
-	  uint32_t highIndex;
-	  for( highIndex=0; highIndex<s_camCapabilities.uiLowGain; highIndex++ )
-	    {
-	      if( uiGainDeviceIndex == pNewTableHigh[highIndex].uiDeviceIndex )
-		{
-		  break;
-		}
-	    }
-	  if( highIndex != gainIndex )
-	    {
-	       std::cerr << "FliCameraC::setHighGain() ERROR: requested gain index " << gainIndex
-			 << ", but read back " << highIndex << "." << std::endl;
-	    }
-	  
-	  this->fHighGainValue = (float)pNewTableHigh[gainIndex].uiValue / (float)FPRO_GAIN_SCALE_FACTOR;
-	  printf( "Current high gain index setting is %d, which corresponds to device index %d and gain %5.3f\n",
-		  gainIndex, uiGainDeviceIndex, this->fHighGainValue );
-	  // return true only if read-back is identical
-	  delete [] pNewTableHigh;
-	  return (uiGainDeviceIndex == pNewTableHigh[gainIndex].uiDeviceIndex);
+	  std::cerr << "FliCameraC::applyConfigFrom() ERROR: reading gain index failed, retval=" << iResult << std::endl;
+	  ok = false;
+	  continue;
 	}
-      else
+      const std::vector<FPROGAINVALUE>& gainTable = (i == 0) ? gainTableLow : gainTableHigh;
+      uint32_t gainIndex = findGainTableIndex( gainTable, uiGainDeviceIndex );
+      if( gainIndex >= gainTable.size() )
 	{
-	  std::cerr << "FliCameraC::setHighGain() ERROR: index %d is out of range 0..%d"
-		    << gainIndex << s_camCapabilities.uiHighGain << std::endl;	  
-	  delete [] pNewTableHigh;
-	  return false;
-	}	
+	  std::cerr << "FliCameraC::applyConfigFrom() ERROR: gain device index " << uiGainDeviceIndex
+		    << " not in the gain table of this camera." << std::endl;
+	  ok = false;
+	  continue;
+	}
+      ok = setGain( tables[i], gainIndex ) && ok;
+    }
+
+  iResult = FPROCtrl_GetTemperatureSetPoint( master->siDeviceHandle, &setPoint );
+  if( iResult < 0 )
+    {
+      std::cerr << "FliCameraC::applyConfigFrom() ERROR: FPROCtrl_GetTemperatureSetPoint() failed, retval=" << iResult << std::endl;
+      ok = false;
+    }
+  else
+    {
+      ok = setTemperatureSetPoint( setPoint ) && ok;
+    }
+
+  if( master->getExternalTriggerEnable() )
+    {
+      ok = setExternalTriggerEnable( master->isExternalTriggerEnabled, master->externalTriggerType ) && ok;
+    }
+  else
+    {
+      ok = false;
     }
+  return ok;
 }
 
 //--------------------------------------------------------------
@@ -1008,6 +1420,10 @@ bool FliCameraC::prepareCaptureFullSensor()
   int32_t iResult;
   // assume failure
   iResult = -1;
+  if( replay.isOpen() )
+    {
+      return true;
+    }
   // Enable/disable image data
   // The power on default of the camera is to have image data enabled.
   // This is just shown here in case you are working with test frames and
@@ -1026,7 +1442,7 @@ bool FliCameraC::prepareCaptureFullSensor()
   // which is it's netive resolution?
   if( iResult >= 0 )
     {
-        iResult = FPROFrame_SetImageArea(siDeviceHandle, 0, 0, 4096, 4096);
+	iResult = FPROFrame_SetImageArea(siDeviceHandle, 0, 0, sensor.width, sensor.height);
     }
   else
     {
@@ -1048,13 +1464,32 @@ bool FliCameraC::allocFrameFullRes()
   //    2.) ALL image frames come prepended with Meta Data.  The size is located in the
   //        capabilities structure we retrieved earlier.
   //        The format of the Meta Data is documented in your users manual.
+  //    3.) The image size is taken from the sensor layout, which only knows
+  //        packed 12 bit pixels for now. HDR modes send two rows per sensor
+  //        row, the current mode is read from the camera.
+  readHdrEnable();
+  if( ! sensor.isSupported() )
+    {
+      std::cerr << "FliCameraC::allocFrameFullRes() ERROR: " << sensor.name << " " << sensor.width << "x" << sensor.height
+		<< " with " << sensor.pixelDepth << " bit pixels is not supported" << std::endl;
+      return false;
+    }
   uiFrameSizeInBytes = s_camCapabilities.uiMetaDataSize + FLICAMERA_FRAME_SIZE_ADD_BULGARIAN_CONSTATNT +
-    (FPRO_IMAGE_DIMENSIONS_TO_FRAMEBYTES(FLICAMERA_GSENSE4040_SENSOR_WIDTH, FLICAMERA_GSENSE4040_SENSOR_HEIGHT) * 2);
+    sensor.getImageBytes();
+
+  FliLogC::event( FLILOG_DEBUG, FLILOG_EV_FRAME_ALLOC, NULL, sensor.getImageBytes(), uiFrameSizeInBytes );
 
-  printf("FliCameraC::allocFrameFullRes() DEBUG: Frame size (FPRO_IMAGE_DIMENSIONS_TO_FRAMEBYTES(%d, %d) = %d\n",
-	 FLICAMERA_GSENSE4040_SENSOR_WIDTH, FLICAMERA_GSENSE4040_SENSOR_HEIGHT,
-	 FPRO_IMAGE_DIMENSIONS_TO_FRAMEBYTES(FLICAMERA_GSENSE4040_SENSOR_WIDTH, FLICAMERA_GSENSE4040_SENSOR_HEIGHT) * 2 );
-  printf("FliCameraC::allocFrameFullRes() DEBUG: uiFrameSizeInBytes = %d\n", uiFrameSizeInBytes);
+  if( replay.isOpen() )
+    {
+      // getImage() points pFrame at the recorded frames
+      if( uiFrameSizeInBytes != replay.getHeader().frameSize )
+	{
+	  std::cerr << "FliCameraC::allocFrameFullRes() ERROR: recorded frames have " << replay.getHeader().frameSize
+		    << " bytes instead of " << uiFrameSizeInBytes << std::endl;
+	  return false;
+	}
+      return true;
+    }
 
   // free pframe in case it was allocated before (eg FliCameraC::allocFrameFullRes() not called 1st time
   // this is to prevent memory leak
@@ -1069,6 +1504,8 @@ bool FliCameraC::allocFrameFullRes()
   pFrame = (uint8_t *)malloc(uiFrameSizeInBytes);
   if( pFrame != NULL )
     {
+      // map the pages on the NUMA node of the calling (capture) thread
+      fliFirstTouch( pFrame, uiFrameSizeInBytes );
       return true;
     }
   else
@@ -1100,7 +1537,7 @@ bool FliCameraC::grabImage()
 	}
       else
 	{
-	  iGrabResult = FPROFrame_GetVideoFrame( siDeviceHandle, pFrame, &uiSizeGrabbed, 0 );
+	  iGrabResult = FPROFrame_GetVideoFrame( siDeviceHandle, pFrame, &uiSizeGrabbed, getFrameTimeoutMs() );
 	}
       // Regardless of how the capture turned out, stop the capture
       iResult = FPROFrame_CaptureStop(siDeviceHandle);
@@ -1142,6 +1579,13 @@ bool FliCameraC::grabImage()
 bool FliCameraC::startCapture(uint32_t num)
 {
   int32_t  iResult = -1; // assuming failed
+  if( replay.isOpen() )
+    {
+      // recorded intervals count from the first frame of this capture
+      replayStart = std::chrono::steady_clock::now();
+      replayFirstArrivalNs = (uiReplayPos < replay.getNumFrames()) ? replay.getFrameHeader( uiReplayPos )->arrivalNs : 0;
+      return true;
+    }
  
   // Start the capture and tell it to get num frames
   iResult = FPROFrame_CaptureStart(siDeviceHandle, num);
@@ -1153,28 +1597,99 @@ bool FliCameraC::startCapture(uint32_t num)
 }
 
 //--------------------------------------------------------------
+/// deadline of one internally triggered frame [ms]
+uint32_t FliCameraC::getFrameTimeoutMs()
+{
+  return (uint32_t)((exposureTime + frameDelay) / 1000000) + uiTimeoutMarginMs;
+}
+
+//--------------------------------------------------------------
+/// wait for the next frame at most as long as the current exposure settings require,
+/// or uiExtTriggerTimeoutMs for an external trigger
 /// return true if succeeded, false if failed
 bool FliCameraC::getImage()
+{
+  return getImage( isExternalTriggerEnabled ? uiExtTriggerTimeoutMs : getFrameTimeoutMs() );
+}
+
+//--------------------------------------------------------------
+/// wait for the next frame at most timeoutMs milliseconds, 0 ... no deadline
+/// (external trigger only, abortCapture() still ends the wait)
+/// return true if succeeded, false if failed, timed out or aborted
+bool FliCameraC::getImage( uint32_t timeoutMs )
 {
   int32_t  iResult = -1; // assuming failed
   uint32_t  uiSizeGrabbed = 0;  // assuming zero bytes read
+
+  isLastFrameTimedOut = false;
+  isLastFrameAborted = false;
+  uiLastSizeGrabbed = 0;
+  if( isAbortRequested )
+    {
+      isLastFrameAborted = true;
+      return false;
+    }
+  if( replay.isOpen() )
+    {
+      return getReplayImage();
+    }
   
   // Grab  the frame- Here you can save the requested image size if you like as
   // the FPROFrame_GetVideoFrame() will return the actual number of bytes received.
   // Whatever you decide, make sure you pass the correct size into this API in order
   // to get the correct number of bytes for your frame.
   uiSizeGrabbed = uiFrameSizeInBytes;
-  // TODO: what does mean timeout 0? is infinite timeout?
-  if( isExternalTriggerEnabled )
-    {
-      iResult = FPROFrame_GetVideoFrameExt( siDeviceHandle, pFrame, &uiSizeGrabbed );
-      //std::cout << "DEBUG: FliCameraC::getImage(): calling FPROFrame_GetVideoFrameExt\n";
+  std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+  bool isDeadlineHit = false;
+  {
+    // no other thread talks to the camera while the frame is read out
+    std::lock_guard<std::mutex> lock( mtxReadout );
+    if( isExternalTriggerEnabled )
+      {
+	// FPROFrame_GetVideoFrameExt() has no timeout, the watchdog aborts it
+	armWatchdog( timeoutMs );
+	iResult = FPROFrame_GetVideoFrameExt( siDeviceHandle, pFrame, &uiSizeGrabbed );
+	isDeadlineHit = disarmWatchdog();
+      }
+    else
+      {
+	// the watchdog is only a backstop in case the library misses its own timeout
+	armWatchdog( timeoutMs + uiTimeoutMarginMs );
+	iResult = FPROFrame_GetVideoFrame( siDeviceHandle, pFrame, &uiSizeGrabbed, timeoutMs );
+	isDeadlineHit = disarmWatchdog();
+      }
+  }
+  uint64_t waitMs = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - waitStart ).count();
+  if( isDeadlineHit && (iResult >= 0) && !isAbortRequested )
+    {
+      // the frame came in just as the watchdog aborted the capture: the
+      // stream is gone either way, so it counts as timed out and the caller
+      // restarts the capture
+      isLastFrameTimedOut = true;
+      std::cerr << "FliCameraC::getImage() ERROR: frame arrived as the " << timeoutMs
+		<< " ms deadline aborted the capture, dropped" << std::endl;
+      return false;
     }
-  else
+  if( iResult < 0 )
     {
-      iResult = FPROFrame_GetVideoFrame( siDeviceHandle, pFrame, &uiSizeGrabbed, 0 );
-      //					 (this->exposureTime + this->frameDelay) / 1000000 + 1000 );
+      if( isAbortRequested )
+	{
+	  isLastFrameAborted = true;
+	  FliLogC::event( FLILOG_INFO, FLILOG_EV_FRAME_ABORTED );
+	}
+      else if( isDeadlineHit || ((timeoutMs > 0) && (waitMs >= timeoutMs)) )
+	{
+	  isLastFrameTimedOut = true;
+	  std::cerr << "FliCameraC::getImage() ERROR: no frame within " << timeoutMs << " ms" << std::endl;
+	}
+      else
+	{
+	  std::cerr << "FliCameraC::getImage(): FPROFrame_GetVideoFrame() failed, retval=" << iResult << std::endl;
+	}
+      return false;
     }
+  uiLastSizeGrabbed = uiSizeGrabbed;
+  frameArrival = std::chrono::steady_clock::now();
   // calculate approx time of exposure start
   // !@#$%^& TODO we get time at the end of frame readout, so we actually should compensate
   // for readout time (and shutter delay time as well...)
@@ -1183,15 +1698,36 @@ bool FliCameraC::getImage()
   // get actual exposure time from the FLI camera rather than relaying
   // on commandline argument or default value set in constructor
   bool immediate = false;
-  iResult = FPROCtrl_GetExposure( siDeviceHandle, &(this->exposureTime), &(this->frameDelay), &immediate );
-  if( iResult < 0 )
+  int32_t iExpResult = FPROCtrl_GetExposure( siDeviceHandle, &(this->exposureTime), &(this->frameDelay), &immediate );
+  if( iExpResult < 0 )
     {
-      std::cerr << "FliCameraC::getImage() ERROR: FPROFrame_GetExposure() failed, retval=" << iResult << std::endl;
+      std::cerr << "FliCameraC::getImage() ERROR: FPROFrame_GetExposure() failed, retval=" << iExpResult << std::endl;
     }
   ptime_frameTimeStamp -= boost::posix_time::nanoseconds(this->exposureTime);
   //  std::cout << "DEBUG: FliCameraC::getImage(): ptime_frameTimeStamp = " << ptime_frameTimeStamp<< std::endl;
   //  std::cout << "DEBUG: FliCameraC::getImage(): to_iso_string( ptime_frameTimeStamp ) = "
   //	    << to_iso_string( ptime_frameTimeStamp ) << std::endl;
+  setFrameTimeStamps();
+
+  // here you can do whatever you want with the frame data.
+  if (uiSizeGrabbed == uiFrameSizeInBytes)
+    {
+      FliLogC::event( FLILOG_DEBUG, FLILOG_EV_FRAME_GOT, NULL, uiSizeGrabbed, uiFrameSizeInBytes );
+      // got the correct number of bytes
+      return true;
+    }
+  else
+    {
+      FliLogC::event( FLILOG_WARN, FLILOG_EV_FRAME_GOT, NULL, uiSizeGrabbed, uiFrameSizeInBytes );
+      // something bad happened with the USB image transfer
+      return false;
+    }
+}
+
+//--------------------------------------------------------------
+/// file name time stamps from ptime_frameTimeStamp (exposure start)
+void FliCameraC::setFrameTimeStamps()
+{
   // external trigger is synced to GPS PPS, so we can truncate sub-seconds
   ptime_truncFrameTimeStamp = ptime_frameTimeStamp
     - boost::posix_time::nanoseconds( ptime_frameTimeStamp.time_of_day().total_nanoseconds() % 1000000000 );
@@ -1203,30 +1739,156 @@ bool FliCameraC::getImage()
   //  std::cout << "DEBUG: FliCameraC::getImage(): ptime_roundFrameTimeStamp = " << ptime_roundFrameTimeStamp<< std::endl;
   //  std::cout << "DEBUG: FliCameraC::getImage(): to_iso_string( ptime_roundFrameTimeStamp ) = "
   //	    << to_iso_string( ptime_roundFrameTimeStamp ) << std::endl;
-  
-  // If the FPROFrame_GetVideoFrame() succeeded- then process it
-  if (iResult >= 0)
+}
+
+//--------------------------------------------------------------
+/// getImage() of a replay: point pFrame at the next recorded frame and take
+/// over its settings and exposure start; in real time the frame is held
+/// back until its recorded interval from the first frame of the capture
+/// has passed, abortCapture() ends the wait
+/// return true if succeeded, false if failed, aborted or a short frame
+bool FliCameraC::getReplayImage()
+{
+  if( uiReplayPos >= replay.getNumFrames() )
+    {
+      std::cerr << "FliCameraC::getImage() ERROR: end of the recording after " << replay.getNumFrames() << " frames" << std::endl;
+      return false;
+    }
+  const FliRawFrameHeaderC* frame = replay.getFrameHeader( uiReplayPos );
+  replay.prefetch( uiReplayPos + 1 );
+  if( isReplayRealTime )
     {
-      printf("FliCameraC::getImage(): Got a frame, %d bytes\n", uiSizeGrabbed);
-      // here you can do whatever you want with the frame data.
-      if (uiSizeGrabbed == uiFrameSizeInBytes)
+      std::chrono::steady_clock::time_point due = replayStart + std::chrono::nanoseconds( frame->arrivalNs - replayFirstArrivalNs );
+      std::unique_lock<std::mutex> lock( mtxReplay );
+      cvReplay.wait_until( lock, due, [this]{ return isAbortRequested.load(); } );
+    }
+  if( isAbortRequested )
+    {
+      isLastFrameAborted = true;
+      FliLogC::event( FLILOG_INFO, FLILOG_EV_FRAME_ABORTED );
+      return false;
+    }
+  pFrame = (uint8_t*)replay.getFrame( uiReplayPos );
+  uiReplayPos++;
+  frameArrival = std::chrono::steady_clock::now();
+  uiLastSizeGrabbed = frame->sizeGrabbed;
+  exposureTime = frame->exposureTime;
+  frameDelay = frame->frameDelay;
+  uiLowGainIndex = frame->lowGainIndex;
+  uiHighGainIndex = frame->highGainIndex;
+  fLowGainValue = frame->lowGain;
+  fHighGainValue = frame->highGain;
+  ptime_frameTimeStamp = boost::posix_time::ptime( boost::gregorian::date( 1970, 1, 1 ) )
+    + boost::posix_time::nanoseconds( frame->obsTimeNs );
+  setFrameTimeStamps();
+  if( uiLastSizeGrabbed != uiFrameSizeInBytes )
+    {
+      FliLogC::event( FLILOG_WARN, FLILOG_EV_FRAME_GOT, NULL, uiLastSizeGrabbed, uiFrameSizeInBytes );
+      return false;
+    }
+  FliLogC::event( FLILOG_DEBUG, FLILOG_EV_FRAME_GOT, NULL, uiLastSizeGrabbed, uiFrameSizeInBytes );
+  return true;
+}
+
+//--------------------------------------------------------------
+/// watchdog thread: abort the frame wait when the armed deadline passes
+void FliCameraC::watchdogLoop()
+{
+  std::unique_lock<std::mutex> lock( mtxWatchdog );
+  while( !isWatchdogExit )
+    {
+      if( !isWatchdogArmed )
 	{
-	  printf("FliCameraC::getImage(): Frame OK\n");
-	  // got the correct number of bytes
-	  return true;
+	  cvWatchdog.wait( lock );
+	  continue;
 	}
-      else
+      cvWatchdog.wait_until( lock, watchdogDeadline );
+      if( isWatchdogArmed && (std::chrono::steady_clock::now() >= watchdogDeadline) )
 	{
-	  printf("FliCameraC::getImage(): frame has different size than expected (%d bytes)\n", uiFrameSizeInBytes );
-	  // something bad happened with the USB image transfer
-	  return false;
+	  isWatchdogArmed = false;
+	  isWatchdogFired = true;
+	  FPROFrame_CaptureAbort( siDeviceHandle );
 	}
     }
-  else
+}
+
+//--------------------------------------------------------------
+/// start the deadline of one frame wait, 0 ... no deadline
+void FliCameraC::armWatchdog( uint32_t timeoutMs )
+{
+  if( timeoutMs == 0 )
+    {
+      return;
+    }
+  std::lock_guard<std::mutex> lock( mtxWatchdog );
+  if( !isWatchdogRunning )
+    {
+      watchdog = std::thread( &FliCameraC::watchdogLoop, this );
+      isWatchdogRunning = true;
+    }
+  watchdogDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds( timeoutMs );
+  isWatchdogArmed = true;
+  isWatchdogFired = false;
+  cvWatchdog.notify_all();
+}
+
+//--------------------------------------------------------------
+/// end the deadline of a frame wait
+/// return true if the watchdog had to abort the wait
+bool FliCameraC::disarmWatchdog()
+{
+  std::lock_guard<std::mutex> lock( mtxWatchdog );
+  isWatchdogArmed = false;
+  bool fired = isWatchdogFired;
+  isWatchdogFired = false;
+  return fired;
+}
+
+//--------------------------------------------------------------
+/// cancel a capture, may be called from another thread while getImage() waits:
+/// the waiting getImage() and all further calls fail until resetAbort()
+/// return true if succeeded, false if failed
+bool FliCameraC::abortCapture()
+{
+  int32_t  iResult = -1; // assuming failed
+  if( replay.isOpen() )
     {
-      std::cerr << "FliCameraC::getImage(): FPROFrame_GetVideoFrame() failed, retval=" << iResult << std::endl;
+      {
+	std::lock_guard<std::mutex> lock( mtxReplay );
+	isAbortRequested = true;
+      }
+      cvReplay.notify_all();
+      return true;
+    }
+  isAbortRequested = true;
+  iResult = FPROFrame_CaptureAbort(siDeviceHandle);
+  if( iResult < 0 )
+    {
+      std::cerr << "FliCameraC::abortCapture() ERROR: FPROFrame_CaptureAbort() failed, retval=" << iResult << std::endl;
       return false;
     }
+  return true;
+}
+
+//--------------------------------------------------------------
+/// allow getImage() again after abortCapture()
+void FliCameraC::resetAbort()
+{
+  isAbortRequested = false;
+}
+
+//--------------------------------------------------------------
+/// true if the last getImage() failed because its deadline passed
+bool FliCameraC::wasLastFrameTimedOut()
+{
+  return isLastFrameTimedOut;
+}
+
+//--------------------------------------------------------------
+/// true if the last getImage() was cancelled by abortCapture()
+bool FliCameraC::wasLastFrameAborted()
+{
+  return isLastFrameAborted;
 }
   
 //--------------------------------------------------------------
@@ -1235,6 +1897,10 @@ bool FliCameraC::getImage()
 bool FliCameraC::stopCapture()
 {
   int32_t  iResult = -1; // assuming failed
+  if( replay.isOpen() )
+    {
+      return true;
+    }
   iResult = FPROFrame_CaptureStop(siDeviceHandle);
   if( iResult < 0 )
     {
@@ -1251,6 +1917,10 @@ bool FliCameraC::stopCapture()
 bool FliCameraC::endCapture()
 {
   int32_t  iResult = -1; // assuming failed
+  if( replay.isOpen() )
+    {
+      return true;
+    }
   iResult = FPROFrame_CaptureEnd(siDeviceHandle);
   if( iResult < 0 )
     {
@@ -1275,6 +1945,37 @@ bool FliCameraC::getMetaDataSize( uint32_t* metaDataSize )
     }  
 }
   
+//--------------------------------------------------------------
+/// true if frameCounterOffset is set and inside the meta data block
+bool FliCameraC::hasFrameCounter()
+{
+  return (frameCounterOffset >= 0)
+    && (s_camCapabilities.uiMetaDataSize >= (uint32_t)frameCounterOffset + 4);
+}
+
+//--------------------------------------------------------------
+/// camera frame counter of the last frame, read from its meta data
+/// return true if succeeded, false if failed or no counter offset is set
+bool FliCameraC::getLastFrameCounter( uint32_t* counter )
+{
+  if( (pFrame == NULL) || !hasFrameCounter() || (uiLastSizeGrabbed < (uint32_t)frameCounterOffset + 4) )
+    {
+      return false;
+    }
+  const uint8_t* p = pFrame + frameCounterOffset;
+  *counter = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+  return true;
+}
+
+//--------------------------------------------------------------
+/// true if the last getImage() received data, but less than a full frame
+bool FliCameraC::isLastFrameShort( uint32_t* sizeGrabbed, uint32_t* sizeExpected )
+{
+  *sizeGrabbed = uiLastSizeGrabbed;
+  *sizeExpected = uiFrameSizeInBytes;
+  return (uiLastSizeGrabbed > 0) && (uiLastSizeGrabbed != uiFrameSizeInBytes);
+}
+
 //--------------------------------------------------------------
 /// return true if succeeded, false if failed
 bool FliCameraC::extractMetaData( uint8_t* pMetaData, uint32_t metaDataSize )
@@ -1297,50 +1998,22 @@ bool FliCameraC::convertHdrRawToBitmaps16bit( uint16_t* bitamp16bitLow, uint16_t
       // there is apparently no frame captured
       return false;
     }
-
-  // MCu setup...
-  uint8_t* rawPtrFromCamera = pFrame;
-  uint32_t MetaDataSize = s_camCapabilities.uiMetaDataSize;
-  uint32_t frameHeight = FLICAMERA_GSENSE4040_SENSOR_HEIGHT;
-  uint32_t frameWidth = FLICAMERA_GSENSE4040_SENSOR_WIDTH; 
-  uint32_t frameWidthBytes = (FLICAMERA_GSENSE4040_SENSOR_WIDTH * 3 / 2);
-  uint8_t* tempRawLow;
-  uint8_t* tempRawHigh = rawPtrFromCamera + MetaDataSize;  // Move 246 bytes to start at image data
-  uint16_t* tempLdr = bitamp16bitLow;
-  uint16_t* tempHdr = bitamp16bitHigh;
-
-  // John's code
-  // Now process the image data
-  for (uint32_t y = 0; y < frameHeight; y++)
-    {
-      // In HDR mode, the capture contains both images interlaced so the pixels are:
-      // (LDR, row0, pixel0), (LDR, row0, pixel1) ... (LDR, row0, pixelN),
-      // (HDR, row0, pixel0), (HDR, row0, pixel1) ... (HDR, row0, pixelN),
-      // (LDR, row1, pixel0), (LDR, row1, pixel1) ... (LDR, row1, pixelN),
-      // (HDR, row1, pixel0), (HDR, row1, pixel1) ... (HDR, row1, pixelN),
-      // (LDR, rowN, pixel0), (LDR, rowN, pixel1) ... (LDR, rowN, pixelN),
-      // (HDR, rowN, pixel0), (HDR, rowN, pixel1) ... (HDR, rowN, pixelN),
-      tempRawLow = tempRawHigh;   // Set the low raw pointer to where the High left off
-      tempRawHigh += frameWidthBytes;  // Set the high one width past the Low
-      
-      // Since we are pulling off 2 pixels per loop only loop for half the width
-      for (uint32_t x = 0; x < frameWidth; x += 2, tempRawLow += 3, tempRawHigh += 3)
-	{
-	  // Convert the Low values
-	  uint8_t tL = tempRawLow[1];
-	  tempLdr[0] = (uint16_t)((tempRawLow[0] << 4) | (tL >> 4));
-	  tempLdr[1] = (uint16_t)(((tL & 0x0F) << 8) | tempRawLow[2]);
-
-	  // Convert the High values
-	  uint8_t tH = tempRawHigh[1];
-	  tempHdr[0] = (uint16_t)((tempRawHigh[0] << 4) | (tH >> 4));
-	  tempHdr[1] = (uint16_t)(((tH & 0x0F) << 8) | tempRawHigh[2]);
-	  // Move the pointers
-	  tempLdr += 2;
-	  tempHdr += 2;	  
-	}      
+  if( ! sensor.isHdrInterleaved )
+    {
+      std::cerr << "FliCameraC::convertHdrRawToBitmaps16bit() ERROR: " << sensor.name << " frames have a single channel" << std::endl;
+      return false;
     }
 
+  // In HDR mode, the capture contains both images interlaced so the pixels are:
+  // (LDR, row0, pixel0), (LDR, row0, pixel1) ... (LDR, row0, pixelN),
+  // (HDR, row0, pixel0), (HDR, row0, pixel1) ... (HDR, row0, pixelN),
+  // (LDR, row1, pixel0), (LDR, row1, pixel1) ... (LDR, row1, pixelN),
+  // (HDR, row1, pixel0), (HDR, row1, pixel1) ... (HDR, row1, pixelN),
+  // (LDR, rowN, pixel0), (LDR, rowN, pixel1) ... (LDR, rowN, pixelN),
+  // (HDR, rowN, pixel0), (HDR, rowN, pixel1) ... (HDR, rowN, pixelN),
+  // the image data starts after the meta data
+  sensor.unpackHdr( pFrame + s_camCapabilities.uiMetaDataSize, sensor.width, sensor.height,
+		    skyMask.getSpans(), skyMask.getRowSpans(), bitamp16bitLow, bitamp16bitHigh );
   return true;
 }
 
@@ -1354,36 +2027,91 @@ bool FliCameraC::convertLdrRawToBitmap16bit( uint16_t* bitamp16bit )
       return false;
     }
 
-  uint8_t* rawPtrFromCamera = pFrame;
-  uint32_t MetaDataSize = s_camCapabilities.uiMetaDataSize;
-  uint32_t frameHeight = FLICAMERA_GSENSE4040_SENSOR_HEIGHT;
-  uint32_t frameWidth = FLICAMERA_GSENSE4040_SENSOR_WIDTH; 
-  //  uint32_t frameWidthBytes = (FLICAMERA_GSENSE4040_SENSOR_WIDTH * 3 / 2);
-  uint8_t* tempRaw = rawPtrFromCamera + MetaDataSize;  // Move 246 bytes to start at image data
-  uint16_t* temp = bitamp16bit;
+  // In LDR mode the rows follow each other:
+  // (LDR, row0, pixel0), (LDR, row0, pixel1) ... (LDR, row0, pixelN),
+  // (LDR, row1, pixel0), (LDR, row1, pixel1) ... (LDR, row1, pixelN),
+  // (LDR, rowN, pixel0), (LDR, rowN, pixel1) ... (LDR, rowN, pixelN),
+  sensor.unpackLdr( pFrame + s_camCapabilities.uiMetaDataSize, sensor.width, sensor.height,
+		    skyMask.getSpans(), skyMask.getRowSpans(), bitamp16bit, NULL );
+  return true;
+}
 
-  // modifield John's code for LDR mode
-  // Now process the image data
-  for (uint32_t y = 0; y < frameHeight; y++)
+//--------------------------------------------------------------
+/// unpack a band of numRows rows starting at firstRow into band sized
+/// bitmaps, bitmap16bitHigh is not used in single channel modes
+/// return true if succeeded, false if failed
+bool FliCameraC::convertRawRows( uint32_t firstRow, uint32_t numRows, uint16_t* bitmap16bitLow, uint16_t* bitmap16bitHigh )
+{
+  if( (pFrame == NULL) || (firstRow + numRows > sensor.height) )
     {
-      // In HDR mode, the capture contains both images interlaced so the pixels are:
-      // (LDR, row0, pixel0), (LDR, row0, pixel1) ... (LDR, row0, pixelN),
-      // (LDR, row1, pixel0), (LDR, row1, pixel1) ... (LDR, row1, pixelN),
-      // (LDR, rowN, pixel0), (LDR, rowN, pixel1) ... (LDR, rowN, pixelN),
-
-      // Since we are pulling off 2 pixels per loop only loop for half the width
-      for (uint32_t x = 0; x < frameWidth; x += 2, tempRaw += 3 )
-	{
-	  // Convert the Low values
-	  uint8_t tL = tempRaw[1];
-	  temp[0] = (uint16_t)((tempRaw[0] << 4) | (tL >> 4));
-	  temp[1] = (uint16_t)(((tL & 0x0F) << 8) | tempRaw[2]);
+      return false;
+    }
+  uint32_t rowsPerSensorRow = sensor.isHdrInterleaved ? 2 : 1;
+  const uint8_t* raw = pFrame + s_camCapabilities.uiMetaDataSize
+    + (size_t)firstRow * rowsPerSensorRow * sensor.getRowBytes();
+  const FliSpanC* spans = skyMask.getSpans();
+  const uint32_t* rowSpans = skyMask.getRowSpans();
+  if( rowSpans != NULL )
+    {
+      rowSpans += firstRow;
+    }
+  if( sensor.isHdrInterleaved )
+    {
+      sensor.unpackHdr( raw, sensor.width, numRows, spans, rowSpans, bitmap16bitLow, bitmap16bitHigh );
+    }
+  else
+    {
+      sensor.unpackLdr( raw, sensor.width, numRows, spans, rowSpans, bitmap16bitLow, NULL );
+    }
+  return true;
+}
 
-	  temp += 2;
-	}      
+//--------------------------------------------------------------
+/// CRC32C of the last frame as received (meta data and packed pixels), for
+/// telling a corrupted file from a corrupted transfer later on
+uint32_t FliCameraC::getRawFrameCrc()
+{
+  if( pFrame == NULL )
+    {
+      return 0;
     }
+  return fliCrc32c( pFrame, uiLastSizeGrabbed );
+}
 
-  return true;
+//--------------------------------------------------------------
+/// recording description of the current frames for FliRawRecorderC
+void FliCameraC::getRawFileHeader( FliRawFileHeaderC* header )
+{
+  memset( header, 0, sizeof(*header) );
+  header->pixelDepth = sensor.pixelDepth;
+  header->pixelLsb = uiPixelLSB;
+  header->isHdr = sensor.isHdrInterleaved ? 1 : 0;
+  header->frameSize = uiFrameSizeInBytes;
+  strncpy( header->serial, getSerial().c_str(), sizeof(header->serial) - 1 );
+  header->capabilities = s_camCapabilities;
+}
+
+//--------------------------------------------------------------
+/// settings and times of the last frame for FliRawRecorderC, index is left 0
+void FliCameraC::getLastRawFrameHeader( FliRawFrameHeaderC* header )
+{
+  memset( header, 0, sizeof(*header) );
+  header->obsTimeNs = (ptime_frameTimeStamp - boost::posix_time::ptime( boost::gregorian::date( 1970, 1, 1 ) )).total_nanoseconds();
+  header->arrivalNs = std::chrono::duration_cast<std::chrono::nanoseconds>( frameArrival.time_since_epoch() ).count();
+  header->exposureTime = exposureTime;
+  header->frameDelay = frameDelay;
+  header->lowGainIndex = uiLowGainIndex;
+  header->highGainIndex = uiHighGainIndex;
+  header->lowGain = fLowGainValue;
+  header->highGain = fHighGainValue;
+  header->sizeGrabbed = uiLastSizeGrabbed;
+}
+
+//--------------------------------------------------------------
+/// the last frame as received, meta data first
+const uint8_t* FliCameraC::getRawFrame()
+{
+  return pFrame;
 }
 
 //--------------------------------------------------------------
@@ -1409,6 +2137,51 @@ void FliCameraC::getLastFrameTimeStamp( boost::posix_time::ptime* timestamp )
     }  
 }
 
+//--------------------------------------------------------------
+/// returns timestamp (start of exposure) of the last frame as written
+/// to the OBSTIME FITS keyword
+void FliCameraC::getLastFrameObsTime( boost::posix_time::ptime* timestamp )
+{
+  if( isExternalTriggerEnabled )
+    {
+      // external trigger is synced to GPS PPS
+      *timestamp = ptime_truncFrameTimeStamp;
+    }
+  else
+    {
+      *timestamp = ptime_frameTimeStamp;
+    }
+}
+
+//--------------------------------------------------------------
+/// snapshot of the FITS header values of the last frame,
+/// stacked images are timestamped with the start of the first stacked frame
+void FliCameraC::getLastFrameInfo( FliFrameInfoC* info )
+{
+  if( uiStackNumFrames > 0 )
+    {
+      info->ptime_obsTime = ptime_stackObsTime;
+    }
+  else
+    {
+      getLastFrameObsTime( &(info->ptime_obsTime) );
+    }
+  info->exposureTime = this->exposureTime;
+  info->fLowGainValue = this->fLowGainValue;
+  info->fHighGainValue = this->fHighGainValue;
+  info->uiStackNumFrames = this->uiStackNumFrames;
+  info->str_stackMode = this->str_stackMode;
+  info->uiBracketIndex = this->uiBracketIndex;
+  info->uiBracketNum = this->uiBracketNum;
+  info->hasTemperatures = false;
+  info->ambientTemp = 0.0;
+  info->baseTemp = 0.0;
+  info->coolerTemp = 0.0;
+  info->setPointTemp = 0.0;
+  info->hasRawCrc = false;
+  info->uiRawCrc = 0;
+}
+
 //--------------------------------------------------------------
 /// set coordinates that will be written to FITS header file
 void FliCameraC::setFitsLocation( double lat, double lon, double alt, std::string loc )
@@ -1417,10 +2190,17 @@ void FliCameraC::setFitsLocation( double lat, double lon, double alt, std::strin
   this->longitude = lon;
   this->altitude = alt;
   this->str_siteLocation = loc;
+  // header templates contain the location
+  std::lock_guard<std::mutex> lock( mtxFitsTemplate );
+  for( int i = 0; i < FLICAMERA_FITS_TEMPLATES; i++ )
+    {
+      fitsTemplate[i].clear();
+    }
 }
 
 //--------------------------------------------------------------
-/// return true if succeeded, false if failed
+/// constant part of the FITS header, rendered once per session,
+/// per-frame cards get placeholder values and are patched in getFitsHeader()
 // 
 // INSTRUME ... camera type eg Nikon D810, FLI Kepler KL4040
 // CAMERA ... camera type eg Nikon D810, FLI Kepler KL4040
@@ -1439,251 +2219,378 @@ void FliCameraC::setFitsLocation( double lat, double lon, double alt, std::strin
 // --< optional >-----
 // APERTUR
 // IMAGETYP "LIGHT"
+//
+// The primary header of a multi-extension file (isMefPrimary) has no image
+// and no LHIMGCH, the channels follow as IMAGE extensions.
 
-bool FliCameraC::writeFitsKeywords(fitsfile *fp, const char *filename, char channel )
+void FliCameraC::buildFitsTemplate( FliFitsHeaderC* hdr, int width, int height, int bitpix, bool isStack,
+				    bool isBracket, bool hasTemperatures, bool isMefPrimary, bool hasRawCrc )
 {
-  int status = 0;
-  if(ffdkey(fp, "COMMENT", &status))
+  char hostName[256];
+  gethostname( hostName, sizeof(hostName) );
+  hostName[sizeof(hostName) - 1] = '\0';
+
+  hdr->clear();
+  hdr->addLogical( "SIMPLE", true, "file does conform to FITS standard" );
+  if( isMefPrimary )
     {
-      std::cerr << "flictl: writeFitsKeywords() Failed! ffdkey( , \"COMMENT\", ) status = " << status << std::endl;
-      return false;
+      hdr->addInt( "BITPIX", 8, "number of bits per data pixel" );
+      hdr->addInt( "NAXIS", 0, "number of data axes" );
+      hdr->addLogical( "EXTEND", true, "FITS dataset may contain extensions" );
+      hdr->addInt( "NEXTEND", 0, "number of image extensions (L, H)" );
     }
-  if(ffdkey(fp, "COMMENT", &status))
+  else
     {
-      std::cerr << "flictl: writeFitsKeywords() Failed! ffdkey( , \"COMMENT\", ) status = " << status << std::endl;
-      return false;
+      hdr->addInt( "BITPIX", bitpix, "number of bits per data pixel" );
+      hdr->addInt( "NAXIS", 2, "number of data axes" );
+      hdr->addInt( "NAXIS1", width, "length of data axis 1" );
+      hdr->addInt( "NAXIS2", height, "length of data axis 2" );
+      hdr->addLogical( "EXTEND", true, "FITS dataset may contain extensions" );
+      if( bitpix == 32 )
+	{
+	  hdr->addInt( "BZERO", 2147483648LL, "offset data range to that of unsigned long" );
+	}
+      else
+	{
+	  hdr->addInt( "BZERO", 32768, "offset data range to that of unsigned short" );
+	}
+      hdr->addInt( "BSCALE", 1, "default scaling factor" );
+    }
+  hdr->addString( "DATE", "", "file creation date (YYYY-MM-DDThh:mm:ss UT)" );
+  hdr->addString( "FILENAME", "", "" );
+  hdr->addString( "INSTRUME", sensor.camera, "Instrument type" );
+  hdr->addString( "CAMERA", sensor.camera, "Camera model" );
+  hdr->addString( "DETNAM", sensor.detector, "Detector used to make the observation" );
+  hdr->addString( "OBSTIME", "", "ISO UTC timestamp start exposure" );
+  hdr->addDouble( "EXPOSURE", 0.0, "Exposure time in s" );
+  hdr->addDouble( "SITELAT", this->latitude, "latitude (WGS84 North positive decimal deg)" );
+  hdr->addDouble( "SITELON", this->longitude, "longitude (WGS84 North positive decimal deg)" );
+  hdr->addDouble( "SITEALT", this->altitude, "altitude (metres ASL)" );
+  hdr->addString( "SITELOC", this->str_siteLocation, "Name of camera site location" );
+  hdr->addString( "TELESCOP", hostName, "Name of telescope" );
+  hdr->addDouble( "HIGHGAIN", 0.0, "High gain channel gain" );
+  hdr->addDouble( "LOWGAIN", 0.0, "Low gain channel gain" );
+  // indicates if the image is Low or High gain channel ("L" or "H")
+  if( !isMefPrimary )
+    {
+      hdr->addString( "LHIMGCH", "L", "Low or High gain channel identification" );
     }
-
-  char *buff;
-  
-  buff = new char[ strlen(filename) ];
-  strncpy( buff, filename, strlen(filename) );
-
-  //   int fits_write_key / ffpky
-  //    (fitsfile *fptr, int datatype, char *keyname, DTYPE *value,
-  //        char *comment, > int *status)  
-  // --------- FILENAME -----------------
-  if( fits_write_key(fp, TSTRING, "FILENAME", buff, "", &status) )
-    {
-      std::cerr << "flictl: writeFitsKeywords() Failed! fits_write_key( , TSTRING, \"FILENAME\", "
-		<< filename << ", , ) status =" << status << std::endl;
-      delete buff;
-      return false;
+  if( isStack )
+    {
+      hdr->addInt( "NSTACK", 0, "Number of co-added frames" );
+      hdr->addString( "STACKMOD", "", "Frame stacking mode (sum, mean or max)" );
+      hdr->addDouble( "STACKEXP", 0.0, "Total exposure time of stacked frames in s" );
     }
-  delete buff;
-
-  // --------- INSTRUME ----------------
-  buff = new char[256];
-  snprintf( buff, 256, "FLI Kepler KL4040");
-  
-  if( fits_write_key(fp, TSTRING, "INSTRUME", buff, "Instrument type", &status) )
+  if( isBracket )
     {
-      std::cerr << "flictl: writeFitsKeywords() Failed! fits_write_key( , TSTRING, \"INSTRUME\", "
-		<< buff << ", , ) status =" << status << std::endl;
-      delete buff;
-      return false;
+      hdr->addInt( "BRKTIDX", 0, "Bracketing point of this frame (0-based)" );
+      hdr->addInt( "BRKTNUM", 0, "Number of bracketing points per cycle" );
     }
-
-  // --------- CAMERA ----------------
-  
-  if( fits_write_key(fp, TSTRING, "CAMERA", buff, "Camera model", &status) )
+  if( skyMask.isEnabled() )
     {
-      std::cerr << "flictl: writeFitsKeywords() Failed! fits_write_key( , TSTRING, \"CAMERA\", "
-		<< buff << ", , ) status =" << status << std::endl;
-      delete buff;
-      return false;
+      double maskX, maskY, maskR;
+      skyMask.getCircle( &maskX, &maskY, &maskR );
+      hdr->addString( "SKYMASK", skyMask.getTypeName(), "Pixels outside the sky mask are 0" );
+      hdr->addDouble( "SKYFRAC", skyMask.getSkyFraction(), "Fraction of pixels inside the sky mask" );
+      if( skyMask.getType() == FLIMASK_CIRCLE )
+	{
+	  hdr->addDouble( "MASKCX", maskX, "Sky mask circle centre x in pixels" );
+	  hdr->addDouble( "MASKCY", maskY, "Sky mask circle centre y in pixels" );
+	  hdr->addDouble( "MASKR", maskR, "Sky mask circle radius in pixels" );
+	}
+    }
+  if( hasTemperatures )
+    {
+      hdr->addDouble( "AMBTEMP", 0.0, "Ambient temperature at mid exposure in C" );
+      hdr->addDouble( "BASETEMP", 0.0, "Camera base temperature at mid exposure in C" );
+      hdr->addDouble( "COOLTEMP", 0.0, "Cooler temperature at mid exposure in C" );
+      hdr->addDouble( "SET-TEMP", 0.0, "Cooler set point in C" );
     }
+  if( hasRawCrc )
+    {
+      hdr->addString( "RAWCRC", "00000000", "CRC32C of the raw camera frame (hex)" );
+    }
+  hdr->addChecksum();
+}
 
-  // --------- DETNAM ----------------
+//--------------------------------------------------------------
+/// complete FITS header of one file: copy of the template for this image
+/// size and BITPIX with the per-frame cards patched in; numExtensions > 0
+/// gives the primary header of a multi-extension file (channel is not used)
+/// return true if succeeded, false if failed
+bool FliCameraC::getFitsHeader( std::string* header, const char* filename, int width, int height,
+				char channel, int bitpix, const FliFrameInfoC* info, int numExtensions )
+{
+  bool isMefPrimary = (numExtensions > 0);
+  bool isStack = (info->uiStackNumFrames > 0);
+  bool isBracket = (info->uiBracketNum > 0);
+  int slot = (info->hasRawCrc ? 32 : 0) + (isMefPrimary ? 16 : 0) + ((bitpix == 32) ? 8 : 0) + (isStack ? 4 : 0)
+    + (isBracket ? 2 : 0) + (info->hasTemperatures ? 1 : 0);
+  std::lock_guard<std::mutex> lock( mtxFitsTemplate );
 
-  snprintf( buff, 256, "Gsense 4040");
-  if( fits_write_key(fp, TSTRING, "DETNAM", buff, "Detector used to make the observation", &status) )
+  if( fitsTemplate[slot].isEmpty() || (fitsTemplateWidth[slot] != width) || (fitsTemplateHeight[slot] != height) )
     {
-      std::cerr << "flictl: writeFitsKeywords() Failed! fits_write_key( , TSTRING, \"DETNAM\", "
-		<< buff << ", , ) status =" << status << std::endl;
-      delete buff;
-      return false;
+      buildFitsTemplate( &fitsTemplate[slot], width, height, bitpix, isStack, isBracket, info->hasTemperatures,
+			 isMefPrimary, info->hasRawCrc );
+      str_fitsTemplateBlock[slot] = fitsTemplate[slot].getBlock();
+      fitsTemplateWidth[slot] = width;
+      fitsTemplateHeight[slot] = height;
     }
+  const FliFitsHeaderC& hdr = fitsTemplate[slot];
+  *header = str_fitsTemplateBlock[slot];
 
-  delete buff;
- 
-  // --------- OBSTIME -----------------
-  std::string str_timeStamp;
-  if( isExternalTriggerEnabled )
+  std::string str_date = to_iso_extended_string( boost::posix_time::second_clock::universal_time() );
+  bool ok = hdr.patchString( header, "DATE", str_date )
+    && hdr.patchString( header, "FILENAME", filename )
+    && hdr.patchString( header, "OBSTIME", to_iso_extended_string( info->ptime_obsTime ) )
+    && hdr.patchDouble( header, "EXPOSURE", (double)(info->exposureTime)/1000000000.0 ) // [ns] -> [s]
+    && hdr.patchDouble( header, "HIGHGAIN", info->fHighGainValue )
+    && hdr.patchDouble( header, "LOWGAIN", info->fLowGainValue );
+  if( ok && isMefPrimary )
     {
-      str_timeStamp = to_iso_extended_string( ptime_truncFrameTimeStamp );
-      buff = new char[str_timeStamp.length()+1];
-      strncpy( buff, str_timeStamp.c_str(), str_timeStamp.length()+1 );
+      ok = hdr.patchInt( header, "NEXTEND", numExtensions );
     }
-  else
+  else if( ok )
     {
-      str_timeStamp = to_iso_extended_string( ptime_frameTimeStamp );
-      buff = new char[str_timeStamp.length()+1];
-      strncpy( buff, str_timeStamp.c_str(), str_timeStamp.length()+1 );
+      ok = hdr.patchString( header, "LHIMGCH", (channel == 'H') ? "H" : ((channel == 'L') ? "L" : "INVALID") );
     }
-  if( fits_write_key(fp, TSTRING, "OBSTIME", buff, "ISO UTC timestamp start exposure", &status) )
+  if( ok && isStack )
     {
-      std::cerr << "flictl: writeFitsKeywords() Failed! fits_write_key( , TSTRING, \"OBSTIME\", "
-		<< buff << ", , ) status =" << status << std::endl;
-      delete buff;
-      return false;
+      double dStackExpTime = (double)(info->exposureTime) * info->uiStackNumFrames / 1000000000.0; // [ns] -> [s]
+      ok = hdr.patchInt( header, "NSTACK", info->uiStackNumFrames )
+	&& hdr.patchString( header, "STACKMOD", info->str_stackMode )
+	&& hdr.patchDouble( header, "STACKEXP", dStackExpTime );
     }
-  delete buff;
-  
-  // --------- EXPTIME -----------------
-  double dExpTime = (double)(this->exposureTime)/1000000000.0; // [ns] -> [s]
-  if( fits_write_key( fp, TDOUBLE, "EXPOSURE", &dExpTime, "Exposure time in s", &status) )
+  if( ok && isBracket )
     {
-      std::cerr << "flictl: writeFitsKeywords() Failed! fits_write_key( , TDOUBLE, \"EXPTIME\", "
-		<< dExpTime << ", , ) status =" << status << std::endl;
-      return false;
+      ok = hdr.patchInt( header, "BRKTIDX", info->uiBracketIndex )
+	&& hdr.patchInt( header, "BRKTNUM", info->uiBracketNum );
     }
-
-  // --------- SITELAT -----------------
-  if( fits_write_key( fp, TDOUBLE, "SITELAT", &(this->latitude), "latitude (WGS84 North positive decimal deg)", &status) )
+  if( ok && info->hasTemperatures )
     {
-      std::cerr << "flictl: writeFitsKeywords() Failed! fits_write_key( , TDOUBLE, \"SITELAT\", "
-		<< this->latitude << ", , ) status =" << status << std::endl;
-      return false;
+      ok = hdr.patchDouble( header, "AMBTEMP", info->ambientTemp )
+	&& hdr.patchDouble( header, "BASETEMP", info->baseTemp )
+	&& hdr.patchDouble( header, "COOLTEMP", info->coolerTemp )
+	&& hdr.patchDouble( header, "SET-TEMP", info->setPointTemp );
     }
-  
-  // --------- SITELON -----------------
-  if( fits_write_key( fp, TDOUBLE, "SITELON", &(this->longitude), "longitude (WGS84 North positive decimal deg)", &status) )
+  if( ok && info->hasRawCrc )
     {
-      std::cerr << "flictl: writeFitsKeywords() Failed! fits_write_key( , TDOUBLE, \"SITELON\", "
-		<< this->longitude << ", , ) status =" << status << std::endl;
-      return false;
+      char str_crc[9];
+      snprintf( str_crc, sizeof(str_crc), "%08x", info->uiRawCrc );
+      ok = hdr.patchString( header, "RAWCRC", str_crc );
     }
+  return ok;
+}
 
-  // --------- SITEALT---------------
-  if( fits_write_key( fp, TDOUBLE, "SITEALT", &(this->altitude), "altitude (metres ASL)", &status) )
-    {
-      std::cerr << "flictl: writeFitsKeywords() Failed! fits_write_key( , TDOUBLE, \"SITEALT\", "
-		<< this->altitude << ", , ) status =" << status << std::endl;
-      return false;
-    }
+//--------------------------------------------------------------
+/// set frame stacking info for the following writeFits() calls
+/// numFrames = 0 switches the stacking keywords off
+void FliCameraC::setStackInfo( uint32_t numFrames, std::string mode, boost::posix_time::ptime obsTime )
+{
+  this->uiStackNumFrames = numFrames;
+  this->str_stackMode = mode;
+  this->ptime_stackObsTime = obsTime;
+}
 
-  // --------- SITELOC ---------------
-  buff = new char[ str_siteLocation.length()+1 ];
-  
-  strncpy( buff, str_siteLocation.c_str(), str_siteLocation.length()+1 );
+//--------------------------------------------------------------
+/// set the bracketing point of the following frames
+/// num = 0 switches the bracketing keywords off
+void FliCameraC::setBracketInfo( uint32_t index, uint32_t num )
+{
+  this->uiBracketIndex = index;
+  this->uiBracketNum = num;
+}
+
+//--------------------------------------------------------------
+/// write 16-bit image of the last frame
+/// return 0 if succeeded, non-zero if failed
+int FliCameraC::writeFits(const char *filename, int width, int height, void *data, char channel )
+{
+  FliFrameInfoC info;
+  getLastFrameInfo( &info );
+  return writeFitsImage( filename, width, height, data, channel, 16, &info );
+}
+
+//--------------------------------------------------------------
+/// write 16-bit image with header values taken earlier by getLastFrameInfo(),
+/// safe to call from a writer thread while the camera captures the next frame
+/// return 0 if succeeded, non-zero if failed
+int FliCameraC::writeFits(const char *filename, int width, int height, void *data, char channel,
+			  const FliFrameInfoC* info )
+{
+  return writeFitsImage( filename, width, height, data, channel, 16, info );
+}
 
-  if( fits_write_key( fp, TSTRING, "SITELOC", buff, "Name of camera site location", &status) )
+//--------------------------------------------------------------
+/// write 32-bit image (eg. summed stack)
+/// return 0 if succeeded, non-zero if failed
+int FliCameraC::writeFits32bit(const char *filename, int width, int height, uint32_t *data, char channel )
+{
+  FliFrameInfoC info;
+  getLastFrameInfo( &info );
+  return writeFitsImage( filename, width, height, (void *)data, channel, 32, &info );
+}
+
+//--------------------------------------------------------------
+/// write 32-bit image with header values taken earlier by getLastFrameInfo()
+/// return 0 if succeeded, non-zero if failed
+int FliCameraC::writeFits32bit(const char *filename, int width, int height, uint32_t *data, char channel,
+			       const FliFrameInfoC* info )
+{
+  return writeFitsImage( filename, width, height, (void *)data, channel, 32, info );
+}
+
+//--------------------------------------------------------------
+/// header of the IMAGE extension of one channel in a multi-extension file,
+/// small enough to be rendered per file
+void FliCameraC::getFitsExtensionHeader( std::string* header, int width, int height, char channel, int bitpix,
+					 const FliFrameInfoC* info )
+{
+  FliFitsHeaderC hdr;
+  hdr.addString( "XTENSION", "IMAGE", "IMAGE extension" );
+  hdr.addInt( "BITPIX", bitpix, "number of bits per data pixel" );
+  hdr.addInt( "NAXIS", 2, "number of data axes" );
+  hdr.addInt( "NAXIS1", width, "length of data axis 1" );
+  hdr.addInt( "NAXIS2", height, "length of data axis 2" );
+  hdr.addInt( "PCOUNT", 0, "required keyword; must = 0" );
+  hdr.addInt( "GCOUNT", 1, "required keyword; must = 1" );
+  if( bitpix == 32 )
+    {
+      hdr.addInt( "BZERO", 2147483648LL, "offset data range to that of unsigned long" );
+    }
+  else
     {
-      std::cerr << "flictl: writeFitsKeywords() Failed! fits_write_key( , TSTRING, \"SITELOC\", "
-		<< this->str_siteLocation << ", , ) status =" << status << std::endl;
-      delete buff;
-      return false;
+      hdr.addInt( "BZERO", 32768, "offset data range to that of unsigned short" );
     }
-  delete buff;
+  hdr.addInt( "BSCALE", 1, "default scaling factor" );
+  hdr.addString( "EXTNAME", (channel == 'H') ? "H" : "L", "extension name" );
+  hdr.addString( "LHIMGCH", (channel == 'H') ? "H" : "L", "Low or High gain channel identification" );
+  hdr.addDouble( "CHANGAIN", (channel == 'H') ? info->fHighGainValue : info->fLowGainValue, "Gain of this channel" );
+  hdr.addChecksum();
+  *header = hdr.getBlock();
+}
 
-  // --------- TELESCOP ---------------
-  buff = new char[256];
-  gethostname( buff, 256 );
-  if( fits_write_key( fp, TSTRING, "TELESCOP", buff , "Name of telescope", &status) )
+//--------------------------------------------------------------
+/// write one multi-extension FITS file: primary header with the shared cards
+/// followed by an IMAGE extension per channel, dataL or dataH NULL ... channel
+/// left out
+/// return 0 if succeeded, 1 if the file exists, -1 if failed
+int FliCameraC::writeFitsMef( const char *filename, int width, int height, void *dataL, void *dataH,
+			      int bitpix, const FliFrameInfoC* info )
+{
+  FliTraceScopeC trace( "write mef" );
+  std::string header;
+  int numExtensions = ((dataL != NULL) ? 1 : 0) + ((dataH != NULL) ? 1 : 0);
+  if( numExtensions == 0 )
     {
-      std::cerr << "flictl: writeFitsKeywords() Failed! fits_write_key( , TSTRING, \"TELESCOP\", "
-		<< buff << ", , ) status =" << status << std::endl;
-      delete buff;
-      return false;
+      std::cerr << "flictl: writeFitsMef() Failed! No channel to write to " << filename << std::endl;
+      return -1;
     }
-  delete buff;
-
-  // ---------  HIGHGAIN --------------
-  if( fits_write_key( fp, TDOUBLE, "HIGHGAIN", &(this->fHighGainValue), "High gain channel gain", &status) )
+  if( ! getFitsHeader( &header, filename, width, height, 0, bitpix, info, numExtensions ) )
     {
-      std::cerr << "flictl: writeFitsKeywords() Failed! fits_write_key( , TDOUBLE, \"HIGHGAIN\", "
-		<< this->fHighGainValue << ", , ) status =" << status << std::endl;
-      return false;
+      return -1;
     }
 
-  // ---------  LOWGAIN --------------
-  if( fits_write_key( fp, TDOUBLE, "LOWGAIN", &(this->fLowGainValue), "Low gain channel gain", &status) )
+  int fd = open( filename, O_WRONLY | O_CREAT | O_EXCL, 0644 );
+  if( fd < 0 )
     {
-      std::cerr << "flictl: writeFitsKeywords() Failed! fits_write_key( , TDOUBLE, \"LOWGAIN\", "
-		<< this->fLowGainValue << ", , ) status =" << status << std::endl;
-      return false;
+      if( errno == EEXIST )
+	{
+	  std::cerr << "flictl: writeFitsMef() Failed! File " << filename << " already exists" << std::endl;
+	  return 1;
+	}
+      std::cerr << "flictl: writeFitsMef() Failed! Cannot create " << filename << ": " << strerror( errno ) << std::endl;
+      return -1;
     }
 
-  // ---------  LHIMGCH  ----------------
-  // indicates if the image is Low or High gain channel ("L" or "H")
-  buff = new char[256];
-  switch( channel )
-    {
-    case 'H':
-      snprintf( buff, 256, "%s", "H");
-      break;
-    case 'L':
-      snprintf( buff, 256, "%s", "L");
-      break;
-    default:
-      snprintf( buff, 256, "%s", "INVALID");
+  bool ok = fliWriteFitsHdu( fd, &header, NULL, 0, bitpix );
+  const char channels[2] = { 'L', 'H' };
+  void* data[2] = { dataL, dataH };
+  for( int k = 0; ok && (k < 2); k++ )
+    {
+      if( data[k] == NULL )
+	{
+	  continue;
+	}
+      std::string extension;
+      getFitsExtensionHeader( &extension, width, height, channels[k], bitpix, info );
+      ok = fliWriteFitsHdu( fd, &extension, data[k], (size_t)width * height, bitpix );
     }
-  
-  if( fits_write_key( fp, TSTRING, "LHIMGCH", buff, "Low or High gain channel identification", &status) )
+  if( close( fd ) != 0 )
     {
-      std::cerr << "flictl: writeFitsKeywords() Failed! fits_write_key( , TSTRING, \"LHIMGCH\", "
-		<< channel << ", , ) status =" << status << std::endl;
-      return false;
+      ok = false;
     }
-  delete buff;
- 
-  return true;
+  if( !ok )
+    {
+      std::cerr << "flictl: writeFitsMef() Failed! Writing " << filename << " failed" << std::endl;
+      return -1;
+    }
+  return 0;
 }
 
 //--------------------------------------------------------------
-/// return true if succeeded, false if failed
-int FliCameraC::writeFits(const char *filename, int width, int height, void *data, char channel )
+/// write a 16-bit image compressed into a .fliz file, carrying the FITS
+/// header writeFits() would have written
+/// return 0 if succeeded, non-zero if failed
+int FliCameraC::writeFliz( const char *filename, int width, int height, uint16_t *data, char channel,
+			   const FliFrameInfoC* info )
 {
-  FILE *pFile = fopen(filename, "r");
-  if(pFile != NULL)
+  FliTraceScopeC trace( "write fliz" );
+  std::string header;
+  if( ! getFitsHeader( &header, filename, width, height, channel, 16, info ) )
     {
-      fclose(pFile);
-      std::cerr << "flictl: writeFits() Failed! File " << filename << " already exists" << std::endl;
-      return 1;
+      return -1;
     }
-  
-  int status = 0;
-  long naxes[2] = {width, height};
-  fitsfile *fp;
-  
-  fits_create_file(&fp, filename, &status);
-  if(status)
+  return FliCodecC::writeFile( filename, &header, data, width, height ) ? 0 : -1;
+}
+
+//--------------------------------------------------------------
+/// create a 16-bit FITS file of the full image for writing in row bands
+/// return true if succeeded, false if failed
+bool FliCameraC::openFitsStream( FliFitsStreamC* stream, const char* filename, char channel, const FliFrameInfoC* info )
+{
+  std::string header;
+  if( ! getFitsHeader( &header, filename, sensor.width, sensor.height, channel, 16, info ) )
     {
-      std::cerr << "flictl: writeFits() Failed! fits_create_file() retval " << status << std::endl;
-      fits_report_error(stderr, status);
-      return -1;
+      return false;
     }
-  
-  fits_create_img(fp, USHORT_IMG, 2, naxes, &status);
-  if(status)
+  return stream->open( filename, header, sensor.getNumPixels() );
+}
+
+//--------------------------------------------------------------
+/// write header and data in one go, existing files are never overwritten
+/// return 0 if succeeded, non-zero if failed
+int FliCameraC::writeFitsImage(const char *filename, int width, int height, void *data, char channel,
+			       int bitpix, const FliFrameInfoC* info )
+{
+  FliTraceScopeC trace( "write fits" );
+  std::string header;
+  if( ! getFitsHeader( &header, filename, width, height, channel, bitpix, info ) )
     {
-      std::cerr << "flictl: writeFits() Failed! fits_create_img() retval " << status << std::endl;
-      fits_report_error(stderr, status);
       return -1;
     }
-  
-  fits_write_date(fp, &status);
-  
-  fits_write_img(fp, TUSHORT, 1, (width * height), data, &status);
-  if(status)
+
+  int fd = open( filename, O_WRONLY | O_CREAT | O_EXCL, 0644 );
+  if( fd < 0 )
     {
-      std::cerr << "flictl: writeFits() Failed! fits_write_img() retval " << status << std::endl;
-      fits_report_error(stderr, status);
+      if( errno == EEXIST )
+	{
+	  std::cerr << "flictl: writeFits() Failed! File " << filename << " already exists" << std::endl;
+	  return 1;
+	}
+      std::cerr << "flictl: writeFits() Failed! Cannot create " << filename << ": " << strerror( errno ) << std::endl;
       return -1;
     }
 
-  writeFitsKeywords(fp, filename, channel);
-  
-  fits_close_file(fp, &status);
-  
-  if(status)
+  bool ok = fliWriteFitsHdu( fd, &header, data, (size_t)width * height, bitpix );
+  if( close( fd ) != 0 )
+    {
+      ok = false;
+    }
+  if( !ok )
     {
-      std::cerr << "flictl: writeFits() Failed! fits_close_file() retval " << status << std::endl;
-      fits_report_error(stderr, status);
+      std::cerr << "flictl: writeFits() Failed! Writing " << filename << " failed" << std::endl;
       return -1;
     }
-  
   return 0;
 }
-
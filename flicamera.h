@@ -1,6 +1,11 @@
 #pragma once
 
 #include "libflipro.h"
+#include "flicache.h"
+#include "flifits.h"
+#include "flisensor.h"
+#include "flimask.h"
+#include "fliraw.h"
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 
@@ -10,15 +15,56 @@
 #include <string.h>
 #include <iostream>
 #include <cmath>
-#include <fitsio.h>
 #include <unistd.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
 
 #define FLICAMERA_MAX_SUPPORTED_CAMERAS (4)
 
 #define FLICAMERA_FRAME_SIZE_ADD_BULGARIAN_CONSTATNT (10)
 
-#define FLICAMERA_GSENSE4040_SENSOR_WIDTH (4096)
-#define FLICAMERA_GSENSE4040_SENSOR_HEIGHT (4096)
+// added to exposure + frame delay for readout and USB transfer
+#define FLICAMERA_DEFAULT_TIMEOUT_MARGIN_MS (2000)
+
+// FITS header templates: [with/without raw CRC][image/MEF primary][16/32 bit][single/stacked][plain/bracketed]
+// [with/without temperatures]
+#define FLICAMERA_FITS_TEMPLATES (64)
+
+/// per-frame values written to the FITS header, taken right after getImage()
+/// so that a writer thread can write a frame while the next one is captured
+class FliFrameInfoC
+{
+ public:
+  boost::posix_time::ptime ptime_obsTime;
+  uint64_t exposureTime;
+  double fLowGainValue, fHighGainValue;
+  // uiStackNumFrames == 0 means no stacking
+  uint32_t uiStackNumFrames;
+  std::string str_stackMode;
+  // uiBracketNum == 0 means no bracketing
+  uint32_t uiBracketIndex;
+  uint32_t uiBracketNum;
+  // camera temperatures at mid exposure [Celsius], filled in from the telemetry ring
+  bool hasTemperatures;
+  double ambientTemp, baseTemp, coolerTemp, setPointTemp;
+  // CRC32C of the raw camera frame (meta data and packed pixels)
+  bool hasRawCrc;
+  uint32_t uiRawCrc;
+};
+
+/// one exposure / gain setting of a bracketing cycle
+class FliBracketPointC
+{
+ public:
+  uint64_t exposureTime;   // [ns]
+  int32_t lowGainIndex;    // gain table index, -1 ... keep
+  int32_t highGainIndex;
+};
 
 class FliCameraC
 {
@@ -27,8 +73,42 @@ class FliCameraC
   uint8_t *pFrame;    // allocted in allocFrameFullRes()
   uint32_t uiCamCapSize;
   bool isDeviceOpen;
+  uint32_t uiDeviceIndex;  // index into s_camDeviceInfo[] of the open device
   uint32_t uiFrameSizeInBytes;
-  FPROGAINVALUE *pNewTableLow, *pNewTableHigh;
+  uint32_t uiLastSizeGrabbed;  // bytes received by the last getImage()
+  FliSensorLayoutC sensor;     // from the capabilities, GSENSE4040 until they are known
+  FliSkyMaskC skyMask;         // pixels outside are not unpacked and written as 0
+  bool isLastFrameTimedOut;
+  bool isLastFrameAborted;
+  std::atomic<bool> isAbortRequested;
+  // deadline watchdog, aborts a frame wait the library does not time out itself
+  std::thread watchdog;
+  std::mutex mtxWatchdog;
+  std::condition_variable cvWatchdog;
+  bool isWatchdogRunning;
+  bool isWatchdogArmed;
+  bool isWatchdogExit;
+  bool isWatchdogFired;
+  std::chrono::steady_clock::time_point watchdogDeadline;
+  std::chrono::steady_clock::time_point frameArrival;  // last getImage() returned
+  // held while a frame is read out, readTemperatures() waits for it
+  std::mutex mtxReadout;
+  // replay of a raw recording instead of the camera, see openReplay()
+  FliRawReplayC replay;
+  bool isReplayRealTime;       // frames are due at their recorded intervals
+  uint64_t uiReplayPos;        // next frame of the recording
+  int64_t replayFirstArrivalNs;  // recorded arrival of the first frame of the current capture
+  std::chrono::steady_clock::time_point replayStart;
+  std::mutex mtxReplay;
+  std::condition_variable cvReplay;
+  // gain tables and mode list are fetched once per session or taken from the cache
+  std::vector<FPROGAINVALUE> gainTableLow, gainTableHigh;
+  std::vector<FPROSENSMODE> modeList;
+  bool weKnowGainTables;
+  FliCacheC cache;
+  bool isCacheEnabled;
+  std::string str_cacheSerial;
+  std::string str_cacheVersion;
   bool isExternalTriggerEnabled;
   FPROEXTTRIGTYPE externalTriggerType;
   double latitude;  // decimal degrees
@@ -40,6 +120,37 @@ class FliCameraC
   boost::posix_time::ptime ptime_roundFrameTimeStamp;
   std::string str_fileNameFrameTimeStamp;
   std::string str_siteLocation;
+  // frame stacking info written to FITS header, uiStackNumFrames == 0 means no stacking
+  uint32_t uiStackNumFrames;
+  std::string str_stackMode;
+  boost::posix_time::ptime ptime_stackObsTime;
+  // bracketing point of the following frames, uiBracketNum == 0 means no bracketing
+  uint32_t uiBracketIndex;
+  uint32_t uiBracketNum;
+  FliFitsHeaderC fitsTemplate[FLICAMERA_FITS_TEMPLATES];
+  std::string str_fitsTemplateBlock[FLICAMERA_FITS_TEMPLATES];
+  int fitsTemplateWidth[FLICAMERA_FITS_TEMPLATES], fitsTemplateHeight[FLICAMERA_FITS_TEMPLATES];
+  std::mutex mtxFitsTemplate;
+
+  bool readCacheKey();
+  bool getGainTables();
+  bool getModeList();
+  bool readHdrEnable();
+  bool setGain( FPROGAINTABLE table, uint32_t gainIndex, bool doVerify = true );
+  uint32_t findGainTableIndex( const std::vector<FPROGAINVALUE>& table, uint32_t deviceIndex );
+  void buildFitsTemplate( FliFitsHeaderC* hdr, int width, int height, int bitpix, bool isStack,
+			  bool isBracket, bool hasTemperatures, bool isMefPrimary, bool hasRawCrc );
+  bool getFitsHeader( std::string* header, const char* filename, int width, int height,
+		      char channel, int bitpix, const FliFrameInfoC* info, int numExtensions = 0 );
+  void getFitsExtensionHeader( std::string* header, int width, int height, char channel, int bitpix,
+			       const FliFrameInfoC* info );
+  int writeFitsImage(const char *filename, int width, int height, void *data, char channel,
+		     int bitpix, const FliFrameInfoC* info);
+  void watchdogLoop();
+  void armWatchdog( uint32_t timeoutMs );
+  bool disarmWatchdog();
+  void setFrameTimeStamps();
+  bool getReplayImage();
   
  public:
   uint32_t uiNumDetectedDevices;
@@ -56,6 +167,10 @@ class FliCameraC
   uint64_t frameDelay;
   uint32_t uiLowGainIndex, uiHighGainIndex;
   double fHighGainValue, fLowGainValue;
+  uint32_t uiTimeoutMarginMs;     // frame deadline = exposure + frame delay + margin
+  uint32_t uiExtTriggerTimeoutMs; // wait for an external trigger at most this long, 0 ... forever
+  int32_t frameCounterOffset;     // byte offset of the 32-bit big-endian frame counter in the meta data,
+				  // -1 ... not known for this firmware, no counter checks
   
   FliCameraC();
   ~FliCameraC();
@@ -63,10 +178,23 @@ class FliCameraC
   bool listDevices( int32_t maxNumDevices );
   bool listDevices();
   bool openDevice();
+  bool openDevice( uint32_t deviceIndex );
+  bool openReplay( const std::string& filename, bool isRealTime );
+  bool isReplay();
+  uint64_t getReplayNumFrames();
+  std::string getSerial();
+  bool applyConfigFrom( FliCameraC* master );
   bool closeDevice();
+  void setCacheFolder( const std::string& folder );
+  void disableCache();
   bool getCapabilities();
   bool getPixelConfig();
   void printCapabilities();
+  const FliSensorLayoutC& getSensorLayout();
+  uint32_t getImageWidth();
+  uint32_t getImageHeight();
+  bool setSkyMask( const std::string& spec );
+  const FliSkyMaskC& getSkyMask();
 
   bool getPrintConfig();
     
@@ -79,6 +207,7 @@ class FliCameraC
   bool setExternalTriggerEnable(bool bEnable, FPROEXTTRIGTYPE pTrigType); 
   
   bool getAllTemperatures();
+  bool readTemperatures( double* ambient, double* base, double* cooler, double* setPoint );
   void printAllTemperatures();
 
   bool printModes();
@@ -95,6 +224,8 @@ class FliCameraC
 
   bool setLowGain(uint32_t gainIndex);
   bool setHighGain(uint32_t gainIndex);
+  bool checkBracketPoint( const FliBracketPointC& point );
+  bool setBracketPoint( const FliBracketPointC& point );
  
   bool allocFrameFullRes();
   bool prepareCaptureFullSensor();
@@ -102,21 +233,47 @@ class FliCameraC
   //  bool grabImages(uint32_t num);
 
   bool startCapture(uint32_t num);
+  uint32_t getFrameTimeoutMs();
   bool getImage();
+  bool getImage( uint32_t timeoutMs );
   bool stopCapture();
   bool endCapture();
-  // bool abortCapture();
+  bool abortCapture();
+  void resetAbort();
+  bool wasLastFrameTimedOut();
+  bool wasLastFrameAborted();
 
+  bool getLastFrameCounter( uint32_t *counter );
+  bool hasFrameCounter();
+  bool isLastFrameShort( uint32_t *sizeGrabbed, uint32_t *sizeExpected );
   bool getMetaDataSize( uint32_t *metaDataSize );
   bool extractMetaData( uint8_t* pMetaData, uint32_t metaDataSize );
   bool convertHdrRawToBitmaps16bit( uint16_t* bitamp16bitLow, uint16_t* bitamp16bitHigh );
   bool convertLdrRawToBitmap16bit( uint16_t* bitamp16bit );
+  bool convertRawRows( uint32_t firstRow, uint32_t numRows, uint16_t* bitmap16bitLow, uint16_t* bitmap16bitHigh );
+  uint32_t getRawFrameCrc();
+  void getRawFileHeader( FliRawFileHeaderC* header );
+  void getLastRawFrameHeader( FliRawFrameHeaderC* header );
+  const uint8_t* getRawFrame();
   
   void* getImagePtr();
 
   void getLastFrameTimeStamp( boost::posix_time::ptime* timestamp );
+  void getLastFrameObsTime( boost::posix_time::ptime* timestamp );
+  void getLastFrameInfo( FliFrameInfoC* info );
   
   void setFitsLocation( double lat, double lon, double alt, std::string loc );
-  bool writeFitsKeywords(fitsfile *fp, const char* filename, char channel);
+  void setStackInfo( uint32_t numFrames, std::string mode, boost::posix_time::ptime obsTime );
+  void setBracketInfo( uint32_t index, uint32_t num );
   int writeFits(const char *filename, int width, int height, void *data, char channel);
+  int writeFits(const char *filename, int width, int height, void *data, char channel,
+		const FliFrameInfoC* info);
+  int writeFits32bit(const char *filename, int width, int height, uint32_t *data, char channel);
+  int writeFits32bit(const char *filename, int width, int height, uint32_t *data, char channel,
+		     const FliFrameInfoC* info);
+  bool openFitsStream( FliFitsStreamC* stream, const char* filename, char channel, const FliFrameInfoC* info );
+  int writeFitsMef( const char *filename, int width, int height, void *dataL, void *dataH,
+		    int bitpix, const FliFrameInfoC* info );
+  int writeFliz( const char *filename, int width, int height, uint16_t *data, char channel,
+		 const FliFrameInfoC* info );
 };
@@ -0,0 +1,1242 @@
+#include "flicapture.h"
+#include "flictl.h"
+#include "flithread.h"
+#include "flilog.h"
+#include "flicodec.h"
+#include "flitrace.h"
+
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <algorithm>
+#include <new>
+#include <string.h>
+
+/// write FLI camera meta data binary blob to file - as it is
+int writeMetaData( const char *filename, uint8_t *mem, uint32_t memSize )
+{
+  std::ofstream os( filename, std::ofstream::binary );
+  if( ! os.is_open() )
+    {
+      // show message:
+      std::cerr << "writeMetaData(): Error opening file " << filename << std::endl;
+      return -1;
+    }
+
+  os.write( (char *)mem, memSize );
+  os.flush();
+  os.close();
+
+  return 0;
+}
+
+//--------------------------------------------------------------
+
+FliCaptureC::FliCaptureC( FliCameraC* camera )
+{
+  fc = camera;
+  isPrepared = false;
+  uiBufferRows = 0;
+  metaDataSize = 0;
+  isStopRequested = false;
+  isCaptureRunning = false;
+
+  numImages = 1;
+  fileNameBase = "fli_image_";
+  isTimeInFileNames = false;
+  doWriteMetaData = false;
+  isExtTriggerEnabled = false;
+  stackNum = 0;
+  stackMode = FLISTACK_MODE_SUM;
+  restoreInternalTrigger = true;
+  writerPool = NULL;
+  numFrameBuffers = 4;
+  acqCpu = -1;
+  acqPriority = 0;
+  convCpu = -1;
+  str_cameraTag = "";
+
+  uiNumCaptured = 0;
+  uiNumFramesWritten = 0;
+  uiNumWriteErrors = 0;
+  uiNumBacklogStalls = 0;
+  dLastWriteSeconds = 0.0;
+  doWriteIntegrityReport = true;
+  maxConsecutiveTimeouts = 3;
+  telemetry = NULL;
+  metrics = &unexportedMetrics;
+  preview = NULL;
+  numChannels = 2;
+  streamRows = 0;
+  isMef = false;
+  isCompressed = false;
+  doRawCrc = false;
+  doRawDump = false;
+  uiRawSlotSize = 0;
+  isRawDumpFailed = false;
+}
+
+//--------------------------------------------------------------
+
+FliCaptureC::~FliCaptureC()
+{
+  freeFrameBuffers();
+  rawDumpHelper.stop();
+  for( size_t i = 0; i < rawSlots.size(); i++ )
+    {
+      delete [] rawSlots[i];
+    }
+}
+
+//--------------------------------------------------------------
+/// take over the capture settings of another instance (not the camera,
+/// the file name base or the statistics)
+void FliCaptureC::copySettings( const FliCaptureC& other )
+{
+  numImages = other.numImages;
+  isTimeInFileNames = other.isTimeInFileNames;
+  doWriteMetaData = other.doWriteMetaData;
+  isExtTriggerEnabled = other.isExtTriggerEnabled;
+  stackNum = other.stackNum;
+  stackMode = other.stackMode;
+  restoreInternalTrigger = other.restoreInternalTrigger;
+  writerPool = other.writerPool;
+  numFrameBuffers = other.numFrameBuffers;
+  streamRows = other.streamRows;
+  isMef = other.isMef;
+  isCompressed = other.isCompressed;
+  doRawCrc = other.doRawCrc;
+  doRawDump = other.doRawDump;
+  acqPriority = other.acqPriority;
+  throttle.isEnabled = other.throttle.isEnabled;
+  throttle.highWater = other.throttle.highWater;
+  throttle.lowWater = other.throttle.lowWater;
+  throttle.recoverFrames = other.throttle.recoverFrames;
+  throttle.maxDecimation = other.throttle.maxDecimation;
+  doWriteIntegrityReport = other.doWriteIntegrityReport;
+  maxConsecutiveTimeouts = other.maxConsecutiveTimeouts;
+  bracket = other.bracket;
+}
+
+//--------------------------------------------------------------
+/// allocate frame and bitmap buffers and set the image area, and the stack
+/// buffers if stacking; done once, later runs reuse the buffers
+/// run() calls it, calling it before takes the allocation out of the dead time
+/// between two runs
+/// return true if succeeded, false if failed
+bool FliCaptureC::prepare()
+{
+  if( ! isPrepared && ! prepareFrameBuffers() )
+    {
+      return false;
+    }
+  uint32_t bufferRows = (streamRows > 0) ? std::min( streamRows, fc->getImageHeight() ) : fc->getImageHeight();
+  if( bufferRows != uiBufferRows )
+    {
+      // a sequence step switched --streamrows
+      freeFrameBuffers();
+      allocFrameBuffers();
+    }
+  if( stackNum == 0 )
+    {
+      return true;
+    }
+  if( ! stack )
+    {
+      stack.reset( new FliStackC() );
+      stack->setWorkerCpu( convCpu );
+      if( ! stack->init( fc->getImageWidth() * fc->getImageHeight(), stackMode, numChannels ) )
+	{
+	  stack.reset();
+	  return false;
+	}
+      return true;
+    }
+  if( stack->getNumStacked() > 0 )
+    {
+      // left over from a failed run
+      stack->reset();
+    }
+  return (stack->getMode() == stackMode) || stack->setMode( stackMode );
+}
+
+//--------------------------------------------------------------
+/// allocate the frame buffers and set the image area
+/// return true if succeeded, false if failed
+bool FliCaptureC::prepareFrameBuffers()
+{
+  if( ! fc->allocFrameFullRes() )
+    {
+      return false;
+    }
+  if( ! fc->prepareCaptureFullSensor() )
+    {
+      return false;
+    }
+  fc->getMetaDataSize( &metaDataSize );
+  numChannels = fc->getSensorLayout().isHdrInterleaved ? 2 : 1;
+  allocFrameBuffers();
+  isPrepared = true;
+  return true;
+}
+
+//--------------------------------------------------------------
+/// allocate the frame buffers for whole frames, or a single band of
+/// streamRows rows
+void FliCaptureC::allocFrameBuffers()
+{
+  uint32_t numPixels = fc->getImageWidth() * fc->getImageHeight();
+  // without a writer pool one set of buffers is written before the next capture
+  uint32_t numBuffers = (writerPool != NULL) ? std::max( numFrameBuffers, (uint32_t)1 ) : 1;
+  uiBufferRows = fc->getImageHeight();
+  if( streamRows > 0 )
+    {
+      // one band, written by the capture thread
+      streamRows = std::min( streamRows, fc->getImageHeight() );
+      numPixels = streamRows * fc->getImageWidth();
+      numBuffers = 1;
+      uiBufferRows = streamRows;
+    }
+  for( uint32_t i = 0; i < numBuffers; i++ )
+    {
+      FliFrameBuffersC* buffers = new FliFrameBuffersC;
+      buffers->bitmap16bitL = new uint16_t[ numPixels ];
+      buffers->bitmap16bitH = (numChannels == 2) ? new uint16_t[ numPixels ] : NULL;
+      buffers->metaData = new uint8_t[ metaDataSize ];
+      buffers->index = 0;
+      buffers->doWriteL = true;
+      buffers->doCompress = false;
+      // buffers are allocated by the capture thread, which converts into them
+      fliFirstTouch( buffers->bitmap16bitL, numPixels * sizeof(uint16_t) );
+      if( buffers->bitmap16bitH != NULL )
+	{
+	  fliFirstTouch( buffers->bitmap16bitH, numPixels * sizeof(uint16_t) );
+	}
+      frameBuffers.push_back( buffers );
+      freeBuffers.push_back( buffers );
+    }
+}
+
+//--------------------------------------------------------------
+/// free the frame buffers, none may be in use
+void FliCaptureC::freeFrameBuffers()
+{
+  for( size_t i = 0; i < frameBuffers.size(); i++ )
+    {
+      delete [] frameBuffers[i]->bitmap16bitL;
+      delete [] frameBuffers[i]->bitmap16bitH;
+      delete [] frameBuffers[i]->metaData;
+      delete frameBuffers[i];
+    }
+  frameBuffers.clear();
+  freeBuffers.clear();
+}
+
+//--------------------------------------------------------------
+/// unpack the last frame of the camera (frame index), bitmap16bitH is not
+/// used in single channel modes
+void FliCaptureC::convertFrame( uint16_t* bitmap16bitL, uint16_t* bitmap16bitH, uint32_t index )
+{
+  FliTraceScopeC trace( "unpack", index );
+  FliPerfScopeC perf( &perfStages[FLIMETRICS_STAGE_CONVERT] );
+  std::chrono::steady_clock::time_point convertStart = std::chrono::steady_clock::now();
+  if( numChannels == 2 )
+    {
+      fc->convertHdrRawToBitmaps16bit( bitmap16bitL, bitmap16bitH );
+    }
+  else
+    {
+      fc->convertLdrRawToBitmap16bit( bitmap16bitL );
+    }
+  metrics->stages[FLIMETRICS_STAGE_CONVERT].add( std::chrono::steady_clock::now() - convertStart );
+}
+
+//--------------------------------------------------------------
+/// wait for a set of buffers not being written
+FliFrameBuffersC* FliCaptureC::getFreeBuffers()
+{
+  FliTraceScopeC trace( "wait buffers" );
+  std::unique_lock<std::mutex> lock( mtxBuffers );
+  if( freeBuffers.empty() )
+    {
+      // the camera keeps exposing meanwhile, frames may be lost in the camera
+      uiNumBacklogStalls++;
+      metrics->uiBacklogStalls++;
+      std::cerr << str_cameraTag << "WARNING: writer backlog full, capture waits for a free frame buffer" << std::endl;
+    }
+  cvBuffers.wait( lock, [this]{ return !freeBuffers.empty(); } );
+  FliFrameBuffersC* buffers = freeBuffers.back();
+  freeBuffers.pop_back();
+  metrics->uiBuffersInUse++;
+  return buffers;
+}
+
+//--------------------------------------------------------------
+
+void FliCaptureC::releaseBuffers( FliFrameBuffersC* buffers )
+{
+  {
+    std::lock_guard<std::mutex> lock( mtxBuffers );
+    freeBuffers.push_back( buffers );
+  }
+  metrics->uiBuffersInUse--;
+  cvBuffers.notify_all();
+}
+
+//--------------------------------------------------------------
+/// fraction of frame buffers waiting to be written (writer pool),
+/// or time of the last write relative to the time between two written
+/// frames, ie. the frame period times the decimation (no writer pool),
+/// or the fraction of raw frame copies still queued if that is higher
+double FliCaptureC::getWriterBacklog()
+{
+  double backlog = 0.0;
+  double framePeriod = (double)(fc->exposureTime + fc->frameDelay) / 1000000000.0; // [ns] -> [s]
+  std::lock_guard<std::mutex> lock( mtxBuffers );
+  if( writerPool != NULL )
+    {
+      backlog = (double)(frameBuffers.size() - freeBuffers.size()) / frameBuffers.size();
+    }
+  else if( framePeriod > 0.0 )
+    {
+      // decimated frames are not written, so the last write time would
+      // otherwise keep the throttle at its worst level
+      backlog = dLastWriteSeconds / (throttle.getDecimation() * framePeriod);
+    }
+  if( rawRecorder.isOpen() && !rawSlots.empty() )
+    {
+      // the raw recording competes for the same disk
+      backlog = std::max( backlog, (double)(rawSlots.size() - freeRawSlots.size()) / rawSlots.size() );
+    }
+  return backlog;
+}
+
+//--------------------------------------------------------------
+/// wait until the writer pool has written all frames of this capture
+void FliCaptureC::waitWritesDone()
+{
+  std::unique_lock<std::mutex> lock( mtxBuffers );
+  cvBuffers.wait( lock, [this]{ return freeBuffers.size() == frameBuffers.size(); } );
+}
+
+//--------------------------------------------------------------
+/// ask a running capture to stop, frames captured so far are still written
+/// safe to call from another thread, a frame wait in progress is cancelled
+void FliCaptureC::requestStop()
+{
+  isStopRequested = true;
+  if( isCaptureRunning )
+    {
+      fc->abortCapture();
+    }
+}
+
+//--------------------------------------------------------------
+
+bool FliCaptureC::isRunning()
+{
+  return isCaptureRunning;
+}
+
+//--------------------------------------------------------------
+/// grab numImages frames and write them to files
+/// return FLICTL_OK if succeeded, FLICTL_ERR* code if failed
+int FliCaptureC::run()
+{
+  isStopRequested = false;
+  fc->resetAbort();
+  isCaptureRunning = true;
+  uiNumCaptured = 0;
+  uiNumFramesWritten = 0;
+  uiNumWriteErrors = 0;
+  uiNumBacklogStalls = 0;
+  dLastWriteSeconds = 0.0;
+  for( int s = 0; s < FLIMETRICS_NUM_STAGES; s++ )
+    {
+      perfStages[s].reset();
+    }
+  throttle.reset();
+  throttle.str_logTag = str_cameraTag;
+  throttle.canCompress = !isCompressed && (streamRows == 0) && !isMef;
+  // a step shows in the backlog only once the queued buffers are written
+  throttle.holdFrames = numFrameBuffers;
+  ptime_runStart = boost::posix_time::microsec_clock::universal_time();
+  ptime_runEnd = ptime_runStart;
+  FliLogC::setThreadTag( str_cameraTag );
+  FliTraceC::setThreadName( str_cameraTag + "capture" );
+
+  // pin before prepare(), buffers are placed on the NUMA node of this thread
+  if( (acqCpu >= 0) && fliSetThreadAffinity( acqCpu ) )
+    {
+      std::cout << str_cameraTag << "Capture thread on CPU " << acqCpu
+		<< " (NUMA node " << fliCpuNumaNode( acqCpu ) << ")" << std::endl;
+    }
+  fliSetThreadRealtime( acqPriority );
+  if( (streamRows > 0) && ((stackNum > 0) || (preview != NULL)) )
+    {
+      std::cerr << str_cameraTag << "FliCaptureC::run() ERROR: streaming row bands cannot be combined with stacking or the preview" << std::endl;
+      isCaptureRunning = false;
+      return FLICTL_ERR;
+    }
+  if( (streamRows > 0) && isMef )
+    {
+      std::cerr << str_cameraTag << "FliCaptureC::run() ERROR: streaming row bands cannot be combined with multi-extension files" << std::endl;
+      isCaptureRunning = false;
+      return FLICTL_ERR;
+    }
+  if( isCompressed && ((streamRows > 0) || isMef) )
+    {
+      std::cerr << str_cameraTag << "FliCaptureC::run() ERROR: compressed files cannot be combined with streaming row bands or multi-extension files" << std::endl;
+      isCaptureRunning = false;
+      return FLICTL_ERR;
+    }
+  if( ! prepare() )
+    {
+      return finishCapture( FLICTL_ERR_FAILED_ALLOC_FRAME );
+    }
+  metrics->setDirectory( fileNameBase );
+  metrics->uiBuffersTotal = frameBuffers.size();
+  metrics->isCaptureRunning = true;
+  if( doRawDump )
+    {
+      FliRawFileHeaderC rawHeader;
+      fc->getRawFileHeader( &rawHeader );
+      std::string rawFileName = fileNameBase + "raw_" + to_iso_string( ptime_runStart ).substr( 0, 15 ) + FLIRAW_EXTENSION;
+      if( ! prepareRawDump( rawHeader.frameSize ) || ! rawRecorder.open( rawFileName, rawHeader ) )
+	{
+	  isCaptureRunning = false;
+	  metrics->isCaptureRunning = false;
+	  return FLICTL_ERR;
+	}
+      std::cout << str_cameraTag << "Record raw frames to " << rawFileName << std::endl;
+    }
+  if( doRawCrc && (rawCrcHelper.getNumThreads() == 0)
+      && ! rawCrcHelper.start( 1, 1, std::vector<int>( (convCpu >= 0) ? 1 : 0, convCpu ), "raw crc" ) )
+    {
+      isCaptureRunning = false;
+      metrics->isCaptureRunning = false;
+      return FLICTL_ERR;
+    }
+
+  // stacking double buffers its own bitmaps
+  boost::posix_time::ptime ptime_stackObsTime;
+
+  // the first bracketing point is set and verified the slow way
+  uint64_t maxExposureTime = fc->exposureTime;
+  if( ! bracket.empty() )
+    {
+      const FliBracketPointC& first = bracket[0];
+      if( stackNum > 0 )
+	{
+	  std::cerr << str_cameraTag << "FliCaptureC::run() ERROR: bracketing and stacking cannot be combined" << std::endl;
+	  isCaptureRunning = false;
+	  metrics->isCaptureRunning = false;
+	  return FLICTL_ERR;
+	}
+      for( size_t k = 0; k < bracket.size(); k++ )
+	{
+	  if( ! fc->checkBracketPoint( bracket[k] ) )
+	    {
+	      isCaptureRunning = false;
+	      metrics->isCaptureRunning = false;
+	      return FLICTL_ERR;
+	    }
+	}
+      if( ! (fc->setExpTime( first.exposureTime )
+	     && ((first.lowGainIndex < 0) || fc->setLowGain( first.lowGainIndex ))
+	     && ((first.highGainIndex < 0) || fc->setHighGain( first.highGainIndex ))) )
+	{
+	  isCaptureRunning = false;
+	  metrics->isCaptureRunning = false;
+	  return FLICTL_ERR;
+	}
+      fc->setBracketInfo( 0, bracket.size() );
+      for( size_t k = 0; k < bracket.size(); k++ )
+	{
+	  maxExposureTime = std::max( maxExposureTime, bracket[k].exposureTime );
+	}
+    }
+
+  // externally triggered frame period is learned from the first frames,
+  // without a frame counter gaps are found from the frame times only
+  integrity.reset( isExtTriggerEnabled ? 0.0 : (double)(maxExposureTime + fc->frameDelay) / 1000000000.0,
+		   fc->hasFrameCounter() );
+
+  if( ! isExtTriggerEnabled )
+    {
+      // call startCapture only when not triggering externally
+      // (when using FLI camera internal trigger), one frame at a time when bracketing
+      if( ! fc->startCapture( bracket.empty() ? numImages : 1 ) )
+	{
+	  // TODO - define specific err code
+	  isCaptureRunning = false;
+	  metrics->isCaptureRunning = false;
+	  return FLICTL_ERR;
+	}
+    }
+
+  boost::posix_time::ptime ptime_fileNameFrameTimeStamp;
+  std::string str_fileNameFrameTimeStamp;
+  uint32_t numTimeoutsInRow = 0;
+  uint32_t lastFrameIndex = 0;
+
+  for( uint32_t i=0; (i<numImages) && !isStopRequested; i++ )
+    {
+      FliLogC::event( FLILOG_INFO, FLILOG_EV_FRAME_WAIT, NULL, i, isExtTriggerEnabled );
+
+      std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+      int64_t traceStartNs = FliTraceC::isEnabled() ? FliTraceC::now() : 0;
+      bool isImage;
+      {
+	FliPerfScopeC perf( &perfStages[FLIMETRICS_STAGE_WAIT] );
+	isImage = fc->getImage();
+      }
+      if( traceStartNs != 0 )
+	{
+	  FliTraceC::add( "getImage", traceStartNs, FliTraceC::now(), i );
+	}
+      if( !isImage )
+	{
+	  if( isStopRequested )
+	    {
+	      // cancelled by requestStop(), keep what we have
+	      break;
+	    }
+	  if( fc->wasLastFrameTimedOut() )
+	    {
+	      uint32_t timeoutMs = isExtTriggerEnabled ? fc->uiExtTriggerTimeoutMs : fc->getFrameTimeoutMs();
+	      integrity.addTimeout( i, timeoutMs );
+	      metrics->uiFramesDropped++;
+	      if( ++numTimeoutsInRow >= maxConsecutiveTimeouts )
+		{
+		  std::cerr << str_cameraTag << "FliCaptureC::run() ERROR: " << numTimeoutsInRow
+			    << " frame timeouts in a row, giving up" << std::endl;
+		  return finishCapture( FLICTL_ERR_FRAME_TIMEOUT );
+		}
+	      // the timed out wait was aborted: an internally triggered capture has
+	      // to be restarted, an externally triggered one needs the abort
+	      // finished before the next trigger wait
+	      bool ok = true;
+	      if( isExtTriggerEnabled )
+		{
+		  // the watchdog aborted the trigger wait, finish the abort; no
+		  // capture was started for the trigger, so a failing stop is harmless
+		  fc->stopCapture();
+		}
+	      if( i + 1 >= numImages )
+		{
+		  // that was the last frame, finishCapture() stops the camera
+		}
+	      else if( ! bracket.empty() )
+		{
+		  ok = armBracketPoint( i + 1 );
+		}
+	      else if( !isExtTriggerEnabled )
+		{
+		  ok = fc->stopCapture() && fc->startCapture( numImages - i - 1 );
+		}
+	      if( !ok )
+		{
+		  return finishCapture( FLICTL_ERR_FRAME_TIMEOUT );
+		}
+	      continue;
+	    }
+	  uint32_t sizeGrabbed, sizeExpected;
+	  if( fc->isLastFrameShort( &sizeGrabbed, &sizeExpected ) )
+	    {
+	      // broken USB transfer, the next frame may be fine
+	      integrity.addShortRead( i, sizeGrabbed, sizeExpected );
+	      metrics->uiFramesDropped++;
+	      if( !bracket.empty() && (i + 1 < numImages) && ! armBracketPoint( i + 1 ) )
+		{
+		  return finishCapture( FLICTL_ERR );
+		}
+	      continue;
+	    }
+	  // TODO - define specific err code
+	  return finishCapture( FLICTL_ERR );
+	}
+      metrics->stages[FLIMETRICS_STAGE_WAIT].add( std::chrono::steady_clock::now() - waitStart );
+      metrics->uiFramesCaptured++;
+      uiNumCaptured++;
+      numTimeoutsInRow = 0;
+      lastFrameIndex = i;
+      uint32_t frameCounter = 0;
+      boost::posix_time::ptime ptime_frameObsTime;
+      fc->getLastFrameCounter( &frameCounter );
+      fc->getLastFrameObsTime( &ptime_frameObsTime );
+      uint32_t numMissing = integrity.uiNumMissing;
+      integrity.addFrame( i, frameCounter, ptime_frameObsTime );
+      metrics->uiFramesDropped += integrity.uiNumMissing - numMissing;
+
+      fc->getLastFrameTimeStamp( &ptime_fileNameFrameTimeStamp );
+      str_fileNameFrameTimeStamp = "_" + to_iso_string( ptime_fileNameFrameTimeStamp );
+
+      if( isTimeInFileNames )
+	{
+	  FliLogC::event( FLILOG_INFO, FLILOG_EV_FRAME_TIME, NULL, i, isExtTriggerEnabled, 0,
+			  str_fileNameFrameTimeStamp.c_str() );
+	}
+
+      // header values of this frame, before the camera moves on to the next bracketing point
+      FliFrameInfoC frameInfo;
+      fc->getLastFrameInfo( &frameInfo );
+      if( rawRecorder.isOpen() )
+	{
+	  dumpRawFrame( i );
+	}
+      if( !bracket.empty() && (i + 1 < numImages) && ! armBracketPoint( i + 1 ) )
+	{
+	  return finishCapture( FLICTL_ERR );
+	}
+
+      if( stackNum > 0 )
+	{
+	  uint16_t *fillL, *fillH;
+	  if( stack->getNumStacked() == 0 )
+	    {
+	      fc->getLastFrameObsTime( &ptime_stackObsTime );
+	    }
+	  stack->getFillBuffers( &fillL, &fillH );
+	  convertFrame( fillL, fillH, i );
+	  if( preview != NULL )
+	    {
+	      // single frames, not stacks, rate limited by the preview
+	      FliTraceScopeC trace( "preview", i );
+	      preview->publish( fillL, fillH, frameInfo, i );
+	    }
+	  {
+	    FliTraceScopeC trace( "stack add", i );
+	    stack->addFrame();
+	  }
+	  // write the stack when complete, at the last frame or when stopped
+	  if( (stack->getNumStacked() >= stackNum) || (i + 1 >= numImages) || isStopRequested )
+	    {
+	      writeStack( stack.get(), i / stackNum, str_fileNameFrameTimeStamp, ptime_stackObsTime );
+	      stack->reset();
+	    }
+	  continue;
+	}
+
+      bool doWriteL = true;
+      bool doCompress = false;
+      throttle.update( getWriterBacklog() );
+      if( ! throttle.decide( i, &doWriteL, &doCompress ) )
+	{
+	  // decimated, counted by the throttle
+	  metrics->uiFramesDecimated++;
+	  continue;
+	}
+
+      // everything needed from the camera is taken here, the camera frame
+      // buffer is overwritten by the next getImage()
+      FliFrameBuffersC* buffers = getFreeBuffers();
+      // the single channel is never dropped, only decimated
+      buffers->doWriteL = doWriteL || (numChannels == 1);
+      buffers->doCompress = doCompress;
+      uint32_t rawCrc = 0;
+      if( doRawCrc )
+	{
+	  // hashing the raw frame runs next to the conversion, both only read it
+	  rawCrcHelper.submit( [this, i, &rawCrc]{
+	      FliTraceScopeC trace( "raw crc", i );
+	      rawCrc = fc->getRawFrameCrc();
+	      return true;
+	    } );
+	}
+      if( streamRows == 0 )
+	{
+	  convertFrame( buffers->bitmap16bitL, buffers->bitmap16bitH, i );
+	}
+      if( doWriteMetaData )
+	{
+	  fc->extractMetaData( buffers->metaData, metaDataSize );
+	}
+      if( doRawCrc )
+	{
+	  rawCrcHelper.waitIdle();
+	  frameInfo.uiRawCrc = rawCrc;
+	  frameInfo.hasRawCrc = true;
+	}
+      buffers->info = frameInfo;
+      buffers->index = i;
+      buffers->str_timeStamp = str_fileNameFrameTimeStamp;
+      if( (writerPool != NULL) && (streamRows == 0) )
+	{
+	  writerPool->submit( [this, buffers]{
+	      bool ok = writeFrame( buffers );
+	      releaseBuffers( buffers );
+	      return ok;
+	    } );
+	}
+      else
+	{
+	  boost::posix_time::ptime ptime_writeStart = boost::posix_time::microsec_clock::universal_time();
+	  writeFrame( buffers );
+	  releaseBuffers( buffers );
+	  dLastWriteSeconds = (boost::posix_time::microsec_clock::universal_time() - ptime_writeStart).total_microseconds() / 1000000.0;
+	}
+    }
+
+  if( (stackNum > 0) && (stack->getNumStacked() > 0) )
+    {
+      // stopped in the middle of a stack
+      writeStack( stack.get(), lastFrameIndex / stackNum, str_fileNameFrameTimeStamp, ptime_stackObsTime );
+      stack->reset();
+    }
+
+  return finishCapture( FLICTL_OK );
+}
+
+//--------------------------------------------------------------
+/// stop the camera after a capture
+/// return retval, or FLICTL_ERR if stopping failed
+int FliCaptureC::finishCapture( int retval )
+{
+  fc->setBracketInfo( 0, 0 );
+  finishRawDump();
+  if( isPrepared )
+    {
+      waitWritesDone();
+    }
+  // the file messages of this run come before the summaries
+  FliLogC::flush();
+  ptime_runEnd = boost::posix_time::microsec_clock::universal_time();
+  metrics->isCaptureRunning = false;
+  if( isPrepared && doWriteIntegrityReport )
+    {
+      // whole seconds are enough to tell runs apart
+      std::string fileName = fileNameBase + "integrity_" + to_iso_string( ptime_runStart ).substr( 0, 15 ) + ".json";
+      std::cout << str_cameraTag << "Write integrity report as " << fileName << std::endl;
+      integrity.writeReport( fileName, str_cameraTag.empty() ? fc->getSerial() : str_cameraTag,
+			     numImages, uiNumFramesWritten, uiNumWriteErrors, getPerfJson() );
+    }
+  if( isExtTriggerEnabled )
+    {
+      if( !restoreInternalTrigger )
+	{
+	  isCaptureRunning = false;
+	  return retval;
+	}
+      // disable external triggering (set camera to use internal triggering),
+      // but keep the previously set ext trigger type
+      bool dummy;
+      FPROEXTTRIGTYPE externalTriggerType;
+      fc->getExternalTriggerEnable( &dummy, &externalTriggerType );
+      if( ! fc->setExternalTriggerEnable( false, externalTriggerType ) )
+	{
+	  retval = FLICTL_ERR;
+	}
+    }
+  else if( retval != FLICTL_ERR_FAILED_ALLOC_FRAME )
+    {
+      // call stopCapture only when not triggering externally
+      // (when using FLI camera internal trigger), an aborted capture may refuse it
+      if( ! fc->stopCapture() && !isStopRequested )
+	{
+	  // TODO - define specific err code
+	  retval = FLICTL_ERR;
+	}
+    }
+  isCaptureRunning = false;
+  return retval;
+}
+
+//--------------------------------------------------------------
+/// hardware counter averages per stage as JSON, "" if nothing was counted
+std::string FliCaptureC::getPerfJson()
+{
+  std::string str_json;
+  for( int s = 0; s < FLIMETRICS_NUM_STAGES; s++ )
+    {
+      if( perfStages[s].uiCount > 0 )
+	{
+	  str_json += std::string( str_json.empty() ? "{" : ", " ) + "\"" + FliMetricsC::getStageName( s ) + "\": "
+	    + perfStages[s].formatJson();
+	}
+    }
+  if( str_json.empty() )
+    {
+      return "";
+    }
+  return str_json + ", \"user_space_only\": " + (FliPerfC::isUserSpaceOnly() ? "true" : "false") + "}";
+}
+
+//--------------------------------------------------------------
+/// fill in the camera temperatures in the middle of the exposure (of a stack)
+void FliCaptureC::addTemperatures( FliFrameInfoC* info )
+{
+  FliTelemetrySampleC sample;
+  uint64_t exposureNs = info->exposureTime * std::max( info->uiStackNumFrames, (uint32_t)1 );
+  if( (telemetry == NULL)
+      || ! telemetry->interpolate( info->ptime_obsTime + boost::posix_time::microseconds( exposureNs / 2000 ), &sample ) )
+    {
+      return;
+    }
+  info->hasTemperatures = true;
+  info->ambientTemp = sample.ambientTemp;
+  info->baseTemp = sample.baseTemp;
+  info->coolerTemp = sample.coolerTemp;
+  info->setPointTemp = sample.setPoint;
+}
+
+//--------------------------------------------------------------
+/// start the raw recording thread and allocate the frame copies it works
+/// off, kept between runs of the same frame size
+/// return true if succeeded, false if failed
+bool FliCaptureC::prepareRawDump( uint32_t frameSize )
+{
+  isRawDumpFailed = false;
+  if( (rawDumpHelper.getNumThreads() == 0) && ! rawDumpHelper.start( 1, FLICAPTURE_RAW_SLOTS, std::vector<int>(), "raw dump" ) )
+    {
+      return false;
+    }
+  if( uiRawSlotSize == frameSize )
+    {
+      return true;
+    }
+  // the helper is idle between runs
+  std::lock_guard<std::mutex> lock( mtxBuffers );
+  for( size_t i = 0; i < rawSlots.size(); i++ )
+    {
+      delete [] rawSlots[i];
+    }
+  rawSlots.clear();
+  freeRawSlots.clear();
+  uiRawSlotSize = 0;
+  for( uint32_t k = 0; k < FLICAPTURE_RAW_SLOTS; k++ )
+    {
+      uint8_t* slot = new (std::nothrow) uint8_t[frameSize];
+      if( slot == NULL )
+	{
+	  std::cerr << str_cameraTag << "FliCaptureC::prepareRawDump() ERROR: cannot allocate "
+		    << FLICAPTURE_RAW_SLOTS << " raw frame copies of " << frameSize << " bytes" << std::endl;
+	  return false;
+	}
+      fliFirstTouch( slot, frameSize );
+      rawSlots.push_back( slot );
+      freeRawSlots.push_back( slot );
+    }
+  uiRawSlotSize = frameSize;
+  return true;
+}
+
+//--------------------------------------------------------------
+/// copy the last camera frame and queue it for the raw recording, waits
+/// (counted as a backlog stall) only while all copies are still queued
+void FliCaptureC::dumpRawFrame( uint32_t index )
+{
+  if( isRawDumpFailed )
+    {
+      rawDumpHelper.waitIdle();
+      std::cerr << str_cameraTag << "FliCaptureC::run() ERROR: recording raw frames failed, stopped recording" << std::endl;
+      rawRecorder.close();
+      return;
+    }
+  FliRawFrameHeaderC rawFrame;
+  fc->getLastRawFrameHeader( &rawFrame );
+  rawFrame.index = index;
+  uint8_t* slot;
+  {
+    FliTraceScopeC trace( "wait raw dump", index );
+    std::unique_lock<std::mutex> lock( mtxBuffers );
+    if( freeRawSlots.empty() )
+      {
+	uiNumBacklogStalls++;
+	metrics->uiBacklogStalls++;
+	std::cerr << str_cameraTag << "WARNING: raw recording backlog full, capture waits for the disk" << std::endl;
+      }
+    cvBuffers.wait( lock, [this]{ return !freeRawSlots.empty(); } );
+    slot = freeRawSlots.back();
+    freeRawSlots.pop_back();
+  }
+  memcpy( slot, fc->getRawFrame(), uiRawSlotSize );
+  rawDumpHelper.submit( [this, rawFrame, slot]{
+      bool ok = false;
+      if( !isRawDumpFailed )
+	{
+	  FliTraceScopeC trace( "raw dump", rawFrame.index );
+	  ok = rawRecorder.append( rawFrame, slot );
+	  isRawDumpFailed = !ok;
+	}
+      {
+	std::lock_guard<std::mutex> lock( mtxBuffers );
+	freeRawSlots.push_back( slot );
+      }
+      cvBuffers.notify_all();
+      return ok;
+    } );
+}
+
+//--------------------------------------------------------------
+/// wait until the queued raw frames are recorded and close the recording
+void FliCaptureC::finishRawDump()
+{
+  if( ! rawRecorder.isOpen() )
+    {
+      return;
+    }
+  rawDumpHelper.waitIdle();
+  if( isRawDumpFailed )
+    {
+      std::cerr << str_cameraTag << "FliCaptureC::run() ERROR: recording raw frames failed, stopped recording" << std::endl;
+    }
+  std::cout << str_cameraTag << "Recorded " << rawRecorder.getNumFrames() << " raw frames" << std::endl;
+  rawRecorder.close();
+}
+
+//--------------------------------------------------------------
+/// set the camera to the bracketing point of frame frameIndex (and restart an
+/// internally triggered capture for one frame)
+/// return true if succeeded, false if failed
+bool FliCaptureC::armBracketPoint( uint32_t frameIndex )
+{
+  uint32_t k = frameIndex % bracket.size();
+  bool ok = true;
+
+  if( ! isExtTriggerEnabled )
+    {
+      ok = fc->stopCapture();
+    }
+  ok = fc->setBracketPoint( bracket[k] ) && ok;
+  fc->setBracketInfo( k, bracket.size() );
+  if( ! isExtTriggerEnabled )
+    {
+      ok = ok && fc->startCapture( 1 );
+    }
+  return ok;
+}
+
+//--------------------------------------------------------------
+/// parse bracketing points "exptime[:lowgain[:highgain]],...", exposure time
+/// in ns, gain table indexes (omitted gains are kept), no negative numbers
+/// return true if succeeded, false if failed
+bool FliCaptureC::parseBracket( const std::string& str, std::vector<FliBracketPointC>* points )
+{
+  std::istringstream is( str );
+  std::string item;
+
+  points->clear();
+  while( std::getline( is, item, ',' ) )
+    {
+      FliBracketPointC point;
+      unsigned long long exposureTime;
+      int lowGain = -1, highGain = -1;
+      int n = 0;
+      if( (sscanf( item.c_str(), "%llu%n:%d%n:%d%n", &exposureTime, &n, &lowGain, &n, &highGain, &n ) < 1)
+	  || ((size_t)n != item.length()) || (exposureTime == 0) || (item.find( '-' ) != std::string::npos) )
+	{
+	  std::cerr << "FliCaptureC::parseBracket() ERROR: invalid bracketing point '" << item
+		    << "', expected exptime[:lowgain[:highgain]]" << std::endl;
+	  return false;
+	}
+      point.exposureTime = exposureTime;
+      point.lowGainIndex = lowGain;
+      point.highGainIndex = highGain;
+      points->push_back( point );
+    }
+  return !points->empty();
+}
+
+//--------------------------------------------------------------
+/// write L and H image (and optionally meta data) of a converted frame,
+/// runs in a writer pool thread when writerPool is set
+/// return true if succeeded, false if failed
+bool FliCaptureC::writeFrame( FliFrameBuffersC* buffers )
+{
+  uint32_t numDigits = 5;
+  char numberStr[numDigits + 1];
+  std::string fileName;
+  bool ok = true;
+  uint64_t numBytes = 0;
+  FliTraceScopeC trace( "write frame", buffers->index );
+  FliPerfScopeC perf( &perfStages[FLIMETRICS_STAGE_WRITE] );
+  std::chrono::steady_clock::time_point writeStart = std::chrono::steady_clock::now();
+
+  // by now the telemetry ring usually has a sample after the exposure
+  addTemperatures( &(buffers->info) );
+  if( preview != NULL )
+    {
+      FliTraceScopeC tracePreview( "preview", buffers->index );
+      preview->publish( buffers->bitmap16bitL, buffers->bitmap16bitH, buffers->info, buffers->index );
+    }
+  // TODO: replace "%05d" with something using numDigits
+  snprintf( numberStr, numDigits+1, "%05d", buffers->index );
+  std::string fileNameL, fileNameH;
+  bool isFliz = isCompressed || buffers->doCompress;
+  const char* extension = isFliz ? FLICODEC_EXTENSION : ".fits";
+  if( isMef )
+    {
+      // one file, L (unless dropped by the throttle) and H (HDR modes) as extensions
+      fileName = fileNameBase + numberStr + buffers->str_timeStamp + "_fli.fits";
+      uint16_t* dataL = buffers->doWriteL ? buffers->bitmap16bitL : NULL;
+      uint16_t* dataH = (numChannels == 2) ? buffers->bitmap16bitH : NULL;
+      char channel = (dataH == NULL) ? 'L' : ((dataL == NULL) ? 'H' : 'B');
+      FliLogC::event( FLILOG_INFO, FLILOG_EV_FILE_WRITE, str_cameraTag.c_str(), buffers->index, channel, 0, fileName.c_str() );
+      numBytes += (uint64_t)(((dataL != NULL) ? 1 : 0) + ((dataH != NULL) ? 1 : 0))
+	* fc->getImageWidth() * fc->getImageHeight() * sizeof(uint16_t);
+      ok = (fc->writeFitsMef( fileName.c_str(),
+			      fc->getImageWidth(),
+			      fc->getImageHeight(),
+			      dataL, dataH, 16, &(buffers->info) ) == 0);
+    }
+  else if( buffers->doWriteL )
+    {
+      fileNameL = fileNameBase + numberStr + buffers->str_timeStamp + "_L_fli" + extension;
+      FliLogC::event( FLILOG_INFO, FLILOG_EV_FILE_WRITE, str_cameraTag.c_str(), buffers->index, 'L', 0, fileNameL.c_str() );
+      numBytes += (uint64_t)fc->getImageWidth() * fc->getImageHeight() * sizeof(uint16_t);
+    }
+  if( !isMef && (numChannels == 2) )
+    {
+      fileNameH = fileNameBase + numberStr + buffers->str_timeStamp + "_H_fli" + extension;
+      FliLogC::event( FLILOG_INFO, FLILOG_EV_FILE_WRITE, str_cameraTag.c_str(), buffers->index, 'H', 0, fileNameH.c_str() );
+      numBytes += (uint64_t)fc->getImageWidth() * fc->getImageHeight() * sizeof(uint16_t);
+    }
+
+  if( streamRows > 0 )
+    {
+      ok = writeBands( buffers, fileNameL, fileNameH );
+    }
+  else if( isFliz )
+    {
+      if( ! fileNameL.empty() )
+	{
+	  ok = (fc->writeFliz( fileNameL.c_str(),
+			       fc->getImageWidth(),
+			       fc->getImageHeight(),
+			       buffers->bitmap16bitL, 'L', &(buffers->info) ) == 0) && ok;
+	}
+      if( ! fileNameH.empty() )
+	{
+	  ok = (fc->writeFliz( fileNameH.c_str(),
+			       fc->getImageWidth(),
+			       fc->getImageHeight(),
+			       buffers->bitmap16bitH, 'H', &(buffers->info) ) == 0) && ok;
+	}
+    }
+  else if( ! isMef )
+    {
+      if( ! fileNameL.empty() )
+	{
+	  ok = (fc->writeFits( fileNameL.c_str(),
+			       fc->getImageWidth(),
+			       fc->getImageHeight(),
+			       buffers->bitmap16bitL, 'L', &(buffers->info) ) == 0) && ok;
+	}
+      if( ! fileNameH.empty() )
+	{
+	  ok = (fc->writeFits( fileNameH.c_str(),
+			       fc->getImageWidth(),
+			       fc->getImageHeight(),
+			       buffers->bitmap16bitH, 'H', &(buffers->info) ) == 0) && ok;
+	}
+    }
+
+  if( doWriteMetaData )
+    {
+      // write meta data binary blob
+      fileName = fileNameBase + numberStr + buffers->str_timeStamp + "_meta.bin";
+      FliLogC::event( FLILOG_INFO, FLILOG_EV_FILE_WRITE, str_cameraTag.c_str(), buffers->index, 'M', 0, fileName.c_str() );
+      ok = (writeMetaData( fileName.c_str(), buffers->metaData, metaDataSize ) == 0) && ok;
+      numBytes += metaDataSize;
+    }
+  if( ok )
+    {
+      uiNumFramesWritten++;
+      metrics->uiFramesWritten++;
+      metrics->uiBytesWritten += numBytes;
+    }
+  else
+    {
+      uiNumWriteErrors++;
+      metrics->uiWriteErrors++;
+    }
+  metrics->stages[FLIMETRICS_STAGE_WRITE].add( std::chrono::steady_clock::now() - writeStart );
+  return ok;
+}
+
+//--------------------------------------------------------------
+/// convert the camera frame band by band into the band buffers and append
+/// each band to the L and H files (empty file name ... channel not written)
+/// return true if succeeded, false if failed
+bool FliCaptureC::writeBands( FliFrameBuffersC* buffers, const std::string& fileNameL, const std::string& fileNameH )
+{
+  FliFitsStreamC streamL, streamH;
+  uint32_t width = fc->getImageWidth();
+  uint32_t height = fc->getImageHeight();
+  std::chrono::steady_clock::duration convertTime = std::chrono::steady_clock::duration::zero();
+
+  bool ok = (fileNameL.empty() || fc->openFitsStream( &streamL, fileNameL.c_str(), 'L', &(buffers->info) ))
+    && (fileNameH.empty() || fc->openFitsStream( &streamH, fileNameH.c_str(), 'H', &(buffers->info) ));
+  for( uint32_t row = 0; ok && (row < height); row += streamRows )
+    {
+      uint32_t numRows = std::min( streamRows, height - row );
+      std::chrono::steady_clock::time_point convertStart = std::chrono::steady_clock::now();
+      ok = fc->convertRawRows( row, numRows, buffers->bitmap16bitL, buffers->bitmap16bitH );
+      std::chrono::steady_clock::time_point convertEnd = std::chrono::steady_clock::now();
+      convertTime += convertEnd - convertStart;
+      ok = ok
+	&& (fileNameL.empty() || streamL.write( buffers->bitmap16bitL, (size_t)numRows * width ))
+	&& (fileNameH.empty() || streamH.write( buffers->bitmap16bitH, (size_t)numRows * width ));
+      if( FliTraceC::isEnabled() )
+	{
+	  int64_t convertStartNs = std::chrono::duration_cast<std::chrono::nanoseconds>( convertStart.time_since_epoch() ).count();
+	  int64_t convertEndNs = std::chrono::duration_cast<std::chrono::nanoseconds>( convertEnd.time_since_epoch() ).count();
+	  FliTraceC::add( "unpack band", convertStartNs, convertEndNs, buffers->index );
+	  FliTraceC::add( "write band", convertEndNs, FliTraceC::now(), buffers->index );
+	}
+    }
+  metrics->stages[FLIMETRICS_STAGE_CONVERT].add( convertTime );
+  if( streamL.isOpen() )
+    {
+      ok = streamL.close() && ok;
+    }
+  if( streamH.isOpen() )
+    {
+      ok = streamH.close() && ok;
+    }
+  return ok;
+}
+
+//--------------------------------------------------------------
+/// write stacked L and H images
+/// meta data of single frames is not kept for stacked images
+/// return true if succeeded, false if failed
+bool FliCaptureC::writeStack( FliStackC* stack, uint32_t index, const std::string& str_timeStamp,
+			      boost::posix_time::ptime ptime_stackObsTime )
+{
+  uint32_t numDigits = 5;
+  char numberStr[numDigits + 1];
+  bool ok;
+  uint64_t numBytes;
+  FliTraceScopeC trace( "write stack", index );
+
+  stack->finish();
+  FliPerfScopeC perf( &perfStages[FLIMETRICS_STAGE_WRITE] );
+  std::chrono::steady_clock::time_point writeStart = std::chrono::steady_clock::now();
+  fc->setStackInfo( stack->getNumStacked(), FliStackC::modeName( stack->getMode() ), ptime_stackObsTime );
+  FliFrameInfoC info;
+  fc->getLastFrameInfo( &info );
+  addTemperatures( &info );
+  snprintf( numberStr, numDigits+1, "%05d", index );
+  std::string fileNameL = fileNameBase + numberStr + str_timeStamp + "_L_stack_fli.fits";
+  std::string fileNameH = fileNameBase + numberStr + str_timeStamp + "_H_stack_fli.fits";
+  std::string fileNameMef = fileNameBase + numberStr + str_timeStamp + "_stack_fli.fits";
+  bool hasHigh = (stack->getNumChannels() == 2);
+  if( isMef )
+    {
+      FliLogC::event( FLILOG_INFO, FLILOG_EV_FILE_WRITE, str_cameraTag.c_str(), index, hasHigh ? 'B' : 'L',
+		      stack->getNumStacked(), fileNameMef.c_str() );
+    }
+  else
+    {
+      FliLogC::event( FLILOG_INFO, FLILOG_EV_FILE_WRITE, str_cameraTag.c_str(), index, 'L', stack->getNumStacked(), fileNameL.c_str() );
+      if( hasHigh )
+	{
+	  FliLogC::event( FLILOG_INFO, FLILOG_EV_FILE_WRITE, str_cameraTag.c_str(), index, 'H', stack->getNumStacked(), fileNameH.c_str() );
+	}
+    }
+  if( isMef )
+    {
+      int bitpix = stack->isResult16bit() ? 16 : 32;
+      void *resultL, *resultH;
+      if( bitpix == 16 )
+	{
+	  uint16_t *fillL, *fillH;
+	  stack->getFillBuffers( &fillL, &fillH );
+	  stack->packResult16bit( fillL, fillH );
+	  resultL = fillL;
+	  resultH = fillH;
+	}
+      else
+	{
+	  resultL = stack->getResultLow();
+	  resultH = stack->getResultHigh();
+	}
+      ok = (fc->writeFitsMef( fileNameMef.c_str(),
+			      fc->getImageWidth(),
+			      fc->getImageHeight(),
+			      resultL, hasHigh ? resultH : NULL, bitpix, &info ) == 0);
+      numBytes = stack->getNumChannels() * (uint64_t)fc->getImageWidth() * fc->getImageHeight() * (bitpix / 8);
+    }
+  else if( stack->isResult16bit() )
+    {
+      uint16_t *resultL, *resultH;
+      stack->getFillBuffers( &resultL, &resultH );
+      stack->packResult16bit( resultL, resultH );
+      ok = (fc->writeFits( fileNameL.c_str(),
+			   fc->getImageWidth(),
+			   fc->getImageHeight(),
+			   resultL, 'L', &info ) == 0);
+      if( hasHigh )
+	{
+	  ok = (fc->writeFits( fileNameH.c_str(),
+			       fc->getImageWidth(),
+			       fc->getImageHeight(),
+			       resultH, 'H', &info ) == 0) && ok;
+	}
+      numBytes = stack->getNumChannels() * (uint64_t)fc->getImageWidth() * fc->getImageHeight() * sizeof(uint16_t);
+    }
+  else
+    {
+      ok = (fc->writeFits32bit( fileNameL.c_str(),
+				fc->getImageWidth(),
+				fc->getImageHeight(),
+				stack->getResultLow(), 'L', &info ) == 0);
+      if( hasHigh )
+	{
+	  ok = (fc->writeFits32bit( fileNameH.c_str(),
+				    fc->getImageWidth(),
+				    fc->getImageHeight(),
+				    stack->getResultHigh(), 'H', &info ) == 0) && ok;
+	}
+      numBytes = stack->getNumChannels() * (uint64_t)fc->getImageWidth() * fc->getImageHeight() * sizeof(uint32_t);
+    }
+  fc->setStackInfo( 0, "", ptime_stackObsTime );
+  if( ok )
+    {
+      uiNumFramesWritten++;
+      metrics->uiFramesWritten++;
+      metrics->uiBytesWritten += numBytes;
+    }
+  else
+    {
+      uiNumWriteErrors++;
+      metrics->uiWriteErrors++;
+    }
+  metrics->stages[FLIMETRICS_STAGE_WRITE].add( std::chrono::steady_clock::now() - writeStart );
+  return ok;
+}
+
+//--------------------------------------------------------------
+/// print statistics of the last run
+void FliCaptureC::printSummary()
+{
+  double elapsed = (ptime_runEnd - ptime_runStart).total_microseconds() / 1000000.0;
+  double fps = (elapsed > 0.0) ? uiNumCaptured / elapsed : 0.0;
+  // one or two 16-bit channels per frame
+  double mbps = fps * numChannels * 2.0 * fc->getImageWidth() * fc->getImageHeight() / 1.0e6;
+  // packed raw image data received from the camera
+  double usbMbps = fps * fc->getSensorLayout().getImageBytes() / 1.0e6;
+
+  printf( "%sCaptured %u frames in %.3f s (%.2f frames/s, %.1f MB/s, USB %.1f MB/s, %s), written %u, write errors %u\n",
+	  str_cameraTag.c_str(), (uint32_t)uiNumCaptured, elapsed, fps, mbps, usbMbps,
+	  (numChannels == 2) ? "HDR" : "single channel",
+	  (uint32_t)uiNumFramesWritten, (uint32_t)uiNumWriteErrors );
+  if( uiNumBacklogStalls > 0 )
+    {
+      printf( "%sCapture waited %u times for the writers, frames may have been lost in the camera\n",
+	      str_cameraTag.c_str(), uiNumBacklogStalls );
+    }
+  for( int s = 0; s < FLIMETRICS_NUM_STAGES; s++ )
+    {
+      std::string str_perf = perfStages[s].formatSummary();
+      if( ! str_perf.empty() )
+	{
+	  printf( "%sCounters, %s per frame%s: %s\n", str_cameraTag.c_str(), FliMetricsC::getStageName( s ),
+		  FliPerfC::isUserSpaceOnly() ? " (user space)" : "", str_perf.c_str() );
+	}
+    }
+  throttle.printSummary();
+  integrity.printSummary( str_cameraTag );
+}
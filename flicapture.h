@@ -0,0 +1,168 @@
+#pragma once
+
+#include "flicamera.h"
+#include "flistack.h"
+#include "fliwriter.h"
+#include "flithrottle.h"
+#include "fliintegrity.h"
+#include "flitelemetry.h"
+#include "flimetrics.h"
+#include "flipreview.h"
+#include "fliperf.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#define FLICAPTURE_RAW_SLOTS (3)  // camera frame copies queued for the raw recording
+
+int writeMetaData( const char *filename, uint8_t *mem, uint32_t memSize );
+
+/// one converted frame on its way to the files
+class FliFrameBuffersC
+{
+ public:
+  uint16_t* bitmap16bitL;  // whole image, one row band when streaming
+  uint16_t* bitmap16bitH;  // NULL in single channel modes
+  uint8_t* metaData;
+  bool doWriteL;           // false when the throttle dropped the low gain channel
+  bool doCompress;         // write .fliz files, set by the throttle
+  FliFrameInfoC info;
+  uint32_t index;
+  std::string str_timeStamp;
+};
+
+/// Capture loop: grab a sequence of frames from an opened and configured
+/// camera, convert them and write them to FITS files.
+/// Used by the flictl command line as well as by the daemon mode, which keeps
+/// one instance (and its buffers) alive between sequences.
+/// With a writer pool the files are written by the pool threads while the
+/// next frames are captured; frame buffers are recycled through a free list,
+/// so a slow disk throttles the capture instead of exhausting memory.
+/// One instance per camera, several instances may share one writer pool.
+/// With bracket points the exposure time and gains cycle frame by frame: the
+/// camera is re-armed for one frame at a time and switched to the next point
+/// as soon as a frame has arrived, so the next exposure overlaps with the
+/// conversion and writing of the previous frame.
+/// In single channel (non-HDR) camera modes only the L buffers are allocated
+/// and converted, and one file is written per frame.
+/// With streamRows > 0 there are no image bitmaps: the capture thread converts
+/// the camera frame in bands of streamRows rows and appends each band to the
+/// FITS files right away, so the unpacked rows stay in cache and only a few MB
+/// are needed besides the camera frame. The writer pool is not used then, and
+/// stacking and the preview, which need whole images, are not available.
+/// With isMef the channels of a frame (or stack) go into one multi-extension
+/// FITS file <base><number>_fli.fits: a primary header with the shared cards
+/// and an IMAGE extension per channel (EXTNAME L / H).
+/// With isCompressed the frames are written as <name>.fliz instead of
+/// <name>.fits (FliCodecC, lossless, decoded by fliz -d); stacks stay FITS.
+/// The throttle switches to .fliz as its first step where that is possible.
+/// With doRawCrc a helper thread, started once (not pinned, or on convCpu),
+/// hashes the raw camera frame while the capture thread converts it.
+/// With doRawDump every captured camera frame is also appended, as received,
+/// to <base>raw_<start time>.fliraw (FliRawRecorderC), by an unpinned helper
+/// thread that works off a copy of the last few frames, so the capture
+/// waits for the disk only when all copies are queued; FliCameraC::openReplay()
+/// plays such a recording back.
+/// requestStop() may be called from any thread: it cancels the frame wait in
+/// progress, the frames already captured are still written before run() returns.
+class FliCaptureC
+{
+ private:
+  FliCameraC* fc;
+  bool isPrepared;       // frame buffer allocated and image area set
+  uint32_t uiBufferRows; // rows of the frame buffers, streamRows or the image height
+  std::unique_ptr<FliStackC> stack;  // kept between runs, allocating it takes long
+  std::vector<FliFrameBuffersC*> frameBuffers;
+  std::vector<FliFrameBuffersC*> freeBuffers;
+  std::mutex mtxBuffers;
+  std::condition_variable cvBuffers;
+  uint32_t metaDataSize;
+  uint32_t numChannels;  // 2 ... HDR (L and H), 1 ... single channel mode (L only)
+  std::atomic<bool> isStopRequested;
+  std::atomic<bool> isCaptureRunning;
+  boost::posix_time::ptime ptime_runStart;
+  boost::posix_time::ptime ptime_runEnd;
+  double dLastWriteSeconds;    // duration of the last synchronous frame write
+  FliCaptureMetricsC unexportedMetrics;
+  FliRawRecorderC rawRecorder;
+  FliWriterPoolC rawCrcHelper; // hashes the raw frame next to the conversion
+  FliWriterPoolC rawDumpHelper; // appends the queued raw frames to the recording
+  std::vector<uint8_t*> rawSlots;      // copies of camera frames for rawDumpHelper, guarded by mtxBuffers
+  std::vector<uint8_t*> freeRawSlots;
+  uint32_t uiRawSlotSize;
+  std::atomic<bool> isRawDumpFailed;
+
+  double getWriterBacklog();
+  bool prepareFrameBuffers();
+  void allocFrameBuffers();
+  void freeFrameBuffers();
+  void convertFrame( uint16_t* bitmap16bitL, uint16_t* bitmap16bitH, uint32_t index );
+  bool writeBands( FliFrameBuffersC* buffers, const std::string& fileNameL, const std::string& fileNameH );
+  FliFrameBuffersC* getFreeBuffers();
+  void releaseBuffers( FliFrameBuffersC* buffers );
+  void waitWritesDone();
+  bool writeFrame( FliFrameBuffersC* buffers );
+  bool writeStack( FliStackC* stack, uint32_t index, const std::string& str_timeStamp,
+		   boost::posix_time::ptime ptime_stackObsTime );
+  int finishCapture( int retval );
+  bool armBracketPoint( uint32_t frameIndex );
+  void addTemperatures( FliFrameInfoC* info );
+  bool prepareRawDump( uint32_t frameSize );
+  void dumpRawFrame( uint32_t index );
+  void finishRawDump();
+  std::string getPerfJson();
+
+ public:
+  // capture settings, set them before calling run()
+  uint32_t numImages;
+  std::string fileNameBase;
+  bool isTimeInFileNames;
+  bool doWriteMetaData;
+  bool isExtTriggerEnabled;
+  uint32_t stackNum;     // 0 ... no stacking
+  uint32_t stackMode;
+  bool restoreInternalTrigger; // switch back to internal trigger after an externally triggered run
+  FliWriterPoolC* writerPool;  // NULL ... write files in the capture thread
+  uint32_t numFrameBuffers;    // frames in flight when writing with writerPool
+  uint32_t streamRows;         // convert and write in bands of this many rows, 0 ... whole images
+  bool isMef;                  // one multi-extension file per frame instead of one file per channel
+  bool isCompressed;           // write frames as .fliz files
+  bool doRawCrc;               // RAWCRC header card: CRC32C of the raw camera frame (not for stacks)
+  bool doRawDump;              // record the raw camera frames for replay
+  int acqCpu;                  // pin the capture thread to this CPU, -1 ... no pinning
+  int acqPriority;             // SCHED_FIFO priority of the capture thread, 0 ... normal
+  int convCpu;                 // pin the stacking worker and the raw crc helper to this CPU, -1 ... no pinning
+  std::string str_cameraTag;   // prefix of console messages, eg. serial number
+  FliThrottleC throttle;       // set throttle.isEnabled to degrade output under backlog
+  bool doWriteIntegrityReport; // write <fileNameBase>integrity_<start time>.json after each run
+  FliIntegrityC integrity;     // frame gaps of the current / last run
+  uint32_t maxConsecutiveTimeouts; // give up after this many frame waits in a row ran into their deadline
+  std::vector<FliBracketPointC> bracket; // cycled frame by frame, empty ... no bracketing
+  FliTelemetryC* telemetry;    // temperature samples of this camera, NULL ... none in the FITS headers
+  FliCaptureMetricsC* metrics; // counters for the metrics exporter, never NULL (a private, unexported set by default)
+  FliPreviewC* preview;        // shared memory live preview of this camera, NULL ... none
+
+  // statistics of the current / last run
+  std::atomic<uint32_t> uiNumCaptured;
+  std::atomic<uint32_t> uiNumFramesWritten;
+  std::atomic<uint32_t> uiNumWriteErrors;
+  uint32_t uiNumBacklogStalls; // capture had to wait for a free frame buffer or raw frame copy
+  FliPerfStageC perfStages[FLIMETRICS_NUM_STAGES]; // hardware counters per stage, with FliPerfC started
+
+  FliCaptureC( FliCameraC* camera );
+  ~FliCaptureC();
+
+  void copySettings( const FliCaptureC& other );
+  bool prepare();
+  int run();
+  void printSummary();
+  void requestStop();
+  bool isRunning();
+
+  static bool parseBracket( const std::string& str, std::vector<FliBracketPointC>* points );
+};
@@ -0,0 +1,278 @@
+#include "flichecksum.h"
+#include "flifits.h"
+#include "flisimd.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#define FLICHECKSUM_CRC32C_POLY (0x82f63b78)    // Castagnoli, reflected
+#define FLICHECKSUM_READ_SIZE   (4 * 1024 * 1024)
+
+//--------------------------------------------------------------
+// CRC32C kernels, the SSE4.2 crc32 instruction does 8 bytes per step
+
+/// CRC32C of every byte value
+class FliCrc32cTableC
+{
+ public:
+  uint32_t values[256];
+
+  FliCrc32cTableC()
+  {
+    for( uint32_t i = 0; i < 256; i++ )
+      {
+	uint32_t c = i;
+	for( int k = 0; k < 8; k++ )
+	  {
+	    c = (c & 1) ? (c >> 1) ^ FLICHECKSUM_CRC32C_POLY : (c >> 1);
+	  }
+	values[i] = c;
+      }
+  }
+};
+
+static uint32_t crc32cScalar( const uint8_t* p, size_t size, uint32_t crc )
+{
+  // built by the first caller, the others wait for it
+  static const FliCrc32cTableC table;
+  for( size_t i = 0; i < size; i++ )
+    {
+      crc = table.values[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+  return crc;
+}
+
+#ifdef FLI_SIMD_X86
+FLI_TARGET_SSE42 static uint32_t crc32cSse42( const uint8_t* p, size_t size, uint32_t crc )
+{
+  uint64_t c = crc;
+  size_t i = 0;
+  for( ; i + 32 <= size; i += 32 )
+    {
+      uint64_t w[4];
+      memcpy( w, p + i, sizeof(w) );
+      c = _mm_crc32_u64( c, w[0] );
+      c = _mm_crc32_u64( c, w[1] );
+      c = _mm_crc32_u64( c, w[2] );
+      c = _mm_crc32_u64( c, w[3] );
+    }
+  for( ; i + 8 <= size; i += 8 )
+    {
+      uint64_t w;
+      memcpy( &w, p + i, sizeof(w) );
+      c = _mm_crc32_u64( c, w );
+    }
+  return crc32cScalar( p + i, size - i, (uint32_t)c );
+}
+#endif
+
+//--------------------------------------------------------------
+/// CRC32C (iSCSI, hardware accelerated on x86-64 with SSE4.2), crc is the
+/// value of the data before, so it can be computed piecewise
+uint32_t fliCrc32c( const void* data, size_t size, uint32_t crc )
+{
+  crc = ~crc;
+#ifdef FLI_SIMD_X86
+  static const bool useSse42 = fliCpuHasSse42();
+  if( useSse42 )
+    {
+      return ~crc32cSse42( (const uint8_t*)data, size, crc );
+    }
+#endif
+  return ~crc32cScalar( (const uint8_t*)data, size, crc );
+}
+
+//--------------------------------------------------------------
+/// read until size bytes are read or the file ends
+/// return bytes read, -1 if failed
+static ssize_t readAll( int fd, void* data, size_t size )
+{
+  size_t done = 0;
+  while( done < size )
+    {
+      ssize_t n = read( fd, (uint8_t*)data + done, size - done );
+      if( n < 0 )
+	{
+	  if( errno == EINTR )
+	    {
+	      continue;
+	    }
+	  return -1;
+	}
+      if( n == 0 )
+	{
+	  break;
+	}
+      done += n;
+    }
+  return done;
+}
+
+//--------------------------------------------------------------
+/// check DATASUM and CHECKSUM of every HDU of a FITS file: the data must
+/// add up to DATASUM and the whole HDU to -0 (all ones)
+/// return true if all HDUs with checksum cards are intact and there is at
+/// least one, false otherwise; result is a one line description
+bool fliVerifyFitsFile( const std::string& fileName, std::string* result )
+{
+  int fd = open( fileName.c_str(), O_RDONLY );
+  if( fd < 0 )
+    {
+      *result = std::string( "cannot open: " ) + strerror( errno );
+      return false;
+    }
+  std::vector<uint8_t> buffer( FLICHECKSUM_READ_SIZE );
+  uint32_t numHdus = 0, numChecked = 0;
+  bool ok = true;
+  *result = "";
+  while( ok )
+    {
+      // header blocks up to the END card
+      std::string header;
+      bool hasEnd = false;
+      while( !hasEnd )
+	{
+	  char block[FLIFITS_BLOCK_SIZE];
+	  ssize_t n = readAll( fd, block, sizeof(block) );
+	  if( n == 0 && header.empty() )
+	    {
+	      break;
+	    }
+	  if( n != (ssize_t)sizeof(block) )
+	    {
+	      *result = "HDU " + std::to_string( numHdus ) + ": truncated header";
+	      ok = false;
+	      break;
+	    }
+	  header.append( block, sizeof(block) );
+	  for( size_t pos = header.size() - FLIFITS_BLOCK_SIZE; pos < header.size(); pos += FLIFITS_CARD_SIZE )
+	    {
+	      if( header.compare( pos, 8, "END     " ) == 0 )
+		{
+		  hasEnd = true;
+		  break;
+		}
+	    }
+	}
+      if( !ok || !hasEnd )
+	{
+	  break;
+	}
+
+      int64_t bitpix = 0, naxis = 0, pcount = 0, gcount = 1;
+      if( !FliFitsHeaderC::getCardInt( header, "BITPIX", &bitpix ) || !FliFitsHeaderC::getCardInt( header, "NAXIS", &naxis ) )
+	{
+	  *result = "HDU " + std::to_string( numHdus ) + ": no BITPIX or NAXIS";
+	  ok = false;
+	  break;
+	}
+      FliFitsHeaderC::getCardInt( header, "PCOUNT", &pcount );
+      FliFitsHeaderC::getCardInt( header, "GCOUNT", &gcount );
+      uint64_t numElements = (naxis > 0) ? 1 : 0;
+      for( int64_t k = 1; k <= naxis; k++ )
+	{
+	  int64_t axis = 0;
+	  FliFitsHeaderC::getCardInt( header, ("NAXIS" + std::to_string( k )).c_str(), &axis );
+	  numElements *= (uint64_t)axis;
+	}
+      uint64_t dataSize = (naxis > 0) ? (uint64_t)(std::abs( bitpix ) / 8) * gcount * (pcount + numElements) : 0;
+      dataSize = (dataSize + FLIFITS_BLOCK_SIZE - 1) / FLIFITS_BLOCK_SIZE * FLIFITS_BLOCK_SIZE;
+
+      FliFitsSumC dataSum;
+      for( uint64_t done = 0; done < dataSize; )
+	{
+	  size_t chunk = (size_t)std::min( (uint64_t)buffer.size(), dataSize - done );
+	  if( readAll( fd, buffer.data(), chunk ) != (ssize_t)chunk )
+	    {
+	      *result = "HDU " + std::to_string( numHdus ) + ": truncated data";
+	      ok = false;
+	      break;
+	    }
+	  dataSum.addBytes( buffer.data(), chunk );
+	  done += chunk;
+	}
+      if( !ok )
+	{
+	  break;
+	}
+
+      int64_t datasum = 0, checksum = 0;
+      bool hasDatasum = FliFitsHeaderC::getCardInt( header, "DATASUM", &datasum );
+      bool hasChecksum = FliFitsHeaderC::getCardInt( header, "CHECKSUM", &checksum );
+      if( hasDatasum && ((uint32_t)datasum != dataSum.get()) )
+	{
+	  *result = "HDU " + std::to_string( numHdus ) + ": DATASUM mismatch, data corrupted";
+	  ok = false;
+	}
+      else if( hasChecksum )
+	{
+	  FliFitsSumC hduSum;
+	  hduSum.addBytes( (const uint8_t*)header.data(), header.size() );
+	  hduSum.addSum( dataSum.get() );
+	  if( hduSum.get() != 0xffffffff )
+	    {
+	      *result = "HDU " + std::to_string( numHdus ) + ": CHECKSUM mismatch, header corrupted";
+	      ok = false;
+	    }
+	}
+      numChecked += (hasDatasum || hasChecksum) ? 1 : 0;
+      numHdus++;
+    }
+  close( fd );
+  if( ok && (numHdus == 0) )
+    {
+      *result = "not a FITS file";
+      ok = false;
+    }
+  else if( ok && (numChecked == 0) )
+    {
+      *result = "no checksums";
+      ok = false;
+    }
+  else if( ok )
+    {
+      *result = "OK, " + std::to_string( numHdus ) + ((numHdus == 1) ? " HDU" : " HDUs");
+    }
+  return ok;
+}
+
+//--------------------------------------------------------------
+/// verify files in parallel, one per core, and print one line per file in
+/// the given order
+/// return true if all files are intact, false otherwise
+bool fliVerifyFitsFiles( const std::vector<std::string>& fileNames )
+{
+  std::vector<std::string> results( fileNames.size() );
+  std::vector<char> isOk( fileNames.size(), 0 );
+  std::atomic<size_t> next( 0 );
+  size_t numThreads = std::min( (size_t)std::max( 1u, std::thread::hardware_concurrency() ), fileNames.size() );
+  std::vector<std::thread> threads;
+  for( size_t t = 0; t < numThreads; t++ )
+    {
+      threads.push_back( std::thread( [&]{
+	    for( size_t i = next++; i < fileNames.size(); i = next++ )
+	      {
+		isOk[i] = fliVerifyFitsFile( fileNames[i], &results[i] );
+	      }
+	  } ) );
+    }
+  for( size_t t = 0; t < threads.size(); t++ )
+    {
+      threads[t].join();
+    }
+  size_t numBad = 0;
+  for( size_t i = 0; i < fileNames.size(); i++ )
+    {
+      std::cout << fileNames[i] << ": " << results[i] << std::endl;
+      numBad += isOk[i] ? 0 : 1;
+    }
+  std::cout << "Verified " << fileNames.size() << " files, " << numBad << " failed" << std::endl;
+  return numBad == 0;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Integrity hashing of the raw camera frames and checksum verification of
+// written FITS files.
+
+uint32_t fliCrc32c( const void* data, size_t size, uint32_t crc = 0 );
+bool fliVerifyFitsFile( const std::string& fileName, std::string* result );
+bool fliVerifyFitsFiles( const std::vector<std::string>& fileNames );
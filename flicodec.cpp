@@ -0,0 +1,437 @@
+#include "flicodec.h"
+#include "flisimd.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+
+//--------------------------------------------------------------
+// zigzag mapping of the 16-bit residuals: 0, -1, 1, -2 ... -> 0, 1, 2, 3 ...
+
+static inline uint16_t zigzag( uint16_t r )
+{
+  return (uint16_t)((r << 1) ^ (uint16_t)((int16_t)r >> 15));
+}
+
+static inline uint16_t unzigzag( uint16_t s )
+{
+  return (uint16_t)((s >> 1) ^ (uint16_t)(-(s & 1)));
+}
+
+//--------------------------------------------------------------
+// row kernels: residuals of cur (row above up) in [start, end), with the sums
+// of the FITS values (top bit flipped) at even and odd columns; blocks of
+// bit planes; rebuilding a row from its residuals
+
+static void residualsScalar( const uint16_t* cur, const uint16_t* up, uint32_t start, uint32_t end,
+			     uint16_t* zz, uint64_t* sumEven, uint64_t* sumOdd )
+{
+  for( uint32_t i = start; i < end; i++ )
+    {
+      uint16_t a = (i > 0) ? cur[i - 1] : 0;
+      uint16_t c = (i > 0) ? up[i - 1] : 0;
+      zz[i] = zigzag( (uint16_t)(cur[i] - (uint16_t)(a + up[i] - c)) );
+      if( i & 1 )
+	{
+	  *sumOdd += cur[i] ^ 0x8000;
+	}
+      else
+	{
+	  *sumEven += cur[i] ^ 0x8000;
+	}
+    }
+}
+
+static uint8_t* packBlockScalar( const uint16_t* zz, uint8_t* out )
+{
+  uint32_t orAll = 0;
+  for( uint32_t j = 0; j < FLICODEC_BLOCK_SIZE; j++ )
+    {
+      orAll |= zz[j];
+    }
+  uint32_t w = (orAll != 0) ? 32 - __builtin_clz( orAll ) : 0;
+  *out++ = (uint8_t)w;
+  for( uint32_t k = 0; k < w; k++ )
+    {
+      uint32_t m = 0;
+      for( uint32_t j = 0; j < FLICODEC_BLOCK_SIZE; j++ )
+	{
+	  m |= (uint32_t)((zz[j] >> k) & 1) << j;
+	}
+      memcpy( out, &m, sizeof(m) );
+      out += sizeof(m);
+    }
+  return out;
+}
+
+static void unpackBlockScalar( const uint8_t* planes, uint32_t w, uint16_t* zz )
+{
+  memset( zz, 0, FLICODEC_BLOCK_SIZE * sizeof(uint16_t) );
+  for( uint32_t k = 0; k < w; k++ )
+    {
+      uint32_t m;
+      memcpy( &m, planes + k * sizeof(m), sizeof(m) );
+      for( uint32_t j = 0; j < FLICODEC_BLOCK_SIZE; j++ )
+	{
+	  zz[j] |= (uint16_t)(((m >> j) & 1) << k);
+	}
+    }
+}
+
+static void rebuildScalar( const uint16_t* zz, const uint16_t* up, uint32_t start, uint32_t end, uint16_t* cur )
+{
+  for( uint32_t i = start; i < end; i++ )
+    {
+      uint16_t a = (i > 0) ? cur[i - 1] : 0;
+      uint16_t c = (i > 0) ? up[i - 1] : 0;
+      cur[i] = (uint16_t)(unzigzag( zz[i] ) + a + up[i] - c);
+    }
+}
+
+#ifdef FLI_SIMD_X86
+// the first 16 pixels of a row have no left neighbour in memory and go
+// through the scalar kernels, rows are at least 32 pixels wide
+
+FLI_TARGET_AVX2 static uint32_t residualsAvx2( const uint16_t* cur, const uint16_t* up, uint32_t width,
+					       uint16_t* zz, uint64_t* sumEven, uint64_t* sumOdd )
+{
+  const __m256i flip = _mm256_set1_epi16( (short)0x8000 );
+  const __m256i lowMask = _mm256_set1_epi32( 0xffff );
+  __m256i accEven = _mm256_setzero_si256();
+  __m256i accOdd = _mm256_setzero_si256();
+  uint32_t i;
+  // one row of lane sums stays below 2^32 for rows up to a million pixels
+  for( i = 16; i + 16 <= width; i += 16 )
+    {
+      __m256i x = _mm256_loadu_si256( (const __m256i*)(cur + i) );
+      __m256i a = _mm256_loadu_si256( (const __m256i*)(cur + i - 1) );
+      __m256i b = _mm256_loadu_si256( (const __m256i*)(up + i) );
+      __m256i c = _mm256_loadu_si256( (const __m256i*)(up + i - 1) );
+      __m256i r = _mm256_sub_epi16( x, _mm256_sub_epi16( _mm256_add_epi16( a, b ), c ) );
+      _mm256_storeu_si256( (__m256i*)(zz + i), _mm256_xor_si256( _mm256_slli_epi16( r, 1 ), _mm256_srai_epi16( r, 15 ) ) );
+      __m256i v = _mm256_xor_si256( x, flip );
+      accEven = _mm256_add_epi32( accEven, _mm256_and_si256( v, lowMask ) );
+      accOdd = _mm256_add_epi32( accOdd, _mm256_srli_epi32( v, 16 ) );
+    }
+  uint32_t lanes[16];
+  _mm256_storeu_si256( (__m256i*)lanes, accEven );
+  _mm256_storeu_si256( (__m256i*)(lanes + 8), accOdd );
+  for( int k = 0; k < 8; k++ )
+    {
+      *sumEven += lanes[k];
+      *sumOdd += lanes[k + 8];
+    }
+  return i;
+}
+
+FLI_TARGET_AVX2 static uint8_t* packBlockAvx2( const uint16_t* zz, uint8_t* out )
+{
+  __m256i v0 = _mm256_loadu_si256( (const __m256i*)zz );
+  __m256i v1 = _mm256_loadu_si256( (const __m256i*)(zz + 16) );
+  __m256i o = _mm256_or_si256( v0, v1 );
+  __m128i o128 = _mm_or_si128( _mm256_castsi256_si128( o ), _mm256_extracti128_si256( o, 1 ) );
+  o128 = _mm_or_si128( o128, _mm_srli_si128( o128, 8 ) );
+  o128 = _mm_or_si128( o128, _mm_srli_si128( o128, 4 ) );
+  o128 = _mm_or_si128( o128, _mm_srli_si128( o128, 2 ) );
+  uint32_t orAll = (uint32_t)_mm_extract_epi16( o128, 0 );
+  uint32_t w = (orAll != 0) ? 32 - __builtin_clz( orAll ) : 0;
+  *out++ = (uint8_t)w;
+  for( uint32_t k = 0; k < w; k++ )
+    {
+      // bit k to the sign bit, spread over the 16-bit lane, packed to bytes
+      __m128i count = _mm_cvtsi32_si128( 15 - k );
+      __m256i t0 = _mm256_srai_epi16( _mm256_sll_epi16( v0, count ), 15 );
+      __m256i t1 = _mm256_srai_epi16( _mm256_sll_epi16( v1, count ), 15 );
+      __m256i p = _mm256_permute4x64_epi64( _mm256_packs_epi16( t0, t1 ), 0xd8 );
+      uint32_t m = (uint32_t)_mm256_movemask_epi8( p );
+      memcpy( out, &m, sizeof(m) );
+      out += sizeof(m);
+    }
+  return out;
+}
+
+FLI_TARGET_AVX2 static void unpackBlockAvx2( const uint8_t* planes, uint32_t w, uint16_t* zz )
+{
+  const __m256i sel = _mm256_setr_epi16( 0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
+					 0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, (short)0x8000 );
+  __m256i v0 = _mm256_setzero_si256();
+  __m256i v1 = _mm256_setzero_si256();
+  for( uint32_t k = 0; k < w; k++ )
+    {
+      uint32_t m;
+      memcpy( &m, planes + k * sizeof(m), sizeof(m) );
+      __m256i bit = _mm256_set1_epi16( (short)(1 << k) );
+      __m256i m0 = _mm256_and_si256( _mm256_set1_epi16( (short)(m & 0xffff) ), sel );
+      __m256i m1 = _mm256_and_si256( _mm256_set1_epi16( (short)(m >> 16) ), sel );
+      v0 = _mm256_or_si256( v0, _mm256_and_si256( _mm256_cmpeq_epi16( m0, sel ), bit ) );
+      v1 = _mm256_or_si256( v1, _mm256_and_si256( _mm256_cmpeq_epi16( m1, sel ), bit ) );
+    }
+  _mm256_storeu_si256( (__m256i*)zz, v0 );
+  _mm256_storeu_si256( (__m256i*)(zz + 16), v1 );
+}
+
+FLI_TARGET_AVX2 static uint32_t rebuildAvx2( const uint16_t* zz, const uint16_t* up, uint32_t width, uint16_t* cur )
+{
+  // x[i] = x[i-1] + d[i] with d = residual + b - c: a prefix sum over the row
+  const __m256i one = _mm256_set1_epi16( 1 );
+  const __m256i lastOfLane = _mm256_setr_epi8( 14, 15, 14, 15, 14, 15, 14, 15, 14, 15, 14, 15, 14, 15, 14, 15,
+					       14, 15, 14, 15, 14, 15, 14, 15, 14, 15, 14, 15, 14, 15, 14, 15 );
+  uint16_t carry = cur[15];
+  uint32_t i;
+  for( i = 16; i + 16 <= width; i += 16 )
+    {
+      __m256i s = _mm256_loadu_si256( (const __m256i*)(zz + i) );
+      __m256i r = _mm256_xor_si256( _mm256_srli_epi16( s, 1 ), _mm256_sub_epi16( _mm256_setzero_si256(), _mm256_and_si256( s, one ) ) );
+      __m256i d = _mm256_add_epi16( r, _mm256_sub_epi16( _mm256_loadu_si256( (const __m256i*)(up + i) ),
+							 _mm256_loadu_si256( (const __m256i*)(up + i - 1) ) ) );
+      d = _mm256_add_epi16( d, _mm256_slli_si256( d, 2 ) );
+      d = _mm256_add_epi16( d, _mm256_slli_si256( d, 4 ) );
+      d = _mm256_add_epi16( d, _mm256_slli_si256( d, 8 ) );
+      __m256i last = _mm256_shuffle_epi8( d, lastOfLane );
+      d = _mm256_add_epi16( d, _mm256_permute2x128_si256( last, last, 0x08 ) );
+      d = _mm256_add_epi16( d, _mm256_set1_epi16( (short)carry ) );
+      _mm256_storeu_si256( (__m256i*)(cur + i), d );
+      carry = (uint16_t)_mm256_extract_epi16( d, 15 );
+    }
+  return i;
+}
+#endif
+
+//--------------------------------------------------------------
+
+FliCodecC::FliCodecC()
+{
+  useAvx2 = fliCpuHasAvx2();
+}
+
+//--------------------------------------------------------------
+/// switch the AVX2 kernels off, eg. to compare them with the scalar ones
+void FliCodecC::setAvx2( bool enable )
+{
+  useAvx2 = enable && fliCpuHasAvx2();
+}
+
+//--------------------------------------------------------------
+/// row buffers, the residual row is zero padded to whole blocks
+void FliCodecC::prepareRows( uint32_t width )
+{
+  uint32_t numBlocks = (width + FLICODEC_BLOCK_SIZE - 1) / FLICODEC_BLOCK_SIZE;
+  residuals.assign( numBlocks * FLICODEC_BLOCK_SIZE, 0 );
+  zeroRow.assign( width, 0 );
+}
+
+//--------------------------------------------------------------
+/// upper bound of the compressed size: every block 16 bits wide
+size_t FliCodecC::getMaxSize( uint32_t width, uint32_t height )
+{
+  size_t numBlocks = (width + FLICODEC_BLOCK_SIZE - 1) / FLICODEC_BLOCK_SIZE;
+  return numBlocks * height * (1 + 16 * sizeof(uint32_t));
+}
+
+//--------------------------------------------------------------
+/// compress a plane into out (getMaxSize() bytes), adding the FITS data
+/// sum of the plane to sum (NULL ... not needed)
+/// return the compressed size
+size_t FliCodecC::encode( const uint16_t* plane, uint32_t width, uint32_t height, uint8_t* out, FliFitsSumC* sum )
+{
+  prepareRows( width );
+  uint8_t* start = out;
+  uint16_t* zz = residuals.data();
+  for( uint32_t y = 0; y < height; y++ )
+    {
+      const uint16_t* cur = plane + (size_t)y * width;
+      const uint16_t* up = (y > 0) ? cur - width : zeroRow.data();
+      uint64_t sumEven = 0, sumOdd = 0;
+      uint32_t head = std::min( width, (uint32_t)16 );
+      residualsScalar( cur, up, 0, head, zz, &sumEven, &sumOdd );
+      uint32_t done = head;
+#ifdef FLI_SIMD_X86
+      if( useAvx2 && (width >= 32) )
+	{
+	  done = residualsAvx2( cur, up, width, zz, &sumEven, &sumOdd );
+	}
+#endif
+      residualsScalar( cur, up, done, width, zz, &sumEven, &sumOdd );
+      if( sum != NULL )
+	{
+	  sum->addHalves( sumEven, sumOdd, width );
+	}
+
+      for( uint32_t s = 0; s < width; s += FLICODEC_BLOCK_SIZE )
+	{
+#ifdef FLI_SIMD_X86
+	  if( useAvx2 )
+	    {
+	      out = packBlockAvx2( zz + s, out );
+	      continue;
+	    }
+#endif
+	  out = packBlockScalar( zz + s, out );
+	}
+    }
+  return out - start;
+}
+
+//--------------------------------------------------------------
+/// decompress size bytes into a width x height plane
+/// return true if succeeded, false if the data is corrupted or short
+bool FliCodecC::decode( const uint8_t* in, size_t size, uint32_t width, uint32_t height, uint16_t* plane )
+{
+  prepareRows( width );
+  const uint8_t* end = in + size;
+  uint16_t* zz = residuals.data();
+  for( uint32_t y = 0; y < height; y++ )
+    {
+      for( uint32_t s = 0; s < width; s += FLICODEC_BLOCK_SIZE )
+	{
+	  if( in >= end )
+	    {
+	      std::cerr << "FliCodecC::decode() ERROR: data ends in row " << y << std::endl;
+	      return false;
+	    }
+	  uint32_t w = *in++;
+	  if( (w > 16) || (in + w * sizeof(uint32_t) > end) )
+	    {
+	      std::cerr << "FliCodecC::decode() ERROR: bad block in row " << y << std::endl;
+	      return false;
+	    }
+#ifdef FLI_SIMD_X86
+	  if( useAvx2 )
+	    {
+	      unpackBlockAvx2( in, w, zz + s );
+	    }
+	  else
+#endif
+	    {
+	      unpackBlockScalar( in, w, zz + s );
+	    }
+	  in += w * sizeof(uint32_t);
+	}
+
+      uint16_t* cur = plane + (size_t)y * width;
+      const uint16_t* up = (y > 0) ? cur - width : zeroRow.data();
+      uint32_t head = std::min( width, (uint32_t)16 );
+      rebuildScalar( zz, up, 0, head, cur );
+      uint32_t done = head;
+#ifdef FLI_SIMD_X86
+      if( useAvx2 && (width >= 32) )
+	{
+	  done = rebuildAvx2( zz, up, width, cur );
+	}
+#endif
+      rebuildScalar( zz, up, done, width, cur );
+    }
+  if( in != end )
+    {
+      std::cerr << "FliCodecC::decode() ERROR: " << (end - in) << " bytes left over" << std::endl;
+      return false;
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+/// compress a 16-bit plane into a new .fliz file; the DATASUM and CHECKSUM
+/// cards of fitsHeader are set from the plane on the way
+/// return true if succeeded, false if failed
+bool FliCodecC::writeFile( const char* filename, std::string* fitsHeader, const uint16_t* plane,
+			   uint32_t width, uint32_t height )
+{
+  // one buffer per writer thread, kept between files
+  static thread_local std::vector<uint8_t> buffer;
+  buffer.resize( getMaxSize( width, height ) );
+  FliCodecC codec;
+  FliFitsSumC sum;
+  size_t dataSize = codec.encode( plane, width, height, buffer.data(), &sum );
+  FliFitsHeaderC::updateChecksum( fitsHeader, sum.get() );
+
+  FliCodecFileHeaderC header;
+  memset( &header, 0, sizeof(header) );
+  memcpy( header.magic, FLICODEC_MAGIC, sizeof(FLICODEC_MAGIC) );
+  header.headerSize = sizeof(header);
+  header.fitsHeaderSize = fitsHeader->size();
+  header.width = width;
+  header.height = height;
+  header.bitpix = 16;
+  header.dataSize = dataSize;
+
+  int fd = open( filename, O_WRONLY | O_CREAT | O_EXCL, 0644 );
+  if( fd < 0 )
+    {
+      std::cerr << "FliCodecC::writeFile() ERROR: cannot create " << filename << ": " << strerror( errno ) << std::endl;
+      return false;
+    }
+  bool ok = fliWriteAll( fd, &header, sizeof(header) )
+    && fliWriteAll( fd, fitsHeader->data(), fitsHeader->size() )
+    && fliWriteAll( fd, buffer.data(), dataSize );
+  if( close( fd ) != 0 )
+    {
+      ok = false;
+    }
+  if( !ok )
+    {
+      std::cerr << "FliCodecC::writeFile() ERROR: writing " << filename << " failed" << std::endl;
+    }
+  return ok;
+}
+
+//--------------------------------------------------------------
+/// read and decompress a .fliz file; the sizes in the file header are
+/// checked against the file size before anything is allocated
+/// return true if succeeded, false if failed
+bool FliCodecC::readFile( const char* filename, std::string* fitsHeader, std::vector<uint16_t>* plane,
+			  uint32_t* width, uint32_t* height )
+{
+  int fd = open( filename, O_RDONLY );
+  if( fd < 0 )
+    {
+      std::cerr << "FliCodecC::readFile() ERROR: cannot open " << filename << ": " << strerror( errno ) << std::endl;
+      return false;
+    }
+  struct stat st;
+  FliCodecFileHeaderC header;
+  std::vector<uint8_t> data;
+  bool ok = (fstat( fd, &st ) == 0)
+    && (read( fd, &header, sizeof(header) ) == (ssize_t)sizeof(header))
+    && (memcmp( header.magic, FLICODEC_MAGIC, sizeof(FLICODEC_MAGIC) ) == 0)
+    && (header.headerSize == sizeof(header)) && (header.bitpix == 16)
+    && (header.fitsHeaderSize % FLIFITS_BLOCK_SIZE == 0);
+  if( ok )
+    {
+      // every block takes at least one byte, so the plane is at most
+      // FLICODEC_BLOCK_SIZE pixels per byte of the file
+      uint64_t minDataSize = (uint64_t)((header.width + FLICODEC_BLOCK_SIZE - 1) / FLICODEC_BLOCK_SIZE) * header.height;
+      if( (header.width == 0) || (header.width > FLICODEC_MAX_SIDE)
+	  || (header.height == 0) || (header.height > FLICODEC_MAX_SIDE)
+	  || (header.dataSize < minDataSize) || (header.dataSize > getMaxSize( header.width, header.height ))
+	  || ((uint64_t)header.headerSize + header.fitsHeaderSize + header.dataSize > (uint64_t)st.st_size) )
+	{
+	  std::cerr << "FliCodecC::readFile() ERROR: " << filename << ": implausible sizes in the header ("
+		    << header.width << "x" << header.height << ", FITS header " << header.fitsHeaderSize
+		    << " bytes, data " << header.dataSize << " bytes, file " << st.st_size << " bytes)" << std::endl;
+	  close( fd );
+	  return false;
+	}
+    }
+  if( ok )
+    {
+      fitsHeader->resize( header.fitsHeaderSize );
+      data.resize( header.dataSize );
+      ok = (read( fd, &((*fitsHeader)[0]), fitsHeader->size() ) == (ssize_t)fitsHeader->size())
+	&& (read( fd, data.data(), data.size() ) == (ssize_t)data.size());
+    }
+  close( fd );
+  if( !ok )
+    {
+      std::cerr << "FliCodecC::readFile() ERROR: " << filename << " is not a complete .fliz file" << std::endl;
+      return false;
+    }
+  *width = header.width;
+  *height = header.height;
+  plane->resize( (size_t)header.width * header.height );
+  FliCodecC codec;
+  return codec.decode( data.data(), data.size(), header.width, header.height, plane->data() );
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "flifits.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#define FLICODEC_MAGIC      "FLIZ1"
+#define FLICODEC_BLOCK_SIZE (32)   // pixels per block, the bit planes of a block are 32-bit words
+#define FLICODEC_EXTENSION  ".fliz"
+#define FLICODEC_MAX_SIDE   (65536)  // pixels, readFile() rejects larger images
+
+/// Start of a .fliz file (host byte order), followed by the FITS header
+/// block the image would have had and the compressed plane.
+class FliCodecFileHeaderC
+{
+ public:
+  char magic[8];               // FLICODEC_MAGIC
+  uint32_t headerSize;         // sizeof(FliCodecFileHeaderC)
+  uint32_t fitsHeaderSize;     // bytes, multiple of 2880
+  uint32_t width, height;
+  uint32_t bitpix;             // 16
+  uint32_t reserved;
+  uint64_t dataSize;           // compressed bytes after the FITS header
+};
+
+/// Lossless codec for unpacked sensor planes (uint16 per pixel, 12 bits used).
+/// Each pixel is predicted from its left (a), upper (b) and upper left (c)
+/// neighbours as a + b - c, pixels outside the image count as 0. The
+/// zigzag coded residuals are stored in blocks of FLICODEC_BLOCK_SIZE pixels
+/// of a row: one byte with the bit width w of the largest residual, then w
+/// 32-bit bit planes (bit j of plane k is bit k of residual j), so 4 w bytes
+/// for a full block and a single byte for a block of zeros (sky mask).
+/// The linear predictor is chosen over MED so that decoding vectorizes as
+/// well: the row is rebuilt as a prefix sum of residual + b - c. Encoding
+/// and decoding use AVX2 where the CPU has it, the scalar path writes and
+/// reads the same stream.
+/// The encoder also takes the FITS data sum of the plane, so a .fliz file
+/// carries a complete header with DATASUM and CHECKSUM and decodes into the
+/// very FITS file flictl would have written.
+class FliCodecC
+{
+ private:
+  bool useAvx2;
+  std::vector<uint16_t> residuals;   // one row, rounded up to whole blocks
+  std::vector<uint16_t> zeroRow;
+
+  void prepareRows( uint32_t width );
+
+ public:
+  FliCodecC();
+
+  static size_t getMaxSize( uint32_t width, uint32_t height );
+  size_t encode( const uint16_t* plane, uint32_t width, uint32_t height, uint8_t* out, FliFitsSumC* sum );
+  bool decode( const uint8_t* in, size_t size, uint32_t width, uint32_t height, uint16_t* plane );
+  void setAvx2( bool enable );
+
+  static bool writeFile( const char* filename, std::string* fitsHeader, const uint16_t* plane,
+			 uint32_t width, uint32_t height );
+  static bool readFile( const char* filename, std::string* fitsHeader, std::vector<uint16_t>* plane,
+			uint32_t* width, uint32_t* height );
+};
@@ -1,18 +1,31 @@
 #include "libflipro.h"
 #include "flicamera.h"
 #include "flictl.h"
+#include "flistack.h"
+#include "flicapture.h"
+#include "flidaemon.h"
+#include "fliwriter.h"
+#include "flithread.h"
+#include "flisignal.h"
+#include "flisequence.h"
+#include "flimetrics.h"
+#include "flilog.h"
+#include "flitrace.h"
+#include "fliperf.h"
+#include "flichecksum.h"
 
 #include <boost/program_options.hpp>
 //#include <boost/date_time/gregorian/gregorian.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
-#include <fitsio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <vector>
+#include <thread>
 
 namespace po = boost::program_options;
 
@@ -31,29 +44,153 @@ void conflicting_options(const po::variables_map& vm,
                           + opt1 + "' and '" + opt2 + "'.");
 }
 
-/// write FLI camera meta data binary blob to file - as it is
-int writeMetaData( const char *filename, uint8_t *mem, uint32_t memSize )
+/// open all detected cameras besides fc, configure them like fc and capture
+/// on all of them concurrently, one capture thread per camera
+/// files of each camera are prefixed by its serial number
+/// telemetryMs > 0 samples the temperatures of each camera into its FITS headers,
+/// each camera is registered with metrics unless it is NULL
+/// return FLICTL_OK if all succeeded, first failing FLICTL_ERR* code otherwise
+int grabAllCameras( FliCameraC* fc, FliCaptureC* settings, const std::vector<int>& acqCpus,
+		    const std::vector<int>& convCpus, const std::string& cacheFolder, bool noCache,
+		    FliSignalC* signals, uint32_t telemetryMs, bool doLogTelemetry, FliMetricsC* metrics )
 {
-  std::ofstream os( filename, std::ofstream::binary );
-  if( ! os.is_open() ) 
+  int retval = FLICTL_OK;
+  uint32_t numCameras = fc->uiNumDetectedDevices;
+  std::vector<FliCameraC*> cameras;
+
+  cameras.push_back( fc );
+  for( uint32_t k = 1; k < numCameras; k++ )
     {
-      // show message:
-      std::cerr << "writeMetaData(): Error opening file " << filename << std::endl;
-      return -1;
+      FliCameraC* cam = new FliCameraC();
+      if( noCache )
+	{
+	  cam->disableCache();
+	}
+      if( ! cacheFolder.empty() )
+	{
+	  cam->setCacheFolder( cacheFolder );
+	}
+      // same device list as fc, no need to enumerate the USB bus again
+      cam->uiNumDetectedDevices = fc->uiNumDetectedDevices;
+      memcpy( cam->s_camDeviceInfo, fc->s_camDeviceInfo, sizeof(fc->s_camDeviceInfo) );
+      if( ! cam->openDevice( k ) )
+	{
+	  std::cerr << "grabAllCameras() ERROR: cannot open camera #" << k << std::endl;
+	  delete cam;
+	  retval = FLICTL_ERR_CANNOT_OPEN_CAMERA_DEVICE;
+	  break;
+	}
+      cam->getCapabilities();
+      cam->getPixelConfig();
+      if( ! cam->applyConfigFrom( fc ) )
+	{
+	  std::cerr << "grabAllCameras() ERROR: cannot configure camera #" << k << std::endl;
+	  retval = FLICTL_ERR;
+	}
+      cameras.push_back( cam );
     }
-    
-  os.write( (char *)mem, memSize );
-  os.flush();
-  os.close();
 
-  return 0;  
-}
+  std::vector<FliCaptureC*> captures;
+  std::vector<FliTelemetryC*> telemetries;
+  std::vector<FliPreviewC*> previews;   // of cameras 1..n, camera 0 uses the one of settings
+  std::vector<int> results( cameras.size(), FLICTL_ERR_DEFAULT_CODE );
+  std::vector<std::thread> threads;
+  if( retval == FLICTL_OK )
+    {
+      for( uint32_t k = 0; k < cameras.size(); k++ )
+	{
+	  FliCaptureC* capture = new FliCaptureC( cameras[k] );
+	  std::string serial = cameras[k]->getSerial();
+	  capture->copySettings( *settings );
+	  capture->fileNameBase = settings->fileNameBase + serial + "_";
+	  capture->str_cameraTag = "[" + serial + "] ";
+	  capture->acqCpu = acqCpus.empty() ? -1 : acqCpus[k % acqCpus.size()];
+	  capture->convCpu = convCpus.empty() ? -1 : convCpus[k % convCpus.size()];
+	  if( telemetryMs > 0 )
+	    {
+	      FliTelemetryC* telemetry = new FliTelemetryC();
+	      if( telemetry->start( cameras[k], telemetryMs, doLogTelemetry ? capture->fileNameBase + "telemetry.csv" : "" ) )
+		{
+		  capture->telemetry = telemetry;
+		}
+	      telemetries.push_back( telemetry );
+	    }
+	  if( metrics != NULL )
+	    {
+	      capture->metrics = metrics->addCamera( serial, capture->telemetry );
+	    }
+	  if( (settings->preview != NULL) && (k == 0) )
+	    {
+	      capture->preview = settings->preview;
+	    }
+	  else if( settings->preview != NULL )
+	    {
+	      FliPreviewC* preview = new FliPreviewC();
+	      preview->binning = settings->preview->binning;
+	      preview->intervalMs = settings->preview->intervalMs;
+	      if( preview->create( "/flictl_preview_" + serial, cameras[k]->getImageWidth(), cameras[k]->getImageHeight() ) )
+		{
+		  capture->preview = preview;
+		}
+	      previews.push_back( preview );
+	    }
+	  captures.push_back( capture );
+	}
+      signals->setStopHandler( [&captures]{
+	  for( uint32_t k = 0; k < captures.size(); k++ )
+	    {
+	      captures[k]->requestStop();
+	    }
+	} );
+      for( uint32_t k = 0; k < captures.size(); k++ )
+	{
+	  threads.push_back( std::thread( [&results, &captures, k]{ results[k] = captures[k]->run(); } ) );
+	}
+      for( uint32_t k = 0; k < threads.size(); k++ )
+	{
+	  threads[k].join();
+	}
+      signals->setStopHandler( nullptr );
+    }
 
+  uint32_t totalCaptured = 0, totalWritten = 0;
+  for( uint32_t k = 0; k < captures.size(); k++ )
+    {
+      captures[k]->printSummary();
+      totalCaptured += captures[k]->uiNumCaptured;
+      totalWritten += captures[k]->uiNumFramesWritten;
+      if( (retval == FLICTL_OK) && (results[k] != FLICTL_OK) )
+	{
+	  retval = results[k];
+	}
+      if( metrics != NULL )
+	{
+	  // the metrics outlive the telemetry deleted below
+	  metrics->setTelemetry( captures[k]->metrics, NULL );
+	}
+      delete captures[k];
+    }
+  if( ! captures.empty() )
+    {
+      std::cout << "All " << captures.size() << " cameras: captured " << totalCaptured
+		<< " frames, written " << totalWritten << std::endl;
+    }
 
-void exitCloseCameraDevice( FliCameraC* fc, int status )
-{
-  fc->closeDevice();
-  exit( status );
+  for( uint32_t k = 0; k < telemetries.size(); k++ )
+    {
+      delete telemetries[k];
+    }
+  for( uint32_t k = 0; k < previews.size(); k++ )
+    {
+      delete previews[k];
+    }
+  // fc is closed by the caller
+  for( uint32_t k = 1; k < cameras.size(); k++ )
+    {
+      cameras[k]->closeDevice();
+      delete cameras[k];
+    }
+  return retval;
 }
 
 //----------------------------------------------------
@@ -73,17 +210,59 @@ int main(int argc, const char ** argv)
       uint32_t externalTriggerType;
       bool printCapabilities = false;
       bool printModes = false;
-      //      uint32_t mode = 0;
+      uint32_t mode = 0;
       uint32_t lowGain = 0;
       uint32_t highGain = 0;
       uint32_t numImages = 1;
+      uint32_t stackNum = 0;
+      uint32_t stackMode = FLISTACK_MODE_SUM;
+      std::string stackModeName = "sum";
       // times are in nanoseconds
       // the default values are what camera configuretion dump reports after camera power-up
       uint64_t local_exposureTime = 2000000; // 2ms aka 1/500s
       uint64_t local_frameDelay = 0; // 0s
       std::string fileNameBase = "fli_image_";
-      std::string fileName;
       std::string siteLocation = "default_lab";
+      std::string skyMaskSpec;
+      std::string daemonSocket;
+      std::string configFile;
+      std::string sequenceFile;
+      std::string cacheFolder;
+      bool noCache = false;
+      bool allCameras = false;
+      uint32_t numWriters = 0;
+      uint32_t numFrameBuffers = 4;
+      uint32_t streamRows = 0;
+      bool isMef = false;
+      bool isCompressed = false;
+      bool doRawCrc = false;
+      bool doRawDump = false;
+      std::string replayFile;
+      bool isReplayFast = false;
+      std::vector<std::string> verifyFiles;
+      std::string acqCpuList, convCpuList, writerCpuList;
+      std::vector<int> acqCpus, convCpus, writerCpus;
+      int acqPriority = 0;
+      bool isThrottleEnabled = false;
+      bool noIntegrityReport = false;
+      uint32_t timeoutMarginMs = FLICAMERA_DEFAULT_TIMEOUT_MARGIN_MS;
+      uint32_t extTriggerTimeoutMs = 0;
+      int32_t frameCounterOffset = -1;
+      std::string bracketList;
+      uint32_t telemetryMs = 0;
+      bool doLogTelemetry = false;
+      uint16_t metricsPort = 0;
+      std::string metricsFile;
+      std::string logLevelName = "info";
+      std::string logFormatName = "text";
+      std::string logFile;
+      std::string traceFile;
+      bool doCountPerf = false;
+      std::string logDecodeFile;
+      bool isPreviewEnabled = false;
+      uint32_t previewBinning = 0;
+      uint32_t previewIntervalMs = 1000;
+      std::vector<FliBracketPointC> bracket;
       
       // libflipro debug
       bool isDebug = false;
@@ -100,7 +279,6 @@ int main(int argc, const char ** argv)
       boost::posix_time::ptime ptime_truncFrameTimeStamp;
       boost::posix_time::ptime ptime_roundFrameTimeStamp;
       
-      boost::posix_time::ptime ptime_fileNameFrameTimeStamp;
       std::string str_fileNameFrameTimeStamp = "";
       
       po::options_description desc("Usage:\n flictl [options]\n\nOptions");
@@ -119,7 +297,9 @@ int main(int argc, const char ** argv)
 	("logfolder,l", po::value<std::string>(&logFolder), "Set folder where libflipro debug log is saved")
         ("printcap,p", po::bool_switch(&printCapabilities), "Print camera capabilities and temperatures")
 	("printmodes", po::bool_switch(&printModes), "Print list of camera modes")
-	//	("mode,m", po::value<uint32_t>(&mode), "Set cemare mode (index from list of modes)")
+	("cachefolder", po::value<std::string>(&cacheFolder), "Folder of the camera capabilities cache (default ~/.cache/flictl)")
+	("nocache", po::bool_switch(&noCache), "Always read capabilities, gain tables and modes from the camera")
+	("mode,m", po::value<uint32_t>(&mode), "Set camera mode (index from --printmodes), non-HDR modes write only _L_ files")
 	("cool,c", po::value<double>(&coolTemp), "Set cooling temperature (Celsius degrees)")
 	("shutter,s", po::value<bool>(&shutterOpen), "Shutter open (arg=1) or close (arg=0)")
 	("trigger,t", po::value<bool>(&isExtTriggerEnabled), "Set trigger extrenal (arg=1) or internal (arg=0)")
@@ -132,17 +312,67 @@ int main(int argc, const char ** argv)
 	("grabimage,g", "Grab single image and exit")
 	("grabimages,G", po::value<uint32_t>(&numImages), "Grab N images and exit")
 	("filename,f", po::value<std::string>(&fileNameBase), "Filename base for image(s) is captured.\n\tExample: -f file transfers into file_L_fli.fits + file_H_fli.fits (low gain and high gain images)")
+	("stack", po::value<uint32_t>(&stackNum), "Co-add N consecutive frames per channel and write only the stacked image(s)")
+	("stackmode", po::value<std::string>(&stackModeName), "Stacking mode: sum (32-bit FITS), mean or max (max-hold for meteor trails)")
+	("bracket", po::value<std::string>(&bracketList), "Cycle exposure time [ns] and gain indexes frame by frame: exptime[:lowgain[:highgain]],... (eg. 1000000:14:57,10000000:14:57)")
 	("time",  po::bool_switch(&isTimeInFileNames), "Add exposure start time to filename(s)" )
 	("meta",  po::bool_switch(&doWriteMetaData), "Write binary meta data to extra file" )
+	("allcameras", po::bool_switch(&allCameras), "Grab on all detected cameras concurrently, file names get the camera serial number")
+	("writers", po::value<uint32_t>(&numWriters), "Number of file writer threads shared by all cameras (default 0 = write in the capture thread, 2 per camera with --allcameras)")
+	("writebuffers", po::value<uint32_t>(&numFrameBuffers), "Frames per camera queued for writing when using writer threads (default 4, 64 MB each)")
+	("streamrows", po::value<uint32_t>(&streamRows), "Convert and write frames in bands of N rows in the capture thread, without image buffers (low memory, eg. 16; no writer threads, stacking or preview)")
+	("mef", po::bool_switch(&isMef), "Write one multi-extension FITS file per frame (primary header, L and H image extensions) instead of one file per channel")
+	("fliz", po::bool_switch(&isCompressed), "Write frames losslessly compressed as .fliz files instead of .fits (decode with fliz -d), stacks stay FITS")
+	("rawcrc", po::bool_switch(&doRawCrc), "Add the CRC32C of the raw camera frame to the FITS headers (RAWCRC)")
+	("rawdump", po::bool_switch(&doRawDump), "Also record every captured camera frame as received to <filename>raw_<time>.fliraw (for --replay)")
+	("replay", po::value<std::string>(&replayFile), "Capture from raw recording arg (see --rawdump) instead of a camera, at the recorded frame intervals")
+	("replayfast", po::bool_switch(&isReplayFast), "With --replay deliver the recorded frames as fast as they are processed")
+	("verify", po::value< std::vector<std::string> >(&verifyFiles)->multitoken(), "Check DATASUM and CHECKSUM of the given FITS files and exit")
+	("acqcpus", po::value<std::string>(&acqCpuList), "Pin capture threads to these CPUs, comma separated, one per camera (eg. 2,4)")
+	("convcpus", po::value<std::string>(&convCpuList), "Pin stacking worker threads to these CPUs, one per camera")
+	("writercpus", po::value<std::string>(&writerCpuList), "Pin writer threads to these CPUs (used round robin)")
+	("acqfifo", po::value<int>(&acqPriority), "Run capture threads with SCHED_FIFO priority arg (1..99, needs CAP_SYS_NICE)")
+	("nointegrity", po::bool_switch(&noIntegrityReport), "Do not write the frame gap report <filename>integrity_<time>.json")
+	("frametimeout", po::value<uint32_t>(&timeoutMarginMs), "Give up waiting for a frame arg ms after exposure + frame delay (default 2000)")
+	("triggertimeout", po::value<uint32_t>(&extTriggerTimeoutMs), "Give up waiting for an external trigger after arg ms (default 0 = wait forever)")
+	("framecounter", po::value<int32_t>(&frameCounterOffset), "Check the 32-bit big-endian frame counter at byte offset arg of the frame meta data for gaps and duplicates (see the meta data table of the camera firmware; default: frame times only)")
+	("telemetry", po::value<uint32_t>(&telemetryMs), "Sample camera temperatures every arg ms in the background and write them, interpolated to mid exposure, into the FITS headers")
+	("telemetrylog", po::bool_switch(&doLogTelemetry), "With --telemetry also append the samples to <filename>telemetry.csv")
+	("loglevel", po::value<std::string>(&logLevelName), "Capture progress messages: error, warn, info (default) or debug (every frame read)")
+	("logformat", po::value<std::string>(&logFormatName), "Capture progress messages as text (default), json lines or binary (needs --logfile)")
+	("logfile", po::value<std::string>(&logFile), "Append capture progress messages to file arg instead of stdout")
+	("logdecode", po::value<std::string>(&logDecodeFile), "Print binary log file arg as JSON lines and exit")
+	("trace", po::value<std::string>(&traceFile), "Record a timeline of getImage, unpack, stacking and file writes per frame and thread, written at exit as Chrome trace JSON to file arg (chrome://tracing, ui.perfetto.dev)")
+	("perf", po::bool_switch(&doCountPerf), "Count cycles, instructions, cache and branch misses (perf_event_open) per frame of the wait, convert and write stages, printed in the summary and the integrity report")
+	("preview", po::bool_switch(&isPreviewEnabled), "Publish the latest frame in shared memory /dev/shm/flictl_preview_<serial> for live viewers (see flipreview.h)")
+	("previewbin", po::value<uint32_t>(&previewBinning), "With --preview also publish both planes binned arg x arg")
+	("previewinterval", po::value<uint32_t>(&previewIntervalMs), "With --preview publish at most one frame per arg ms (default 1000)")
+	("metricsport", po::value<uint16_t>(&metricsPort), "Serve Prometheus metrics on http://<host>:arg/metrics")
+	("metricsfile", po::value<std::string>(&metricsFile), "Write Prometheus metrics every 10 s to file arg (for the node exporter textfile collector)")
+	("throttle", po::bool_switch(&isThrottleEnabled), "When writing falls behind, write lossless .fliz, then only H, then only every 2nd, 4th ... frame (logged)")
 	("lat", po::value<double>(&latitude), "Set latitude that will be written into FITS header [double, decimal degrees]")
 	("lon", po::value<double>(&longitude), "Set longitude that will be written into FITS header [double, decimal degrees]")
 	("alt", po::value<double>(&altitude), "Set altitude that will be written into FITS header [double, meters]")
-	("location", po::value<std::string>(&siteLocation), "Set location name that will be written into FITS header.");
+	("location", po::value<std::string>(&siteLocation), "Set location name that will be written into FITS header.")
+	("skymask", po::value<std::string>(&skyMaskSpec), "Convert and write only the sky area, pixels outside are 0: circle:cx,cy,r or polygon:x0,y0,x1,y1,... [pixels]")
+	("config", po::value<std::string>(&configFile), "Read options from file arg, one 'option = value' per line (command line options take precedence)")
+	("sequence", po::value<std::string>(&sequenceFile), "Run the capture steps of INI file arg in one camera session (see flisequence.h for the format)")
+	("daemon", po::value<std::string>(&daemonSocket), "Keep the camera open and accept commands on Unix domain socket arg (see flidaemon.h for the protocol)");
       
       po::variables_map vm;
       
       po::store(po::parse_command_line(argc, argv, desc), vm);
-      // no config file yet ... store(parse_config_file("example.cfg", desc), vm);
+      if( vm.count("config") )
+	{
+	  // values stored first win, so the command line overrides the file
+	  std::ifstream ifs( vm["config"].as<std::string>().c_str() );
+	  if( ! ifs.is_open() )
+	    {
+	      std::cerr << "Cannot open config file " << vm["config"].as<std::string>() << std::endl;
+	      exit( FLICTL_ERR );
+	    }
+	  po::store( po::parse_config_file( ifs, desc ), vm );
+	}
       notify(vm);
       
       // dunno how to detect that there are no parameters with boost::program_options
@@ -160,6 +390,36 @@ int main(int argc, const char ** argv)
 	  exit( FLICTL_OK );
         }
 
+      if( vm.count("logdecode") )
+	{
+	  exit( FliLogC::decode( logDecodeFile ) ? FLICTL_OK : FLICTL_ERR );
+	}
+      if( vm.count("verify") )
+	{
+	  exit( fliVerifyFitsFiles( verifyFiles ) ? FLICTL_OK : FLICTL_ERR );
+	}
+      if( vm.count("replay") )
+	{
+	  // the recording fixes the camera settings
+	  const char* cameraOptions[] = { "printcap", "printmodes", "mode", "cool", "shutter", "trigger", "exttrigtype",
+					  "lowgain", "highgain", "exptime", "framedelay", "getprintconfig", "bracket",
+					  "allcameras", "telemetry", "sequence", "daemon" };
+	  for( size_t k = 0; k < sizeof(cameraOptions) / sizeof(cameraOptions[0]); k++ )
+	    {
+	      if( vm.count( cameraOptions[k] ) && ! vm[cameraOptions[k]].defaulted() )
+		{
+		  std::cerr << argv[0] << " ERROR: --" << cameraOptions[k] << " needs a camera, it cannot be combined with --replay" << std::endl;
+		  exit( FLICTL_ERR );
+		}
+	    }
+	}
+      int logLevel, logFormat;
+      if( ! FliLogC::parseLevel( logLevelName, &logLevel ) || ! FliLogC::parseFormat( logFormatName, &logFormat ) )
+	{
+	  exit( FLICTL_ERR );
+	}
+      FliLogC::setLevel( logLevel );
+
       if( vm.count("logfolder") )
 	{
           std::cout << "DEBUG: set libflipro log folder " << logFolder << std::endl;
@@ -199,6 +459,16 @@ int main(int argc, const char ** argv)
 	  std::cout << "DEBUG: set highgain list index = " << highGain << std::endl;
 	}
 
+      if( vm.count("stack") )
+	{
+	  if( ! FliStackC::parseMode( stackModeName, &stackMode ) )
+	    {
+	      std::cerr << argv[0] << " ERROR: unknown stack mode '" << stackModeName << "'" << std::endl;
+	      exit( FLICTL_ERR );
+	    }
+	  std::cout << "DEBUG: stack " << stackNum << " frames, mode " << stackModeName << std::endl;
+	}
+
       if( vm.count("time") )
 	{
 	  std::cout << "DEBUG: add exposure start time to image file name(s) = " << isTimeInFileNames << std::endl;
@@ -209,6 +479,46 @@ int main(int argc, const char ** argv)
 	  std::cout << "DEBUG: write meta data to extra file = " << doWriteMetaData << std::endl;
 	}
 
+      if( vm.count("bracket") )
+	{
+	  if( ! FliCaptureC::parseBracket( bracketList, &bracket ) )
+	    {
+	      exit( FLICTL_ERR );
+	    }
+	  if( stackNum > 0 )
+	    {
+	      std::cerr << argv[0] << " ERROR: --bracket and --stack cannot be combined" << std::endl;
+	      exit( FLICTL_ERR );
+	    }
+	}
+
+      if( vm.count("acqcpus") )
+	{
+	  if( ! fliParseCpuList( acqCpuList, &acqCpus ) )
+	    {
+	      std::cerr << argv[0] << " ERROR: invalid CPU list '" << acqCpuList << "'" << std::endl;
+	      exit( FLICTL_ERR );
+	    }
+	}
+
+      if( vm.count("convcpus") )
+	{
+	  if( ! fliParseCpuList( convCpuList, &convCpus ) )
+	    {
+	      std::cerr << argv[0] << " ERROR: invalid CPU list '" << convCpuList << "'" << std::endl;
+	      exit( FLICTL_ERR );
+	    }
+	}
+
+      if( vm.count("writercpus") )
+	{
+	  if( ! fliParseCpuList( writerCpuList, &writerCpus ) )
+	    {
+	      std::cerr << argv[0] << " ERROR: invalid CPU list '" << writerCpuList << "'" << std::endl;
+	      exit( FLICTL_ERR );
+	    }
+	}
+
       if( vm.count("lat") )
 	{
 	  std::cout << "DEBUG: latitude = " << latitude << " will be written to FITS file header." << std::endl;
@@ -273,25 +583,73 @@ int main(int argc, const char ** argv)
 	    }
 	}
       
+      // before libflipro or the capture start any thread
+      FliSignalC signals;
+      signals.start();
+      // progress messages are written by a background thread from here on
+      if( ! FliLogC::start( logFormat, logFile ) )
+	{
+	  exit( FLICTL_ERR );
+	}
+      if( vm.count("trace") && ! FliTraceC::start( traceFile ) )
+	{
+	  exit( FLICTL_ERR );
+	}
+      if( doCountPerf )
+	{
+	  FliPerfC::start();
+	}
+
       // ---------------------------------------------------------------
       // Now we declare the camera class and start initialising it
       FliCameraC fc; 
+      FliTelemetryC telemetry;
+      FliPreviewC preview;
+      FliMetricsC metrics;
+      // the one way out once the camera is declared: the telemetry sampler
+      // reads the camera until stopped, so it has to stop before closeDevice()
+      auto shutdown = [&]( int status )
+	{
+	  metrics.stop();
+	  telemetry.stop();
+	  preview.destroy();
+	  fc.closeDevice();
+	  exit( status );
+	};
+      if( noCache )
+	{
+	  fc.disableCache();
+	}
+      if( vm.count("cachefolder") )
+	{
+	  fc.setCacheFolder( cacheFolder );
+	}
       
-      // list camera devices and open first camera
-      if( ! fc.listDevices() )
+      if( vm.count("replay") )
 	{
-	  std::cerr << argv[0] << " ERROR: fc.listDevices() failed! No camera attached or not powered?" << std::endl
-		    << "\tHint: try 'lsusb'." << std::endl;
-	  exitCloseCameraDevice( &fc, FLICTL_ERR_NO_CAMERA_FOUND );
+	  if( ! fc.openReplay( replayFile, !isReplayFast ) )
+	    {
+	      shutdown( FLICTL_ERR );
+	    }
 	}
-      if( ! fc.openDevice() )
+      else
 	{
-	  std::cerr << argv[0] << " ERROR: fc.openDevice() failed!" << std::endl
-		    << "\tHint: the current user may have restricted access to the camera device." << std::endl;
-	  exitCloseCameraDevice( &fc, FLICTL_ERR_CANNOT_OPEN_CAMERA_DEVICE );
+	  // list camera devices and open first camera
+	  if( ! fc.listDevices() )
+	    {
+	      std::cerr << argv[0] << " ERROR: fc.listDevices() failed! No camera attached or not powered?" << std::endl
+			<< "\tHint: try 'lsusb'." << std::endl;
+	      shutdown( FLICTL_ERR_NO_CAMERA_FOUND );
+	    }
+	  if( ! fc.openDevice() )
+	    {
+	      std::cerr << argv[0] << " ERROR: fc.openDevice() failed!" << std::endl
+			<< "\tHint: the current user may have restricted access to the camera device." << std::endl;
+	      shutdown( FLICTL_ERR_CANNOT_OPEN_CAMERA_DEVICE );
+	    }
+	  fc.getCapabilities();
+	  fc.getPixelConfig();
 	}
-      fc.getCapabilities();
-      fc.getPixelConfig(); 
       
       if(vm.count("cool"))
 	{
@@ -323,7 +681,7 @@ int main(int argc, const char ** argv)
 	    {
 	      if( ! fc.setShutterUserControl(true) )
 		{
-		  exitCloseCameraDevice( &fc, FLICTL_ERR );
+		  shutdown( FLICTL_ERR );
 		}
 	    }
 	  if( fc.setShutter( shutterOpen ) )
@@ -346,7 +704,7 @@ int main(int argc, const char ** argv)
 	    }
 	  if( ! fc.setExternalTriggerEnable( isExtTriggerEnabled, (FPROEXTTRIGTYPE)externalTriggerType ) )
 	    {
-	      exitCloseCameraDevice( &fc, FLICTL_ERR );
+	      shutdown( FLICTL_ERR );
 	    }	  
 	}
       
@@ -361,15 +719,23 @@ int main(int argc, const char ** argv)
 	{
 	  if( ! fc.printModes() )
 	    {
-	      exitCloseCameraDevice( &fc, FLICTL_ERR );
+	      shutdown( FLICTL_ERR );
 	    }	  	    
 	}
 
+      if(vm.count("mode"))
+	{
+	  if( ! fc.setMode(mode) )
+	    {
+	      shutdown( FLICTL_ERR );
+	    }
+	}
+
       if(vm.count("exptime"))
 	{
 	  if( ! fc.setExpTime(local_exposureTime) )
 	    {
-	      exitCloseCameraDevice( &fc, FLICTL_ERR );
+	      shutdown( FLICTL_ERR );
 	    }
 	}
 
@@ -377,7 +743,7 @@ int main(int argc, const char ** argv)
 	{
 	  if( ! fc.setExpDelay(local_frameDelay) )
 	    {
-	      exitCloseCameraDevice( &fc, FLICTL_ERR );
+	      shutdown( FLICTL_ERR );
 	    }
 	}
 
@@ -385,7 +751,7 @@ int main(int argc, const char ** argv)
 	{
 	  if( ! fc.setLowGain(lowGain) )
 	    {
-	      exitCloseCameraDevice( &fc, FLICTL_ERR );
+	      shutdown( FLICTL_ERR );
 	    }
 	}
 
@@ -393,7 +759,7 @@ int main(int argc, const char ** argv)
 	{
 	  if( ! fc.setHighGain(highGain) )
 	    {
-	      exitCloseCameraDevice( &fc, FLICTL_ERR );
+	      shutdown( FLICTL_ERR );
 	    }
 	}
 
@@ -402,145 +768,248 @@ int main(int argc, const char ** argv)
 	{
 	  if( ! fc.getPrintConfig() )
 	    {
-	      exitCloseCameraDevice( &fc, FLICTL_ERR );
+	      shutdown( FLICTL_ERR );
 	    }	  
 	}
 
-      //------------------------------------------------
-      if(vm.count("grabimage"))
+      fc.setFitsLocation( latitude, longitude, altitude, siteLocation );
+      fc.uiTimeoutMarginMs = timeoutMarginMs;
+      fc.uiExtTriggerTimeoutMs = extTriggerTimeoutMs;
+      fc.frameCounterOffset = frameCounterOffset;
+      if( vm.count("skymask") )
 	{
-	  std::cout << "Grab single image and exit. " << std::endl;
-	  /// Grab single image and exit
-	  numImages = 1;
+	  if( ! fc.setSkyMask( skyMaskSpec ) )
+	    {
+	      shutdown( FLICTL_ERR );
+	    }
+	  printf( "Sky mask: %s, %.1f%% of the pixels are converted\n",
+		  fc.getSkyMask().getTypeName(), 100.0 * fc.getSkyMask().getSkyFraction() );
 	}
-      
-      //------------------------------------------------
-      if(vm.count("grabimages") || vm.count("grabimage"))
+
+      // single camera telemetry, with --allcameras each camera gets its own
+      bool isMultiCamera = allCameras && (fc.uiNumDetectedDevices > 1)
+	&& (vm.count("grabimages") || vm.count("grabimage")) && !vm.count("daemon") && !vm.count("sequence");
+      if( (telemetryMs > 0) && !isMultiCamera )
 	{
-	  /// Grab N images and exit
+	  if( ! telemetry.start( &fc, telemetryMs, doLogTelemetry ? fileNameBase + "telemetry.csv" : "" ) )
+	    {
+	      shutdown( FLICTL_ERR );
+	    }
+	}
+      FliTelemetryC* pTelemetry = telemetry.isRunning() ? &telemetry : NULL;
+
+      // camera 0 of --allcameras uses it too, grabAllCameras() creates the others
+      preview.binning = previewBinning;
+      preview.intervalMs = previewIntervalMs;
+      if( isPreviewEnabled
+	  && ! preview.create( "/flictl_preview_" + fc.getSerial(), fc.getImageWidth(), fc.getImageHeight() ) )
+	{
+	  shutdown( FLICTL_ERR );
+	}
+      FliPreviewC* pPreview = preview.isCreated() ? &preview : NULL;
 
-	  if( ! fc.allocFrameFullRes() )
+      // with --allcameras grabAllCameras() registers each camera
+      FliCaptureMetricsC* pMetrics = NULL;
+      bool isMetricsEnabled = vm.count("metricsport") || vm.count("metricsfile");
+      if( isMetricsEnabled )
+	{
+	  if( !isMultiCamera )
 	    {
-	      exitCloseCameraDevice( &fc, FLICTL_ERR_FAILED_ALLOC_FRAME );
+	      pMetrics = metrics.addCamera( fc.getSerial(), pTelemetry );
 	    }
-	  if( ! fc.prepareCaptureFullSensor() )
+	  if( ! metrics.start( metricsPort, metricsFile, 10000 ) )
 	    {
-	      exitCloseCameraDevice( &fc, FLICTL_ERR );
+	      shutdown( FLICTL_ERR );
 	    }
+	}
 
-	  if( ! isExtTriggerEnabled )
+      //------------------------------------------------
+      if(vm.count("daemon"))
+	{
+	  /// Serve commands until SHUTDOWN, camera stays open in between
+	  // (own scope so the daemon removes its socket before exit)
+	  FliWriterPoolC writerPool;
+	  if( numWriters > 0 )
 	    {
-	      // call startCapture only when not triggering externally
-	      // (when using FLI camera internal trigger)
-	      if( ! fc.startCapture(numImages) )
+	      if( ! writerPool.start( numWriters, numFrameBuffers, writerCpus ) )
 		{
-		  // TODO - define specific err code
-		  exitCloseCameraDevice( &fc, FLICTL_ERR );
+		  shutdown( FLICTL_ERR );
 		}
 	    }
+	  {
+	    FliDaemonC daemon( &fc );
+	    daemon.capture.fileNameBase = fileNameBase;
+	    daemon.capture.isTimeInFileNames = isTimeInFileNames;
+	    daemon.capture.doWriteMetaData = doWriteMetaData;
+	    daemon.capture.isExtTriggerEnabled = isExtTriggerEnabled;
+	    daemon.capture.stackNum = stackNum;
+	    daemon.capture.stackMode = stackMode;
+	    daemon.capture.writerPool = (numWriters > 0) ? &writerPool : NULL;
+	    daemon.capture.numFrameBuffers = numFrameBuffers;
+	    daemon.capture.streamRows = streamRows;
+	    daemon.capture.isMef = isMef;
+	    daemon.capture.isCompressed = isCompressed;
+	    daemon.capture.bracket = bracket;
+	    daemon.capture.doRawCrc = doRawCrc;
+	    daemon.capture.doRawDump = doRawDump;
+	    daemon.capture.acqCpu = acqCpus.empty() ? -1 : acqCpus[0];
+	    daemon.capture.convCpu = convCpus.empty() ? -1 : convCpus[0];
+	    daemon.capture.acqPriority = acqPriority;
+	    daemon.capture.throttle.isEnabled = isThrottleEnabled;
+	    daemon.capture.doWriteIntegrityReport = !noIntegrityReport;
+	    daemon.capture.telemetry = pTelemetry;
+	    daemon.capture.preview = pPreview;
+	    if( pMetrics != NULL )
+	      {
+		daemon.capture.metrics = pMetrics;
+	      }
+	    metrics.setWriterPool( (numWriters > 0) ? &writerPool : NULL );
+	    if( ! daemon.open( daemonSocket ) )
+	      {
+		shutdown( FLICTL_ERR );
+	      }
+	    signals.setStopHandler( [&daemon]{ daemon.requestShutdown(); } );
+	    iResult = daemon.run();
+	    signals.setStopHandler( nullptr );
+	  }
+	  writerPool.stop();
+	  shutdown( iResult );
+	}
 
-	  uint16_t* bitmap16bitL = new uint16_t[ FLICAMERA_GSENSE4040_SENSOR_HEIGHT * FLICAMERA_GSENSE4040_SENSOR_WIDTH ];
-	  uint16_t* bitmap16bitH = new uint16_t[ FLICAMERA_GSENSE4040_SENSOR_HEIGHT * FLICAMERA_GSENSE4040_SENSOR_WIDTH ];
-
-	  uint32_t metaDataSize;
-	  fc.getMetaDataSize( &metaDataSize );
-	  uint8_t* metaDataBinBlob = new uint8_t[ metaDataSize ];
-	    
-	  uint32_t numDigits = 5;
-	  char numberStr[numDigits + 1];
-	  char *fName;
-
-	  fc.setFitsLocation( latitude, longitude, altitude, siteLocation );
-	  
-	  for( uint32_t i=0; i<numImages; i++ )
+      //------------------------------------------------
+      if(vm.count("sequence"))
+	{
+	  /// Run all steps of the sequence file and exit
+	  FliWriterPoolC writerPool;
+	  if( numWriters > 0 )
 	    {
-	      if( isExtTriggerEnabled )
-		{
-		  std::cout << "Waiting for external trigger... ";
-		}
-	      std::cout << "Image # " << i << std::endl;
-		
-	      if( ! fc.getImage() )
+	      if( ! writerPool.start( numWriters, numFrameBuffers, writerCpus ) )
 		{
-		  // TODO - define specific err code
-		  exitCloseCameraDevice( &fc, FLICTL_ERR );
+		  shutdown( FLICTL_ERR );
 		}
+	    }
+	  {
+	    FliSequenceC sequence( &fc );
+	    if( ! sequence.load( sequenceFile ) )
+	      {
+		shutdown( FLICTL_ERR );
+	      }
+	    sequence.capture.fileNameBase = fileNameBase;
+	    sequence.capture.isTimeInFileNames = isTimeInFileNames;
+	    sequence.capture.doWriteMetaData = doWriteMetaData;
+	    sequence.capture.isExtTriggerEnabled = isExtTriggerEnabled;
+	    sequence.capture.stackNum = stackNum;
+	    sequence.capture.stackMode = stackMode;
+	    sequence.capture.writerPool = (numWriters > 0) ? &writerPool : NULL;
+	    sequence.capture.numFrameBuffers = numFrameBuffers;
+	    sequence.capture.streamRows = streamRows;
+	    sequence.capture.isMef = isMef;
+	    sequence.capture.isCompressed = isCompressed;
+	    sequence.capture.doRawCrc = doRawCrc;
+	    sequence.capture.doRawDump = doRawDump;
+	    sequence.capture.acqCpu = acqCpus.empty() ? -1 : acqCpus[0];
+	    sequence.capture.convCpu = convCpus.empty() ? -1 : convCpus[0];
+	    sequence.capture.acqPriority = acqPriority;
+	    sequence.capture.throttle.isEnabled = isThrottleEnabled;
+	    sequence.capture.doWriteIntegrityReport = !noIntegrityReport;
+	    sequence.capture.bracket = bracket;
+	    sequence.capture.telemetry = pTelemetry;
+	    sequence.capture.preview = pPreview;
+	    if( pMetrics != NULL )
+	      {
+		sequence.capture.metrics = pMetrics;
+	      }
+	    metrics.setWriterPool( (numWriters > 0) ? &writerPool : NULL );
+	    std::cout << "Sequence " << sequenceFile << ": " << sequence.getNumSteps() << " steps" << std::endl;
+	    signals.setStopHandler( [&sequence]{ sequence.requestStop(); } );
+	    iResult = sequence.run();
+	    signals.setStopHandler( nullptr );
+	  }
+	  writerPool.stop();
+	  if( (iResult == FLICTL_OK) && (signals.getCaughtSignal() != 0) )
+	    {
+	      iResult = FLICTL_ERR_INTERRUPTED;
+	    }
+	  shutdown( iResult );
+	}
 
-	      fc.getLastFrameTimeStamp( &ptime_fileNameFrameTimeStamp );
-	      str_fileNameFrameTimeStamp = "_" + to_iso_string( ptime_fileNameFrameTimeStamp );
-		
-	      if( isTimeInFileNames )
-		{
-		  if( isExtTriggerEnabled )
-		    {
-		      std::cout << "  Externally triggered frame capture time = "
-				<< str_fileNameFrameTimeStamp << std::endl;
-		    }
-		  else
-		    {		      
-		      std::cout << "  Approx internally triggered frame capture time = "
-				<< str_fileNameFrameTimeStamp << std::endl;
-		    }		    
-		}
-	      fc.convertHdrRawToBitmaps16bit( bitmap16bitL, bitmap16bitH );	      
-	      // TODO: replace "%05d" with something using numDigits
-	      snprintf( numberStr, numDigits+1, "%05d", i );
-	      // TODO: add time to the file name - as for DFN cameras
-	      fileName = fileNameBase + numberStr + str_fileNameFrameTimeStamp + "_L_fli.fits";
-	      std::cout << "  Write low gain image as " << fileName << std::endl;
-	      fName = &fileName[0u];
-	      // TODO: check retval of writeFits	      
-	      fc.writeFits( fName,
-			    FLICAMERA_GSENSE4040_SENSOR_WIDTH,
-			    FLICAMERA_GSENSE4040_SENSOR_HEIGHT,
-			    bitmap16bitL, 'L' );
-	      
-	      fileName = fileNameBase + numberStr + str_fileNameFrameTimeStamp + "_H_fli.fits";
-	      std::cout << "  Write high gain image as " << fileName << std::endl;
-	      fName = &fileName[0u];
-	      // TODO: check retval of writeFits
-	      fc.writeFits( fName,
-			 FLICAMERA_GSENSE4040_SENSOR_WIDTH,
-			 FLICAMERA_GSENSE4040_SENSOR_HEIGHT,
-			    bitmap16bitH, 'H' );
-
-	      if( doWriteMetaData )
+      //------------------------------------------------
+      if(vm.count("grabimage"))
+	{
+	  std::cout << "Grab single image and exit. " << std::endl;
+	  /// Grab single image and exit
+	  numImages = 1;
+	}
+      if( fc.isReplay() && (numImages > fc.getReplayNumFrames()) )
+	{
+	  std::cout << "Replay: grab the " << fc.getReplayNumFrames() << " recorded frames" << std::endl;
+	  numImages = fc.getReplayNumFrames();
+	}
+      
+      //------------------------------------------------
+      if(vm.count("grabimages") || vm.count("grabimage"))
+	{
+	  /// Grab N images and exit
+	  if( isMultiCamera && !vm.count("writers") )
+	    {
+	      numWriters = 2 * fc.uiNumDetectedDevices;
+	    }
+	  FliWriterPoolC writerPool;
+	  if( numWriters > 0 )
+	    {
+	      // queue never holds more jobs than there are frame buffers
+	      if( ! writerPool.start( numWriters, numFrameBuffers * fc.uiNumDetectedDevices, writerCpus ) )
 		{
-		  // write meta data binary blob
-		  fc.extractMetaData( metaDataBinBlob, metaDataSize );
-		  fileName = fileNameBase + numberStr + str_fileNameFrameTimeStamp + "_meta.bin";
-		  std::cout << "  Write binary meta data as " << fileName << std::endl;
-		  fName = &fileName[0u];
-		  writeMetaData( fName, metaDataBinBlob, metaDataSize );
+		  shutdown( FLICTL_ERR );
 		}
 	    }
-	  delete [] bitmap16bitL;
-	  delete [] bitmap16bitH;
-	  delete [] metaDataBinBlob;
-	  
-	  if( isExtTriggerEnabled )
+	  FliCaptureC capture( &fc );
+	  capture.numImages = numImages;
+	  capture.fileNameBase = fileNameBase;
+	  capture.isTimeInFileNames = isTimeInFileNames;
+	  capture.doWriteMetaData = doWriteMetaData;
+	  capture.isExtTriggerEnabled = isExtTriggerEnabled;
+	  capture.stackNum = stackNum;
+	  capture.stackMode = stackMode;
+	  capture.writerPool = (numWriters > 0) ? &writerPool : NULL;
+	  capture.numFrameBuffers = numFrameBuffers;
+	  capture.streamRows = streamRows;
+	  capture.isMef = isMef;
+	  capture.isCompressed = isCompressed;
+	  capture.doRawCrc = doRawCrc;
+	  capture.doRawDump = doRawDump;
+	  capture.acqPriority = acqPriority;
+	  capture.throttle.isEnabled = isThrottleEnabled;
+	  capture.doWriteIntegrityReport = !noIntegrityReport;
+	  capture.bracket = bracket;
+	  capture.telemetry = pTelemetry;
+	  capture.preview = pPreview;
+	  if( pMetrics != NULL )
 	    {
-	      // disable external triggering (set camera to use internal triggering),
-	      // but keep the previously set ext trigger type
-	      bool dummy;
-	      fc.getExternalTriggerEnable( &dummy, (FPROEXTTRIGTYPE*)(&externalTriggerType) );	      
-	      if( ! fc.setExternalTriggerEnable( false, (FPROEXTTRIGTYPE)externalTriggerType ) )
-		{
-		  exitCloseCameraDevice( &fc, FLICTL_ERR );
-		}	  
+	      capture.metrics = pMetrics;
+	    }
+	  metrics.setWriterPool( (numWriters > 0) ? &writerPool : NULL );
+	  if( isMultiCamera )
+	    {
+	      iResult = grabAllCameras( &fc, &capture, acqCpus, convCpus,
+					vm.count("cachefolder") ? cacheFolder : "", noCache, &signals,
+					telemetryMs, doLogTelemetry, isMetricsEnabled ? &metrics : NULL );
 	    }
 	  else
 	    {
-	      // call stopCapture only when not triggering externally
-	      // (when using FLI camera internal trigger)
-	      if( ! fc.stopCapture() )
-		{
-		  // TODO - define specific err code
-		  exitCloseCameraDevice( &fc, FLICTL_ERR );
-		}
+	      capture.acqCpu = acqCpus.empty() ? -1 : acqCpus[0];
+	      capture.convCpu = convCpus.empty() ? -1 : convCpus[0];
+	      signals.setStopHandler( [&capture]{ capture.requestStop(); } );
+	      iResult = capture.run();
+	      signals.setStopHandler( nullptr );
+	      capture.printSummary();
+	    }
+	  writerPool.stop();
+	  if( (iResult == FLICTL_OK) && (signals.getCaughtSignal() != 0) )
+	    {
+	      iResult = FLICTL_ERR_INTERRUPTED;
 	    }
-	  // all good exit witout error
-	  exitCloseCameraDevice( &fc, FLICTL_OK );
+	  shutdown( iResult );
         }
     }
   catch(std::exception& e)
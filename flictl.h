@@ -9,5 +9,7 @@
 #define FLICTL_ERR_CANNOT_OPEN_CAMERA_DEVICE (3)
 #define FLICTL_ERR_FAILED_ALLOC_FRAME (4)
 #define FLICTL_ERR_FAILED_GRAB_IMAGE (5)
+#define FLICTL_ERR_FRAME_TIMEOUT (6)
+#define FLICTL_ERR_INTERRUPTED (7)
 
 #define FLICTL_ERR_DEFAULT_CODE (-9999)
@@ -0,0 +1,392 @@
+#include "flidaemon.h"
+#include "flictl.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <errno.h>
+#include <ctype.h>
+#include <sstream>
+#include <algorithm>
+
+//--------------------------------------------------------------
+
+FliDaemonC::FliDaemonC( FliCameraC* camera ):
+  capture( camera )
+{
+  fc = camera;
+  listenFd = -1;
+  activeClientFd = -1;
+  isShutdownRequested = false;
+  lastCaptureResult = FLICTL_OK;
+  isCaptureActive = false;
+  // external trigger setting is owned by the TRIGGER command in daemon mode
+  capture.restoreInternalTrigger = false;
+}
+
+//--------------------------------------------------------------
+
+FliDaemonC::~FliDaemonC()
+{
+  capture.requestStop();
+  joinCapture();
+  if( listenFd >= 0 )
+    {
+      close( listenFd );
+      unlink( socketPath.c_str() );
+    }
+}
+
+//--------------------------------------------------------------
+/// create the listening Unix domain socket
+/// return true if succeeded, false if failed
+bool FliDaemonC::open( const std::string& path )
+{
+  struct sockaddr_un addr;
+
+  if( path.length() >= sizeof(addr.sun_path) )
+    {
+      std::cerr << "FliDaemonC::open() ERROR: socket path " << path << " is too long." << std::endl;
+      return false;
+    }
+  listenFd = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if( listenFd < 0 )
+    {
+      std::cerr << "FliDaemonC::open() ERROR: socket() failed, errno=" << errno << std::endl;
+      return false;
+    }
+  memset( &addr, 0, sizeof(addr) );
+  addr.sun_family = AF_UNIX;
+  strncpy( addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1 );
+  // remove stale socket left behind by a killed daemon
+  unlink( path.c_str() );
+  if( (bind( listenFd, (struct sockaddr*)&addr, sizeof(addr) ) < 0) || (listen( listenFd, 4 ) < 0) )
+    {
+      std::cerr << "FliDaemonC::open() ERROR: cannot listen on " << path << ", errno=" << errno << std::endl;
+      close( listenFd );
+      listenFd = -1;
+      return false;
+    }
+  socketPath = path;
+  // a client disconnecting while we reply must not kill the daemon
+  signal( SIGPIPE, SIG_IGN );
+  std::cout << "FliDaemonC: listening on " << socketPath << std::endl;
+  return true;
+}
+
+//--------------------------------------------------------------
+/// serve clients one after another until SHUTDOWN is received
+/// return FLICTL_OK if succeeded, FLICTL_ERR if failed
+int FliDaemonC::run()
+{
+  if( listenFd < 0 )
+    {
+      return FLICTL_ERR;
+    }
+  while( !isShutdownRequested )
+    {
+      int clientFd = accept( listenFd, NULL, NULL );
+      if( clientFd < 0 )
+	{
+	  if( errno == EINTR )
+	    {
+	      continue;
+	    }
+	  if( isShutdownRequested )
+	    {
+	      break;
+	    }
+	  std::cerr << "FliDaemonC::run() ERROR: accept() failed, errno=" << errno << std::endl;
+	  return FLICTL_ERR;
+	}
+      activeClientFd = clientFd;
+      serveClient( clientFd );
+      activeClientFd = -1;
+      close( clientFd );
+    }
+  capture.requestStop();
+  joinCapture();
+  if( capture.isExtTriggerEnabled )
+    {
+      // leave the camera in internal trigger mode, as the command line does
+      bool dummy;
+      FPROEXTTRIGTYPE trigType;
+      fc->getExternalTriggerEnable( &dummy, &trigType );
+      fc->setExternalTriggerEnable( false, trigType );
+    }
+  return FLICTL_OK;
+}
+
+//--------------------------------------------------------------
+/// leave run() as SHUTDOWN does, safe to call from another thread (signal listener):
+/// a running capture is stopped and blocking accept() / recv() are woken up
+void FliDaemonC::requestShutdown()
+{
+  isShutdownRequested = true;
+  capture.requestStop();
+  int clientFd = activeClientFd;
+  if( clientFd >= 0 )
+    {
+      shutdown( clientFd, SHUT_RDWR );
+    }
+  if( listenFd >= 0 )
+    {
+      shutdown( listenFd, SHUT_RDWR );
+    }
+}
+
+//--------------------------------------------------------------
+/// read command lines from a client and send one reply line per command
+void FliDaemonC::serveClient( int clientFd )
+{
+  std::string pending;
+  char buff[512];
+
+  while( !isShutdownRequested )
+    {
+      ssize_t n = recv( clientFd, buff, sizeof(buff), 0 );
+      if( n < 0 && errno == EINTR )
+	{
+	  continue;
+	}
+      if( n <= 0 )
+	{
+	  return;
+	}
+      pending.append( buff, n );
+      size_t eol;
+      while( (eol = pending.find( '\n' )) != std::string::npos )
+	{
+	  std::string line = pending.substr( 0, eol );
+	  pending.erase( 0, eol + 1 );
+	  if( !line.empty() && line[line.length() - 1] == '\r' )
+	    {
+	      line.erase( line.length() - 1 );
+	    }
+	  if( line.empty() )
+	    {
+	      continue;
+	    }
+	  std::string reply;
+	  if( handleCommand( line, &reply ) )
+	    {
+	      reply = "OK" + (reply.empty() ? "" : " " + reply);
+	    }
+	  else
+	    {
+	      reply = "ERR " + reply;
+	    }
+	  reply += "\n";
+	  if( send( clientFd, reply.c_str(), reply.length(), 0 ) < 0 )
+	    {
+	      return;
+	    }
+	}
+    }
+}
+
+//--------------------------------------------------------------
+/// wait for a finished or stopped capture thread
+void FliDaemonC::joinCapture()
+{
+  if( captureThread.joinable() )
+    {
+      captureThread.join();
+    }
+}
+
+//--------------------------------------------------------------
+/// execute a single command line
+/// return true if succeeded, false if failed, reply holds the reply text
+bool FliDaemonC::handleCommand( const std::string& line, std::string* reply )
+{
+  std::istringstream is( line );
+  std::string cmd;
+  std::ostringstream os;
+
+  is >> cmd;
+  std::transform( cmd.begin(), cmd.end(), cmd.begin(), ::toupper );
+
+  if( cmd == "STATUS" )
+    {
+      bool isCapturing = isCaptureActive;
+      // do not talk to the camera while a frame is being read out
+      if( !isCapturing )
+	{
+	  fc->getAllTemperatures();
+	}
+      os << "state=" << (isCapturing ? "capturing" : "idle")
+	 << " captured=" << capture.uiNumCaptured
+	 << " written=" << capture.uiNumFramesWritten
+	 << " last=" << lastCaptureResult
+	 << " exptime=" << fc->exposureTime
+	 << " framedelay=" << fc->frameDelay
+	 << " lowgain=" << fc->uiLowGainIndex
+	 << " highgain=" << fc->uiHighGainIndex
+	 << " trigger=" << capture.isExtTriggerEnabled
+	 << " ambient=" << fc->ambientTemp
+	 << " base=" << fc->baseTemp
+	 << " cooler=" << fc->coolerTemp;
+      *reply = os.str();
+      return true;
+    }
+  if( cmd == "STOP" )
+    {
+      capture.requestStop();
+      joinCapture();
+      os << "captured=" << capture.uiNumCaptured;
+      *reply = os.str();
+      return true;
+    }
+  if( cmd == "SHUTDOWN" )
+    {
+      isShutdownRequested = true;
+      return true;
+    }
+
+  // everything below touches the camera or the capture settings
+  if( isCaptureActive )
+    {
+      *reply = "busy, capture in progress";
+      return false;
+    }
+  joinCapture();
+
+  if( cmd == "EXPTIME" || cmd == "FRAMEDELAY" )
+    {
+      uint64_t ns;
+      if( !(is >> ns) )
+	{
+	  *reply = "usage: " + cmd + " <nanoseconds>";
+	  return false;
+	}
+      bool ok = (cmd == "EXPTIME") ? fc->setExpTime( ns ) : fc->setExpDelay( ns );
+      os << "exptime=" << fc->exposureTime << " framedelay=" << fc->frameDelay;
+      *reply = ok ? os.str() : "camera rejected " + cmd;
+      return ok;
+    }
+  if( cmd == "LOWGAIN" || cmd == "HIGHGAIN" )
+    {
+      uint32_t index;
+      if( !(is >> index) )
+	{
+	  *reply = "usage: " + cmd + " <index>";
+	  return false;
+	}
+      bool ok = (cmd == "LOWGAIN") ? fc->setLowGain( index ) : fc->setHighGain( index );
+      os << "lowgain=" << fc->uiLowGainIndex << " highgain=" << fc->uiHighGainIndex;
+      *reply = ok ? os.str() : "camera rejected " + cmd;
+      return ok;
+    }
+  if( cmd == "COOL" )
+    {
+      double setPoint;
+      if( !(is >> setPoint) )
+	{
+	  *reply = "usage: COOL <celsius>";
+	  return false;
+	}
+      if( ! fc->setTemperatureSetPoint( setPoint ) )
+	{
+	  *reply = "camera rejected COOL";
+	  return false;
+	}
+      return true;
+    }
+  if( cmd == "TRIGGER" )
+    {
+      bool enable;
+      uint32_t trigType;
+      if( !(is >> enable) )
+	{
+	  *reply = "usage: TRIGGER <0|1> [type]";
+	  return false;
+	}
+      if( !(is >> trigType) )
+	{
+	  // keep the trigger type currently set in the camera
+	  bool dummy;
+	  FPROEXTTRIGTYPE currentType;
+	  fc->getExternalTriggerEnable( &dummy, &currentType );
+	  trigType = (uint32_t)currentType;
+	}
+      if( ! fc->setExternalTriggerEnable( enable, (FPROEXTTRIGTYPE)trigType ) )
+	{
+	  *reply = "camera rejected TRIGGER";
+	  return false;
+	}
+      capture.isExtTriggerEnabled = enable;
+      return true;
+    }
+  if( cmd == "FILENAME" )
+    {
+      std::string base;
+      if( !(is >> base) )
+	{
+	  *reply = "usage: FILENAME <base>";
+	  return false;
+	}
+      capture.fileNameBase = base;
+      return true;
+    }
+  if( cmd == "TIME" || cmd == "META" )
+    {
+      bool enable;
+      if( !(is >> enable) )
+	{
+	  *reply = "usage: " + cmd + " <0|1>";
+	  return false;
+	}
+      if( cmd == "TIME" )
+	{
+	  capture.isTimeInFileNames = enable;
+	}
+      else
+	{
+	  capture.doWriteMetaData = enable;
+	}
+      return true;
+    }
+  if( cmd == "STACK" )
+    {
+      uint32_t num;
+      std::string modeName = "sum";
+      uint32_t mode;
+      if( !(is >> num) )
+	{
+	  *reply = "usage: STACK <n> [sum|mean|max]";
+	  return false;
+	}
+      is >> modeName;
+      if( ! FliStackC::parseMode( modeName, &mode ) )
+	{
+	  *reply = "unknown stack mode " + modeName;
+	  return false;
+	}
+      capture.stackNum = num;
+      capture.stackMode = mode;
+      return true;
+    }
+  if( cmd == "CAPTURE" )
+    {
+      uint32_t num;
+      if( !(is >> num) || (num == 0) )
+	{
+	  *reply = "usage: CAPTURE <n>";
+	  return false;
+	}
+      capture.numImages = num;
+      // set the flag here, so a STATUS right after CAPTURE is consistent
+      isCaptureActive = true;
+      captureThread = std::thread( [this]{
+	  lastCaptureResult = capture.run();
+	  isCaptureActive = false;
+	} );
+      os << "capturing " << num;
+      *reply = os.str();
+      return true;
+    }
+
+  *reply = "unknown command " + cmd;
+  return false;
+}
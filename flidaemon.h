@@ -0,0 +1,49 @@
+#pragma once
+
+#include "flicamera.h"
+#include "flicapture.h"
+
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <atomic>
+
+/// Daemon mode: keep the camera session open and accept line based commands
+/// on a Unix domain socket. Each command line gets exactly one reply line,
+/// starting with "OK" or "ERR". Captures run in a background thread, so STATUS
+/// and STOP stay responsive while a sequence is being grabbed.
+///
+/// Commands:
+///   EXPTIME <ns>            FRAMEDELAY <ns>
+///   LOWGAIN <index>         HIGHGAIN <index>
+///   COOL <celsius>          TRIGGER <0|1> [type]
+///   FILENAME <base>         TIME <0|1>          META <0|1>
+///   STACK <n> [sum|mean|max]
+///   CAPTURE <n>             STOP                STATUS
+///   SHUTDOWN
+class FliDaemonC
+{
+ private:
+  FliCameraC* fc;
+  std::thread captureThread;
+  std::atomic<int> lastCaptureResult;
+  std::atomic<bool> isCaptureActive;  // set before the capture thread starts
+  std::string socketPath;
+  int listenFd;
+  std::atomic<int> activeClientFd;
+  std::atomic<bool> isShutdownRequested;
+
+  bool handleCommand( const std::string& line, std::string* reply );
+  void serveClient( int clientFd );
+  void joinCapture();
+
+ public:
+  FliCaptureC capture;  // capture settings, initialised from the command line
+
+  FliDaemonC( FliCameraC* camera );
+  ~FliDaemonC();
+
+  bool open( const std::string& path );
+  int run();
+  void requestShutdown();
+};
@@ -0,0 +1,718 @@
+#include "flifits.h"
+#include "flisimd.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#define FLIFITS_DATASUM_COMMENT  "data unit checksum"
+#define FLIFITS_CHECKSUM_COMMENT "HDU checksum"
+
+//--------------------------------------------------------------
+// conversion kernels: dst[i] = big-endian FITS value of src[i] (top bit
+// flipped for BZERO), summing the FITS values at even and odd indexes for
+// the high and low halves of the checksum words; n is a multiple of 16 for
+// all supported sensors, the scalar tail loops only handle odd sized images
+
+static void toFits16Scalar( const uint16_t* src, uint16_t* dst, size_t start, size_t n,
+			    uint64_t* sumEven, uint64_t* sumOdd )
+{
+  for( size_t i = start; i < n; i++ )
+    {
+      uint16_t v = src[i] ^ 0x8000;
+      dst[i] = __builtin_bswap16( v );
+      if( i & 1 )
+	{
+	  *sumOdd += v;
+	}
+      else
+	{
+	  *sumEven += v;
+	}
+    }
+}
+
+#ifdef FLI_SIMD_X86
+// 32-bit lanes hold an even pixel in the low and an odd pixel in the high
+// half; lane sums are moved to the 64-bit totals before they can overflow
+#define FLIFITS_FLUSH_VECTORS (32768)
+
+static void toFits16Sse2( const uint16_t* src, uint16_t* dst, size_t n, uint64_t* sumEven, uint64_t* sumOdd )
+{
+  const __m128i flip = _mm_set1_epi16( (short)0x8000 );
+  const __m128i lowMask = _mm_set1_epi32( 0xffff );
+  size_t i = 0;
+  while( i + 8 <= n )
+    {
+      __m128i accEven = _mm_setzero_si128();
+      __m128i accOdd = _mm_setzero_si128();
+      for( size_t k = 0; (k < FLIFITS_FLUSH_VECTORS) && (i + 8 <= n); k++, i += 8 )
+	{
+	  __m128i v = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)(src + i) ), flip );
+	  _mm_storeu_si128( (__m128i*)(dst + i), _mm_or_si128( _mm_slli_epi16( v, 8 ), _mm_srli_epi16( v, 8 ) ) );
+	  accEven = _mm_add_epi32( accEven, _mm_and_si128( v, lowMask ) );
+	  accOdd = _mm_add_epi32( accOdd, _mm_srli_epi32( v, 16 ) );
+	}
+      uint32_t lanes[8];
+      _mm_storeu_si128( (__m128i*)lanes, accEven );
+      _mm_storeu_si128( (__m128i*)(lanes + 4), accOdd );
+      *sumEven += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+      *sumOdd += (uint64_t)lanes[4] + lanes[5] + lanes[6] + lanes[7];
+    }
+  toFits16Scalar( src, dst, i, n, sumEven, sumOdd );
+}
+
+FLI_TARGET_AVX2 static void toFits16Avx2( const uint16_t* src, uint16_t* dst, size_t n, uint64_t* sumEven, uint64_t* sumOdd )
+{
+  const __m256i flip = _mm256_set1_epi16( (short)0x8000 );
+  const __m256i lowMask = _mm256_set1_epi32( 0xffff );
+  const __m256i swap = _mm256_setr_epi8( 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+					 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 );
+  size_t i = 0;
+  while( i + 16 <= n )
+    {
+      __m256i accEven = _mm256_setzero_si256();
+      __m256i accOdd = _mm256_setzero_si256();
+      for( size_t k = 0; (k < FLIFITS_FLUSH_VECTORS) && (i + 16 <= n); k++, i += 16 )
+	{
+	  __m256i v = _mm256_xor_si256( _mm256_loadu_si256( (const __m256i*)(src + i) ), flip );
+	  _mm256_storeu_si256( (__m256i*)(dst + i), _mm256_shuffle_epi8( v, swap ) );
+	  accEven = _mm256_add_epi32( accEven, _mm256_and_si256( v, lowMask ) );
+	  accOdd = _mm256_add_epi32( accOdd, _mm256_srli_epi32( v, 16 ) );
+	}
+      uint32_t lanes[16];
+      _mm256_storeu_si256( (__m256i*)lanes, accEven );
+      _mm256_storeu_si256( (__m256i*)(lanes + 8), accOdd );
+      for( int k = 0; k < 8; k++ )
+	{
+	  *sumEven += lanes[k];
+	  *sumOdd += lanes[k + 8];
+	}
+    }
+  toFits16Scalar( src, dst, i, n, sumEven, sumOdd );
+}
+#endif
+
+static void toFits16( const uint16_t* src, uint16_t* dst, size_t n, uint64_t* sumEven, uint64_t* sumOdd )
+{
+#ifdef FLI_SIMD_X86
+  static const bool useAvx2 = fliCpuHasAvx2();
+  if( useAvx2 )
+    {
+      toFits16Avx2( src, dst, n, sumEven, sumOdd );
+    }
+  else
+    {
+      toFits16Sse2( src, dst, n, sumEven, sumOdd );
+    }
+#else
+  toFits16Scalar( src, dst, 0, n, sumEven, sumOdd );
+#endif
+}
+
+//--------------------------------------------------------------
+
+FliFitsSumC::FliFitsSumC()
+{
+  clear();
+}
+
+//--------------------------------------------------------------
+
+void FliFitsSumC::clear()
+{
+  uiHigh = 0;
+  uiLow = 0;
+  uiNumBytes = 0;
+}
+
+//--------------------------------------------------------------
+/// add bytes as they are in the file
+void FliFitsSumC::addBytes( const uint8_t* bytes, size_t size )
+{
+  size_t i = 0;
+  if( (uiNumBytes & 3) == 0 )
+    {
+      // whole words
+      for( ; i + 4 <= size; i += 4 )
+	{
+	  uint32_t word;
+	  memcpy( &word, bytes + i, sizeof(word) );
+	  word = __builtin_bswap32( word );
+	  uiHigh += word >> 16;
+	  uiLow += word & 0xffff;
+	}
+      uiNumBytes += i;
+    }
+  for( ; i < size; i++, uiNumBytes++ )
+    {
+      uint64_t shift = (uiNumBytes & 1) ? 0 : 8;
+      if( uiNumBytes & 2 )
+	{
+	  uiLow += (uint64_t)bytes[i] << shift;
+	}
+      else
+	{
+	  uiHigh += (uint64_t)bytes[i] << shift;
+	}
+    }
+}
+
+//--------------------------------------------------------------
+/// add numHalves 16-bit values, given as the sums of the values at even
+/// and odd positions
+void FliFitsSumC::addHalves( uint64_t sumEven, uint64_t sumOdd, size_t numHalves )
+{
+  if( uiNumBytes & 2 )
+    {
+      std::swap( sumEven, sumOdd );
+    }
+  uiHigh += sumEven;
+  uiLow += sumOdd;
+  uiNumBytes += 2 * numHalves;
+}
+
+//--------------------------------------------------------------
+/// ones' complement addition of another sum, eg. the data sum to the header sum
+void FliFitsSumC::addSum( uint32_t sum )
+{
+  uiHigh += sum >> 16;
+  uiLow += sum & 0xffff;
+}
+
+//--------------------------------------------------------------
+/// fold the carries: out of the low half into the high half, out of the
+/// high half around into the low half
+uint32_t FliFitsSumC::get() const
+{
+  uint64_t high = uiHigh;
+  uint64_t low = uiLow;
+  while( ((high >> 16) != 0) || ((low >> 16) != 0) )
+    {
+      uint64_t carryHigh = high >> 16;
+      uint64_t carryLow = low >> 16;
+      high = (high & 0xffff) + carryLow;
+      low = (low & 0xffff) + carryHigh;
+    }
+  return (uint32_t)((high << 16) | low);
+}
+
+//--------------------------------------------------------------
+
+void FliFitsHeaderC::clear()
+{
+  str_cards.clear();
+  cards.clear();
+}
+
+//--------------------------------------------------------------
+
+bool FliFitsHeaderC::isEmpty() const
+{
+  return str_cards.empty();
+}
+
+//--------------------------------------------------------------
+/// FITS string value: quoted, inner quotes doubled, at least 8 chars, cut
+/// to the 68 chars that fit between the quotes of a card
+std::string FliFitsHeaderC::formatString( const std::string& value )
+{
+  std::string str = "'";
+  for( size_t i = 0; i < value.size(); i++ )
+    {
+      size_t size = (value[i] == '\'') ? 2 : 1;
+      if( str.size() - 1 + size > FLIFITS_CARD_SIZE - 12 )
+	{
+	  break;
+	}
+      str += value[i];
+      if( value[i] == '\'' )
+	{
+	  str += '\'';
+	}
+    }
+  while( str.size() < 9 )
+    {
+      str += ' ';
+    }
+  return str + "'";
+}
+
+//--------------------------------------------------------------
+/// FITS real value, always with a decimal point or exponent, "" (an
+/// undefined value) for NaN and infinity, which FITS cannot represent
+std::string FliFitsHeaderC::formatDouble( double value )
+{
+  if( !std::isfinite( value ) )
+    {
+      return "";
+    }
+  char buff[32];
+  snprintf( buff, sizeof(buff), "%.15G", value );
+  std::string str = buff;
+  if( str.find_first_of( ".EN" ) == std::string::npos )
+    {
+      str += ".";
+    }
+  return str;
+}
+
+//--------------------------------------------------------------
+/// fixed format card: strings start in column 11 and are padded to column
+/// 30, other values end in column 30, long values and comments are cut at
+/// 80 chars; the same layout as cfitsio and astropy, which re-render the
+/// CHECKSUM card when they verify it
+std::string FliFitsHeaderC::formatCard( const std::string& key, const std::string& value,
+					bool isString, const std::string& comment )
+{
+  std::string card = key;
+  card.resize( 8, ' ' );
+  card += "= ";
+  if( isString )
+    {
+      card += value + std::string( (value.size() < 20) ? 20 - value.size() : 0, ' ' );
+    }
+  else
+    {
+      card += std::string( (value.size() < 20) ? 20 - value.size() : 0, ' ' ) + value;
+    }
+  if( !comment.empty() )
+    {
+      card += " / " + comment;
+    }
+  card.resize( FLIFITS_CARD_SIZE, ' ' );
+  return card;
+}
+
+//--------------------------------------------------------------
+
+void FliFitsHeaderC::add( const char* key, const std::string& value, bool isString, const char* comment )
+{
+  CardC card;
+  card.offset = str_cards.size();
+  card.comment = comment;
+  cards[key] = card;
+  str_cards += formatCard( key, value, isString, comment );
+}
+
+//--------------------------------------------------------------
+
+void FliFitsHeaderC::addString( const char* key, const std::string& value, const char* comment )
+{
+  add( key, formatString( value ), true, comment );
+}
+
+//--------------------------------------------------------------
+
+void FliFitsHeaderC::addDouble( const char* key, double value, const char* comment )
+{
+  add( key, formatDouble( value ), false, comment );
+}
+
+//--------------------------------------------------------------
+
+void FliFitsHeaderC::addInt( const char* key, int64_t value, const char* comment )
+{
+  add( key, std::to_string( value ), false, comment );
+}
+
+//--------------------------------------------------------------
+
+void FliFitsHeaderC::addLogical( const char* key, bool value, const char* comment )
+{
+  add( key, value ? "T" : "F", false, comment );
+}
+
+//--------------------------------------------------------------
+/// DATASUM and CHECKSUM cards with placeholder values, filled in by
+/// updateChecksum() once the data is written
+void FliFitsHeaderC::addChecksum()
+{
+  add( "CHECKSUM", formatString( "0000000000000000" ), true, FLIFITS_CHECKSUM_COMMENT );
+  add( "DATASUM", formatString( "0" ), true, FLIFITS_DATASUM_COMMENT );
+}
+
+//--------------------------------------------------------------
+/// header with END card, padded with blanks to whole 2880 byte blocks
+std::string FliFitsHeaderC::getBlock() const
+{
+  std::string block = str_cards;
+  block += std::string( "END" ) + std::string( FLIFITS_CARD_SIZE - 3, ' ' );
+  block.resize( ((block.size() + FLIFITS_BLOCK_SIZE - 1) / FLIFITS_BLOCK_SIZE) * FLIFITS_BLOCK_SIZE, ' ' );
+  return block;
+}
+
+//--------------------------------------------------------------
+/// return true if succeeded, false if key is not in the template
+bool FliFitsHeaderC::patch( std::string* block, const char* key, const std::string& value, bool isString ) const
+{
+  std::map<std::string, CardC>::const_iterator it = cards.find( key );
+  if( (it == cards.end()) || (it->second.offset + FLIFITS_CARD_SIZE > block->size()) )
+    {
+      std::cerr << "FliFitsHeaderC::patch() ERROR: no card " << key << " in header template." << std::endl;
+      return false;
+    }
+  block->replace( it->second.offset, FLIFITS_CARD_SIZE, formatCard( key, value, isString, it->second.comment ) );
+  return true;
+}
+
+//--------------------------------------------------------------
+
+bool FliFitsHeaderC::patchString( std::string* block, const char* key, const std::string& value ) const
+{
+  return patch( block, key, formatString( value ), true );
+}
+
+//--------------------------------------------------------------
+
+bool FliFitsHeaderC::patchDouble( std::string* block, const char* key, double value ) const
+{
+  return patch( block, key, formatDouble( value ), false );
+}
+
+//--------------------------------------------------------------
+
+bool FliFitsHeaderC::patchInt( std::string* block, const char* key, int64_t value ) const
+{
+  return patch( block, key, std::to_string( value ), false );
+}
+
+//--------------------------------------------------------------
+/// the 16 character CHECKSUM value of an HDU with ones' complement sum
+/// (CHECKSUM = '0000000000000000'), which makes the sum of the HDU -0;
+/// encoding of the FITS checksum convention (Seaman, Pence & Rots 2002)
+std::string FliFitsHeaderC::encodeChecksum( uint32_t sum )
+{
+  static const uint8_t exclude[13] = { 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f, 0x40,
+				       0x5b, 0x5c, 0x5d, 0x5e, 0x5f, 0x60 };
+  uint32_t value = ~sum;
+  char asc[16];
+  for( int i = 0; i < 4; i++ )
+    {
+      // each byte is spread over 4 printable chars of the same word position
+      int byte = (value >> (24 - 8 * i)) & 0xff;
+      int ch[4];
+      for( int j = 0; j < 4; j++ )
+	{
+	  ch[j] = byte / 4 + 0x30;
+	}
+      ch[0] += byte % 4;
+      bool isChanged = true;
+      while( isChanged )
+	{
+	  // move away from punctuation, pairwise so the sum stays the same
+	  isChanged = false;
+	  for( int k = 0; k < 13; k++ )
+	    {
+	      for( int j = 0; j < 4; j += 2 )
+		{
+		  if( (ch[j] == exclude[k]) || (ch[j + 1] == exclude[k]) )
+		    {
+		      ch[j]++;
+		      ch[j + 1]--;
+		      isChanged = true;
+		    }
+		}
+	    }
+	}
+      for( int j = 0; j < 4; j++ )
+	{
+	  asc[4 * j + i] = (char)ch[j];
+	}
+    }
+  // rotated by one char, as the words of the card start at an odd column
+  std::string str( 16, ' ' );
+  for( int i = 0; i < 16; i++ )
+    {
+      str[i] = asc[(i + 15) % 16];
+    }
+  return str;
+}
+
+//--------------------------------------------------------------
+/// set DATASUM and CHECKSUM of a rendered header block (see addChecksum())
+/// for the data unit with sum dataSum; works on any header with these
+/// cards, also extension headers built per file
+/// return true if succeeded, false if the header has no checksum cards
+bool FliFitsHeaderC::updateChecksum( std::string* block, uint32_t dataSum )
+{
+  size_t posChecksum = std::string::npos;
+  size_t posDatasum = std::string::npos;
+  for( size_t pos = 0; pos + FLIFITS_CARD_SIZE <= block->size(); pos += FLIFITS_CARD_SIZE )
+    {
+      if( block->compare( pos, 9, "CHECKSUM=" ) == 0 )
+	{
+	  posChecksum = pos;
+	}
+      else if( block->compare( pos, 9, "DATASUM =" ) == 0 )
+	{
+	  posDatasum = pos;
+	}
+      else if( block->compare( pos, 8, "END     " ) == 0 )
+	{
+	  break;
+	}
+    }
+  if( (posChecksum == std::string::npos) || (posDatasum == std::string::npos) )
+    {
+      return false;
+    }
+  block->replace( posDatasum, FLIFITS_CARD_SIZE,
+		  formatCard( "DATASUM", formatString( std::to_string( dataSum ) ), true, FLIFITS_DATASUM_COMMENT ) );
+  block->replace( posChecksum, FLIFITS_CARD_SIZE,
+		  formatCard( "CHECKSUM", formatString( "0000000000000000" ), true, FLIFITS_CHECKSUM_COMMENT ) );
+  FliFitsSumC sum;
+  sum.addBytes( (const uint8_t*)block->data(), block->size() );
+  sum.addSum( dataSum );
+  block->replace( posChecksum, FLIFITS_CARD_SIZE,
+		  formatCard( "CHECKSUM", formatString( encodeChecksum( sum.get() ) ), true, FLIFITS_CHECKSUM_COMMENT ) );
+  return true;
+}
+
+//--------------------------------------------------------------
+/// integer value of a card of a rendered header, string values (DATASUM)
+/// may be quoted
+/// return true if succeeded, false if the card is missing or has no value
+bool FliFitsHeaderC::getCardInt( const std::string& block, const char* key, int64_t* value )
+{
+  std::string prefix = key;
+  prefix.resize( 8, ' ' );
+  prefix += "=";
+  for( size_t pos = 0; pos + FLIFITS_CARD_SIZE <= block.size(); pos += FLIFITS_CARD_SIZE )
+    {
+      if( block.compare( pos, prefix.size(), prefix ) == 0 )
+	{
+	  std::string str = block.substr( pos + 10, FLIFITS_CARD_SIZE - 10 );
+	  size_t start = str.find_first_not_of( " '" );
+	  if( start == std::string::npos )
+	    {
+	      return false;
+	    }
+	  *value = strtoll( str.c_str() + start, NULL, 10 );
+	  return true;
+	}
+    }
+  return false;
+}
+
+//--------------------------------------------------------------
+/// write() until all bytes are written
+/// return true if succeeded, false if failed
+bool fliWriteAll( int fd, const void* data, size_t size )
+{
+  const uint8_t* p = (const uint8_t*)data;
+  while( size > 0 )
+    {
+      ssize_t n = write( fd, p, size );
+      if( n < 0 )
+	{
+	  if( errno == EINTR )
+	    {
+	      continue;
+	    }
+	  std::cerr << "fliWriteAll() ERROR: write failed: " << strerror( errno ) << std::endl;
+	  return false;
+	}
+      p += n;
+      size -= n;
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+/// write unsigned 16-bit (bitpix 16) or 32-bit (bitpix 32) pixels as FITS
+/// data: signed big-endian with BZERO 32768 / 2147483648, which is the
+/// unsigned value with the top bit flipped, padded to whole 2880 byte blocks;
+/// the ones' complement sum of the data is added to sum in the same pass
+/// (sum NULL ... not needed)
+/// return true if succeeded, false if failed
+bool fliWriteFitsData( int fd, const void* data, size_t numPixels, int bitpix, FliFitsSumC* sum )
+{
+  const size_t chunkPixels = 64 * 1024;
+  std::vector<uint8_t> chunk;
+  size_t bytesPerPixel;
+  bool ok = true;
+
+  if( bitpix == 16 )
+    {
+      bytesPerPixel = 2;
+    }
+  else if( bitpix == 32 )
+    {
+      bytesPerPixel = 4;
+    }
+  else
+    {
+      std::cerr << "fliWriteFitsData() ERROR: unsupported BITPIX " << bitpix << std::endl;
+      return false;
+    }
+  chunk.resize( chunkPixels * bytesPerPixel );
+
+  for( size_t start = 0; ok && (start < numPixels); start += chunkPixels )
+    {
+      size_t n = std::min( chunkPixels, numPixels - start );
+      uint64_t sumEven = 0, sumOdd = 0;
+      if( bitpix == 16 )
+	{
+	  toFits16( (const uint16_t*)data + start, (uint16_t*)chunk.data(), n, &sumEven, &sumOdd );
+	}
+      else
+	{
+	  // 32-bit pixels are whole checksum words
+	  const uint32_t* src = (const uint32_t*)data + start;
+	  uint32_t* dst = (uint32_t*)chunk.data();
+	  for( size_t i = 0; i < n; i++ )
+	    {
+	      uint32_t v = src[i] ^ 0x80000000;
+	      dst[i] = __builtin_bswap32( v );
+	      sumEven += v >> 16;
+	      sumOdd += v & 0xffff;
+	    }
+	}
+      if( sum != NULL )
+	{
+	  sum->addHalves( sumEven, sumOdd, n * bytesPerPixel / 2 );
+	}
+      ok = fliWriteAll( fd, chunk.data(), n * bytesPerPixel );
+    }
+
+  size_t dataSize = numPixels * bytesPerPixel;
+  size_t padding = (FLIFITS_BLOCK_SIZE - dataSize % FLIFITS_BLOCK_SIZE) % FLIFITS_BLOCK_SIZE;
+  if( ok && (padding > 0) )
+    {
+      std::vector<uint8_t> zeros( padding, 0 );
+      ok = fliWriteAll( fd, zeros.data(), padding );
+    }
+  return ok;
+}
+
+//--------------------------------------------------------------
+/// write one header and data unit at the current file position; the header
+/// is written first and, if it has checksum cards, written again with
+/// DATASUM and CHECKSUM once the data sum is known (one block, no second
+/// pass over the data)
+/// return true if succeeded, false if failed
+bool fliWriteFitsHdu( int fd, std::string* header, const void* data, size_t numPixels, int bitpix )
+{
+  off_t headerOffset = lseek( fd, 0, SEEK_CUR );
+  FliFitsSumC sum;
+  bool ok = (headerOffset >= 0)
+    && fliWriteAll( fd, header->data(), header->size() )
+    && fliWriteFitsData( fd, data, numPixels, bitpix, &sum );
+  if( ok && FliFitsHeaderC::updateChecksum( header, sum.get() ) )
+    {
+      ok = (pwrite( fd, header->data(), header->size(), headerOffset ) == (ssize_t)header->size());
+    }
+  return ok;
+}
+
+//--------------------------------------------------------------
+
+FliFitsStreamC::FliFitsStreamC()
+{
+  fd = -1;
+  uiNumPixels = 0;
+  uiNumWritten = 0;
+}
+
+//--------------------------------------------------------------
+
+FliFitsStreamC::~FliFitsStreamC()
+{
+  if( fd >= 0 )
+    {
+      ::close( fd );
+    }
+}
+
+//--------------------------------------------------------------
+/// create the file (it must not exist) and write the header block
+/// return true if succeeded, false if failed
+bool FliFitsStreamC::open( const char* filename, const std::string& header, size_t numPixels )
+{
+  if( fd >= 0 )
+    {
+      std::cerr << "FliFitsStreamC::open() ERROR: " << str_fileName << " is still open" << std::endl;
+      return false;
+    }
+  fd = ::open( filename, O_WRONLY | O_CREAT | O_EXCL, 0644 );
+  if( fd < 0 )
+    {
+      std::cerr << "FliFitsStreamC::open() ERROR: cannot create " << filename << ": " << strerror( errno ) << std::endl;
+      return false;
+    }
+  str_fileName = filename;
+  str_header = header;
+  dataSum.clear();
+  uiNumPixels = numPixels;
+  uiNumWritten = 0;
+  return fliWriteAll( fd, header.data(), header.size() );
+}
+
+//--------------------------------------------------------------
+/// append unsigned 16-bit pixels, converted as in fliWriteFitsData()
+/// return true if succeeded, false if failed
+bool FliFitsStreamC::write( const uint16_t* data, size_t numPixels )
+{
+  if( (fd < 0) || (uiNumWritten + numPixels > uiNumPixels) )
+    {
+      std::cerr << "FliFitsStreamC::write() ERROR: " << str_fileName << " not open or more pixels than announced" << std::endl;
+      return false;
+    }
+  if( swapped.size() < numPixels )
+    {
+      swapped.resize( numPixels );
+    }
+  uint64_t sumEven = 0, sumOdd = 0;
+  toFits16( data, swapped.data(), numPixels, &sumEven, &sumOdd );
+  dataSum.addHalves( sumEven, sumOdd, numPixels );
+  uiNumWritten += numPixels;
+  return fliWriteAll( fd, swapped.data(), numPixels * sizeof(uint16_t) );
+}
+
+//--------------------------------------------------------------
+/// pad and close the file, fails if fewer pixels were written than announced
+/// return true if succeeded, false if failed
+bool FliFitsStreamC::close()
+{
+  if( fd < 0 )
+    {
+      return false;
+    }
+  bool ok = (uiNumWritten == uiNumPixels);
+  size_t dataSize = uiNumWritten * sizeof(uint16_t);
+  size_t padding = (FLIFITS_BLOCK_SIZE - dataSize % FLIFITS_BLOCK_SIZE) % FLIFITS_BLOCK_SIZE;
+  if( ok && (padding > 0) )
+    {
+      std::vector<uint8_t> zeros( padding, 0 );
+      ok = fliWriteAll( fd, zeros.data(), padding );
+    }
+  if( ok && FliFitsHeaderC::updateChecksum( &str_header, dataSum.get() ) )
+    {
+      ok = (pwrite( fd, str_header.data(), str_header.size(), 0 ) == (ssize_t)str_header.size());
+    }
+  if( ::close( fd ) != 0 )
+    {
+      ok = false;
+    }
+  fd = -1;
+  if( !ok )
+    {
+      std::cerr << "FliFitsStreamC::close() ERROR: writing " << str_fileName << " failed" << std::endl;
+    }
+  return ok;
+}
+
+//--------------------------------------------------------------
+
+bool FliFitsStreamC::isOpen()
+{
+  return fd >= 0;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#define FLIFITS_CARD_SIZE  (80)
+#define FLIFITS_BLOCK_SIZE (2880)
+
+/// Ones' complement sum of big-endian 32-bit words, the checksum of the FITS
+/// DATASUM and CHECKSUM keywords. The high and low 16 bits of the words are
+/// summed separately and only folded in get(), so the sum is built up chunk
+/// by chunk while the data is converted for writing.
+class FliFitsSumC
+{
+ private:
+  uint64_t uiHigh, uiLow;
+  uint64_t uiNumBytes;      // added so far, tells where in a word the next 16 bits go
+
+ public:
+  FliFitsSumC();
+
+  void clear();
+  void addBytes( const uint8_t* bytes, size_t size );
+  void addHalves( uint64_t sumEven, uint64_t sumOdd, size_t numHalves );
+  void addSum( uint32_t sum );
+  uint32_t get() const;
+};
+
+/// Primary FITS header rendered once and patched per file.
+/// Cards are added in the order they appear in the header; getBlock() returns
+/// the header padded to a multiple of 2880 bytes, the patch*() methods
+/// re-render a single card of such a copy in place. The template itself is
+/// not changed by patching, so several writer threads can share one.
+class FliFitsHeaderC
+{
+ private:
+  class CardC
+  {
+  public:
+    size_t offset;         // byte offset of the card in the header
+    std::string comment;
+  };
+  std::string str_cards;   // all cards without END, multiple of 80 chars
+  std::map<std::string, CardC> cards;
+
+  static std::string formatCard( const std::string& key, const std::string& value,
+				 bool isString, const std::string& comment );
+  static std::string formatString( const std::string& value );
+  static std::string formatDouble( double value );
+  void add( const char* key, const std::string& value, bool isString, const char* comment );
+  bool patch( std::string* block, const char* key, const std::string& value, bool isString ) const;
+
+ public:
+  void clear();
+  bool isEmpty() const;
+
+  void addString( const char* key, const std::string& value, const char* comment );
+  void addDouble( const char* key, double value, const char* comment );
+  void addInt( const char* key, int64_t value, const char* comment );
+  void addLogical( const char* key, bool value, const char* comment );
+  void addChecksum();
+
+  std::string getBlock() const;
+  bool patchString( std::string* block, const char* key, const std::string& value ) const;
+  bool patchDouble( std::string* block, const char* key, double value ) const;
+  bool patchInt( std::string* block, const char* key, int64_t value ) const;
+
+  static std::string encodeChecksum( uint32_t sum );
+  static bool updateChecksum( std::string* block, uint32_t dataSum );
+  static bool getCardInt( const std::string& block, const char* key, int64_t* value );
+};
+
+/// 16-bit FITS file written piecewise: open() writes the header block,
+/// write() appends any number of pixel chunks, close() pads the data to whole
+/// blocks. Used to write row bands as they are converted, without a bitmap
+/// of the whole image. The data sum is taken while writing and the header,
+/// if it has checksum cards, is rewritten with DATASUM and CHECKSUM on close().
+class FliFitsStreamC
+{
+ private:
+  int fd;
+  std::string str_fileName;
+  std::string str_header;
+  FliFitsSumC dataSum;
+  size_t uiNumPixels;        // announced in the header
+  size_t uiNumWritten;
+  std::vector<uint16_t> swapped;
+
+ public:
+  FliFitsStreamC();
+  ~FliFitsStreamC();
+
+  bool open( const char* filename, const std::string& header, size_t numPixels );
+  bool write( const uint16_t* data, size_t numPixels );
+  bool close();
+  bool isOpen();
+};
+
+bool fliWriteAll( int fd, const void* data, size_t size );
+bool fliWriteFitsData( int fd, const void* data, size_t numPixels, int bitpix, FliFitsSumC* sum = NULL );
+bool fliWriteFitsHdu( int fd, std::string* header, const void* data, size_t numPixels, int bitpix );
@@ -0,0 +1,229 @@
+#include "fliintegrity.h"
+
+#include <stdio.h>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+//--------------------------------------------------------------
+
+FliIntegrityC::FliIntegrityC()
+{
+  tolerance = 0.5;
+  reset( 0.0, true );
+}
+
+//--------------------------------------------------------------
+/// start a new run, expectedPeriod [s] = 0 if not known (external trigger)
+void FliIntegrityC::reset( double expectedPeriod, bool hasFrameCounter )
+{
+  events.clear();
+  uiNumEventsDropped = 0;
+  isFirstFrame = true;
+  uiPrevCounter = 0;
+  dExpectedPeriod = expectedPeriod;
+  hasCounter = hasFrameCounter;
+  uiNumAccounted = 0;
+  ptime_start = boost::posix_time::microsec_clock::universal_time();
+
+  uiNumFrames = 0;
+  uiFirstCounter = 0;
+  uiLastCounter = 0;
+  uiNumGaps = 0;
+  uiNumMissing = 0;
+  uiNumDuplicates = 0;
+  uiNumOutOfOrder = 0;
+  uiNumLate = 0;
+  uiNumTimeGaps = 0;
+  uiNumShortReads = 0;
+  uiNumTimeouts = 0;
+}
+
+//--------------------------------------------------------------
+
+void FliIntegrityC::addEvent( const char* type, uint32_t index, uint32_t counter, uint32_t prevCounter,
+			      uint32_t missing, double dt )
+{
+  if( events.size() >= FLIINTEGRITY_MAX_EVENTS )
+    {
+      uiNumEventsDropped++;
+      return;
+    }
+  EventC event;
+  event.str_type = type;
+  event.index = index;
+  event.counter = counter;
+  event.prevCounter = prevCounter;
+  event.missing = missing;
+  event.dt = dt;
+  events.push_back( event );
+}
+
+//--------------------------------------------------------------
+/// check a frame that was read completely
+void FliIntegrityC::addFrame( uint32_t index, uint32_t counter, boost::posix_time::ptime frameTime )
+{
+  uiNumFrames++;
+  if( isFirstFrame )
+    {
+      isFirstFrame = false;
+      uiFirstCounter = counter;
+      uiLastCounter = counter;
+      uiPrevCounter = counter;
+      ptime_prevFrame = frameTime;
+      uiNumAccounted = 0;
+      return;
+    }
+
+  // frames lost to timeouts or short reads since the previous frame are
+  // counted already, and the interval includes the capture restart
+  uint32_t numAccounted = uiNumAccounted;
+  uiNumAccounted = 0;
+  double dt = (frameTime - ptime_prevFrame).total_microseconds() / 1000000.0;
+  ptime_prevFrame = frameTime;
+  if( (dExpectedPeriod <= 0.0) && (dt > 0.0) && (numAccounted == 0) )
+    {
+      // external trigger: take the first interval as the period
+      dExpectedPeriod = dt;
+    }
+  bool isLate = (numAccounted == 0) && (dExpectedPeriod > 0.0) && (dt > (1.0 + tolerance) * dExpectedPeriod);
+
+  if( hasCounter )
+    {
+      uint32_t step = counter - uiPrevCounter;
+      if( counter == uiPrevCounter )
+	{
+	  uiNumDuplicates++;
+	  addEvent( "duplicate", index, counter, uiPrevCounter, 0, dt );
+	}
+      else if( (int32_t)step < 0 )
+	{
+	  uiNumOutOfOrder++;
+	  addEvent( "out_of_order", index, counter, uiPrevCounter, 0, dt );
+	}
+      else if( step - 1 > numAccounted )
+	{
+	  uint32_t missing = step - 1 - numAccounted;
+	  uiNumGaps++;
+	  uiNumMissing += missing;
+	  addEvent( "gap", index, counter, uiPrevCounter, missing, dt );
+	}
+      else if( isLate )
+	{
+	  uiNumLate++;
+	  addEvent( "late", index, counter, uiPrevCounter, 0, dt );
+	}
+      uiPrevCounter = counter;
+      uiLastCounter = counter;
+    }
+  else if( isLate )
+    {
+      uint32_t missing = (uint32_t)std::lround( dt / dExpectedPeriod ) - 1;
+      uiNumTimeGaps++;
+      uiNumMissing += missing;
+      addEvent( "time_gap", index, 0, 0, missing, dt );
+    }
+}
+
+//--------------------------------------------------------------
+
+void FliIntegrityC::addShortRead( uint32_t index, uint32_t sizeGrabbed, uint32_t sizeExpected )
+{
+  uiNumShortReads++;
+  uiNumAccounted++;
+  addEvent( "short_read", index, sizeGrabbed, sizeExpected, 1, 0.0 );
+}
+
+//--------------------------------------------------------------
+
+void FliIntegrityC::addTimeout( uint32_t index, uint32_t timeoutMs )
+{
+  uiNumTimeouts++;
+  uiNumAccounted++;
+  addEvent( "timeout", index, 0, 0, 1, timeoutMs / 1000.0 );
+}
+
+//--------------------------------------------------------------
+/// true if no frame is known to be missing or broken
+bool FliIntegrityC::isClean()
+{
+  return (uiNumGaps == 0) && (uiNumDuplicates == 0) && (uiNumOutOfOrder == 0)
+    && (uiNumTimeGaps == 0) && (uiNumShortReads == 0) && (uiNumTimeouts == 0);
+}
+
+//--------------------------------------------------------------
+
+void FliIntegrityC::printSummary( const std::string& str_tag )
+{
+  printf( "%sIntegrity: %s, %u frames, %u gaps (%u frames missing), %u duplicates, %u out of order, "
+	  "%u late, %u short reads, %u timeouts\n",
+	  str_tag.c_str(), isClean() ? "OK" : "PROBLEMS", uiNumFrames, uiNumGaps + uiNumTimeGaps, uiNumMissing,
+	  uiNumDuplicates, uiNumOutOfOrder, uiNumLate, uiNumShortReads, uiNumTimeouts );
+}
+
+//--------------------------------------------------------------
+/// write the report as JSON, str_countersJson is added as "counters" unless empty
+/// return true if succeeded, false if failed
+bool FliIntegrityC::writeReport( const std::string& fileName, const std::string& str_camera,
+				 uint32_t numRequested, uint32_t numWritten, uint32_t numWriteErrors,
+				 const std::string& str_countersJson )
+{
+  std::ofstream os( fileName.c_str() );
+  if( ! os.is_open() )
+    {
+      std::cerr << "FliIntegrityC::writeReport() ERROR: cannot open " << fileName << std::endl;
+      return false;
+    }
+  boost::posix_time::ptime ptime_end = boost::posix_time::microsec_clock::universal_time();
+
+  os << "{\n"
+     << "  \"camera\": \"" << str_camera << "\",\n"
+     << "  \"start\": \"" << to_iso_extended_string( ptime_start ) << "Z\",\n"
+     << "  \"end\": \"" << to_iso_extended_string( ptime_end ) << "Z\",\n"
+     << "  \"clean\": " << (isClean() ? "true" : "false") << ",\n"
+     << "  \"frames_requested\": " << numRequested << ",\n"
+     << "  \"frames_captured\": " << uiNumFrames << ",\n"
+     << "  \"frames_written\": " << numWritten << ",\n"
+     << "  \"write_errors\": " << numWriteErrors << ",\n"
+     << "  \"expected_period_s\": " << dExpectedPeriod << ",\n"
+     << "  \"frame_counter\": " << (hasCounter ? "true" : "false") << ",\n"
+     << "  \"first_counter\": " << uiFirstCounter << ",\n"
+     << "  \"last_counter\": " << uiLastCounter << ",\n"
+     << "  \"gaps\": " << uiNumGaps << ",\n"
+     << "  \"time_gaps\": " << uiNumTimeGaps << ",\n"
+     << "  \"missing_frames\": " << uiNumMissing << ",\n"
+     << "  \"duplicates\": " << uiNumDuplicates << ",\n"
+     << "  \"out_of_order\": " << uiNumOutOfOrder << ",\n"
+     << "  \"late_frames\": " << uiNumLate << ",\n"
+     << "  \"short_reads\": " << uiNumShortReads << ",\n"
+     << "  \"timeouts\": " << uiNumTimeouts << ",\n"
+     << "  \"events_dropped\": " << uiNumEventsDropped << ",\n";
+  if( ! str_countersJson.empty() )
+    {
+      os << "  \"counters\": " << str_countersJson << ",\n";
+    }
+  os << "  \"events\": [";
+  for( size_t i = 0; i < events.size(); i++ )
+    {
+      const EventC& e = events[i];
+      os << (i ? ",\n" : "\n")
+	 << "    {\"type\": \"" << e.str_type << "\", \"index\": " << e.index;
+      if( e.str_type == "short_read" )
+	{
+	  os << ", \"bytes\": " << e.counter << ", \"expected_bytes\": " << e.prevCounter;
+	}
+      else if( e.str_type == "timeout" )
+	{
+	  os << ", \"timeout_s\": " << e.dt;
+	}
+      else
+	{
+	  os << ", \"counter\": " << e.counter << ", \"prev_counter\": " << e.prevCounter
+	     << ", \"missing\": " << e.missing << ", \"dt_s\": " << e.dt;
+	}
+      os << "}";
+    }
+  os << (events.empty() ? "]\n" : "\n  ]\n") << "}\n";
+  os.close();
+  return !os.fail();
+}
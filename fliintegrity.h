@@ -0,0 +1,74 @@
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define FLIINTEGRITY_MAX_EVENTS (1000)
+
+/// Per-run check that no frames went missing between the camera and the disk.
+/// Consecutive camera frame counters (from the frame meta data) must increase
+/// by one: a larger step is a gap, the same value a duplicate, a smaller one
+/// out of order. Frame time stamps are compared against the expected frame
+/// period: frames arriving much later than expected with contiguous counters
+/// are "late" (host side delay), without a usable counter the time delta alone
+/// estimates the number of missing frames. Short USB reads and frame waits
+/// that ran into their deadline are counted too; the frame after them is not
+/// checked against the time delta and its counter gap is reduced by them, so
+/// a lost frame is only counted once.
+/// writeReport() stores the result as JSON next to the images.
+class FliIntegrityC
+{
+ private:
+  class EventC
+  {
+  public:
+    std::string str_type;   // gap, duplicate, out_of_order, late, time_gap, short_read, timeout
+    uint32_t index;         // frame index in the run
+    uint32_t counter;
+    uint32_t prevCounter;
+    uint32_t missing;
+    double dt;              // time since previous frame [s]
+  };
+  std::vector<EventC> events;
+  uint32_t uiNumEventsDropped;
+  bool isFirstFrame;
+  uint32_t uiPrevCounter;
+  boost::posix_time::ptime ptime_prevFrame;
+  boost::posix_time::ptime ptime_start;
+  double dExpectedPeriod;   // [s], 0 ... unknown, learned from the first delta
+  bool hasCounter;
+  uint32_t uiNumAccounted;  // timeouts and short reads since the previous frame
+
+  void addEvent( const char* type, uint32_t index, uint32_t counter, uint32_t prevCounter,
+		 uint32_t missing, double dt );
+
+ public:
+  double tolerance;         // late if dt > (1 + tolerance) * period
+
+  uint32_t uiNumFrames;
+  uint32_t uiFirstCounter;
+  uint32_t uiLastCounter;
+  uint32_t uiNumGaps;
+  uint32_t uiNumMissing;
+  uint32_t uiNumDuplicates;
+  uint32_t uiNumOutOfOrder;
+  uint32_t uiNumLate;
+  uint32_t uiNumTimeGaps;
+  uint32_t uiNumShortReads;
+  uint32_t uiNumTimeouts;
+
+  FliIntegrityC();
+
+  void reset( double expectedPeriod, bool hasFrameCounter );
+  void addFrame( uint32_t index, uint32_t counter, boost::posix_time::ptime frameTime );
+  void addShortRead( uint32_t index, uint32_t sizeGrabbed, uint32_t sizeExpected );
+  void addTimeout( uint32_t index, uint32_t timeoutMs );
+  bool isClean();
+  void printSummary( const std::string& str_tag );
+  bool writeReport( const std::string& fileName, const std::string& str_camera,
+		    uint32_t numRequested, uint32_t numWritten, uint32_t numWriteErrors,
+		    const std::string& str_countersJson = "" );
+};
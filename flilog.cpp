@@ -0,0 +1,522 @@
+#include "flilog.h"
+
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+
+#define FLILOG_DRAIN_MS (20)
+
+std::atomic<int> FliLogC::level( FLILOG_INFO );
+std::atomic<bool> FliLogC::isRunning( false );
+std::mutex FliLogC::mtxRings;
+std::vector< std::unique_ptr<FliLogC::RingC> > FliLogC::rings;
+thread_local FliLogC::ThreadRingC FliLogC::threadRing;
+uint32_t FliLogC::uiNumThreads = 0;
+std::thread FliLogC::drainer;
+std::mutex FliLogC::mtxDrainer;
+std::condition_variable FliLogC::cvDrainer;
+bool FliLogC::isExit = false;
+int FliLogC::format = FLILOG_FORMAT_TEXT;
+FILE* FliLogC::out = NULL;
+
+static const char* levelNames[] = { "error", "warn", "info", "debug" };
+static const char* formatNames[] = { "text", "json", "binary" };
+
+/// JSON names of the events and of their arguments a0..a2 and text
+static const struct
+{
+  const char* name;
+  const char* args[3];
+  const char* text;
+} eventDefs[FLILOG_NUM_EVENTS] =
+  {
+    { "message",       { NULL, NULL, NULL },                       "msg" },
+    { "frame_wait",    { "index", "ext_trigger", NULL },           NULL },
+    { "frame",         { "bytes", "expected_bytes", NULL },        NULL },
+    { "frame_aborted", { NULL, NULL, NULL },                       NULL },
+    { "frame_time",    { "index", "ext_trigger", NULL },           "time_stamp" },
+    { "file_write",    { "index", "channel", "stacked" },          "file" },
+    { "frame_alloc",   { "image_bytes", "frame_bytes", NULL },     NULL },
+    { "log_dropped",   { "count", NULL, NULL },                    NULL },
+  };
+
+//--------------------------------------------------------------
+
+FliLogC::ThreadRingC::~ThreadRingC()
+{
+  if( ring != NULL )
+    {
+      // after its last event, drain() still writes what is left
+      ring->isInUse.store( false, std::memory_order_release );
+    }
+}
+
+//--------------------------------------------------------------
+/// start the background writer, fileName "" ... stdout (not for binary)
+/// return true if succeeded, false if failed
+bool FliLogC::start( int logFormat, const std::string& fileName )
+{
+  if( drainer.joinable() )
+    {
+      return false;
+    }
+  if( fileName.empty() )
+    {
+      if( logFormat == FLILOG_FORMAT_BINARY )
+	{
+	  std::cerr << "FliLogC::start() ERROR: the binary log needs a file" << std::endl;
+	  return false;
+	}
+      out = stdout;
+    }
+  else
+    {
+      out = fopen( fileName.c_str(), (logFormat == FLILOG_FORMAT_BINARY) ? "ab" : "a" );
+      if( out == NULL )
+	{
+	  std::cerr << "FliLogC::start() ERROR: cannot open " << fileName << std::endl;
+	  return false;
+	}
+      if( (logFormat == FLILOG_FORMAT_BINARY) && (ftell( out ) == 0) )
+	{
+	  char magic[8] = FLILOG_BINARY_MAGIC;
+	  uint32_t header[2] = { (uint32_t)sizeof(FliLogRecordC), 0 };
+	  fwrite( magic, sizeof(magic), 1, out );
+	  fwrite( header, sizeof(header), 1, out );
+	}
+    }
+  format = logFormat;
+  isExit = false;
+  drainer = std::thread( &FliLogC::drainLoop );
+  isRunning = true;
+  // exit() is the usual way out of flictl
+  static bool isAtExitSet = false;
+  if( !isAtExitSet )
+    {
+      atexit( &FliLogC::stop );
+      isAtExitSet = true;
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+/// write everything logged so far and stop the background writer,
+/// later events are written synchronously to stdout
+void FliLogC::stop()
+{
+  if( ! drainer.joinable() )
+    {
+      return;
+    }
+  isRunning = false;
+  {
+    std::lock_guard<std::mutex> lock( mtxDrainer );
+    isExit = true;
+  }
+  cvDrainer.notify_all();
+  drainer.join();
+  if( out != stdout )
+    {
+      fclose( out );
+    }
+  out = NULL;
+}
+
+//--------------------------------------------------------------
+/// write the events logged so far now, eg. before printing a summary
+void FliLogC::flush()
+{
+  if( isRunning )
+    {
+      drain();
+    }
+}
+
+//--------------------------------------------------------------
+
+void FliLogC::setLevel( int logLevel )
+{
+  level = logLevel;
+}
+
+//--------------------------------------------------------------
+/// tag of the events of the calling thread, eg. the camera it captures from
+void FliLogC::setThreadTag( const std::string& tag )
+{
+  RingC* ring = getThreadRing();
+  strncpy( ring->tag, tag.c_str(), FLILOG_TAG_SIZE - 1 );
+  ring->tag[FLILOG_TAG_SIZE - 1] = 0;
+}
+
+//--------------------------------------------------------------
+/// return true if succeeded, false if failed
+bool FliLogC::parseLevel( const std::string& str, int* logLevel )
+{
+  for( int i = 0; i <= FLILOG_DEBUG; i++ )
+    {
+      if( str == levelNames[i] )
+	{
+	  *logLevel = i;
+	  return true;
+	}
+    }
+  std::cerr << "FliLogC::parseLevel() ERROR: unknown log level " << str << ", expected error, warn, info or debug" << std::endl;
+  return false;
+}
+
+//--------------------------------------------------------------
+/// return true if succeeded, false if failed
+bool FliLogC::parseFormat( const std::string& str, int* logFormat )
+{
+  for( int i = 0; i <= FLILOG_FORMAT_BINARY; i++ )
+    {
+      if( str == formatNames[i] )
+	{
+	  *logFormat = i;
+	  return true;
+	}
+    }
+  std::cerr << "FliLogC::parseFormat() ERROR: unknown log format " << str << ", expected text, json or binary" << std::endl;
+  return false;
+}
+
+//--------------------------------------------------------------
+/// the ring of the calling thread with its first event, a drained ring left
+/// by a finished thread or a new one
+FliLogC::RingC* FliLogC::getThreadRing()
+{
+  if( threadRing.ring == NULL )
+    {
+      // drain() holds the lock too, so a drained ring stays drained here
+      std::lock_guard<std::mutex> lock( mtxRings );
+      for( size_t i = 0; (i < rings.size()) && (threadRing.ring == NULL); i++ )
+	{
+	  RingC* ring = rings[i].get();
+	  if( !ring->isInUse.load( std::memory_order_acquire )
+	      && (ring->tail.load( std::memory_order_relaxed ) == ring->head.load( std::memory_order_relaxed ))
+	      && (ring->uiNumDropped.load( std::memory_order_relaxed ) == 0) )
+	    {
+	      threadRing.ring = ring;
+	    }
+	}
+      if( threadRing.ring == NULL )
+	{
+	  RingC* ring = new RingC;
+	  ring->head = 0;
+	  ring->tail = 0;
+	  ring->uiNumDropped = 0;
+	  rings.push_back( std::unique_ptr<RingC>( ring ) );
+	  threadRing.ring = ring;
+	}
+      threadRing.ring->thread = uiNumThreads++;
+      threadRing.ring->tag[0] = 0;
+      threadRing.ring->isInUse = true;
+    }
+  return threadRing.ring;
+}
+
+//--------------------------------------------------------------
+
+void FliLogC::fill( FliLogRecordC* record, int eventLevel, uint16_t event, const char* tag,
+		    int64_t a0, int64_t a1, int64_t a2, const char* text )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_REALTIME, &ts );
+  record->timeNs = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  record->event = event;
+  record->level = eventLevel;
+  record->reserved = 0;
+  record->a0 = a0;
+  record->a1 = a1;
+  record->a2 = a2;
+  strncpy( record->tag, tag, FLILOG_TAG_SIZE - 1 );
+  record->tag[FLILOG_TAG_SIZE - 1] = 0;
+  strncpy( record->text, (text != NULL) ? text : "", FLILOG_TEXT_SIZE - 1 );
+  record->text[FLILOG_TEXT_SIZE - 1] = 0;
+}
+
+//--------------------------------------------------------------
+/// record an event without checking the level, use event()
+void FliLogC::log( int eventLevel, uint16_t event, const char* tag,
+		   int64_t a0, int64_t a1, int64_t a2, const char* text )
+{
+  RingC* ring = getThreadRing();
+  if( !isRunning )
+    {
+      FliLogRecordC record;
+      std::string line;
+      fill( &record, eventLevel, event, (tag != NULL) ? tag : ring->tag, a0, a1, a2, text );
+      record.thread = ring->thread;
+      formatText( record, &line );
+      fputs( line.c_str(), stdout );
+      return;
+    }
+  uint64_t head = ring->head.load( std::memory_order_relaxed );
+  if( head - ring->tail.load( std::memory_order_acquire ) >= FLILOG_RING_SIZE )
+    {
+      ring->uiNumDropped.fetch_add( 1, std::memory_order_relaxed );
+      return;
+    }
+  FliLogRecordC* record = &(ring->records[head & (FLILOG_RING_SIZE - 1)]);
+  fill( record, eventLevel, event, (tag != NULL) ? tag : ring->tag, a0, a1, a2, text );
+  record->thread = ring->thread;
+  ring->head.store( head + 1, std::memory_order_release );
+}
+
+//--------------------------------------------------------------
+
+void FliLogC::drainLoop()
+{
+  std::unique_lock<std::mutex> lock( mtxDrainer );
+  while( !isExit )
+    {
+      cvDrainer.wait_for( lock, std::chrono::milliseconds( FLILOG_DRAIN_MS ), []{ return isExit; } );
+      lock.unlock();
+      drain();
+      lock.lock();
+    }
+}
+
+//--------------------------------------------------------------
+/// write the records of all rings, merged by time
+void FliLogC::drain()
+{
+  std::vector<FliLogRecordC> batch;
+  std::lock_guard<std::mutex> lock( mtxRings );
+
+  for( size_t i = 0; i < rings.size(); i++ )
+    {
+      RingC* ring = rings[i].get();
+      uint64_t tail = ring->tail.load( std::memory_order_relaxed );
+      uint64_t head = ring->head.load( std::memory_order_acquire );
+      for( ; tail < head; tail++ )
+	{
+	  batch.push_back( ring->records[tail & (FLILOG_RING_SIZE - 1)] );
+	}
+      ring->tail.store( tail, std::memory_order_release );
+      uint64_t numDropped = ring->uiNumDropped.exchange( 0, std::memory_order_relaxed );
+      if( numDropped > 0 )
+	{
+	  FliLogRecordC record;
+	  fill( &record, FLILOG_WARN, FLILOG_EV_DROPPED, ring->tag, numDropped, 0, 0, NULL );
+	  record.thread = ring->thread;
+	  batch.push_back( record );
+	}
+    }
+  if( batch.empty() )
+    {
+      return;
+    }
+  std::stable_sort( batch.begin(), batch.end(),
+		    []( const FliLogRecordC& a, const FliLogRecordC& b ){ return a.timeNs < b.timeNs; } );
+  for( size_t i = 0; i < batch.size(); i++ )
+    {
+      write( batch[i] );
+    }
+  fflush( out );
+}
+
+//--------------------------------------------------------------
+
+void FliLogC::write( const FliLogRecordC& record )
+{
+  std::string line;
+  switch( format )
+    {
+    case FLILOG_FORMAT_BINARY:
+      fwrite( &record, sizeof(record), 1, out );
+      return;
+    case FLILOG_FORMAT_JSON:
+      formatJson( record, &line );
+      break;
+    default:
+      formatText( record, &line );
+      break;
+    }
+  fputs( line.c_str(), out );
+}
+
+//--------------------------------------------------------------
+/// the console line(s) of an event, as flictl printed them before
+void FliLogC::formatText( const FliLogRecordC& record, std::string* line )
+{
+  char buf[FLILOG_TEXT_SIZE + 256];
+  const char* gain = (record.a1 == 'L') ? "low" : ((record.a1 == 'B') ? "low and high" : "high");
+
+  switch( record.event )
+    {
+    case FLILOG_EV_FRAME_WAIT:
+      snprintf( buf, sizeof(buf), "%s%sImage # %lld\n", record.tag,
+		record.a1 ? "Waiting for external trigger... " : "", (long long)record.a0 );
+      break;
+    case FLILOG_EV_FRAME_GOT:
+      if( record.a0 == record.a1 )
+	{
+	  snprintf( buf, sizeof(buf), "%sFliCameraC::getImage(): Got a frame, %lld bytes\n"
+		    "%sFliCameraC::getImage(): Frame OK\n", record.tag, (long long)record.a0, record.tag );
+	}
+      else
+	{
+	  snprintf( buf, sizeof(buf), "%sFliCameraC::getImage(): Got a frame, %lld bytes\n"
+		    "%sFliCameraC::getImage(): frame has different size than expected (%lld bytes)\n",
+		    record.tag, (long long)record.a0, record.tag, (long long)record.a1 );
+	}
+      break;
+    case FLILOG_EV_FRAME_ABORTED:
+      snprintf( buf, sizeof(buf), "%sFliCameraC::getImage(): frame wait aborted\n", record.tag );
+      break;
+    case FLILOG_EV_FRAME_TIME:
+      snprintf( buf, sizeof(buf), "%s  %s frame capture time = %s\n", record.tag,
+		record.a1 ? "Externally triggered" : "Approx internally triggered", record.text );
+      break;
+    case FLILOG_EV_FILE_WRITE:
+      if( record.a1 == 'M' )
+	{
+	  snprintf( buf, sizeof(buf), "%s  Write binary meta data as %s\n", record.tag, record.text );
+	}
+      else if( record.a2 > 0 )
+	{
+	  snprintf( buf, sizeof(buf), "%s  Write %lld stacked %s gain frames as %s\n", record.tag,
+		    (long long)record.a2, gain, record.text );
+	}
+      else
+	{
+	  snprintf( buf, sizeof(buf), "%s  Write %s gain image as %s\n", record.tag, gain, record.text );
+	}
+      break;
+    case FLILOG_EV_FRAME_ALLOC:
+      snprintf( buf, sizeof(buf), "%sFliCameraC::allocFrameFullRes() DEBUG: image %lld bytes, frame buffer %lld bytes\n",
+		record.tag, (long long)record.a0, (long long)record.a1 );
+      break;
+    case FLILOG_EV_DROPPED:
+      snprintf( buf, sizeof(buf), "%sWARNING: %lld log events dropped, log buffer full\n", record.tag, (long long)record.a0 );
+      break;
+    default:
+      snprintf( buf, sizeof(buf), "%s%s\n", record.tag, record.text );
+      break;
+    }
+  *line = buf;
+}
+
+//--------------------------------------------------------------
+
+static void appendJsonString( std::string* line, const char* str )
+{
+  line->push_back( '"' );
+  for( const char* p = str; *p; p++ )
+    {
+      if( (*p == '"') || (*p == '\\') )
+	{
+	  line->push_back( '\\' );
+	  line->push_back( *p );
+	}
+      else if( (unsigned char)*p < 0x20 )
+	{
+	  char esc[8];
+	  snprintf( esc, sizeof(esc), "\\u%04x", *p );
+	  line->append( esc );
+	}
+      else
+	{
+	  line->push_back( *p );
+	}
+    }
+  line->push_back( '"' );
+}
+
+//--------------------------------------------------------------
+/// one JSON object per event, the camera tag without brackets
+void FliLogC::formatJson( const FliLogRecordC& record, std::string* line )
+{
+  char buf[96];
+  time_t sec = record.timeNs / 1000000000;
+  struct tm tm;
+  gmtime_r( &sec, &tm );
+  strftime( buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm );
+
+  line->assign( "{\"time\":\"" );
+  line->append( buf );
+  snprintf( buf, sizeof(buf), ".%09lldZ\",\"level\":\"%s\",\"thread\":%u", (long long)(record.timeNs % 1000000000),
+	    levelNames[std::min( (int)record.level, FLILOG_DEBUG )], record.thread );
+  line->append( buf );
+
+  std::string camera( record.tag );
+  camera.erase( std::remove_if( camera.begin(), camera.end(),
+				[]( char c ){ return (c == '[') || (c == ']') || (c == ' '); } ), camera.end() );
+  if( ! camera.empty() )
+    {
+      line->append( ",\"camera\":" );
+      appendJsonString( line, camera.c_str() );
+    }
+  if( record.event >= FLILOG_NUM_EVENTS )
+    {
+      snprintf( buf, sizeof(buf), ",\"event\":%u}\n", record.event );
+      line->append( buf );
+      return;
+    }
+  line->append( ",\"event\":\"" );
+  line->append( eventDefs[record.event].name );
+  line->push_back( '"' );
+  const int64_t args[3] = { record.a0, record.a1, record.a2 };
+  for( int i = 0; i < 3; i++ )
+    {
+      if( eventDefs[record.event].args[i] == NULL )
+	{
+	  continue;
+	}
+      if( (record.event == FLILOG_EV_FILE_WRITE) && (i == 1) )
+	{
+	  // the channel letter
+	  snprintf( buf, sizeof(buf), ",\"channel\":\"%c\"", (char)args[i] );
+	}
+      else
+	{
+	  snprintf( buf, sizeof(buf), ",\"%s\":%lld", eventDefs[record.event].args[i], (long long)args[i] );
+	}
+      line->append( buf );
+    }
+  if( eventDefs[record.event].text != NULL )
+    {
+      line->append( ",\"" );
+      line->append( eventDefs[record.event].text );
+      line->append( "\":" );
+      appendJsonString( line, record.text );
+    }
+  line->append( "}\n" );
+}
+
+//--------------------------------------------------------------
+/// print a binary log as JSON lines to stdout
+/// return true if succeeded, false if failed
+bool FliLogC::decode( const std::string& fileName )
+{
+  FILE* in = fopen( fileName.c_str(), "rb" );
+  if( in == NULL )
+    {
+      std::cerr << "FliLogC::decode() ERROR: cannot open " << fileName << std::endl;
+      return false;
+    }
+  char magic[8];
+  uint32_t header[2];
+  if( (fread( magic, sizeof(magic), 1, in ) != 1) || (fread( header, sizeof(header), 1, in ) != 1)
+      || (strncmp( magic, FLILOG_BINARY_MAGIC, sizeof(magic) ) != 0) || (header[0] != sizeof(FliLogRecordC)) )
+    {
+      std::cerr << "FliLogC::decode() ERROR: " << fileName << " is not a binary log of this flictl version" << std::endl;
+      fclose( in );
+      return false;
+    }
+  FliLogRecordC record;
+  std::string line;
+  while( fread( &record, sizeof(record), 1, in ) == 1 )
+    {
+      record.tag[FLILOG_TAG_SIZE - 1] = 0;
+      record.text[FLILOG_TEXT_SIZE - 1] = 0;
+      formatJson( record, &line );
+      fputs( line.c_str(), stdout );
+    }
+  fclose( in );
+  return true;
+}
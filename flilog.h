@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#define FLILOG_ERROR (0)
+#define FLILOG_WARN  (1)
+#define FLILOG_INFO  (2)
+#define FLILOG_DEBUG (3)
+
+#define FLILOG_FORMAT_TEXT   (0)  // the classic console lines
+#define FLILOG_FORMAT_JSON   (1)  // one JSON object per line
+#define FLILOG_FORMAT_BINARY (2)  // FliLogRecordC as is, see decode()
+
+// event ids, the meaning of a0..a2 and text is given per event
+#define FLILOG_EV_MESSAGE       (0)  // text
+#define FLILOG_EV_FRAME_WAIT    (1)  // a0 frame index, a1 external trigger
+#define FLILOG_EV_FRAME_GOT     (2)  // a0 bytes read, a1 bytes expected
+#define FLILOG_EV_FRAME_ABORTED (3)
+#define FLILOG_EV_FRAME_TIME    (4)  // a0 frame index, a1 external trigger, text time stamp
+#define FLILOG_EV_FILE_WRITE    (5)  // a0 frame index, a1 channel 'L', 'H', 'B' (both, one file) or 'M' (meta data), a2 frames stacked, text file name
+#define FLILOG_EV_FRAME_ALLOC   (6)  // a0 image bytes, a1 frame bytes
+#define FLILOG_EV_DROPPED       (7)  // a0 events lost because a thread buffer was full
+#define FLILOG_NUM_EVENTS       (8)
+
+#define FLILOG_RING_SIZE   (1024)  // records per thread, power of two
+#define FLILOG_TAG_SIZE    (24)
+#define FLILOG_TEXT_SIZE   (192)
+#define FLILOG_BINARY_MAGIC "FLILOG1"
+
+/// one log event, also the record layout of the binary format (host byte order)
+class FliLogRecordC
+{
+ public:
+  int64_t timeNs;           // UTC [ns] since the epoch
+  uint16_t event;
+  uint8_t level;
+  uint8_t reserved;
+  uint32_t thread;          // index of the logging thread, in order of their first event
+  int64_t a0;
+  int64_t a1;
+  int64_t a2;
+  char tag[FLILOG_TAG_SIZE];     // camera tag, eg. "[SN0001] "
+  char text[FLILOG_TEXT_SIZE];   // truncated if longer
+};
+
+/// Asynchronous event log of the capture path.
+/// event() fills a fixed size record into a ring buffer owned by the calling
+/// thread (single producer, single consumer, no lock, no system call) and
+/// returns; a background thread drains all rings every few milliseconds,
+/// merges the records by time and writes them as text, JSON lines or binary.
+/// A full ring drops the event and counts it, logging never blocks a frame.
+/// The ring of a finished thread goes to the next new thread once drained.
+/// Events below the log level cost one atomic load. Before start() and after
+/// stop() events are written synchronously as text to stdout.
+class FliLogC
+{
+ private:
+  class RingC
+  {
+  public:
+    FliLogRecordC records[FLILOG_RING_SIZE];
+    std::atomic<uint64_t> head;   // next record to write, producer only
+    std::atomic<uint64_t> tail;   // next record to read, consumer only
+    std::atomic<uint64_t> uiNumDropped;
+    std::atomic<bool> isInUse;    // false ... its thread ended, free once drained
+    uint32_t thread;
+    char tag[FLILOG_TAG_SIZE];
+  };
+
+  /// returns the ring of a thread when the thread ends
+  class ThreadRingC
+  {
+  public:
+    RingC* ring = NULL;
+    ~ThreadRingC();
+  };
+
+  static std::atomic<int> level;
+  static std::atomic<bool> isRunning;
+  static std::mutex mtxRings;    // the list of rings, also makes drain() the only consumer
+  static std::vector< std::unique_ptr<RingC> > rings;
+  static thread_local ThreadRingC threadRing;
+  static uint32_t uiNumThreads;  // guarded by mtxRings
+  static std::thread drainer;
+  static std::mutex mtxDrainer;
+  static std::condition_variable cvDrainer;
+  static bool isExit;
+  static int format;
+  static FILE* out;
+
+  static RingC* getThreadRing();
+  static void fill( FliLogRecordC* record, int level, uint16_t event, const char* tag,
+		    int64_t a0, int64_t a1, int64_t a2, const char* text );
+  static void drainLoop();
+  static void drain();
+  static void write( const FliLogRecordC& record );
+
+ public:
+  static bool start( int format, const std::string& fileName );
+  static void stop();
+  static void flush();
+  static void setLevel( int level );
+  static void setThreadTag( const std::string& tag );
+  static bool parseLevel( const std::string& str, int* level );
+  static bool parseFormat( const std::string& str, int* format );
+  static bool decode( const std::string& fileName );
+  static void formatText( const FliLogRecordC& record, std::string* line );
+  static void formatJson( const FliLogRecordC& record, std::string* line );
+
+  static inline bool isEnabled( int eventLevel )
+  {
+    return eventLevel <= level.load( std::memory_order_relaxed );
+  }
+
+  /// record an event, tag NULL ... tag of the calling thread
+  static inline void event( int eventLevel, uint16_t event, const char* tag = NULL,
+			    int64_t a0 = 0, int64_t a1 = 0, int64_t a2 = 0, const char* text = NULL )
+  {
+    if( isEnabled( eventLevel ) )
+      {
+	log( eventLevel, event, tag, a0, a1, a2, text );
+      }
+  }
+
+  static void log( int eventLevel, uint16_t event, const char* tag,
+		   int64_t a0, int64_t a1, int64_t a2, const char* text );
+};
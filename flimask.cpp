@@ -0,0 +1,206 @@
+#include "flimask.h"
+
+#include <stdlib.h>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+//--------------------------------------------------------------
+
+FliSkyMaskC::FliSkyMaskC()
+{
+  clear();
+}
+
+//--------------------------------------------------------------
+/// no mask, all pixels are converted and written
+void FliSkyMaskC::clear()
+{
+  type = FLIMASK_NONE;
+  str_spec.clear();
+  width = height = 0;
+  cx = cy = r = 0.0;
+  spans.clear();
+  rowSpans.clear();
+  uiNumSkyPixels = 0;
+}
+
+//--------------------------------------------------------------
+/// comma separated numbers
+/// return true if succeeded, false if failed
+bool FliSkyMaskC::parseNumbers( const std::string& str, std::vector<double>* numbers )
+{
+  std::istringstream is( str );
+  std::string item;
+
+  numbers->clear();
+  while( std::getline( is, item, ',' ) )
+    {
+      char* end = NULL;
+      double value = strtod( item.c_str(), &end );
+      if( item.empty() || (*end != '\0') || !std::isfinite( value ) )
+	{
+	  return false;
+	}
+      numbers->push_back( value );
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+/// add the pixels with their centre in [xMin, xMax] to the current row,
+/// spans are added from left to right
+void FliSkyMaskC::addSpan( double xMin, double xMax )
+{
+  double start = std::ceil( xMin - 0.5 );
+  double end = std::floor( xMax - 0.5 ) + 1.0;
+  start = std::max( start, 0.0 );
+  end = std::min( end, (double)width );
+  if( end <= start )
+    {
+      return;
+    }
+  // whole pixel pairs
+  FliSpanC span;
+  span.start = (uint32_t)start & ~1u;
+  span.end = std::min( ((uint32_t)end + 1) & ~1u, width );
+  if( (spans.size() > rowSpans.back()) && (span.start <= spans.back().end) )
+    {
+      // widening made it meet the previous span of the row
+      uiNumSkyPixels += std::max( span.end, spans.back().end ) - spans.back().end;
+      spans.back().end = std::max( span.end, spans.back().end );
+      return;
+    }
+  spans.push_back( span );
+  uiNumSkyPixels += span.end - span.start;
+}
+
+//--------------------------------------------------------------
+/// build the spans of an imageWidth x imageHeight image
+/// return true if succeeded, false if the spec is invalid (mask cleared)
+bool FliSkyMaskC::parse( const std::string& spec, uint32_t imageWidth, uint32_t imageHeight )
+{
+  std::vector<double> numbers;
+  size_t colon = spec.find( ':' );
+  std::string name = spec.substr( 0, colon );
+
+  clear();
+  if( (colon == std::string::npos) || !parseNumbers( spec.substr( colon + 1 ), &numbers )
+      || (!((name == "circle") && (numbers.size() == 3) && (numbers[2] > 0.0))
+	  && !((name == "polygon") && (numbers.size() >= 6) && (numbers.size() % 2 == 0))) )
+    {
+      std::cerr << "FliSkyMaskC::parse() ERROR: invalid sky mask '" << spec
+		<< "', expected circle:cx,cy,r or polygon:x0,y0,x1,y1,x2,y2,..." << std::endl;
+      return false;
+    }
+  type = (name == "circle") ? FLIMASK_CIRCLE : FLIMASK_POLYGON;
+  str_spec = spec;
+  width = imageWidth;
+  height = imageHeight;
+  rowSpans.reserve( height + 1 );
+  rowSpans.push_back( 0 );
+
+  std::vector<double> crossings;
+  for( uint32_t y = 0; y < height; y++ )
+    {
+      double yc = y + 0.5;
+      if( type == FLIMASK_CIRCLE )
+	{
+	  cx = numbers[0];
+	  cy = numbers[1];
+	  r = numbers[2];
+	  double dy = yc - cy;
+	  if( std::fabs( dy ) <= r )
+	    {
+	      double half = std::sqrt( r * r - dy * dy );
+	      addSpan( cx - half, cx + half );
+	    }
+	  rowSpans.push_back( spans.size() );
+	  continue;
+	}
+      // crossings of the row centre line with the polygon edges, an edge
+      // counts from its lower end up to but without its upper end
+      size_t numPoints = numbers.size() / 2;
+      crossings.clear();
+      for( size_t k = 0; k < numPoints; k++ )
+	{
+	  double x0 = numbers[2 * k], y0 = numbers[2 * k + 1];
+	  double x1 = numbers[(2 * k + 2) % numbers.size()], y1 = numbers[(2 * k + 3) % numbers.size()];
+	  if( (yc < std::min( y0, y1 )) || (yc >= std::max( y0, y1 )) )
+	    {
+	      continue;
+	    }
+	  crossings.push_back( x0 + (yc - y0) * (x1 - x0) / (y1 - y0) );
+	}
+      std::sort( crossings.begin(), crossings.end() );
+      for( size_t k = 0; k + 1 < crossings.size(); k += 2 )
+	{
+	  addSpan( crossings[k], crossings[k + 1] );
+	}
+      rowSpans.push_back( spans.size() );
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+
+bool FliSkyMaskC::isEnabled() const
+{
+  return type != FLIMASK_NONE;
+}
+
+//--------------------------------------------------------------
+
+int FliSkyMaskC::getType() const
+{
+  return type;
+}
+
+//--------------------------------------------------------------
+
+const char* FliSkyMaskC::getTypeName() const
+{
+  return (type == FLIMASK_CIRCLE) ? "circle" : ((type == FLIMASK_POLYGON) ? "polygon" : "none");
+}
+
+//--------------------------------------------------------------
+/// centre and radius [pixels] of a circle mask
+void FliSkyMaskC::getCircle( double* centerX, double* centerY, double* radius ) const
+{
+  *centerX = cx;
+  *centerY = cy;
+  *radius = r;
+}
+
+//--------------------------------------------------------------
+
+const std::string& FliSkyMaskC::getSpec() const
+{
+  return str_spec;
+}
+
+//--------------------------------------------------------------
+
+const FliSpanC* FliSkyMaskC::getSpans() const
+{
+  return rowSpans.empty() ? NULL : spans.data();
+}
+
+//--------------------------------------------------------------
+
+const uint32_t* FliSkyMaskC::getRowSpans() const
+{
+  return rowSpans.empty() ? NULL : rowSpans.data();
+}
+
+//--------------------------------------------------------------
+/// part of the image that is converted and written
+double FliSkyMaskC::getSkyFraction() const
+{
+  if( !isEnabled() || (width == 0) || (height == 0) )
+    {
+      return 1.0;
+    }
+  return (double)uiNumSkyPixels / ((double)width * height);
+}
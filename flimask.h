@@ -0,0 +1,50 @@
+#pragma once
+
+#include "flisensor.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define FLIMASK_NONE    (0)
+#define FLIMASK_CIRCLE  (1)
+#define FLIMASK_POLYGON (2)
+
+/// Sky area of a fisheye image as spans of pixels per row.
+/// Built from "circle:cx,cy,r" or "polygon:x0,y0,x1,y1,..." (pixel
+/// coordinates, the centre of pixel (0,0) is at (0.5,0.5)); a pixel belongs to
+/// the sky if its centre is inside. Polygons follow the even-odd rule: the
+/// edge crossings of a row, sorted, pair up into spans, so concave outlines
+/// (a horizon with buildings) get several spans in a row. Spans are widened to
+/// whole pixel pairs, the granularity of the packed 12 bit data, and merged
+/// where they meet.
+/// The converters unpack only the spans and zero the rest, so the masked
+/// corners cost neither conversion time nor space in compressed files.
+class FliSkyMaskC
+{
+ private:
+  int type;
+  std::string str_spec;
+  uint32_t width, height;
+  double cx, cy, r;                  // circle
+  std::vector<FliSpanC> spans;       // sky pixels, row by row
+  std::vector<uint32_t> rowSpans;    // row y has spans [rowSpans[y], rowSpans[y + 1]), empty ... no mask
+  uint64_t uiNumSkyPixels;
+
+  bool parseNumbers( const std::string& str, std::vector<double>* numbers );
+  void addSpan( double xMin, double xMax );
+
+ public:
+  FliSkyMaskC();
+
+  bool parse( const std::string& spec, uint32_t imageWidth, uint32_t imageHeight );
+  void clear();
+  bool isEnabled() const;
+  int getType() const;
+  const char* getTypeName() const;
+  void getCircle( double* centerX, double* centerY, double* radius ) const;
+  const std::string& getSpec() const;
+  const FliSpanC* getSpans() const;        // NULL ... no mask
+  const uint32_t* getRowSpans() const;     // height + 1 entries, NULL ... no mask
+  double getSkyFraction() const;
+};
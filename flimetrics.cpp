@@ -0,0 +1,469 @@
+#include "flimetrics.h"
+
+#include <sys/socket.h>
+#include <sys/statvfs.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#define FLIMETRICS_POLL_MS (200)  // how fast the exporter notices stop()
+
+static const double quantiles[] = { 0.5, 0.9, 0.99 };
+static const char* stageNames[FLIMETRICS_NUM_STAGES] = { "wait", "convert", "write" };
+
+//--------------------------------------------------------------
+
+FliLatencyC::FliLatencyC()
+{
+  for( int k = 0; k < FLIMETRICS_LATENCY_BUCKETS; k++ )
+    {
+      buckets[k] = 0;
+    }
+  uiCount = 0;
+  uiSumUs = 0;
+}
+
+//--------------------------------------------------------------
+/// record one stage duration, safe to call from any thread
+void FliLatencyC::add( std::chrono::steady_clock::duration d )
+{
+  int64_t us = std::chrono::duration_cast<std::chrono::microseconds>( d ).count();
+  if( us < 0 )
+    {
+      us = 0;
+    }
+  int k = (us == 0) ? 0 : 64 - __builtin_clzll( (uint64_t)us );
+  if( k >= FLIMETRICS_LATENCY_BUCKETS )
+    {
+      k = FLIMETRICS_LATENCY_BUCKETS - 1;
+    }
+  buckets[k].fetch_add( 1, std::memory_order_relaxed );
+  uiSumUs.fetch_add( us, std::memory_order_relaxed );
+  uiCount.fetch_add( 1, std::memory_order_relaxed );
+}
+
+//--------------------------------------------------------------
+
+uint64_t FliLatencyC::getCount()
+{
+  return uiCount.load( std::memory_order_relaxed );
+}
+
+//--------------------------------------------------------------
+
+double FliLatencyC::getSumSeconds()
+{
+  return uiSumUs.load( std::memory_order_relaxed ) / 1000000.0;
+}
+
+//--------------------------------------------------------------
+/// estimate quantile q (0..1) from the buckets, 0 if nothing was recorded
+double FliLatencyC::getQuantileSeconds( double q )
+{
+  uint64_t counts[FLIMETRICS_LATENCY_BUCKETS];
+  uint64_t total = 0;
+
+  // the buckets may move on while we read them, sum our own copy
+  for( int k = 0; k < FLIMETRICS_LATENCY_BUCKETS; k++ )
+    {
+      counts[k] = buckets[k].load( std::memory_order_relaxed );
+      total += counts[k];
+    }
+  if( total == 0 )
+    {
+      return 0.0;
+    }
+  double target = q * total;
+  double below = 0.0;
+  for( int k = 0; k < FLIMETRICS_LATENCY_BUCKETS; k++ )
+    {
+      if( (counts[k] > 0) && (below + counts[k] >= target) )
+	{
+	  double lo = (k == 0) ? 0.0 : (double)(1ULL << (k - 1));
+	  double hi = (k == 0) ? 1.0 : 2.0 * lo;
+	  return (lo + (hi - lo) * (target - below) / counts[k]) / 1000000.0;
+	}
+      below += counts[k];
+    }
+  return (double)(1ULL << (FLIMETRICS_LATENCY_BUCKETS - 1)) / 1000000.0;
+}
+
+//--------------------------------------------------------------
+
+FliCaptureMetricsC::FliCaptureMetricsC()
+{
+  str_directory = ".";
+  telemetry = NULL;
+  uiFramesCaptured = 0;
+  uiFramesWritten = 0;
+  uiFramesDropped = 0;
+  uiFramesDecimated = 0;
+  uiWriteErrors = 0;
+  uiBytesWritten = 0;
+  uiBacklogStalls = 0;
+  uiBuffersInUse = 0;
+  uiBuffersTotal = 0;
+  isCaptureRunning = false;
+}
+
+//--------------------------------------------------------------
+/// remember the directory the files go to, for the free disk space gauge
+void FliCaptureMetricsC::setDirectory( const std::string& fileNameBase )
+{
+  size_t pos = fileNameBase.rfind( '/' );
+  std::lock_guard<std::mutex> lock( mtxDirectory );
+  if( pos == std::string::npos )
+    {
+      str_directory = ".";
+    }
+  else
+    {
+      str_directory = (pos == 0) ? "/" : fileNameBase.substr( 0, pos );
+    }
+}
+
+//--------------------------------------------------------------
+
+std::string FliCaptureMetricsC::getDirectory()
+{
+  std::lock_guard<std::mutex> lock( mtxDirectory );
+  return str_directory;
+}
+
+//--------------------------------------------------------------
+
+FliMetricsC::FliMetricsC()
+{
+  writerPool = NULL;
+  startTime = std::chrono::system_clock::now();
+  listenFd = -1;
+  uiTextFilePeriodMs = 10000;
+  isExit = false;
+}
+
+//--------------------------------------------------------------
+
+FliMetricsC::~FliMetricsC()
+{
+  stop();
+}
+
+//--------------------------------------------------------------
+/// register a camera, the returned metrics live as long as this object
+FliCaptureMetricsC* FliMetricsC::addCamera( const std::string& str_camera, FliTelemetryC* telemetry )
+{
+  std::lock_guard<std::mutex> lock( mtxCameras );
+  cameras.push_back( std::unique_ptr<FliCaptureMetricsC>( new FliCaptureMetricsC() ) );
+  cameras.back()->str_camera = str_camera;
+  cameras.back()->telemetry = telemetry;
+  return cameras.back().get();
+}
+
+//--------------------------------------------------------------
+/// change the temperature source of a camera, NULL before the sampler is deleted
+void FliMetricsC::setTelemetry( FliCaptureMetricsC* camera, FliTelemetryC* telemetry )
+{
+  std::lock_guard<std::mutex> lock( mtxCameras );
+  camera->telemetry = telemetry;
+}
+
+//--------------------------------------------------------------
+/// writer queue depth gauge, NULL ... none (pool about to be destroyed)
+void FliMetricsC::setWriterPool( FliWriterPoolC* pool )
+{
+  std::lock_guard<std::mutex> lock( mtxCameras );
+  writerPool = pool;
+}
+
+//--------------------------------------------------------------
+/// all metrics in the Prometheus text exposition format
+std::string FliMetricsC::render()
+{
+  std::ostringstream os;
+  std::lock_guard<std::mutex> lock( mtxCameras );
+
+  auto header = [&os]( const char* name, const char* type, const char* help ) {
+    os << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+  };
+  auto counter = [&]( const char* name, const char* help, std::atomic<uint64_t> FliCaptureMetricsC::* value ) {
+    header( name, "counter", help );
+    for( size_t i = 0; i < cameras.size(); i++ )
+      {
+	os << name << "{camera=\"" << cameras[i]->str_camera << "\"} "
+	   << ((*cameras[i]).*value).load( std::memory_order_relaxed ) << "\n";
+      }
+  };
+
+  header( "fli_start_time_seconds", "gauge", "Start time of flictl since the epoch." );
+  os << "fli_start_time_seconds "
+     << std::chrono::duration_cast<std::chrono::seconds>( startTime.time_since_epoch() ).count() << "\n";
+
+  counter( "fli_frames_captured_total", "Frames read from the camera.", &FliCaptureMetricsC::uiFramesCaptured );
+  counter( "fli_frames_written_total", "Frames (or stacks) written to disk.", &FliCaptureMetricsC::uiFramesWritten );
+  counter( "fli_frames_dropped_total", "Frames lost: frame counter gaps, frame timeouts and short reads.",
+	   &FliCaptureMetricsC::uiFramesDropped );
+  counter( "fli_frames_decimated_total", "Frames not written by the output throttle.",
+	   &FliCaptureMetricsC::uiFramesDecimated );
+  counter( "fli_write_errors_total", "Frames whose files could not be written.", &FliCaptureMetricsC::uiWriteErrors );
+  counter( "fli_bytes_written_total", "Image and meta data bytes written.", &FliCaptureMetricsC::uiBytesWritten );
+  counter( "fli_backlog_stalls_total", "Times the capture waited for a free frame buffer.",
+	   &FliCaptureMetricsC::uiBacklogStalls );
+
+  header( "fli_capture_running", "gauge", "1 while a capture is running." );
+  for( size_t i = 0; i < cameras.size(); i++ )
+    {
+      os << "fli_capture_running{camera=\"" << cameras[i]->str_camera << "\"} "
+	 << (cameras[i]->isCaptureRunning ? 1 : 0) << "\n";
+    }
+  header( "fli_frame_buffers_in_use", "gauge", "Frame buffers captured and waiting to be written." );
+  for( size_t i = 0; i < cameras.size(); i++ )
+    {
+      os << "fli_frame_buffers_in_use{camera=\"" << cameras[i]->str_camera << "\"} "
+	 << cameras[i]->uiBuffersInUse.load( std::memory_order_relaxed ) << "\n";
+    }
+  header( "fli_frame_buffers", "gauge", "Frame buffers allocated." );
+  for( size_t i = 0; i < cameras.size(); i++ )
+    {
+      os << "fli_frame_buffers{camera=\"" << cameras[i]->str_camera << "\"} "
+	 << cameras[i]->uiBuffersTotal.load( std::memory_order_relaxed ) << "\n";
+    }
+
+  header( "fli_stage_latency_seconds", "summary", "Duration of the capture pipeline stages." );
+  for( size_t i = 0; i < cameras.size(); i++ )
+    {
+      for( int s = 0; s < FLIMETRICS_NUM_STAGES; s++ )
+	{
+	  FliLatencyC& latency = cameras[i]->stages[s];
+	  std::string labels = "camera=\"" + cameras[i]->str_camera + "\",stage=\"" + stageNames[s] + "\"";
+	  for( size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++ )
+	    {
+	      os << "fli_stage_latency_seconds{" << labels << ",quantile=\"" << quantiles[q] << "\"} "
+		 << latency.getQuantileSeconds( quantiles[q] ) << "\n";
+	    }
+	  os << "fli_stage_latency_seconds_sum{" << labels << "} " << latency.getSumSeconds() << "\n";
+	  os << "fli_stage_latency_seconds_count{" << labels << "} " << latency.getCount() << "\n";
+	}
+    }
+
+  header( "fli_temperature_celsius", "gauge", "Latest camera temperatures (with --telemetry)." );
+  for( size_t i = 0; i < cameras.size(); i++ )
+    {
+      FliTelemetrySampleC sample;
+      if( (cameras[i]->telemetry == NULL) || ! cameras[i]->telemetry->getLatest( &sample ) )
+	{
+	  continue;
+	}
+      std::string labels = "camera=\"" + cameras[i]->str_camera + "\",sensor=";
+      os << "fli_temperature_celsius{" << labels << "\"ambient\"} " << sample.ambientTemp << "\n";
+      os << "fli_temperature_celsius{" << labels << "\"base\"} " << sample.baseTemp << "\n";
+      os << "fli_temperature_celsius{" << labels << "\"cooler\"} " << sample.coolerTemp << "\n";
+      os << "fli_temperature_celsius{" << labels << "\"setpoint\"} " << sample.setPoint << "\n";
+    }
+
+  header( "fli_disk_free_bytes", "gauge", "Space available to flictl on the file system the images go to." );
+  for( size_t i = 0; i < cameras.size(); i++ )
+    {
+      struct statvfs fs;
+      std::string str_directory = cameras[i]->getDirectory();
+      if( statvfs( str_directory.c_str(), &fs ) == 0 )
+	{
+	  os << "fli_disk_free_bytes{camera=\"" << cameras[i]->str_camera << "\",path=\"" << str_directory << "\"} "
+	     << (uint64_t)fs.f_bavail * fs.f_frsize << "\n";
+	}
+    }
+
+  if( writerPool != NULL )
+    {
+      header( "fli_writer_queue_depth", "gauge", "File writer jobs queued or running, all cameras." );
+      os << "fli_writer_queue_depth " << writerPool->uiBacklog.load( std::memory_order_relaxed ) << "\n";
+      header( "fli_writer_jobs_total", "counter", "File writer jobs finished, all cameras." );
+      os << "fli_writer_jobs_total{result=\"ok\"} " << writerPool->uiJobsDone << "\n";
+      os << "fli_writer_jobs_total{result=\"failed\"} " << writerPool->uiJobsFailed << "\n";
+    }
+  return os.str();
+}
+
+//--------------------------------------------------------------
+/// "wait", "convert" or "write"
+const char* FliMetricsC::getStageName( int stage )
+{
+  return stageNames[stage];
+}
+
+//--------------------------------------------------------------
+/// serve GET /metrics on httpPort (0 ... no HTTP) and/or write textFileName
+/// (empty ... none) every textFilePeriodMs
+/// return true if succeeded, false if failed
+bool FliMetricsC::start( uint16_t httpPort, const std::string& textFileName, uint32_t textFilePeriodMs )
+{
+  if( exporter.joinable() )
+    {
+      return false;
+    }
+  if( httpPort > 0 )
+    {
+      struct sockaddr_in addr;
+      int on = 1;
+
+      listenFd = socket( AF_INET, SOCK_STREAM, 0 );
+      if( listenFd < 0 )
+	{
+	  std::cerr << "FliMetricsC::start() ERROR: socket() failed, errno=" << errno << std::endl;
+	  return false;
+	}
+      setsockopt( listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
+      memset( &addr, 0, sizeof(addr) );
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl( INADDR_ANY );
+      addr.sin_port = htons( httpPort );
+      if( (bind( listenFd, (struct sockaddr*)&addr, sizeof(addr) ) < 0) || (listen( listenFd, 4 ) < 0) )
+	{
+	  std::cerr << "FliMetricsC::start() ERROR: cannot listen on port " << httpPort << ", errno=" << errno << std::endl;
+	  close( listenFd );
+	  listenFd = -1;
+	  return false;
+	}
+      // a scraper disconnecting while we reply must not kill us
+      signal( SIGPIPE, SIG_IGN );
+      std::cout << "FliMetricsC: serving metrics on http://0.0.0.0:" << httpPort << "/metrics" << std::endl;
+    }
+  str_textFile = textFileName;
+  uiTextFilePeriodMs = std::max( textFilePeriodMs, (uint32_t)FLIMETRICS_POLL_MS );
+  isExit = false;
+  exporter = std::thread( &FliMetricsC::exporterLoop, this );
+  return true;
+}
+
+//--------------------------------------------------------------
+/// stop the exporter, the text file is written a last time
+void FliMetricsC::stop()
+{
+  if( ! exporter.joinable() )
+    {
+      return;
+    }
+  isExit = true;
+  exporter.join();
+  if( listenFd >= 0 )
+    {
+      close( listenFd );
+      listenFd = -1;
+    }
+  if( ! str_textFile.empty() )
+    {
+      writeTextFile();
+    }
+}
+
+//--------------------------------------------------------------
+
+void FliMetricsC::exporterLoop()
+{
+  std::chrono::steady_clock::time_point nextWrite = std::chrono::steady_clock::now();
+
+  while( !isExit )
+    {
+      if( ! str_textFile.empty() && (std::chrono::steady_clock::now() >= nextWrite) )
+	{
+	  writeTextFile();
+	  nextWrite += std::chrono::milliseconds( uiTextFilePeriodMs );
+	}
+      struct pollfd pfd;
+      pfd.fd = listenFd;
+      pfd.events = POLLIN;
+      // a negative fd is ignored by poll(), which then only sleeps
+      if( poll( &pfd, 1, FLIMETRICS_POLL_MS ) <= 0 )
+	{
+	  continue;
+	}
+      int clientFd = accept( listenFd, NULL, NULL );
+      if( clientFd >= 0 )
+	{
+	  serveClient( clientFd );
+	  close( clientFd );
+	}
+    }
+}
+
+//--------------------------------------------------------------
+/// answer one HTTP request, only GET /metrics is known
+void FliMetricsC::serveClient( int clientFd )
+{
+  char request[1024];
+  size_t size = 0;
+  struct timeval tv = { 1, 0 };
+
+  // a stuck scraper must not block the exporter for long
+  setsockopt( clientFd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv) );
+  while( size < sizeof(request) - 1 )
+    {
+      ssize_t n = recv( clientFd, request + size, sizeof(request) - 1 - size, 0 );
+      if( n <= 0 )
+	{
+	  break;
+	}
+      size += n;
+      request[size] = 0;
+      if( strstr( request, "\r\n\r\n" ) != NULL )
+	{
+	  break;
+	}
+    }
+  request[size] = 0;
+
+  std::string str_status = "404 Not Found";
+  std::string str_body = "try /metrics\n";
+  if( (strncmp( request, "GET /metrics ", 13 ) == 0) || (strncmp( request, "GET /metrics?", 13 ) == 0) )
+    {
+      str_status = "200 OK";
+      str_body = render();
+    }
+  std::ostringstream os;
+  os << "HTTP/1.0 " << str_status << "\r\n"
+     << "Content-Type: text/plain; version=0.0.4\r\n"
+     << "Content-Length: " << str_body.size() << "\r\n"
+     << "Connection: close\r\n\r\n"
+     << str_body;
+  std::string str_reply = os.str();
+  size_t sent = 0;
+  while( sent < str_reply.size() )
+    {
+      ssize_t n = send( clientFd, str_reply.data() + sent, str_reply.size() - sent, MSG_NOSIGNAL );
+      if( n <= 0 )
+	{
+	  break;
+	}
+      sent += n;
+    }
+}
+
+//--------------------------------------------------------------
+/// write the metrics for the textfile collector, atomically by rename
+/// return true if succeeded, false if failed
+bool FliMetricsC::writeTextFile()
+{
+  std::string tmpName = str_textFile + ".tmp";
+  std::ofstream os( tmpName.c_str() );
+  if( ! os.is_open() )
+    {
+      std::cerr << "FliMetricsC::writeTextFile() ERROR: cannot open " << tmpName << std::endl;
+      return false;
+    }
+  os << render();
+  os.close();
+  if( os.fail() || (rename( tmpName.c_str(), str_textFile.c_str() ) != 0) )
+    {
+      std::cerr << "FliMetricsC::writeTextFile() ERROR: cannot write " << str_textFile << std::endl;
+      return false;
+    }
+  return true;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "fliwriter.h"
+#include "flitelemetry.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#define FLIMETRICS_LATENCY_BUCKETS (28)  // bucket k holds [2^(k-1), 2^k) us, the last one everything above 67 s
+
+#define FLIMETRICS_STAGE_WAIT    (0)  // getImage(): waiting for the frame and reading it over USB
+#define FLIMETRICS_STAGE_CONVERT (1)  // unpacking the raw frame into the L and H bitmaps
+#define FLIMETRICS_STAGE_WRITE   (2)  // writing the files of one frame
+#define FLIMETRICS_NUM_STAGES    (3)
+
+/// Latency distribution of one pipeline stage.
+/// Power of two microsecond buckets of relaxed atomic counters: add() is a
+/// single fetch_add, so any thread may record without locking. Quantiles are
+/// estimated at scrape time from the buckets (over the whole process life
+/// time), interpolating inside the bucket.
+class FliLatencyC
+{
+ private:
+  std::atomic<uint64_t> buckets[FLIMETRICS_LATENCY_BUCKETS];
+  std::atomic<uint64_t> uiCount;
+  std::atomic<uint64_t> uiSumUs;
+
+ public:
+  FliLatencyC();
+
+  void add( std::chrono::steady_clock::duration d );
+  uint64_t getCount();
+  double getSumSeconds();
+  double getQuantileSeconds( double q );
+};
+
+/// Counters and gauges of one camera, updated by its capture and writer
+/// threads with relaxed atomics only. Values owned by other objects
+/// (temperatures, disk space) are read when the metrics are rendered.
+class FliCaptureMetricsC
+{
+ private:
+  std::mutex mtxDirectory;
+  std::string str_directory;
+
+ public:
+  std::string str_camera;   // label value, serial number
+  FliTelemetryC* telemetry; // NULL ... no temperature gauges, change with FliMetricsC::setTelemetry()
+
+  std::atomic<uint64_t> uiFramesCaptured;
+  std::atomic<uint64_t> uiFramesWritten;
+  std::atomic<uint64_t> uiFramesDropped;     // missing frame counters, timeouts, short reads
+  std::atomic<uint64_t> uiFramesDecimated;   // not written by the throttle
+  std::atomic<uint64_t> uiWriteErrors;
+  std::atomic<uint64_t> uiBytesWritten;      // image and meta data bytes
+  std::atomic<uint64_t> uiBacklogStalls;
+  std::atomic<uint32_t> uiBuffersInUse;      // frame buffers captured and not yet written
+  std::atomic<uint32_t> uiBuffersTotal;
+  std::atomic<bool> isCaptureRunning;
+  FliLatencyC stages[FLIMETRICS_NUM_STAGES];
+
+  FliCaptureMetricsC();
+
+  void setDirectory( const std::string& fileNameBase );
+  std::string getDirectory();
+};
+
+/// Prometheus text format export of all cameras of this process.
+/// Either served over HTTP (GET /metrics) by a small single threaded server,
+/// or written periodically to a file for the node exporter textfile collector
+/// (written to <file>.tmp and renamed, so the collector never sees half a
+/// file), or both. The hot path only touches the atomics of its
+/// FliCaptureMetricsC, rendering happens in the exporter thread.
+class FliMetricsC
+{
+ private:
+  std::vector< std::unique_ptr<FliCaptureMetricsC> > cameras;
+  std::mutex mtxCameras;
+  FliWriterPoolC* writerPool;
+  std::chrono::system_clock::time_point startTime;
+
+  int listenFd;
+  std::string str_textFile;
+  uint32_t uiTextFilePeriodMs;
+  std::thread exporter;
+  std::atomic<bool> isExit;
+
+  void exporterLoop();
+  void serveClient( int clientFd );
+  bool writeTextFile();
+
+ public:
+  FliMetricsC();
+  ~FliMetricsC();
+
+  FliCaptureMetricsC* addCamera( const std::string& str_camera, FliTelemetryC* telemetry );
+  void setTelemetry( FliCaptureMetricsC* camera, FliTelemetryC* telemetry );
+  void setWriterPool( FliWriterPoolC* pool );
+  std::string render();
+  static const char* getStageName( int stage );
+
+  bool start( uint16_t httpPort, const std::string& textFileName, uint32_t textFilePeriodMs );
+  void stop();
+};
@@ -0,0 +1,296 @@
+#include "fliperf.h"
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <iostream>
+#include <chrono>
+
+#define FLIPERF_CACHE_LINE (64)   // bytes from memory per last level cache miss
+
+std::atomic<bool> FliPerfC::isRunning( false );
+
+static const struct
+{
+  uint64_t config;
+  const char* name;
+} counterDefs[FLIPERF_NUM_COUNTERS] =
+  {
+    { PERF_COUNT_HW_CPU_CYCLES,       "cycles" },
+    { PERF_COUNT_HW_INSTRUCTIONS,     "instructions" },
+    { PERF_COUNT_HW_CACHE_REFERENCES, "cache_references" },
+    { PERF_COUNT_HW_CACHE_MISSES,     "cache_misses" },
+    { PERF_COUNT_HW_BRANCH_MISSES,    "branch_misses" },
+  };
+
+/// counter group of one thread, closed when the thread ends
+class FliPerfGroupC
+{
+ public:
+  int fds[FLIPERF_NUM_COUNTERS];
+  int slots[FLIPERF_NUM_COUNTERS];   // position in the group read, -1 ... not available
+  int numOpen;
+  uint32_t mask;
+  bool isTried;
+
+  FliPerfGroupC()
+  {
+    numOpen = 0;
+    mask = 0;
+    isTried = false;
+  }
+
+  ~FliPerfGroupC()
+  {
+    for( int i = 0; i < numOpen; i++ )
+      {
+	close( fds[i] );
+      }
+  }
+
+  bool open();
+};
+
+static thread_local FliPerfGroupC threadGroup;
+static std::atomic<bool> isUserOnly( false );
+static std::atomic<bool> isWarned( false );
+
+//--------------------------------------------------------------
+
+static int perfEventOpen( uint64_t config, int groupFd, bool excludeKernel )
+{
+  struct perf_event_attr attr;
+  memset( &attr, 0, sizeof(attr) );
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.exclude_kernel = excludeKernel ? 1 : 0;
+  attr.exclude_hv = 1;
+  // this thread on any CPU
+  return syscall( __NR_perf_event_open, &attr, 0, -1, groupFd, 0 );
+}
+
+//--------------------------------------------------------------
+/// open the counters of the calling thread, the first one available leads
+/// return true if at least one counter is available
+bool FliPerfGroupC::open()
+{
+  isTried = true;
+  int firstErrno = 0;
+  for( int k = 0; k < FLIPERF_NUM_COUNTERS; k++ )
+    {
+      slots[k] = -1;
+      int groupFd = (numOpen > 0) ? fds[0] : -1;
+      int fd = perfEventOpen( counterDefs[k].config, groupFd, isUserOnly );
+      if( (fd < 0) && ((errno == EACCES) || (errno == EPERM)) && !isUserOnly )
+	{
+	  // perf_event_paranoid >= 2 leaves user space to unprivileged processes
+	  isUserOnly = true;
+	  fd = perfEventOpen( counterDefs[k].config, groupFd, true );
+	}
+      if( fd < 0 )
+	{
+	  firstErrno = (firstErrno != 0) ? firstErrno : errno;
+	  continue;
+	}
+      slots[k] = numOpen;
+      fds[numOpen++] = fd;
+      mask |= 1u << k;
+    }
+  if( (numOpen == 0) && ! isWarned.exchange( true ) )
+    {
+      std::cerr << "WARNING: no hardware performance counters available (perf_event_open: " << strerror( firstErrno )
+		<< "), counting switched off" << std::endl;
+    }
+  return numOpen > 0;
+}
+
+//--------------------------------------------------------------
+
+FliPerfStageC::FliPerfStageC()
+{
+  reset();
+}
+
+//--------------------------------------------------------------
+
+void FliPerfStageC::reset()
+{
+  uiCount = 0;
+  uiSumNs = 0;
+  for( int k = 0; k < FLIPERF_NUM_COUNTERS; k++ )
+    {
+      values[k] = 0;
+    }
+  uiMask = 0;
+}
+
+//--------------------------------------------------------------
+/// add the counter deltas between two readings of the same thread
+void FliPerfStageC::add( const FliPerfSampleC& start, const FliPerfSampleC& end, uint32_t mask, int64_t durationNs )
+{
+  uint64_t timeRunning = end.timeRunning - start.timeRunning;
+  if( timeRunning == 0 )
+    {
+      // the group never got on the PMU, eg. taken by another perf user
+      return;
+    }
+  double scale = (double)(end.timeEnabled - start.timeEnabled) / timeRunning;
+  for( int k = 0; k < FLIPERF_NUM_COUNTERS; k++ )
+    {
+      if( mask & (1u << k) )
+	{
+	  values[k].fetch_add( (uint64_t)((end.values[k] - start.values[k]) * scale), std::memory_order_relaxed );
+	}
+    }
+  uiMask.fetch_or( mask, std::memory_order_relaxed );
+  uiSumNs.fetch_add( durationNs, std::memory_order_relaxed );
+  uiCount.fetch_add( 1, std::memory_order_relaxed );
+}
+
+//--------------------------------------------------------------
+/// per span averages, eg. "12.1 ms, IPC 1.84, 40.2 M instr, LLC miss 12.0 %
+/// (0.9 GB/s), 1.1 branch miss/kinstr", "" if nothing was counted
+std::string FliPerfStageC::formatSummary() const
+{
+  uint64_t count = uiCount;
+  if( count == 0 )
+    {
+      return "";
+    }
+  uint32_t mask = uiMask;
+  double seconds = uiSumNs / 1.0e9;
+  char buf[128];
+  snprintf( buf, sizeof(buf), "%.2f ms", 1000.0 * seconds / count );
+  std::string str = buf;
+  if( (mask & (1u << FLIPERF_CYCLES)) && (mask & (1u << FLIPERF_INSTRUCTIONS)) && (values[FLIPERF_CYCLES] > 0) )
+    {
+      snprintf( buf, sizeof(buf), ", IPC %.2f", (double)values[FLIPERF_INSTRUCTIONS] / values[FLIPERF_CYCLES] );
+      str += buf;
+    }
+  if( mask & (1u << FLIPERF_INSTRUCTIONS) )
+    {
+      snprintf( buf, sizeof(buf), ", %.1f M instr", values[FLIPERF_INSTRUCTIONS] / 1.0e6 / count );
+      str += buf;
+    }
+  if( mask & (1u << FLIPERF_CACHE_MISSES) )
+    {
+      if( (mask & (1u << FLIPERF_CACHE_REFERENCES)) && (values[FLIPERF_CACHE_REFERENCES] > 0) )
+	{
+	  snprintf( buf, sizeof(buf), ", LLC miss %.1f %%",
+		    100.0 * values[FLIPERF_CACHE_MISSES] / values[FLIPERF_CACHE_REFERENCES] );
+	  str += buf;
+	}
+      snprintf( buf, sizeof(buf), ", %.0f k LLC misses (%.2f GB/s)", values[FLIPERF_CACHE_MISSES] / 1.0e3 / count,
+		(seconds > 0.0) ? values[FLIPERF_CACHE_MISSES] * (double)FLIPERF_CACHE_LINE / seconds / 1.0e9 : 0.0 );
+      str += buf;
+    }
+  if( (mask & (1u << FLIPERF_BRANCH_MISSES)) && (mask & (1u << FLIPERF_INSTRUCTIONS)) && (values[FLIPERF_INSTRUCTIONS] > 0) )
+    {
+      snprintf( buf, sizeof(buf), ", %.2f branch miss/kinstr",
+		1000.0 * values[FLIPERF_BRANCH_MISSES] / values[FLIPERF_INSTRUCTIONS] );
+      str += buf;
+    }
+  return str;
+}
+
+//--------------------------------------------------------------
+/// JSON object of the per span averages, counters not available are left out
+std::string FliPerfStageC::formatJson() const
+{
+  uint64_t count = uiCount;
+  uint32_t mask = uiMask;
+  double seconds = uiSumNs / 1.0e9;
+  char buf[96];
+  snprintf( buf, sizeof(buf), "{\"count\": %llu, \"ms\": %.3f", (unsigned long long)count,
+	    (count > 0) ? 1000.0 * seconds / count : 0.0 );
+  std::string str = buf;
+  for( int k = 0; k < FLIPERF_NUM_COUNTERS; k++ )
+    {
+      if( (count > 0) && (mask & (1u << k)) )
+	{
+	  snprintf( buf, sizeof(buf), ", \"%s\": %.0f", counterDefs[k].name, (double)values[k] / count );
+	  str += buf;
+	}
+    }
+  if( (mask & (1u << FLIPERF_CACHE_MISSES)) && (seconds > 0.0) )
+    {
+      snprintf( buf, sizeof(buf), ", \"llc_miss_mb_s\": %.1f",
+		values[FLIPERF_CACHE_MISSES] * (double)FLIPERF_CACHE_LINE / seconds / 1.0e6 );
+      str += buf;
+    }
+  return str + "}";
+}
+
+//--------------------------------------------------------------
+/// count from now on, each thread opens its group when it first measures
+void FliPerfC::start()
+{
+  isRunning = true;
+}
+
+//--------------------------------------------------------------
+/// read the counter group of the calling thread, opening it on first use,
+/// mask gets bit k set if counter k is available
+/// return true if succeeded, false if the thread has no counters
+bool FliPerfC::read( FliPerfSampleC* sample, uint32_t* mask )
+{
+  if( !threadGroup.isTried && !threadGroup.open() )
+    {
+      isRunning = false;
+      return false;
+    }
+  if( threadGroup.numOpen == 0 )
+    {
+      return false;
+    }
+  // nr, time enabled, time running, one value per counter
+  uint64_t buf[3 + FLIPERF_NUM_COUNTERS];
+  ssize_t size = (3 + threadGroup.numOpen) * sizeof(uint64_t);
+  if( ::read( threadGroup.fds[0], buf, size ) != size )
+    {
+      return false;
+    }
+  sample->timeEnabled = buf[1];
+  sample->timeRunning = buf[2];
+  for( int k = 0; k < FLIPERF_NUM_COUNTERS; k++ )
+    {
+      sample->values[k] = (threadGroup.slots[k] >= 0) ? buf[3 + threadGroup.slots[k]] : 0;
+    }
+  *mask = threadGroup.mask;
+  return true;
+}
+
+//--------------------------------------------------------------
+/// true if the kernel only allowed counting user space (perf_event_paranoid)
+bool FliPerfC::isUserSpaceOnly()
+{
+  return isUserOnly;
+}
+
+//--------------------------------------------------------------
+
+void FliPerfScopeC::begin()
+{
+  if( FliPerfC::read( &start, &mask ) )
+    {
+      startNs = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+    }
+}
+
+//--------------------------------------------------------------
+
+void FliPerfScopeC::end()
+{
+  int64_t endNs = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+  FliPerfSampleC sample;
+  uint32_t endMask;
+  if( FliPerfC::read( &sample, &endMask ) )
+    {
+      stage->add( start, sample, mask, endNs - startNs );
+    }
+}
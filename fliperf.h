@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+
+#define FLIPERF_CYCLES           (0)
+#define FLIPERF_INSTRUCTIONS     (1)
+#define FLIPERF_CACHE_REFERENCES (2)  // last level cache
+#define FLIPERF_CACHE_MISSES     (3)  // last level cache, each one a cache line from memory
+#define FLIPERF_BRANCH_MISSES    (4)
+#define FLIPERF_NUM_COUNTERS     (5)
+
+/// one reading of the counter group of a thread
+class FliPerfSampleC
+{
+ public:
+  uint64_t values[FLIPERF_NUM_COUNTERS];
+  uint64_t timeEnabled;     // [ns] the group was enabled
+  uint64_t timeRunning;     // [ns] the group was on the PMU, less if multiplexed
+};
+
+/// Counter totals of one pipeline stage, added to by any thread with
+/// relaxed atomics.
+class FliPerfStageC
+{
+ public:
+  std::atomic<uint64_t> uiCount;         // measured spans, eg. frames
+  std::atomic<uint64_t> uiSumNs;         // wall time of the measured spans
+  std::atomic<uint64_t> values[FLIPERF_NUM_COUNTERS];  // scaled to the full span if multiplexed
+  std::atomic<uint32_t> uiMask;          // bit k ... counter k was available
+
+  FliPerfStageC();
+
+  void reset();
+  void add( const FliPerfSampleC& start, const FliPerfSampleC& end, uint32_t mask, int64_t durationNs );
+  std::string formatSummary() const;
+  std::string formatJson() const;
+};
+
+/// Hardware performance counters (perf_event_open) of the capture stages.
+/// Every thread that measures opens its own group of cycles, instructions,
+/// last level cache references and misses and branch misses on first use
+/// and reads it with one read() at the start and the end of a stage.
+/// Counters the CPU, the kernel (perf_event_paranoid) or a VM does not
+/// provide are left out, counting only user space if kernel counting is not
+/// allowed; without any counter measuring is switched off after a warning.
+/// Disabled, a stage costs one atomic load.
+class FliPerfC
+{
+ private:
+  static std::atomic<bool> isRunning;
+
+ public:
+  static void start();
+  static bool read( FliPerfSampleC* sample, uint32_t* mask );
+  static bool isUserSpaceOnly();
+
+  static inline bool isEnabled()
+  {
+    return isRunning.load( std::memory_order_relaxed );
+  }
+};
+
+/// adds the counters of its lifetime on the calling thread to a stage if
+/// counting is enabled
+class FliPerfScopeC
+{
+ private:
+  FliPerfStageC* stage;
+  FliPerfSampleC start;
+  uint32_t mask;
+  int64_t startNs;          // 0 ... not counted
+
+  void begin();
+  void end();
+
+ public:
+  inline FliPerfScopeC( FliPerfStageC* perfStage ) : stage( perfStage ), startNs( 0 )
+  {
+    if( FliPerfC::isEnabled() )
+      {
+	begin();
+      }
+  }
+
+  inline ~FliPerfScopeC()
+  {
+    if( startNs != 0 )
+      {
+	end();
+      }
+  }
+};
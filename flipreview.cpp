@@ -0,0 +1,235 @@
+#include "flipreview.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <iostream>
+#include <new>
+
+static const boost::posix_time::ptime ptime_epoch( boost::gregorian::date( 1970, 1, 1 ) );
+
+static size_t alignUp( size_t size )
+{
+  return (size + FLIPREVIEW_ALIGN - 1) / FLIPREVIEW_ALIGN * FLIPREVIEW_ALIGN;
+}
+
+//--------------------------------------------------------------
+
+FliPreviewC::FliPreviewC()
+{
+  fd = -1;
+  base = NULL;
+  segmentSize = 0;
+  header = NULL;
+  binning = 0;
+  intervalMs = 1000;
+}
+
+//--------------------------------------------------------------
+
+FliPreviewC::~FliPreviewC()
+{
+  destroy();
+}
+
+//--------------------------------------------------------------
+/// create and map the segment /dev/shm/<name> (name starts with '/') for
+/// width x height planes, replacing a stale one of a killed flictl
+/// return true if succeeded, false if failed
+bool FliPreviewC::create( const std::string& name, uint32_t width, uint32_t height )
+{
+  if( base != NULL )
+    {
+      return false;
+    }
+  uint32_t binnedWidth = (binning > 0) ? width / binning : 0;
+  uint32_t binnedHeight = (binning > 0) ? height / binning : 0;
+  size_t planeSize = alignUp( (size_t)width * height * sizeof(uint16_t) );
+  size_t binnedSize = alignUp( (size_t)binnedWidth * binnedHeight * sizeof(uint16_t) );
+  size_t slotSize = alignUp( sizeof(FliPreviewSlotC) ) + 2 * planeSize + 2 * binnedSize;
+  segmentSize = alignUp( sizeof(FliPreviewHeaderC) ) + FLIPREVIEW_NUM_SLOTS * slotSize;
+
+  shm_unlink( name.c_str() );
+  fd = shm_open( name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644 );
+  if( fd < 0 )
+    {
+      std::cerr << "FliPreviewC::create() ERROR: shm_open(" << name << ") failed, errno=" << errno << std::endl;
+      return false;
+    }
+  if( ftruncate( fd, segmentSize ) < 0 )
+    {
+      std::cerr << "FliPreviewC::create() ERROR: cannot size " << name << " to " << segmentSize << " bytes, errno=" << errno << std::endl;
+      destroy();
+      shm_unlink( name.c_str() );
+      return false;
+    }
+  void* p = mmap( NULL, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  if( p == MAP_FAILED )
+    {
+      std::cerr << "FliPreviewC::create() ERROR: mmap of " << name << " failed, errno=" << errno << std::endl;
+      destroy();
+      shm_unlink( name.c_str() );
+      return false;
+    }
+  base = (uint8_t*)p;
+  str_name = name;
+
+  // the new segment is zero filled, numPublished = 0 tells readers there is no frame yet
+  header = new (base) FliPreviewHeaderC;
+  header->headerSize = sizeof(FliPreviewHeaderC);
+  header->slotHeaderSize = sizeof(FliPreviewSlotC);
+  header->width = width;
+  header->height = height;
+  header->binning = binning;
+  header->binnedWidth = binnedWidth;
+  header->binnedHeight = binnedHeight;
+  header->numSlots = FLIPREVIEW_NUM_SLOTS;
+  for( uint32_t k = 0; k < FLIPREVIEW_NUM_SLOTS; k++ )
+    {
+      header->slotOffset[k] = alignUp( sizeof(FliPreviewHeaderC) ) + k * slotSize;
+      new (base + header->slotOffset[k]) FliPreviewSlotC;
+      getSlot( k )->seq = 0;
+    }
+  header->planeOffset[0] = alignUp( sizeof(FliPreviewSlotC) );
+  header->planeOffset[1] = header->planeOffset[0] + planeSize;
+  header->planeOffset[2] = header->planeOffset[1] + planeSize;
+  header->planeOffset[3] = header->planeOffset[2] + binnedSize;
+  header->numPublished = 0;
+  // readers check the magic last
+  std::atomic_thread_fence( std::memory_order_release );
+  memcpy( header->magic, FLIPREVIEW_MAGIC, sizeof(header->magic) );
+  lastPublish = std::chrono::steady_clock::now() - std::chrono::milliseconds( intervalMs );
+  std::cout << "FliPreviewC: live preview in /dev/shm" << name << " (" << segmentSize / 1048576 << " MB)" << std::endl;
+  return true;
+}
+
+//--------------------------------------------------------------
+/// unmap and remove the segment, readers keep their mapping
+void FliPreviewC::destroy()
+{
+  if( base != NULL )
+    {
+      munmap( base, segmentSize );
+      base = NULL;
+      header = NULL;
+      shm_unlink( str_name.c_str() );
+    }
+  if( fd >= 0 )
+    {
+      close( fd );
+      fd = -1;
+    }
+}
+
+//--------------------------------------------------------------
+
+bool FliPreviewC::isCreated()
+{
+  return base != NULL;
+}
+
+//--------------------------------------------------------------
+
+std::string FliPreviewC::getName()
+{
+  return str_name;
+}
+
+//--------------------------------------------------------------
+
+FliPreviewSlotC* FliPreviewC::getSlot( uint32_t k )
+{
+  return (FliPreviewSlotC*)(base + header->slotOffset[k]);
+}
+
+//--------------------------------------------------------------
+/// mean of binning x binning blocks, remainder rows and columns are left out
+void FliPreviewC::bin( const uint16_t* src, uint16_t* dst )
+{
+  uint32_t n = binning * binning;
+  for( uint32_t by = 0; by < header->binnedHeight; by++ )
+    {
+      uint32_t sums[header->binnedWidth];
+      memset( sums, 0, sizeof(sums) );
+      for( uint32_t y = by * binning; y < (by + 1) * binning; y++ )
+	{
+	  const uint16_t* row = src + (size_t)y * header->width;
+	  for( uint32_t bx = 0; bx < header->binnedWidth; bx++ )
+	    {
+	      const uint16_t* p = row + bx * binning;
+	      for( uint32_t x = 0; x < binning; x++ )
+		{
+		  sums[bx] += p[x];
+		}
+	    }
+	}
+      for( uint32_t bx = 0; bx < header->binnedWidth; bx++ )
+	{
+	  dst[(size_t)by * header->binnedWidth + bx] = sums[bx] / n;
+	}
+    }
+}
+
+//--------------------------------------------------------------
+/// copy a converted frame into the next slot, unless the last publication
+/// was less than intervalMs ago or another thread is publishing right now
+void FliPreviewC::publish( const uint16_t* bitmapL, const uint16_t* bitmapH, const FliFrameInfoC& info, uint32_t frameIndex )
+{
+  if( base == NULL )
+    {
+      return;
+    }
+  std::unique_lock<std::mutex> lock( mtxPublish, std::try_to_lock );
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if( !lock.owns_lock() || (now - lastPublish < std::chrono::milliseconds( intervalMs )) )
+    {
+      return;
+    }
+  lastPublish = now;
+
+  uint64_t n = header->numPublished.load( std::memory_order_relaxed );
+  FliPreviewSlotC* slot = getSlot( n % FLIPREVIEW_NUM_SLOTS );
+  uint8_t* slotBase = (uint8_t*)slot;
+  size_t planeBytes = (size_t)header->width * header->height * sizeof(uint16_t);
+
+  slot->seq.fetch_add( 1, std::memory_order_relaxed );
+  std::atomic_thread_fence( std::memory_order_release );
+  slot->frameIndex = frameIndex;
+  slot->obsTimeNs = (info.ptime_obsTime - ptime_epoch).total_nanoseconds();
+  slot->exposureTime = info.exposureTime;
+  slot->lowGain = info.fLowGainValue;
+  slot->highGain = info.fHighGainValue;
+  slot->stackNum = info.uiStackNumFrames;
+  if( bitmapL != NULL )
+    {
+      memcpy( slotBase + header->planeOffset[0], bitmapL, planeBytes );
+    }
+  else
+    {
+      memset( slotBase + header->planeOffset[0], 0, planeBytes );
+    }
+  if( bitmapH != NULL )
+    {
+      memcpy( slotBase + header->planeOffset[1], bitmapH, planeBytes );
+    }
+  else
+    {
+      memset( slotBase + header->planeOffset[1], 0, planeBytes );
+    }
+  if( binning > 0 )
+    {
+      if( bitmapL != NULL )
+	{
+	  bin( bitmapL, (uint16_t*)(slotBase + header->planeOffset[2]) );
+	}
+      if( bitmapH != NULL )
+	{
+	  bin( bitmapH, (uint16_t*)(slotBase + header->planeOffset[3]) );
+	}
+    }
+  slot->seq.fetch_add( 1, std::memory_order_release );
+  header->numPublished.store( n + 1, std::memory_order_release );
+}
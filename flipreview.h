@@ -0,0 +1,86 @@
+#pragma once
+
+#include "flicamera.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+
+#define FLIPREVIEW_MAGIC     "FLIPRV1"
+#define FLIPREVIEW_NUM_SLOTS (3)
+#define FLIPREVIEW_ALIGN     (4096)  // planes start on page boundaries
+
+/// Start of the shared memory segment, all offsets are from here.
+class FliPreviewHeaderC
+{
+ public:
+  char magic[8];               // FLIPREVIEW_MAGIC
+  uint32_t headerSize;         // sizeof(FliPreviewHeaderC)
+  uint32_t slotHeaderSize;     // sizeof(FliPreviewSlotC)
+  uint32_t width, height;      // full planes, uint16 per pixel
+  uint32_t binning;            // 0 ... no binned planes
+  uint32_t binnedWidth, binnedHeight;
+  uint32_t numSlots;
+  uint64_t slotOffset[FLIPREVIEW_NUM_SLOTS];
+  uint64_t planeOffset[4];     // L, H, binned L, binned H, relative to the slot
+  std::atomic<uint64_t> numPublished;  // the latest frame is in slot (numPublished - 1) % numSlots
+};
+
+/// Per slot frame description, followed by the planes.
+class FliPreviewSlotC
+{
+ public:
+  std::atomic<uint64_t> seq;   // odd while the slot is being written
+  uint64_t frameIndex;         // index in the run
+  int64_t obsTimeNs;           // exposure start, UTC [ns] since the epoch
+  uint64_t exposureTime;       // [ns]
+  double lowGain, highGain;
+  uint32_t stackNum;           // 0 ... single frame
+  uint32_t reserved;
+};
+
+/// Live preview of the latest converted frame in POSIX shared memory
+/// (/dev/shm/<name>), for viewers and QA tools on the same machine.
+/// The segment holds FLIPREVIEW_NUM_SLOTS slots with the L and H planes and,
+/// if binning > 0, both planes binned binning x binning (mean). publish()
+/// fills the slot after the latest one and then advances numPublished, so
+/// readers map the segment read-only and use the latest slot in place:
+///   n = numPublished (0 ... nothing yet); slot = (n - 1) % numSlots
+///   s1 = slot.seq (retry if odd); use the planes; s2 = slot.seq
+///   the data was consistent if s1 == s2
+/// A slot is only overwritten two publications later, so a reader has at
+/// least two publish intervals to finish. The writer never waits for readers;
+/// frames arriving within intervalMs of the last publication, or while
+/// another thread publishes, are skipped. A missing plane (L dropped by the
+/// throttle, H in single channel modes) is published as zeros.
+class FliPreviewC
+{
+ private:
+  std::string str_name;
+  int fd;
+  uint8_t* base;
+  size_t segmentSize;
+  FliPreviewHeaderC* header;
+  std::mutex mtxPublish;
+  std::chrono::steady_clock::time_point lastPublish;
+
+  FliPreviewSlotC* getSlot( uint32_t k );
+  void bin( const uint16_t* src, uint16_t* dst );
+
+ public:
+  // settings, set them before create()
+  uint32_t binning;      // 0 ... full planes only
+  uint32_t intervalMs;   // minimum time between two publications
+
+  FliPreviewC();
+  ~FliPreviewC();
+
+  bool create( const std::string& name, uint32_t width, uint32_t height );
+  void destroy();
+  bool isCreated();
+  std::string getName();
+  void publish( const uint16_t* bitmapL, const uint16_t* bitmapH, const FliFrameInfoC& info, uint32_t frameIndex );
+};
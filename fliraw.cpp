@@ -0,0 +1,262 @@
+#include "fliraw.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+
+static uint64_t alignUp( uint64_t size )
+{
+  return (size + FLIRAW_ALIGN - 1) / FLIRAW_ALIGN * FLIRAW_ALIGN;
+}
+
+//--------------------------------------------------------------
+/// write the whole buffer at offset
+/// return true if succeeded, false if failed
+static bool pwriteAll( int fd, const void* data, size_t size, off_t offset )
+{
+  const uint8_t* p = (const uint8_t*)data;
+  while( size > 0 )
+    {
+      ssize_t n = pwrite( fd, p, size, offset );
+      if( n < 0 )
+	{
+	  if( errno == EINTR )
+	    {
+	      continue;
+	    }
+	  return false;
+	}
+      p += n;
+      size -= n;
+      offset += n;
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+
+FliRawRecorderC::FliRawRecorderC()
+{
+  fd = -1;
+  uiNumFrames = 0;
+  memset( &header, 0, sizeof(header) );
+}
+
+//--------------------------------------------------------------
+
+FliRawRecorderC::~FliRawRecorderC()
+{
+  close();
+}
+
+//--------------------------------------------------------------
+/// create a new recording, magic, sizes and frameStride of fileHeader are
+/// filled in here
+/// return true if succeeded, false if failed
+bool FliRawRecorderC::open( const std::string& filename, const FliRawFileHeaderC& fileHeader )
+{
+  close();
+  header = fileHeader;
+  memcpy( header.magic, FLIRAW_MAGIC, sizeof(header.magic) );
+  header.headerSize = sizeof(FliRawFileHeaderC);
+  header.frameHeaderSize = sizeof(FliRawFrameHeaderC);
+  header.capSize = sizeof(FPROCAP);
+  header.frameStride = alignUp( FLIRAW_ALIGN + (uint64_t)header.frameSize );
+  uiNumFrames = 0;
+
+  fd = ::open( filename.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644 );
+  if( fd < 0 )
+    {
+      std::cerr << "FliRawRecorderC::open() ERROR: cannot create " << filename << ": " << strerror( errno ) << std::endl;
+      return false;
+    }
+  std::vector<uint8_t> block( FLIRAW_ALIGN, 0 );
+  memcpy( block.data(), &header, sizeof(header) );
+  if( ! pwriteAll( fd, block.data(), block.size(), 0 ) )
+    {
+      std::cerr << "FliRawRecorderC::open() ERROR: writing " << filename << " failed: " << strerror( errno ) << std::endl;
+      close();
+      return false;
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+/// append a camera frame (header.frameSize bytes)
+/// return true if succeeded, false if failed
+bool FliRawRecorderC::append( const FliRawFrameHeaderC& frameHeader, const uint8_t* frame )
+{
+  if( fd < 0 )
+    {
+      return false;
+    }
+  off_t offset = FLIRAW_ALIGN + uiNumFrames * header.frameStride;
+  uint8_t block[FLIRAW_ALIGN];
+  memset( block, 0, sizeof(block) );
+  memcpy( block, &frameHeader, sizeof(frameHeader) );
+  if( ! pwriteAll( fd, block, sizeof(block), offset )
+      || ! pwriteAll( fd, frame, header.frameSize, offset + FLIRAW_ALIGN ) )
+    {
+      std::cerr << "FliRawRecorderC::append() ERROR: writing frame " << frameHeader.index << " failed: " << strerror( errno ) << std::endl;
+      return false;
+    }
+  uiNumFrames++;
+  return true;
+}
+
+//--------------------------------------------------------------
+
+void FliRawRecorderC::close()
+{
+  if( fd >= 0 )
+    {
+      ::close( fd );
+      fd = -1;
+    }
+}
+
+//--------------------------------------------------------------
+
+bool FliRawRecorderC::isOpen()
+{
+  return fd >= 0;
+}
+
+//--------------------------------------------------------------
+
+uint64_t FliRawRecorderC::getNumFrames()
+{
+  return uiNumFrames;
+}
+
+//--------------------------------------------------------------
+
+FliRawReplayC::FliRawReplayC()
+{
+  fd = -1;
+  base = NULL;
+  mapSize = 0;
+  uiNumFrames = 0;
+}
+
+//--------------------------------------------------------------
+
+FliRawReplayC::~FliRawReplayC()
+{
+  close();
+}
+
+//--------------------------------------------------------------
+/// map a recording, a partly written last frame is left out
+/// return true if succeeded, false if failed
+bool FliRawReplayC::open( const std::string& filename )
+{
+  close();
+  fd = ::open( filename.c_str(), O_RDONLY );
+  if( fd < 0 )
+    {
+      std::cerr << "FliRawReplayC::open() ERROR: cannot open " << filename << ": " << strerror( errno ) << std::endl;
+      return false;
+    }
+  struct stat st;
+  if( (fstat( fd, &st ) < 0) || ((size_t)st.st_size < FLIRAW_ALIGN) )
+    {
+      std::cerr << "FliRawReplayC::open() ERROR: " << filename << " is not a raw recording" << std::endl;
+      close();
+      return false;
+    }
+  void* p = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+  if( p == MAP_FAILED )
+    {
+      std::cerr << "FliRawReplayC::open() ERROR: mmap of " << filename << " failed, errno=" << errno << std::endl;
+      close();
+      return false;
+    }
+  base = (uint8_t*)p;
+  mapSize = st.st_size;
+  const FliRawFileHeaderC& header = getHeader();
+  if( (memcmp( header.magic, FLIRAW_MAGIC, sizeof(header.magic) ) != 0)
+      || (header.headerSize != sizeof(FliRawFileHeaderC))
+      || (header.frameHeaderSize != sizeof(FliRawFrameHeaderC))
+      || (header.capSize != sizeof(FPROCAP))
+      || (header.frameStride < FLIRAW_ALIGN + (uint64_t)header.frameSize) )
+    {
+      std::cerr << "FliRawReplayC::open() ERROR: " << filename << " is not a raw recording of this flictl version" << std::endl;
+      close();
+      return false;
+    }
+  uint64_t recordSize = FLIRAW_ALIGN + (uint64_t)header.frameSize;
+  uiNumFrames = (mapSize >= FLIRAW_ALIGN + recordSize)
+    ? (mapSize - FLIRAW_ALIGN - recordSize) / header.frameStride + 1 : 0;
+  // frames are read once, front to back
+  madvise( base, mapSize, MADV_SEQUENTIAL );
+  return true;
+}
+
+//--------------------------------------------------------------
+
+void FliRawReplayC::close()
+{
+  if( base != NULL )
+    {
+      munmap( base, mapSize );
+      base = NULL;
+      mapSize = 0;
+    }
+  if( fd >= 0 )
+    {
+      ::close( fd );
+      fd = -1;
+    }
+  uiNumFrames = 0;
+}
+
+//--------------------------------------------------------------
+
+bool FliRawReplayC::isOpen() const
+{
+  return base != NULL;
+}
+
+//--------------------------------------------------------------
+
+const FliRawFileHeaderC& FliRawReplayC::getHeader() const
+{
+  return *(const FliRawFileHeaderC*)base;
+}
+
+//--------------------------------------------------------------
+
+uint64_t FliRawReplayC::getNumFrames() const
+{
+  return uiNumFrames;
+}
+
+//--------------------------------------------------------------
+
+const FliRawFrameHeaderC* FliRawReplayC::getFrameHeader( uint64_t k ) const
+{
+  return (const FliRawFrameHeaderC*)(base + FLIRAW_ALIGN + k * getHeader().frameStride);
+}
+
+//--------------------------------------------------------------
+
+const uint8_t* FliRawReplayC::getFrame( uint64_t k ) const
+{
+  return base + FLIRAW_ALIGN + k * getHeader().frameStride + FLIRAW_ALIGN;
+}
+
+//--------------------------------------------------------------
+/// start reading frame k from disk, so that it is in memory when it is due
+void FliRawReplayC::prefetch( uint64_t k ) const
+{
+  if( k < uiNumFrames )
+    {
+      madvise( (void*)getFrameHeader( k ), FLIRAW_ALIGN + getHeader().frameSize, MADV_WILLNEED );
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "libflipro.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#define FLIRAW_MAGIC     "FLIRAW1"
+#define FLIRAW_ALIGN     (4096)      // file header, frame headers and frames start on page boundaries
+#define FLIRAW_EXTENSION ".fliraw"
+
+/// Start of a raw recording (host byte order), padded to FLIRAW_ALIGN.
+class FliRawFileHeaderC
+{
+ public:
+  char magic[8];               // FLIRAW_MAGIC
+  uint32_t headerSize;         // sizeof(FliRawFileHeaderC)
+  uint32_t frameHeaderSize;    // sizeof(FliRawFrameHeaderC)
+  uint32_t capSize;            // sizeof(FPROCAP)
+  uint32_t pixelDepth, pixelLsb;
+  uint32_t isHdr;              // 1 ... LDR and HDR rows interleaved
+  uint32_t frameSize;          // bytes of a camera frame buffer, meta data included
+  uint32_t reserved;
+  uint64_t frameStride;        // distance of two frame records
+  char serial[64];
+  FPROCAP capabilities;
+};
+
+/// Start of a frame record, padded to FLIRAW_ALIGN and followed by the
+/// camera frame as received (frameSize bytes, sizeGrabbed of them valid).
+class FliRawFrameHeaderC
+{
+ public:
+  uint64_t index;              // frame index in the recorded run
+  int64_t obsTimeNs;           // exposure start, UTC [ns] since the epoch
+  int64_t arrivalNs;           // getImage() returned, steady clock [ns], only differences count
+  uint64_t exposureTime;       // [ns]
+  uint64_t frameDelay;         // [ns]
+  uint32_t lowGainIndex, highGainIndex;
+  double lowGain, highGain;
+  uint32_t sizeGrabbed;        // bytes received
+  uint32_t reserved;
+};
+
+/// Appends camera frames to a raw recording <name>.fliraw that FliRawReplayC
+/// (flictl --replay) plays back through the capture pipeline. Record k starts
+/// at FLIRAW_ALIGN + k * frameStride, so a crashed recording keeps all
+/// complete frames.
+class FliRawRecorderC
+{
+ private:
+  int fd;
+  FliRawFileHeaderC header;
+  uint64_t uiNumFrames;
+
+ public:
+  FliRawRecorderC();
+  ~FliRawRecorderC();
+
+  bool open( const std::string& filename, const FliRawFileHeaderC& fileHeader );
+  bool append( const FliRawFrameHeaderC& frameHeader, const uint8_t* frame );
+  void close();
+  bool isOpen();
+  uint64_t getNumFrames();
+};
+
+/// Read-only mapping of a raw recording; frames are used in place.
+class FliRawReplayC
+{
+ private:
+  int fd;
+  uint8_t* base;
+  size_t mapSize;
+  uint64_t uiNumFrames;
+
+ public:
+  FliRawReplayC();
+  ~FliRawReplayC();
+
+  bool open( const std::string& filename );
+  void close();
+  bool isOpen() const;
+  const FliRawFileHeaderC& getHeader() const;
+  uint64_t getNumFrames() const;
+  const FliRawFrameHeaderC* getFrameHeader( uint64_t k ) const;
+  const uint8_t* getFrame( uint64_t k ) const;
+  void prefetch( uint64_t k ) const;
+};
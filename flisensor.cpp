@@ -0,0 +1,199 @@
+#include "flisensor.h"
+
+#include <stdio.h>
+#include <string.h>
+
+//--------------------------------------------------------------
+/// two pixels from three bytes, W == 0 ... row width known at runtime only
+template<uint32_t W>
+static inline void unpackRow12( const uint8_t* raw, uint32_t width, uint16_t* dst )
+{
+  const uint32_t n = (W > 0) ? W : width;
+  for( uint32_t x = 0; x < n; x += 2, raw += 3, dst += 2 )
+    {
+      uint8_t t = raw[1];
+      dst[0] = (uint16_t)((raw[0] << 4) | (t >> 4));
+      dst[1] = (uint16_t)(((t & 0x0F) << 8) | raw[2]);
+    }
+}
+
+//--------------------------------------------------------------
+/// unpack the spans spans[rowSpan[0]] ... spans[rowSpan[1] - 1] of a row and
+/// zero the masked pixels, rowSpan NULL ... whole row
+template<uint32_t W>
+static inline void unpackRowSpans12( const uint8_t* raw, uint32_t width, const FliSpanC* spans,
+				     const uint32_t* rowSpan, uint16_t* dst )
+{
+  const uint32_t n = (W > 0) ? W : width;
+  if( rowSpan == NULL )
+    {
+      unpackRow12<W>( raw, n, dst );
+      return;
+    }
+  uint32_t x = 0;
+  for( uint32_t k = rowSpan[0]; k < rowSpan[1]; k++ )
+    {
+      const FliSpanC& span = spans[k];
+      memset( dst + x, 0, (span.start - x) * sizeof(uint16_t) );
+      unpackRow12<0>( raw + span.start / 2 * 3, span.end - span.start, dst + span.start );
+      x = span.end;
+    }
+  memset( dst + x, 0, (n - x) * sizeof(uint16_t) );
+}
+
+//--------------------------------------------------------------
+/// HDR frame: each sensor row is the LDR row followed by the HDR row
+template<uint32_t W>
+static void unpackHdr12( const uint8_t* raw, uint32_t width, uint32_t numRows,
+			 const FliSpanC* spans, const uint32_t* rowSpans, uint16_t* low, uint16_t* high )
+{
+  const uint32_t n = (W > 0) ? W : width;
+  const size_t rowBytes = (size_t)n * 3 / 2;
+  for( uint32_t y = 0; y < numRows; y++ )
+    {
+      const uint32_t* rowSpan = (rowSpans != NULL) ? rowSpans + y : NULL;
+      unpackRowSpans12<W>( raw, n, spans, rowSpan, low );
+      raw += rowBytes;
+      unpackRowSpans12<W>( raw, n, spans, rowSpan, high );
+      raw += rowBytes;
+      low += n;
+      high += n;
+    }
+}
+
+//--------------------------------------------------------------
+/// single channel frame, high is not used
+template<uint32_t W>
+static void unpackLdr12( const uint8_t* raw, uint32_t width, uint32_t numRows,
+			 const FliSpanC* spans, const uint32_t* rowSpans, uint16_t* low, uint16_t* high )
+{
+  const uint32_t n = (W > 0) ? W : width;
+  const size_t rowBytes = (size_t)n * 3 / 2;
+  for( uint32_t y = 0; y < numRows; y++ )
+    {
+      unpackRowSpans12<W>( raw, n, spans, (rowSpans != NULL) ? rowSpans + y : NULL, low );
+      raw += rowBytes;
+      low += n;
+    }
+}
+
+/// sensors printCapabilities() knows, width 0 ... no specialized kernels
+class FliSensorKindC
+{
+ public:
+  uint32_t deviceType;
+  const char* name;
+  const char* camera;
+  const char* detector;
+  uint32_t width;
+  bool isHdr;
+  FliUnpackFuncT unpackHdr;
+  FliUnpackFuncT unpackLdr;
+};
+
+static const FliSensorKindC sensorKinds[] =
+  {
+    { FPRO_CAM_DEVICE_TYPE_GSENSE400,  "GSENSE400",  "FLI Kepler KL400",  "Gsense 400",  2048, true,  unpackHdr12<2048>, unpackLdr12<2048> },
+    { FPRO_CAM_DEVICE_TYPE_GSENSE2020, "GSENSE2020", "FLI Kepler KL2020", "Gsense 2020", 2048, true,  unpackHdr12<2048>, unpackLdr12<2048> },
+    { FPRO_CAM_DEVICE_TYPE_GSENSE4040, "GSENSE4040", "FLI Kepler KL4040", "Gsense 4040", 4096, true,  unpackHdr12<4096>, unpackLdr12<4096> },
+    { FPRO_CAM_DEVICE_TYPE_KODAK47051, "KODAK47051", "FLI Kodak 47051",   "Kodak 47051", 0,    false, unpackHdr12<0>,    unpackLdr12<0> },
+    { FPRO_CAM_DEVICE_TYPE_KODAK29050, "KODAK29050", "FLI Kodak 29050",   "Kodak 29050", 0,    false, unpackHdr12<0>,    unpackLdr12<0> },
+    { FPRO_CAM_DEVICE_TYPE_DC230_42,   "DC230-42",   "FLI DC 230-42",     "DC 230-42",   2048, false, unpackHdr12<2048>, unpackLdr12<2048> },
+    { FPRO_CAM_DEVICE_TYPE_DC230_84,   "DC230-84",   "FLI DC 230-84",     "DC 230-84",   4096, false, unpackHdr12<4096>, unpackLdr12<4096> },
+  };
+
+//--------------------------------------------------------------
+
+FliSensorLayoutC::FliSensorLayoutC()
+{
+  deviceType = FPRO_CAM_DEVICE_TYPE_GSENSE4040;
+  name = "GSENSE4040";
+  camera = "FLI Kepler KL4040";
+  detector = "Gsense 4040";
+  width = FLISENSOR_DEFAULT_WIDTH;
+  height = FLISENSOR_DEFAULT_HEIGHT;
+  pixelDepth = FLISENSOR_PACKED_DEPTH;
+  isHdrInterleaved = true;
+  preRefRows = 0;
+  postRefRows = 0;
+  metaDataSize = 0;
+  isSpecialized = true;
+  unpackHdr = unpackHdr12<FLISENSOR_DEFAULT_WIDTH>;
+  unpackLdr = unpackLdr12<FLISENSOR_DEFAULT_WIDTH>;
+}
+
+//--------------------------------------------------------------
+/// take the layout from the camera capabilities, the pixel depth is kept
+/// (see FliCameraC::getPixelConfig())
+/// return true if succeeded, false if the sensor is unknown (generic 12 bit
+/// HDR layout of the reported size is used then)
+bool FliSensorLayoutC::fromCapabilities( const FPROCAP& caps )
+{
+  deviceType = caps.uiDeviceType;
+  width = caps.uiMaxPixelImageWidth;
+  height = caps.uiMaxPixelImageHeight;
+  preRefRows = caps.uiPreFrameReferenceRows;
+  postRefRows = caps.uiPostFrameReferenceRows;
+  metaDataSize = caps.uiMetaDataSize;
+  for( size_t k = 0; k < sizeof(sensorKinds) / sizeof(sensorKinds[0]); k++ )
+    {
+      const FliSensorKindC& kind = sensorKinds[k];
+      if( kind.deviceType == deviceType )
+	{
+	  name = kind.name;
+	  camera = kind.camera;
+	  detector = kind.detector;
+	  isHdrInterleaved = kind.isHdr;
+	  // firmware reporting another size than the data sheet gets the generic kernels
+	  isSpecialized = (kind.width > 0) && (kind.width == width);
+	  unpackHdr = isSpecialized ? kind.unpackHdr : unpackHdr12<0>;
+	  unpackLdr = isSpecialized ? kind.unpackLdr : unpackLdr12<0>;
+	  return true;
+	}
+    }
+  name = "unknown";
+  camera = "FLI unknown";
+  detector = "unknown";
+  isHdrInterleaved = true;
+  isSpecialized = false;
+  unpackHdr = unpackHdr12<0>;
+  unpackLdr = unpackLdr12<0>;
+  return false;
+}
+
+//--------------------------------------------------------------
+/// true if the unpack kernels can handle the frames
+bool FliSensorLayoutC::isSupported() const
+{
+  return (pixelDepth == FLISENSOR_PACKED_DEPTH) && (width > 0) && (width % 2 == 0) && (height > 0);
+}
+
+//--------------------------------------------------------------
+
+uint32_t FliSensorLayoutC::getRowBytes() const
+{
+  return width * pixelDepth / 8;
+}
+
+//--------------------------------------------------------------
+
+uint64_t FliSensorLayoutC::getNumPixels() const
+{
+  return (uint64_t)width * height;
+}
+
+//--------------------------------------------------------------
+
+uint64_t FliSensorLayoutC::getImageBytes() const
+{
+  return (uint64_t)getRowBytes() * height * (isHdrInterleaved ? 2 : 1);
+}
+
+//--------------------------------------------------------------
+
+void FliSensorLayoutC::print() const
+{
+  printf( "Sensor layout: %s %ux%u, %u bit, %s, reference rows %u + %u, meta data %u bytes, %s kernels\n",
+	  name, width, height, pixelDepth, isHdrInterleaved ? "HDR interleaved" : "single channel",
+	  preRefRows, postRefRows, metaDataSize, isSpecialized ? "fixed width" : "generic" );
+}
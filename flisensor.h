@@ -0,0 +1,61 @@
+#pragma once
+
+#include "libflipro.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FLISENSOR_PACKED_DEPTH (12)  // the only pixel depth the unpack kernels know, 2 pixels in 3 bytes
+
+// GSENSE4040, used until the capabilities are known
+#define FLISENSOR_DEFAULT_WIDTH  (4096)
+#define FLISENSOR_DEFAULT_HEIGHT (4096)
+
+/// pixels [start, end) of one row, start and end even
+class FliSpanC
+{
+ public:
+  uint32_t start;
+  uint32_t end;
+};
+
+/// unpack numRows rows of packed 12 bit pixels of a frame (after the meta
+/// data) into 16 bit bitmaps, high is NULL for single channel frames;
+/// row y unpacks only spans[rowSpans[y]] ... spans[rowSpans[y + 1] - 1]
+/// (sorted, not overlapping) and sets the rest of the row to 0,
+/// rowSpans NULL ... whole rows
+typedef void (*FliUnpackFuncT)( const uint8_t* raw, uint32_t width, uint32_t numRows,
+				const FliSpanC* spans, const uint32_t* rowSpans, uint16_t* low, uint16_t* high );
+
+/// Geometry and pixel format of the image data the camera sends, derived
+/// from FPROCAP. In HDR frames every sensor row is sent twice, the low gain
+/// (LDR) row followed by the high gain (HDR) row.
+/// Known sensors get unpack kernels instantiated for their row width, so the
+/// compiler sees constant trip counts; other widths use the generic kernel.
+/// Reference rows are only listed, flictl does not enable them and the
+/// camera does not send them then.
+class FliSensorLayoutC
+{
+ public:
+  uint32_t deviceType;
+  const char* name;
+  const char* camera;          // FITS INSTRUME and CAMERA
+  const char* detector;        // FITS DETNAM
+  uint32_t width, height;      // image pixels of one channel
+  uint32_t pixelDepth;         // bits per pixel in the raw frame
+  bool isHdrInterleaved;       // LDR and HDR rows alternate
+  uint32_t preRefRows, postRefRows;
+  uint32_t metaDataSize;       // bytes in front of the image data
+  bool isSpecialized;          // fixed width kernels
+  FliUnpackFuncT unpackHdr;
+  FliUnpackFuncT unpackLdr;
+
+  FliSensorLayoutC();
+
+  bool fromCapabilities( const FPROCAP& caps );
+  bool isSupported() const;
+  uint32_t getRowBytes() const;     // one channel
+  uint64_t getNumPixels() const;    // one channel
+  uint64_t getImageBytes() const;   // raw image data of a frame, both channels if HDR
+  void print() const;
+};
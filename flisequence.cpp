@@ -0,0 +1,351 @@
+#include "flisequence.h"
+#include "flictl.h"
+#include "flistack.h"
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/ini_parser.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <set>
+
+namespace pt = boost::property_tree;
+
+//--------------------------------------------------------------
+/// read optional key of a section into *value
+/// return true if succeeded (also when the key is missing), false if the value is invalid
+template <typename T>
+static bool getKey( const pt::ptree& section, const std::string& sectionName, const char* key,
+		    boost::optional<T>* value )
+{
+  boost::optional<const pt::ptree&> child = section.get_child_optional( key );
+  if( !child )
+    {
+      return true;
+    }
+  *value = child->get_value_optional<T>();
+  if( !*value )
+    {
+      std::cerr << "FliSequenceC::load() ERROR: [" << sectionName << "] invalid value of "
+		<< key << ": '" << child->data() << "'" << std::endl;
+      return false;
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+
+FliSequenceC::FliSequenceC( FliCameraC* camera ):
+  capture( camera )
+{
+  fc = camera;
+  isStopRequested = false;
+  // trigger changes are done between the steps, not after each run
+  capture.restoreInternalTrigger = false;
+}
+
+//--------------------------------------------------------------
+/// parse the sequence file
+/// return true if succeeded, false if failed
+bool FliSequenceC::load( const std::string& fileName )
+{
+  static const std::set<std::string> knownKeys = {
+    "exptime", "framedelay", "lowgain", "highgain", "trigger", "exttrigtype", "cool",
+    "stack", "stackmode", "time", "meta", "filename", "bracket", "streamrows", "mef", "fliz",
+    "count", "wait", "until" };
+  pt::ptree tree;
+
+  try
+    {
+      pt::read_ini( fileName, tree );
+    }
+  catch( pt::ini_parser_error& e )
+    {
+      std::cerr << "FliSequenceC::load() ERROR: " << e.what() << std::endl;
+      return false;
+    }
+
+  steps.clear();
+  for( pt::ptree::const_iterator it = tree.begin(); it != tree.end(); ++it )
+    {
+      const std::string& name = it->first;
+      const pt::ptree& section = it->second;
+      if( section.empty() && !section.data().empty() )
+	{
+	  std::cerr << "FliSequenceC::load() ERROR: key " << name << " outside of a [step] section" << std::endl;
+	  return false;
+	}
+      for( pt::ptree::const_iterator k = section.begin(); k != section.end(); ++k )
+	{
+	  if( knownKeys.count( k->first ) == 0 )
+	    {
+	      std::cerr << "FliSequenceC::load() ERROR: [" << name << "] unknown key " << k->first << std::endl;
+	      return false;
+	    }
+	}
+
+      FliSequenceStepC step;
+      boost::optional<uint32_t> count;
+      boost::optional<double> wait;
+      boost::optional<std::string> stackModeName, until, bracket;
+      step.str_name = name;
+      bool ok = getKey( section, name, "exptime", &step.exposureTime )
+	&& getKey( section, name, "framedelay", &step.frameDelay )
+	&& getKey( section, name, "lowgain", &step.lowGain )
+	&& getKey( section, name, "highgain", &step.highGain )
+	&& getKey( section, name, "trigger", &step.isExtTriggerEnabled )
+	&& getKey( section, name, "exttrigtype", &step.extTriggerType )
+	&& getKey( section, name, "cool", &step.coolSetPoint )
+	&& getKey( section, name, "stack", &step.stackNum )
+	&& getKey( section, name, "stackmode", &stackModeName )
+	&& getKey( section, name, "time", &step.isTimeInFileNames )
+	&& getKey( section, name, "meta", &step.doWriteMetaData )
+	&& getKey( section, name, "filename", &step.fileNameBase )
+	&& getKey( section, name, "bracket", &bracket )
+	&& getKey( section, name, "streamrows", &step.streamRows )
+	&& getKey( section, name, "mef", &step.isMef )
+	&& getKey( section, name, "fliz", &step.isCompressed )
+	&& getKey( section, name, "count", &count )
+	&& getKey( section, name, "wait", &wait )
+	&& getKey( section, name, "until", &until );
+      if( !ok )
+	{
+	  return false;
+	}
+      step.count = count ? *count : 0;
+      step.waitSeconds = wait ? *wait : 0.0;
+      if( stackModeName )
+	{
+	  uint32_t mode;
+	  if( ! FliStackC::parseMode( *stackModeName, &mode ) )
+	    {
+	      std::cerr << "FliSequenceC::load() ERROR: [" << name << "] unknown stack mode " << *stackModeName << std::endl;
+	      return false;
+	    }
+	  step.stackMode = mode;
+	}
+      if( bracket )
+	{
+	  std::vector<FliBracketPointC> points;
+	  if( !bracket->empty() && ! FliCaptureC::parseBracket( *bracket, &points ) )
+	    {
+	      std::cerr << "FliSequenceC::load() ERROR: [" << name << "] invalid bracket" << std::endl;
+	      return false;
+	    }
+	  step.bracket = points;
+	}
+      if( until )
+	{
+	  // ISO 8601 as in the file names, with 'T' or ' ' between date and time
+	  std::string str_until = *until;
+	  std::replace( str_until.begin(), str_until.end(), 'T', ' ' );
+	  try
+	    {
+	      step.ptime_notBefore = boost::posix_time::time_from_string( str_until );
+	    }
+	  catch( std::exception& e )
+	    {
+	      std::cerr << "FliSequenceC::load() ERROR: [" << name << "] invalid time '" << *until
+			<< "', expected YYYY-MM-DDTHH:MM:SS (UTC)" << std::endl;
+	      return false;
+	    }
+	}
+      steps.push_back( step );
+    }
+  if( steps.empty() )
+    {
+      std::cerr << "FliSequenceC::load() ERROR: no steps in " << fileName << std::endl;
+      return false;
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+
+uint32_t FliSequenceC::getNumSteps()
+{
+  return steps.size();
+}
+
+//--------------------------------------------------------------
+/// wait for the start time and the pause of a step
+/// return true if the step should run, false if stopped meanwhile
+bool FliSequenceC::waitFor( const FliSequenceStepC& step )
+{
+  std::unique_lock<std::mutex> lock( mtxWait );
+  if( ! step.ptime_notBefore.is_not_a_date_time() )
+    {
+      boost::posix_time::time_duration td = step.ptime_notBefore - boost::posix_time::microsec_clock::universal_time();
+      if( td.total_microseconds() > 0 )
+	{
+	  std::cout << "Sequence: waiting until " << to_iso_extended_string( step.ptime_notBefore ) << " UTC" << std::endl;
+	  cvWait.wait_for( lock, std::chrono::microseconds( td.total_microseconds() ),
+			   [this]{ return (bool)isStopRequested; } );
+	}
+    }
+  if( step.waitSeconds > 0.0 )
+    {
+      std::cout << "Sequence: waiting " << step.waitSeconds << " s" << std::endl;
+      cvWait.wait_for( lock, std::chrono::duration<double>( step.waitSeconds ),
+		       [this]{ return (bool)isStopRequested; } );
+    }
+  return !isStopRequested;
+}
+
+//--------------------------------------------------------------
+/// send the camera settings of a step which differ from the ones sent before
+/// return true if succeeded, false if failed
+bool FliSequenceC::applyStep( const FliSequenceStepC& step )
+{
+  bool ok = true;
+
+  if( step.exposureTime && (applied.exposureTime != step.exposureTime) )
+    {
+      ok = fc->setExpTime( *step.exposureTime ) && ok;
+      applied.exposureTime = step.exposureTime;
+    }
+  if( step.frameDelay && (applied.frameDelay != step.frameDelay) )
+    {
+      ok = fc->setExpDelay( *step.frameDelay ) && ok;
+      applied.frameDelay = step.frameDelay;
+    }
+  if( step.lowGain && (applied.lowGain != step.lowGain) )
+    {
+      ok = fc->setLowGain( *step.lowGain ) && ok;
+      applied.lowGain = step.lowGain;
+    }
+  if( step.highGain && (applied.highGain != step.highGain) )
+    {
+      ok = fc->setHighGain( *step.highGain ) && ok;
+      applied.highGain = step.highGain;
+    }
+  if( step.coolSetPoint && (applied.coolSetPoint != step.coolSetPoint) )
+    {
+      ok = fc->setTemperatureSetPoint( *step.coolSetPoint ) && ok;
+      applied.coolSetPoint = step.coolSetPoint;
+    }
+  if( step.isExtTriggerEnabled || step.extTriggerType )
+    {
+      bool isEnabled;
+      FPROEXTTRIGTYPE trigType;
+      fc->getExternalTriggerEnable( &isEnabled, &trigType );
+      bool newEnabled = step.isExtTriggerEnabled ? *step.isExtTriggerEnabled : isEnabled;
+      FPROEXTTRIGTYPE newType = step.extTriggerType ? (FPROEXTTRIGTYPE)*step.extTriggerType : trigType;
+      if( (newEnabled != isEnabled) || (newType != trigType) )
+	{
+	  ok = fc->setExternalTriggerEnable( newEnabled, newType ) && ok;
+	}
+      capture.isExtTriggerEnabled = newEnabled;
+    }
+  return ok;
+}
+
+//--------------------------------------------------------------
+/// run all steps, stops at the first failing capture
+/// return FLICTL_OK if succeeded, FLICTL_ERR* code if failed
+int FliSequenceC::run()
+{
+  int retval = FLICTL_OK;
+  std::string fileNameBase = capture.fileNameBase;
+
+  isStopRequested = false;
+  for( size_t k = 0; (k < steps.size()) && !isStopRequested; k++ )
+    {
+      const FliSequenceStepC& step = steps[k];
+      std::cout << "Sequence: step " << k + 1 << "/" << steps.size() << " [" << step.str_name << "]" << std::endl;
+
+      // output settings first, so the buffers are ready before the wait
+      if( step.stackNum )
+	{
+	  capture.stackNum = *step.stackNum;
+	}
+      if( step.stackMode )
+	{
+	  capture.stackMode = *step.stackMode;
+	}
+      if( step.isTimeInFileNames )
+	{
+	  capture.isTimeInFileNames = *step.isTimeInFileNames;
+	}
+      if( step.doWriteMetaData )
+	{
+	  capture.doWriteMetaData = *step.doWriteMetaData;
+	}
+      if( step.bracket )
+	{
+	  capture.bracket = *step.bracket;
+	}
+      if( step.streamRows )
+	{
+	  capture.streamRows = *step.streamRows;
+	}
+      if( step.isMef )
+	{
+	  capture.isMef = *step.isMef;
+	}
+      if( step.isCompressed )
+	{
+	  capture.isCompressed = *step.isCompressed;
+	}
+      capture.fileNameBase = step.fileNameBase ? *step.fileNameBase : fileNameBase + step.str_name + "_";
+      if( (step.count > 0) && ! capture.prepare() )
+	{
+	  retval = FLICTL_ERR_FAILED_ALLOC_FRAME;
+	  break;
+	}
+
+      if( ! waitFor( step ) )
+	{
+	  break;
+	}
+      if( ! applyStep( step ) )
+	{
+	  std::cerr << "FliSequenceC::run() ERROR: camera rejected settings of step [" << step.str_name << "]" << std::endl;
+	  retval = FLICTL_ERR;
+	  break;
+	}
+      if( step.count == 0 )
+	{
+	  continue;
+	}
+      capture.numImages = step.count;
+      retval = capture.run();
+      if( ! capture.bracket.empty() )
+	{
+	  // bracketing left the camera at some point of the cycle
+	  applied.exposureTime.reset();
+	  applied.lowGain.reset();
+	  applied.highGain.reset();
+	}
+      capture.printSummary();
+      if( retval != FLICTL_OK )
+	{
+	  std::cerr << "FliSequenceC::run() ERROR: step [" << step.str_name << "] failed, sequence stopped" << std::endl;
+	  break;
+	}
+    }
+  capture.fileNameBase = fileNameBase;
+
+  if( capture.isExtTriggerEnabled )
+    {
+      // leave the camera in internal trigger mode, as the command line does
+      bool dummy;
+      FPROEXTTRIGTYPE trigType;
+      fc->getExternalTriggerEnable( &dummy, &trigType );
+      fc->setExternalTriggerEnable( false, trigType );
+    }
+  return retval;
+}
+
+//--------------------------------------------------------------
+/// stop after the frames in flight, safe to call from another thread
+void FliSequenceC::requestStop()
+{
+  {
+    std::lock_guard<std::mutex> lock( mtxWait );
+    isStopRequested = true;
+  }
+  cvWait.notify_all();
+  capture.requestStop();
+}
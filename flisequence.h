@@ -0,0 +1,86 @@
+#pragma once
+
+#include "flicamera.h"
+#include "flicapture.h"
+
+#include <boost/optional.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+/// one section of a sequence file, settings not given keep their previous value
+class FliSequenceStepC
+{
+ public:
+  std::string str_name;                       // section name
+  boost::optional<uint64_t> exposureTime;     // [ns]
+  boost::optional<uint64_t> frameDelay;       // [ns]
+  boost::optional<uint32_t> lowGain;          // gain table index
+  boost::optional<uint32_t> highGain;
+  boost::optional<bool> isExtTriggerEnabled;
+  boost::optional<uint32_t> extTriggerType;
+  boost::optional<double> coolSetPoint;       // [Celsius]
+  boost::optional<uint32_t> stackNum;
+  boost::optional<uint32_t> stackMode;
+  boost::optional<bool> isTimeInFileNames;
+  boost::optional<bool> doWriteMetaData;
+  boost::optional<std::string> fileNameBase;
+  boost::optional< std::vector<FliBracketPointC> > bracket; // empty ... bracketing off
+  boost::optional<uint32_t> streamRows;       // 0 ... whole frames
+  boost::optional<bool> isMef;
+  boost::optional<bool> isCompressed;         // .fliz
+  uint32_t count;                             // frames to grab, 0 ... settings / wait only
+  double waitSeconds;                         // pause before the step
+  boost::posix_time::ptime ptime_notBefore;   // start not before this UTC time (not_a_date_time ... now)
+};
+
+/// Batch of capture steps run within one camera session (--sequence).
+/// The sequence file is INI, one section per step, executed in file order:
+///
+///   [darks]
+///   exptime = 1000000000     ; ns
+///   count = 20
+///   [flats]
+///   until = 2026-10-19T02:00:00 ; UTC, wait until then
+///   exptime = 20000000
+///   lowgain = 14
+///   highgain = 57
+///   stack = 10
+///   stackmode = mean
+///   count = 100
+///
+/// Keys: exptime, framedelay, lowgain, highgain, trigger, exttrigtype, cool,
+/// stack, stackmode, time, meta, filename, bracket (as --bracket, empty ... off),
+/// streamrows, mef, fliz, count, wait [s], until.
+/// Only settings that differ from what the camera already has are sent to it.
+/// Buffers of the next step are allocated before its wait, so a step starts
+/// grabbing right after its settings are applied. Files of a step are named
+/// <filename><section>_... unless the step sets filename.
+class FliSequenceC
+{
+ private:
+  FliCameraC* fc;
+  std::vector<FliSequenceStepC> steps;
+  std::atomic<bool> isStopRequested;
+  std::mutex mtxWait;
+  std::condition_variable cvWait;
+  FliSequenceStepC applied;   // camera settings sent so far
+
+  bool applyStep( const FliSequenceStepC& step );
+  bool waitFor( const FliSequenceStepC& step );
+
+ public:
+  FliCaptureC capture;   // defaults of all steps, initialised from the command line
+
+  FliSequenceC( FliCameraC* camera );
+
+  bool load( const std::string& fileName );
+  uint32_t getNumSteps();
+  int run();
+  void requestStop();
+};
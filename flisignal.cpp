@@ -0,0 +1,108 @@
+#include "flisignal.h"
+
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+#include <iostream>
+
+//--------------------------------------------------------------
+
+FliSignalC::FliSignalC()
+{
+  sigemptyset( &sigSet );
+  caughtSignal = 0;
+  isExitRequested = false;
+  isStarted = false;
+}
+
+//--------------------------------------------------------------
+
+FliSignalC::~FliSignalC()
+{
+  stop();
+}
+
+//--------------------------------------------------------------
+/// block SIGINT and SIGTERM and start the listener thread,
+/// SIGUSR1 is used internally to end the listener (together with
+/// isExitRequested, one sent by another process does nothing)
+/// return true if succeeded, false if failed
+bool FliSignalC::start()
+{
+  if( isStarted )
+    {
+      return true;
+    }
+  sigaddset( &sigSet, SIGINT );
+  sigaddset( &sigSet, SIGTERM );
+  sigaddset( &sigSet, SIGUSR1 );
+  int err = pthread_sigmask( SIG_BLOCK, &sigSet, NULL );
+  if( err != 0 )
+    {
+      std::cerr << "FliSignalC::start() ERROR: pthread_sigmask() failed, " << strerror( err ) << std::endl;
+      return false;
+    }
+  isExitRequested = false;
+  listener = std::thread( &FliSignalC::listen, this );
+  isStarted = true;
+  return true;
+}
+
+//--------------------------------------------------------------
+/// end the listener thread, SIGINT and SIGTERM stay blocked
+void FliSignalC::stop()
+{
+  if( !isStarted )
+    {
+      return;
+    }
+  isExitRequested = true;
+  pthread_kill( listener.native_handle(), SIGUSR1 );
+  listener.join();
+  isStarted = false;
+}
+
+//--------------------------------------------------------------
+/// handler called (in the listener thread) on the first signal,
+/// an empty function restores the immediate exit
+void FliSignalC::setStopHandler( std::function<void()> handler )
+{
+  std::lock_guard<std::mutex> lock( mtxHandler );
+  stopHandler = handler;
+}
+
+//--------------------------------------------------------------
+/// return the first SIGINT / SIGTERM received, 0 if none
+int FliSignalC::getCaughtSignal()
+{
+  return caughtSignal;
+}
+
+//--------------------------------------------------------------
+
+void FliSignalC::listen()
+{
+  int sig = 0;
+
+  while( sigwait( &sigSet, &sig ) == 0 )
+    {
+      if( sig == SIGUSR1 )
+	{
+	  if( isExitRequested )
+	    {
+	      return;
+	    }
+	  continue;
+	}
+      std::lock_guard<std::mutex> lock( mtxHandler );
+      if( (caughtSignal != 0) || !stopHandler )
+	{
+	  std::cerr << "FliSignalC: " << strsignal( sig ) << ", exit now" << std::endl;
+	  _exit( 128 + sig );
+	}
+      caughtSignal = sig;
+      std::cerr << "FliSignalC: " << strsignal( sig ) << ", stopping after the frames in flight are written"
+		<< " (repeat to exit now)" << std::endl;
+      stopHandler();
+    }
+}
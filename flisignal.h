@@ -0,0 +1,37 @@
+#pragma once
+
+#include <signal.h>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <atomic>
+
+/// SIGINT / SIGTERM handling for the threaded capture.
+/// start() blocks the signals in the calling thread and starts a listener
+/// thread, so it has to be called before any other thread is created: all
+/// threads inherit the blocked mask and only the listener receives the
+/// signals. The first signal calls the stop handler, which cancels the
+/// captures and lets the frames in flight be written; a second signal, or a
+/// signal while no handler is set, exits immediately.
+class FliSignalC
+{
+ private:
+  std::thread listener;
+  std::mutex mtxHandler;
+  std::function<void()> stopHandler;
+  sigset_t sigSet;
+  std::atomic<int> caughtSignal;
+  std::atomic<bool> isExitRequested;  // set by stop(), a SIGUSR1 from outside is ignored
+  bool isStarted;
+
+  void listen();
+
+ public:
+  FliSignalC();
+  ~FliSignalC();
+
+  bool start();
+  void stop();
+  void setStopHandler( std::function<void()> handler );
+  int getCaughtSignal();
+};
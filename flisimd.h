@@ -0,0 +1,33 @@
+#pragma once
+
+// Helpers for the optional SIMD code paths.
+// AVX2 kernels are compiled with a per-function target attribute and selected
+// at runtime, so flictl still runs on older station PCs without AVX2.
+// SSE2 is part of the x86-64 baseline and needs no runtime check.
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FLI_SIMD_X86 (1)
+#include <immintrin.h>
+#define FLI_TARGET_AVX2 __attribute__((target("avx2")))
+#define FLI_TARGET_SSE42 __attribute__((target("sse4.2")))
+
+inline bool fliCpuHasAvx2()
+{
+  return __builtin_cpu_supports("avx2");
+}
+
+inline bool fliCpuHasSse42()
+{
+  return __builtin_cpu_supports("sse4.2");
+}
+#else
+inline bool fliCpuHasAvx2()
+{
+  return false;
+}
+
+inline bool fliCpuHasSse42()
+{
+  return false;
+}
+#endif
@@ -0,0 +1,441 @@
+#include "flistack.h"
+#include "flisimd.h"
+#include "flithread.h"
+#include "flitrace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+
+//--------------------------------------------------------------
+// accumulation kernels: acc[i] += bitmap[i] or acc[i] = max(acc[i], bitmap[i])
+// numPixels is a multiple of 16 for all supported sensors, the scalar tail
+// loops only handle odd sized frames
+
+static void accumulateSumScalar( uint32_t* acc, const uint16_t* bitmap, uint32_t start, uint32_t numPixels )
+{
+  for( uint32_t i = start; i < numPixels; i++ )
+    {
+      acc[i] += bitmap[i];
+    }
+}
+
+static void accumulateMaxScalar( uint32_t* acc, const uint16_t* bitmap, uint32_t start, uint32_t numPixels )
+{
+  for( uint32_t i = start; i < numPixels; i++ )
+    {
+      if( bitmap[i] > acc[i] )
+	{
+	  acc[i] = bitmap[i];
+	}
+    }
+}
+
+#ifdef FLI_SIMD_X86
+static void accumulateSumSse2( uint32_t* acc, const uint16_t* bitmap, uint32_t numPixels )
+{
+  const __m128i zero = _mm_setzero_si128();
+  uint32_t i;
+  for( i = 0; i + 8 <= numPixels; i += 8 )
+    {
+      __m128i v = _mm_loadu_si128( (const __m128i*)(bitmap + i) );
+      __m128i a0 = _mm_loadu_si128( (const __m128i*)(acc + i) );
+      __m128i a1 = _mm_loadu_si128( (const __m128i*)(acc + i + 4) );
+      _mm_storeu_si128( (__m128i*)(acc + i), _mm_add_epi32( a0, _mm_unpacklo_epi16( v, zero ) ) );
+      _mm_storeu_si128( (__m128i*)(acc + i + 4), _mm_add_epi32( a1, _mm_unpackhi_epi16( v, zero ) ) );
+    }
+  accumulateSumScalar( acc, bitmap, i, numPixels );
+}
+
+static void accumulateMaxSse2( uint32_t* acc, const uint16_t* bitmap, uint32_t numPixels )
+{
+  // SSE2 has no unsigned 32-bit max, but the accumulator never exceeds
+  // 16 bits in max-hold mode, so the signed compare is safe
+  const __m128i zero = _mm_setzero_si128();
+  uint32_t i;
+  for( i = 0; i + 8 <= numPixels; i += 8 )
+    {
+      __m128i v = _mm_loadu_si128( (const __m128i*)(bitmap + i) );
+      __m128i x0 = _mm_unpacklo_epi16( v, zero );
+      __m128i x1 = _mm_unpackhi_epi16( v, zero );
+      __m128i a0 = _mm_loadu_si128( (const __m128i*)(acc + i) );
+      __m128i a1 = _mm_loadu_si128( (const __m128i*)(acc + i + 4) );
+      __m128i m0 = _mm_cmpgt_epi32( x0, a0 );
+      __m128i m1 = _mm_cmpgt_epi32( x1, a1 );
+      _mm_storeu_si128( (__m128i*)(acc + i), _mm_or_si128( _mm_and_si128( m0, x0 ), _mm_andnot_si128( m0, a0 ) ) );
+      _mm_storeu_si128( (__m128i*)(acc + i + 4), _mm_or_si128( _mm_and_si128( m1, x1 ), _mm_andnot_si128( m1, a1 ) ) );
+    }
+  accumulateMaxScalar( acc, bitmap, i, numPixels );
+}
+
+FLI_TARGET_AVX2 static void accumulateSumAvx2( uint32_t* acc, const uint16_t* bitmap, uint32_t numPixels )
+{
+  uint32_t i;
+  for( i = 0; i + 16 <= numPixels; i += 16 )
+    {
+      __m256i v = _mm256_loadu_si256( (const __m256i*)(bitmap + i) );
+      __m256i x0 = _mm256_cvtepu16_epi32( _mm256_castsi256_si128( v ) );
+      __m256i x1 = _mm256_cvtepu16_epi32( _mm256_extracti128_si256( v, 1 ) );
+      __m256i a0 = _mm256_loadu_si256( (const __m256i*)(acc + i) );
+      __m256i a1 = _mm256_loadu_si256( (const __m256i*)(acc + i + 8) );
+      _mm256_storeu_si256( (__m256i*)(acc + i), _mm256_add_epi32( a0, x0 ) );
+      _mm256_storeu_si256( (__m256i*)(acc + i + 8), _mm256_add_epi32( a1, x1 ) );
+    }
+  accumulateSumScalar( acc, bitmap, i, numPixels );
+}
+
+FLI_TARGET_AVX2 static void accumulateMaxAvx2( uint32_t* acc, const uint16_t* bitmap, uint32_t numPixels )
+{
+  uint32_t i;
+  for( i = 0; i + 16 <= numPixels; i += 16 )
+    {
+      __m256i v = _mm256_loadu_si256( (const __m256i*)(bitmap + i) );
+      __m256i x0 = _mm256_cvtepu16_epi32( _mm256_castsi256_si128( v ) );
+      __m256i x1 = _mm256_cvtepu16_epi32( _mm256_extracti128_si256( v, 1 ) );
+      __m256i a0 = _mm256_loadu_si256( (const __m256i*)(acc + i) );
+      __m256i a1 = _mm256_loadu_si256( (const __m256i*)(acc + i + 8) );
+      _mm256_storeu_si256( (__m256i*)(acc + i), _mm256_max_epu32( a0, x0 ) );
+      _mm256_storeu_si256( (__m256i*)(acc + i + 8), _mm256_max_epu32( a1, x1 ) );
+    }
+  accumulateMaxScalar( acc, bitmap, i, numPixels );
+}
+#endif
+
+//--------------------------------------------------------------
+
+FliStackC::FliStackC()
+{
+  uiNumPixels = 0;
+  uiStackMode = FLISTACK_MODE_SUM;
+  uiNumChannels = 2;
+  uiNumStacked = 0;
+  pAccLow = NULL;
+  pAccHigh = NULL;
+  pBitmapLow[0] = pBitmapLow[1] = NULL;
+  pBitmapHigh[0] = pBitmapHigh[1] = NULL;
+  uiFillIndex = 0;
+  useAvx2 = fliCpuHasAvx2();
+  workerCpu = -1;
+  isJobPending = false;
+  uiJobIndex = 0;
+  isWorkerExit = false;
+}
+
+//--------------------------------------------------------------
+
+FliStackC::~FliStackC()
+{
+  if( worker.joinable() )
+    {
+      {
+	std::unique_lock<std::mutex> lock( mtx );
+	cv.wait( lock, [this]{ return !isJobPending; } );
+	isWorkerExit = true;
+      }
+      cv.notify_all();
+      worker.join();
+    }
+  freeBuffers();
+}
+
+//--------------------------------------------------------------
+
+void FliStackC::freeBuffers()
+{
+  free( pAccLow );
+  free( pAccHigh );
+  pAccLow = NULL;
+  pAccHigh = NULL;
+  for( int i = 0; i < 2; i++ )
+    {
+      free( pBitmapLow[i] );
+      free( pBitmapHigh[i] );
+      pBitmapLow[i] = NULL;
+      pBitmapHigh[i] = NULL;
+    }
+}
+
+//--------------------------------------------------------------
+/// pin the accumulation worker to a CPU, call before init()
+void FliStackC::setWorkerCpu( int cpu )
+{
+  workerCpu = cpu;
+}
+
+//--------------------------------------------------------------
+/// allocate accumulators and bitmap buffers and start the worker thread
+/// return true if succeeded, false if failed
+bool FliStackC::init( uint32_t numPixels, uint32_t mode, uint32_t numChannels )
+{
+  if( mode > FLISTACK_MODE_MAX )
+    {
+      std::cerr << "FliStackC::init() ERROR: invalid stack mode " << mode << std::endl;
+      return false;
+    }
+  if( worker.joinable() )
+    {
+      std::cerr << "FliStackC::init() ERROR: already initialised." << std::endl;
+      return false;
+    }
+  uiNumPixels = numPixels;
+  uiStackMode = mode;
+  uiNumChannels = (numChannels == 1) ? 1 : 2;
+
+  // 32 byte alignment keeps the AVX2 loads within cache lines
+  size_t accSize = (size_t)numPixels * sizeof(uint32_t);
+  size_t bitmapSize = (size_t)numPixels * sizeof(uint16_t);
+  bool hasHigh = (uiNumChannels == 2);
+  bool ok = (posix_memalign( (void**)&pAccLow, 32, accSize ) == 0)
+    && (!hasHigh || (posix_memalign( (void**)&pAccHigh, 32, accSize ) == 0));
+  for( int i = 0; ok && (i < 2); i++ )
+    {
+      ok = (posix_memalign( (void**)&pBitmapLow[i], 32, bitmapSize ) == 0)
+	&& (!hasHigh || (posix_memalign( (void**)&pBitmapHigh[i], 32, bitmapSize ) == 0));
+    }
+  if( !ok )
+    {
+      std::cerr << "FliStackC::init() ERROR: failed to allocate stack buffers for "
+		<< numPixels << " pixels." << std::endl;
+      freeBuffers();
+      return false;
+    }
+  // the worker clears the accumulators, so they are placed on its NUMA node
+  uiNumStacked = 0;
+  worker = std::thread( &FliStackC::workerLoop, this );
+  return true;
+}
+
+//--------------------------------------------------------------
+/// bitmaps the next frame should be converted into
+void FliStackC::getFillBuffers( uint16_t** bitmap16bitLow, uint16_t** bitmap16bitHigh )
+{
+  *bitmap16bitLow = pBitmapLow[uiFillIndex];
+  *bitmap16bitHigh = pBitmapHigh[uiFillIndex];
+}
+
+//--------------------------------------------------------------
+/// queue the filled bitmaps for accumulation and swap to the other buffer pair
+/// blocks only if the worker is still busy with the previous frame
+/// return true if succeeded, false if failed
+bool FliStackC::addFrame()
+{
+  if( !worker.joinable() )
+    {
+      std::cerr << "FliStackC::addFrame() ERROR: not initialised." << std::endl;
+      return false;
+    }
+  {
+    std::unique_lock<std::mutex> lock( mtx );
+    cv.wait( lock, [this]{ return !isJobPending; } );
+    uiJobIndex = uiFillIndex;
+    isJobPending = true;
+    uiNumStacked++;
+  }
+  cv.notify_all();
+  uiFillIndex ^= 1;
+  return true;
+}
+
+//--------------------------------------------------------------
+/// wait until all queued frames are accumulated
+void FliStackC::finish()
+{
+  std::unique_lock<std::mutex> lock( mtx );
+  cv.wait( lock, [this]{ return !isJobPending; } );
+}
+
+//--------------------------------------------------------------
+/// clear the accumulators to start a new stack
+void FliStackC::reset()
+{
+  finish();
+  memset( pAccLow, 0, (size_t)uiNumPixels * sizeof(uint32_t) );
+  if( pAccHigh != NULL )
+    {
+      memset( pAccHigh, 0, (size_t)uiNumPixels * sizeof(uint32_t) );
+    }
+  uiNumStacked = 0;
+}
+
+//--------------------------------------------------------------
+
+void FliStackC::workerLoop()
+{
+  fliSetThreadAffinity( workerCpu );
+  FliTraceC::setThreadName( "stack" );
+  std::unique_lock<std::mutex> lock( mtx );
+  memset( pAccLow, 0, (size_t)uiNumPixels * sizeof(uint32_t) );
+  if( pAccHigh != NULL )
+    {
+      memset( pAccHigh, 0, (size_t)uiNumPixels * sizeof(uint32_t) );
+    }
+  while( true )
+    {
+      cv.wait( lock, [this]{ return isJobPending || isWorkerExit; } );
+      if( isWorkerExit )
+	{
+	  return;
+	}
+      uint32_t index = uiJobIndex;
+      lock.unlock();
+      {
+	FliTraceScopeC trace( "accumulate" );
+	accumulate( pAccLow, pBitmapLow[index] );
+	if( pAccHigh != NULL )
+	  {
+	    accumulate( pAccHigh, pBitmapHigh[index] );
+	  }
+      }
+      lock.lock();
+      isJobPending = false;
+      cv.notify_all();
+    }
+}
+
+//--------------------------------------------------------------
+
+void FliStackC::accumulate( uint32_t* acc, const uint16_t* bitmap )
+{
+  bool isMax = (uiStackMode == FLISTACK_MODE_MAX);
+#ifdef FLI_SIMD_X86
+  if( useAvx2 )
+    {
+      if( isMax )
+	{
+	  accumulateMaxAvx2( acc, bitmap, uiNumPixels );
+	}
+      else
+	{
+	  accumulateSumAvx2( acc, bitmap, uiNumPixels );
+	}
+    }
+  else
+    {
+      if( isMax )
+	{
+	  accumulateMaxSse2( acc, bitmap, uiNumPixels );
+	}
+      else
+	{
+	  accumulateSumSse2( acc, bitmap, uiNumPixels );
+	}
+    }
+#else
+  if( isMax )
+    {
+      accumulateMaxScalar( acc, bitmap, 0, uiNumPixels );
+    }
+  else
+    {
+      accumulateSumScalar( acc, bitmap, 0, uiNumPixels );
+    }
+#endif
+}
+
+//--------------------------------------------------------------
+
+uint32_t FliStackC::getNumStacked()
+{
+  return uiNumStacked;
+}
+
+uint32_t FliStackC::getMode()
+{
+  return uiStackMode;
+}
+
+uint32_t FliStackC::getNumChannels()
+{
+  return uiNumChannels;
+}
+
+//--------------------------------------------------------------
+/// change the stacking mode of an initialised, empty stack (buffers are kept)
+/// return true if succeeded, false if failed
+bool FliStackC::setMode( uint32_t mode )
+{
+  if( (mode > FLISTACK_MODE_MAX) || (uiNumStacked > 0) )
+    {
+      std::cerr << "FliStackC::setMode() ERROR: invalid stack mode " << mode
+		<< " or stack not empty." << std::endl;
+      return false;
+    }
+  finish();
+  uiStackMode = mode;
+  return true;
+}
+
+//--------------------------------------------------------------
+/// mean and max-hold results fit into 16 bits, sum needs all 32 bits
+bool FliStackC::isResult16bit()
+{
+  return (uiStackMode != FLISTACK_MODE_SUM);
+}
+
+//--------------------------------------------------------------
+/// raw 32-bit accumulators, valid after finish()
+uint32_t* FliStackC::getResultLow()
+{
+  return pAccLow;
+}
+
+uint32_t* FliStackC::getResultHigh()
+{
+  return pAccHigh;
+}
+
+//--------------------------------------------------------------
+/// convert the accumulators into 16-bit bitmaps (mean or max-hold)
+/// the fill buffers may be passed in, finish() is called first
+/// return true if succeeded, false if failed
+bool FliStackC::packResult16bit( uint16_t* bitmap16bitLow, uint16_t* bitmap16bitHigh )
+{
+  finish();
+  if( !isResult16bit() || (uiNumStacked == 0) )
+    {
+      return false;
+    }
+  uint32_t div = (uiStackMode == FLISTACK_MODE_MEAN) ? uiNumStacked : 1;
+  uint32_t half = div / 2;
+  for( uint32_t i = 0; i < uiNumPixels; i++ )
+    {
+      bitmap16bitLow[i] = (uint16_t)((pAccLow[i] + half) / div);
+    }
+  for( uint32_t i = 0; (pAccHigh != NULL) && (i < uiNumPixels); i++ )
+    {
+      bitmap16bitHigh[i] = (uint16_t)((pAccHigh[i] + half) / div);
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+/// return true if name is a known stack mode
+bool FliStackC::parseMode( const std::string& name, uint32_t* mode )
+{
+  for( uint32_t m = FLISTACK_MODE_SUM; m <= FLISTACK_MODE_MAX; m++ )
+    {
+      if( name == modeName( m ) )
+	{
+	  *mode = m;
+	  return true;
+	}
+    }
+  return false;
+}
+
+//--------------------------------------------------------------
+
+const char* FliStackC::modeName( uint32_t mode )
+{
+  switch( mode )
+    {
+    case FLISTACK_MODE_SUM:
+      return "sum";
+    case FLISTACK_MODE_MEAN:
+      return "mean";
+    case FLISTACK_MODE_MAX:
+      return "max";
+    default:
+      return "INVALID";
+    }
+}
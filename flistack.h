@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define FLISTACK_MODE_SUM  (0)
+#define FLISTACK_MODE_MEAN (1)
+#define FLISTACK_MODE_MAX  (2)
+
+/// On-the-fly co-adding of consecutive L/H frames into 32-bit accumulators.
+/// The grab loop converts each frame into one of two bitmap pairs owned by
+/// this class (getFillBuffers()), addFrame() hands the pair to a worker thread
+/// and swaps to the other pair, so the camera readout never waits for the
+/// accumulation of the previous frame.
+/// Single channel frames (non-HDR modes) are stacked with numChannels 1, the
+/// high channel buffers are not allocated and returned as NULL then.
+class FliStackC
+{
+ private:
+  uint32_t uiNumPixels;
+  uint32_t uiNumChannels;
+  uint32_t uiStackMode;
+  uint32_t uiNumStacked;
+  uint32_t *pAccLow, *pAccHigh;       // 32-bit accumulators
+  uint16_t *pBitmapLow[2], *pBitmapHigh[2]; // double buffered input bitmaps
+  uint32_t uiFillIndex;               // bitmap pair the grab loop converts into
+  bool useAvx2;
+  int workerCpu;                      // -1 ... worker not pinned
+
+  std::thread worker;
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool isJobPending;
+  uint32_t uiJobIndex;
+  bool isWorkerExit;
+
+  void workerLoop();
+  void accumulate( uint32_t* acc, const uint16_t* bitmap );
+  void freeBuffers();
+
+ public:
+  FliStackC();
+  ~FliStackC();
+
+  void setWorkerCpu( int cpu );
+  bool init( uint32_t numPixels, uint32_t mode, uint32_t numChannels = 2 );
+  bool setMode( uint32_t mode );
+  void getFillBuffers( uint16_t** bitmap16bitLow, uint16_t** bitmap16bitHigh );
+  bool addFrame();
+  void finish();
+  void reset();
+
+  uint32_t getNumStacked();
+  uint32_t getMode();
+  uint32_t getNumChannels();
+  bool isResult16bit();
+  uint32_t* getResultLow();
+  uint32_t* getResultHigh();
+  bool packResult16bit( uint16_t* bitmap16bitLow, uint16_t* bitmap16bitHigh );
+
+  static bool parseMode( const std::string& name, uint32_t* mode );
+  static const char* modeName( uint32_t mode );
+};
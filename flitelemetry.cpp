@@ -0,0 +1,219 @@
+#include "flitelemetry.h"
+
+#include <iostream>
+#include <chrono>
+
+static const boost::posix_time::ptime ptime_epoch( boost::gregorian::date( 1970, 1, 1 ) );
+
+//--------------------------------------------------------------
+
+FliTelemetryC::FliTelemetryC()
+{
+  for( int i = 0; i < FLITELEMETRY_RING_SIZE; i++ )
+    {
+      ring[i].seq = 0;
+    }
+  uiNumSamples = 0;
+  fc = NULL;
+  uiPeriodMs = 1000;
+  isExit = false;
+}
+
+//--------------------------------------------------------------
+
+FliTelemetryC::~FliTelemetryC()
+{
+  stop();
+}
+
+//--------------------------------------------------------------
+/// start sampling camera every periodMs, logFileName = "" ... no CSV time series
+/// return true if succeeded, false if failed
+bool FliTelemetryC::start( FliCameraC* camera, uint32_t periodMs, const std::string& logFileName )
+{
+  if( sampler.joinable() || (periodMs == 0) )
+    {
+      return false;
+    }
+  if( ! logFileName.empty() )
+    {
+      logFile.open( logFileName.c_str(), std::ofstream::app );
+      if( ! logFile.is_open() )
+	{
+	  std::cerr << "FliTelemetryC::start() ERROR: cannot open " << logFileName << std::endl;
+	  return false;
+	}
+      if( logFile.tellp() == 0 )
+	{
+	  logFile << "time_utc,ambient_c,base_c,cooler_c,setpoint_c\n";
+	}
+    }
+  fc = camera;
+  uiPeriodMs = periodMs;
+  isExit = false;
+  sampler = std::thread( &FliTelemetryC::samplerLoop, this );
+  return true;
+}
+
+//--------------------------------------------------------------
+
+void FliTelemetryC::stop()
+{
+  if( ! sampler.joinable() )
+    {
+      return;
+    }
+  {
+    std::lock_guard<std::mutex> lock( mtx );
+    isExit = true;
+  }
+  cv.notify_all();
+  sampler.join();
+  if( logFile.is_open() )
+    {
+      logFile.close();
+    }
+}
+
+//--------------------------------------------------------------
+
+bool FliTelemetryC::isRunning()
+{
+  return sampler.joinable();
+}
+
+//--------------------------------------------------------------
+
+uint32_t FliTelemetryC::getPeriodMs()
+{
+  return uiPeriodMs;
+}
+
+//--------------------------------------------------------------
+
+void FliTelemetryC::samplerLoop()
+{
+  std::unique_lock<std::mutex> lock( mtx );
+  while( !isExit )
+    {
+      lock.unlock();
+      FliTelemetrySampleC sample;
+      if( fc->readTemperatures( &sample.ambientTemp, &sample.baseTemp, &sample.coolerTemp, &sample.setPoint ) )
+	{
+	  sample.ptime_sample = boost::posix_time::microsec_clock::universal_time();
+	  store( sample );
+	  if( logFile.is_open() )
+	    {
+	      logFile << to_iso_extended_string( sample.ptime_sample ) << "Z," << sample.ambientTemp << ","
+		      << sample.baseTemp << "," << sample.coolerTemp << "," << sample.setPoint << "\n";
+	      logFile.flush();
+	    }
+	}
+      lock.lock();
+      cv.wait_for( lock, std::chrono::milliseconds( uiPeriodMs ), [this]{ return isExit; } );
+    }
+}
+
+//--------------------------------------------------------------
+/// append a sample to the ring, only called by the sampler thread
+void FliTelemetryC::store( const FliTelemetrySampleC& sample )
+{
+  uint64_t n = uiNumSamples.load( std::memory_order_relaxed );
+  SlotC& slot = ring[n % FLITELEMETRY_RING_SIZE];
+  uint32_t seq = slot.seq.load( std::memory_order_relaxed );
+
+  slot.seq.store( seq + 1, std::memory_order_relaxed );
+  std::atomic_thread_fence( std::memory_order_release );
+  slot.time.store( (sample.ptime_sample - ptime_epoch).total_microseconds(), std::memory_order_relaxed );
+  slot.ambientTemp.store( sample.ambientTemp, std::memory_order_relaxed );
+  slot.baseTemp.store( sample.baseTemp, std::memory_order_relaxed );
+  slot.coolerTemp.store( sample.coolerTemp, std::memory_order_relaxed );
+  slot.setPoint.store( sample.setPoint, std::memory_order_relaxed );
+  slot.seq.store( seq + 2, std::memory_order_release );
+  uiNumSamples.store( n + 1, std::memory_order_release );
+}
+
+//--------------------------------------------------------------
+/// read sample number n
+/// return true if succeeded, false if it was overwritten meanwhile
+bool FliTelemetryC::readSlot( uint64_t n, FliTelemetrySampleC* sample )
+{
+  const SlotC& slot = ring[n % FLITELEMETRY_RING_SIZE];
+  int64_t time;
+  while( true )
+    {
+      uint32_t seq1 = slot.seq.load( std::memory_order_acquire );
+      if( seq1 & 1 )
+	{
+	  // being written right now
+	  std::this_thread::yield();
+	  continue;
+	}
+      time = slot.time.load( std::memory_order_relaxed );
+      sample->ambientTemp = slot.ambientTemp.load( std::memory_order_relaxed );
+      sample->baseTemp = slot.baseTemp.load( std::memory_order_relaxed );
+      sample->coolerTemp = slot.coolerTemp.load( std::memory_order_relaxed );
+      sample->setPoint = slot.setPoint.load( std::memory_order_relaxed );
+      std::atomic_thread_fence( std::memory_order_acquire );
+      if( slot.seq.load( std::memory_order_relaxed ) == seq1 )
+	{
+	  break;
+	}
+    }
+  sample->ptime_sample = ptime_epoch + boost::posix_time::microseconds( time );
+  return uiNumSamples.load( std::memory_order_acquire ) <= n + FLITELEMETRY_RING_SIZE;
+}
+
+//--------------------------------------------------------------
+/// newest sample
+/// return true if succeeded, false if there is none yet
+bool FliTelemetryC::getLatest( FliTelemetrySampleC* sample )
+{
+  uint64_t total = uiNumSamples.load( std::memory_order_acquire );
+  return (total > 0) && readSlot( total - 1, sample );
+}
+
+//--------------------------------------------------------------
+/// temperatures at time t, linear between the two samples around t,
+/// the oldest / newest sample if t is outside of the ring
+/// return true if succeeded, false if there is no sample yet
+bool FliTelemetryC::interpolate( boost::posix_time::ptime t, FliTelemetrySampleC* sample )
+{
+  uint64_t total = uiNumSamples.load( std::memory_order_acquire );
+  uint64_t oldest = (total > FLITELEMETRY_RING_SIZE) ? total - FLITELEMETRY_RING_SIZE : 0;
+  FliTelemetrySampleC before, after;
+  bool hasAfter = false;
+
+  // frames are recent, so the newest samples are checked first
+  for( uint64_t n = total; n-- > oldest; )
+    {
+      if( ! readSlot( n, &before ) )
+	{
+	  break;
+	}
+      if( before.ptime_sample <= t )
+	{
+	  if( !hasAfter )
+	    {
+	      *sample = before;
+	      return true;
+	    }
+	  double span = (after.ptime_sample - before.ptime_sample).total_microseconds();
+	  double w = (span > 0.0) ? (t - before.ptime_sample).total_microseconds() / span : 0.0;
+	  sample->ptime_sample = t;
+	  sample->ambientTemp = before.ambientTemp + w * (after.ambientTemp - before.ambientTemp);
+	  sample->baseTemp = before.baseTemp + w * (after.baseTemp - before.baseTemp);
+	  sample->coolerTemp = before.coolerTemp + w * (after.coolerTemp - before.coolerTemp);
+	  sample->setPoint = (w < 0.5) ? before.setPoint : after.setPoint;
+	  return true;
+	}
+      after = before;
+      hasAfter = true;
+    }
+  if( hasAfter )
+    {
+      *sample = after;
+      return true;
+    }
+  return false;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "flicamera.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#define FLITELEMETRY_RING_SIZE (1024)  // 17 minutes at 1 Hz
+
+/// one temperature reading of the camera [Celsius]
+class FliTelemetrySampleC
+{
+ public:
+  boost::posix_time::ptime ptime_sample;
+  double ambientTemp;
+  double baseTemp;
+  double coolerTemp;
+  double setPoint;
+};
+
+/// Background sampler of the camera temperatures and cooler set point.
+/// A thread reads them every periodMs into a ring of the latest
+/// FLITELEMETRY_RING_SIZE samples and optionally appends them to a CSV time
+/// series. The ring has a single writer and is read without locks: each slot
+/// carries a sequence number that is odd while the slot is being written
+/// (seqlock), readers retry if it changed under them. interpolate() gives the
+/// temperatures at any time covered by the ring, eg. the middle of an exposure,
+/// so the capture and writer threads never wait for the camera.
+class FliTelemetryC
+{
+ private:
+  class SlotC
+  {
+  public:
+    std::atomic<uint32_t> seq;
+    std::atomic<int64_t> time;   // [us] since epoch
+    std::atomic<double> ambientTemp;
+    std::atomic<double> baseTemp;
+    std::atomic<double> coolerTemp;
+    std::atomic<double> setPoint;
+  };
+  SlotC ring[FLITELEMETRY_RING_SIZE];
+  std::atomic<uint64_t> uiNumSamples;   // written so far, next slot is uiNumSamples % size
+
+  FliCameraC* fc;
+  uint32_t uiPeriodMs;
+  std::ofstream logFile;
+  std::thread sampler;
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool isExit;
+
+  void samplerLoop();
+  void store( const FliTelemetrySampleC& sample );
+  bool readSlot( uint64_t n, FliTelemetrySampleC* sample );
+
+ public:
+  FliTelemetryC();
+  ~FliTelemetryC();
+
+  bool start( FliCameraC* camera, uint32_t periodMs, const std::string& logFileName );
+  void stop();
+  bool isRunning();
+  uint32_t getPeriodMs();
+  bool getLatest( FliTelemetrySampleC* sample );
+  bool interpolate( boost::posix_time::ptime t, FliTelemetrySampleC* sample );
+};
@@ -0,0 +1,147 @@
+#include "flithread.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include <sstream>
+
+//--------------------------------------------------------------
+/// parse comma separated CPU numbers, eg. "2,4,6"
+/// return true if succeeded, false if failed
+bool fliParseCpuList( const std::string& str, std::vector<int>* cpus )
+{
+  std::istringstream is( str );
+  std::string item;
+
+  cpus->clear();
+  while( std::getline( is, item, ',' ) )
+    {
+      char* end;
+      long cpu = strtol( item.c_str(), &end, 10 );
+      if( item.empty() || (*end != '\0') || (cpu < 0) || (cpu >= CPU_SETSIZE) )
+	{
+	  std::cerr << "fliParseCpuList() ERROR: invalid CPU number '" << item << "'" << std::endl;
+	  return false;
+	}
+      cpus->push_back( (int)cpu );
+    }
+  return !cpus->empty();
+}
+
+//--------------------------------------------------------------
+/// pin the calling thread to a single CPU, cpu < 0 does nothing
+/// return true if succeeded, false if failed
+bool fliSetThreadAffinity( int cpu )
+{
+  if( cpu < 0 )
+    {
+      return true;
+    }
+  cpu_set_t set;
+  CPU_ZERO( &set );
+  CPU_SET( cpu, &set );
+  int err = pthread_setaffinity_np( pthread_self(), sizeof(set), &set );
+  if( err != 0 )
+    {
+      std::cerr << "fliSetThreadAffinity() ERROR: cannot pin thread to CPU " << cpu
+		<< ": " << strerror( err ) << std::endl;
+      return false;
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+/// run the calling thread with SCHED_FIFO at priority (1..99),
+/// priority <= 0 does nothing, needs CAP_SYS_NICE or a matching rtprio limit
+/// return true if succeeded, false if failed
+bool fliSetThreadRealtime( int priority )
+{
+  if( priority <= 0 )
+    {
+      return true;
+    }
+  struct sched_param param;
+  memset( &param, 0, sizeof(param) );
+  param.sched_priority = priority;
+  int err = pthread_setschedparam( pthread_self(), SCHED_FIFO, &param );
+  if( err != 0 )
+    {
+      std::cerr << "fliSetThreadRealtime() ERROR: cannot set SCHED_FIFO priority " << priority
+		<< ": " << strerror( err ) << std::endl;
+      return false;
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+/// let the calling thread run on any CPU with normal scheduling, a new thread
+/// inherits the affinity and SCHED_FIFO of the (capture) thread starting it
+/// return true if succeeded, false if failed
+bool fliClearThreadPlacement()
+{
+  cpu_set_t set;
+  CPU_ZERO( &set );
+  long numCpus = sysconf( _SC_NPROCESSORS_CONF );
+  for( long cpu = 0; (cpu < numCpus) && (cpu < CPU_SETSIZE); cpu++ )
+    {
+      CPU_SET( cpu, &set );
+    }
+  // CPUs outside the cpuset of the process are left out by the kernel
+  int err = pthread_setaffinity_np( pthread_self(), sizeof(set), &set );
+  if( err != 0 )
+    {
+      std::cerr << "fliClearThreadPlacement() ERROR: cannot unpin thread: " << strerror( err ) << std::endl;
+      return false;
+    }
+  struct sched_param param;
+  memset( &param, 0, sizeof(param) );
+  err = pthread_setschedparam( pthread_self(), SCHED_OTHER, &param );
+  if( err != 0 )
+    {
+      std::cerr << "fliClearThreadPlacement() ERROR: cannot set normal scheduling: " << strerror( err ) << std::endl;
+      return false;
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+/// NUMA node of a CPU as listed in sysfs, -1 if unknown
+int fliCpuNumaNode( int cpu )
+{
+  char path[128];
+  for( int node = 0; node < 64; node++ )
+    {
+      snprintf( path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node );
+      if( access( path, F_OK ) == 0 )
+	{
+	  return node;
+	}
+    }
+  return -1;
+}
+
+//--------------------------------------------------------------
+/// write one byte per page so the pages are mapped now, on the NUMA node
+/// of the calling thread, and not by page faults during the capture
+void fliFirstTouch( void* mem, size_t size )
+{
+  if( mem == NULL )
+    {
+      return;
+    }
+  long pageSize = sysconf( _SC_PAGESIZE );
+  if( pageSize <= 0 )
+    {
+      pageSize = 4096;
+    }
+  volatile uint8_t* p = (volatile uint8_t*)mem;
+  for( size_t i = 0; i < size; i += pageSize )
+    {
+      p[i] = 0;
+    }
+}
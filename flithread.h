@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Thread placement helpers for the capture pipeline (Linux only).
+// Memory is placed on the NUMA node of the thread that touches it first, so
+// buffers are allocated and touched by the (pinned) thread that uses them.
+
+bool fliParseCpuList( const std::string& str, std::vector<int>* cpus );
+bool fliSetThreadAffinity( int cpu );
+bool fliSetThreadRealtime( int priority );
+bool fliClearThreadPlacement();
+int fliCpuNumaNode( int cpu );
+void fliFirstTouch( void* mem, size_t size );
@@ -0,0 +1,210 @@
+#include "flithrottle.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <stdio.h>
+#include <iostream>
+
+//--------------------------------------------------------------
+
+FliThrottleC::FliThrottleC()
+{
+  isEnabled = false;
+  highWater = 0.75;
+  lowWater = 0.25;
+  recoverFrames = 10;
+  maxDecimation = 16;
+  holdFrames = 4;
+  canCompress = false;
+  str_logTag = "";
+  reset();
+}
+
+//--------------------------------------------------------------
+/// back to full output, clear statistics
+void FliThrottleC::reset()
+{
+  uiLevel = FLITHROTTLE_LEVEL_FULL;
+  uiDecimation = 1;
+  uiFramesBelowLow = 0;
+  uiHoldLeft = 0;
+  uiMaxLevelReached = FLITHROTTLE_LEVEL_FULL;
+  uiMaxDecimationReached = 1;
+  uiNumCompressed = 0;
+  uiNumSkippedL = 0;
+  uiNumDecimated = 0;
+}
+
+//--------------------------------------------------------------
+/// feed the current writer backlog (0..1), called once per captured frame
+void FliThrottleC::update( double backlog )
+{
+  if( !isEnabled )
+    {
+      return;
+    }
+  if( uiHoldLeft > 0 )
+    {
+      uiHoldLeft--;
+    }
+  if( backlog > highWater )
+    {
+      uiFramesBelowLow = 0;
+      if( uiHoldLeft > 0 )
+	{
+	  // the last step has not reached the backlog yet
+	  return;
+	}
+      if( uiLevel == FLITHROTTLE_LEVEL_FULL )
+	{
+	  // compressing loses nothing, so it comes first
+	  uiLevel = canCompress ? FLITHROTTLE_LEVEL_COMPRESS : FLITHROTTLE_LEVEL_SKIP_L;
+	}
+      else if( uiLevel == FLITHROTTLE_LEVEL_COMPRESS )
+	{
+	  uiLevel = FLITHROTTLE_LEVEL_SKIP_L;
+	}
+      else if( uiLevel == FLITHROTTLE_LEVEL_SKIP_L )
+	{
+	  uiLevel = FLITHROTTLE_LEVEL_DECIMATE;
+	  uiDecimation = 2;
+	}
+      else if( uiDecimation < maxDecimation )
+	{
+	  uiDecimation *= 2;
+	}
+      else
+	{
+	  return;
+	}
+      uiHoldLeft = holdFrames;
+      logChange( backlog );
+    }
+  else if( (backlog < lowWater) && (uiLevel != FLITHROTTLE_LEVEL_FULL) )
+    {
+      uiFramesBelowLow++;
+      if( uiFramesBelowLow < recoverFrames )
+	{
+	  return;
+	}
+      uiFramesBelowLow = 0;
+      if( uiDecimation > 2 )
+	{
+	  uiDecimation /= 2;
+	}
+      else if( uiLevel == FLITHROTTLE_LEVEL_DECIMATE )
+	{
+	  uiLevel = FLITHROTTLE_LEVEL_SKIP_L;
+	  uiDecimation = 1;
+	}
+      else if( (uiLevel == FLITHROTTLE_LEVEL_SKIP_L) && canCompress )
+	{
+	  uiLevel = FLITHROTTLE_LEVEL_COMPRESS;
+	}
+      else
+	{
+	  uiLevel = FLITHROTTLE_LEVEL_FULL;
+	}
+      logChange( backlog );
+    }
+  else
+    {
+      uiFramesBelowLow = 0;
+    }
+}
+
+//--------------------------------------------------------------
+/// return true if frame frameIndex should be written at all,
+/// *writeL tells if the low gain channel should be written too,
+/// *compress if the frame should be written as .fliz
+bool FliThrottleC::decide( uint32_t frameIndex, bool* writeL, bool* compress )
+{
+  *writeL = (uiLevel < FLITHROTTLE_LEVEL_SKIP_L);
+  *compress = canCompress && (uiLevel >= FLITHROTTLE_LEVEL_COMPRESS);
+  if( (uiDecimation > 1) && ((frameIndex % uiDecimation) != 0) )
+    {
+      uiNumDecimated++;
+      return false;
+    }
+  if( !*writeL )
+    {
+      uiNumSkippedL++;
+    }
+  if( *compress )
+    {
+      uiNumCompressed++;
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+
+uint32_t FliThrottleC::getLevel()
+{
+  return uiLevel;
+}
+
+//--------------------------------------------------------------
+
+uint32_t FliThrottleC::getDecimation()
+{
+  return uiDecimation;
+}
+
+//--------------------------------------------------------------
+
+std::string FliThrottleC::levelName()
+{
+  switch( uiLevel )
+    {
+    case FLITHROTTLE_LEVEL_FULL:
+      return "full";
+    case FLITHROTTLE_LEVEL_COMPRESS:
+      return "compressed";
+    case FLITHROTTLE_LEVEL_SKIP_L:
+      return canCompress ? "compressed skip-L" : "skip-L";
+    default:
+      return std::string( canCompress ? "compressed " : "" ) + "H only, every " + std::to_string( uiDecimation ) + ". frame";
+    }
+}
+
+//--------------------------------------------------------------
+
+void FliThrottleC::logChange( double backlog )
+{
+  if( uiLevel > uiMaxLevelReached )
+    {
+      uiMaxLevelReached = uiLevel;
+    }
+  if( uiDecimation > uiMaxDecimationReached )
+    {
+      uiMaxDecimationReached = uiDecimation;
+    }
+  std::cout << str_logTag << "THROTTLE " << to_iso_extended_string( boost::posix_time::microsec_clock::universal_time() )
+	    << " writer backlog " << (int)(backlog * 100.0 + 0.5) << "%, output now " << levelName() << std::endl;
+}
+
+//--------------------------------------------------------------
+
+void FliThrottleC::printSummary()
+{
+  if( !isEnabled )
+    {
+      return;
+    }
+  std::string str_worst = "full";
+  if( uiMaxLevelReached == FLITHROTTLE_LEVEL_COMPRESS )
+    {
+      str_worst = "compressed";
+    }
+  else if( uiMaxLevelReached == FLITHROTTLE_LEVEL_SKIP_L )
+    {
+      str_worst = "skip-L";
+    }
+  else if( uiMaxLevelReached == FLITHROTTLE_LEVEL_DECIMATE )
+    {
+      str_worst = "decimate by " + std::to_string( uiMaxDecimationReached );
+    }
+  printf( "%sThrottle: %u frames compressed, L channel skipped for %u frames, %u frames not written (decimated), worst level %s\n",
+	  str_logTag.c_str(), uiNumCompressed, uiNumSkippedL, uiNumDecimated, str_worst.c_str() );
+}
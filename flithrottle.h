@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#define FLITHROTTLE_LEVEL_FULL     (0)  // write L and H of every frame
+#define FLITHROTTLE_LEVEL_COMPRESS (1)  // write them as .fliz, lossless, if canCompress
+#define FLITHROTTLE_LEVEL_SKIP_L   (2)  // additionally write only the high gain channel
+#define FLITHROTTLE_LEVEL_DECIMATE (3)  // additionally write only every n-th frame
+
+/// Write throughput controller of the capture loop.
+/// Fed with the writer backlog (0 = idle, 1 = all frame buffers waiting to be
+/// written) once per frame. Above highWater it steps down the output one level,
+/// at most once every holdFrames frames so a step can take effect: compress
+/// (lossless, only if canCompress), skip L, then decimate by 2, 4, ...
+/// maxDecimation. It steps back
+/// up one level after recoverFrames consecutive frames below lowWater.
+/// Every level change is logged and every frame not written in full is
+/// counted, so data is never dropped silently.
+class FliThrottleC
+{
+ private:
+  uint32_t uiLevel;
+  uint32_t uiDecimation;    // 1 ... no decimation
+  uint32_t uiFramesBelowLow;
+  uint32_t uiHoldLeft;      // frames until the next step down is allowed
+  uint32_t uiMaxLevelReached;
+  uint32_t uiMaxDecimationReached;
+
+  void logChange( double backlog );
+
+ public:
+  bool isEnabled;
+  double highWater;
+  double lowWater;
+  uint32_t recoverFrames;
+  uint32_t maxDecimation;
+  uint32_t holdFrames;      // frames between two steps down
+  bool canCompress;         // the frames may be written as .fliz, set by the capture per run
+  std::string str_logTag;   // prefix of log messages, eg. camera serial number
+
+  // statistics since reset()
+  uint32_t uiNumCompressed;
+  uint32_t uiNumSkippedL;
+  uint32_t uiNumDecimated;
+
+  FliThrottleC();
+
+  void reset();
+  void update( double backlog );
+  bool decide( uint32_t frameIndex, bool* writeL, bool* compress );
+  uint32_t getLevel();
+  uint32_t getDecimation();
+  std::string levelName();
+  void printSummary();
+};
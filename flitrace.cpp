@@ -0,0 +1,203 @@
+#include "flitrace.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+
+std::atomic<bool> FliTraceC::isRunning( false );
+std::mutex FliTraceC::mtxRings;
+std::vector< std::unique_ptr<FliTraceC::RingC> > FliTraceC::rings;
+std::vector<std::string> FliTraceC::threadNames;
+thread_local FliTraceC::ThreadRingC FliTraceC::threadRing;
+std::string FliTraceC::str_fileName;
+int64_t FliTraceC::startNs = 0;
+
+//--------------------------------------------------------------
+/// JSON string of a thread name
+static std::string jsonString( const char* str )
+{
+  std::string result = "\"";
+  for( ; *str != 0; str++ )
+    {
+      if( (*str == '"') || (*str == '\\') )
+	{
+	  result += '\\';
+	}
+      if( (unsigned char)*str >= ' ' )
+	{
+	  result += *str;
+	}
+    }
+  return result + "\"";
+}
+
+//--------------------------------------------------------------
+
+FliTraceC::ThreadRingC::~ThreadRingC()
+{
+  if( ring != NULL )
+    {
+      ring->isInUse = false;
+    }
+}
+
+//--------------------------------------------------------------
+/// start recording, the trace is written to fileName by stop() or at exit
+/// return true if succeeded, false if failed
+bool FliTraceC::start( const std::string& fileName )
+{
+  // fail now rather than after the capture
+  FILE* out = fopen( fileName.c_str(), "w" );
+  if( out == NULL )
+    {
+      std::cerr << "FliTraceC::start() ERROR: cannot create " << fileName << std::endl;
+      return false;
+    }
+  fclose( out );
+  str_fileName = fileName;
+  startNs = now();
+  isRunning = true;
+  // exit() is the usual way out of flictl
+  static bool isAtExitSet = false;
+  if( !isAtExitSet )
+    {
+      atexit( &FliTraceC::stop );
+      isAtExitSet = true;
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+/// stop recording and write the trace
+void FliTraceC::stop()
+{
+  if( !isRunning )
+    {
+      return;
+    }
+  isRunning = false;
+  if( write( str_fileName ) )
+    {
+      std::cout << "Wrote trace " << str_fileName << std::endl;
+    }
+}
+
+//--------------------------------------------------------------
+/// name of the calling thread in the trace, eg. "writer 1"
+void FliTraceC::setThreadName( const std::string& name )
+{
+  if( !isEnabled() )
+    {
+      return;
+    }
+  RingC* ring = getThreadRing();
+  std::lock_guard<std::mutex> lock( mtxRings );
+  threadNames[ring->thread - 1] = name;
+}
+
+//--------------------------------------------------------------
+/// ring of the calling thread, a ring left by a finished thread or a new one
+FliTraceC::RingC* FliTraceC::getThreadRing()
+{
+  if( threadRing.ring == NULL )
+    {
+      std::lock_guard<std::mutex> lock( mtxRings );
+      for( size_t i = 0; (i < rings.size()) && (threadRing.ring == NULL); i++ )
+	{
+	  if( ! rings[i]->isInUse )
+	    {
+	      threadRing.ring = rings[i].get();
+	    }
+	}
+      if( threadRing.ring == NULL )
+	{
+	  RingC* ring = new RingC;
+	  ring->head = 0;
+	  rings.push_back( std::unique_ptr<RingC>( ring ) );
+	  threadRing.ring = ring;
+	}
+      // the spans of the previous owner keep its id and name
+      threadNames.push_back( "" );
+      threadRing.ring->thread = threadNames.size();
+      threadRing.ring->isInUse = true;
+    }
+  return threadRing.ring;
+}
+
+//--------------------------------------------------------------
+/// record a span of the calling thread, name has to be a string literal
+void FliTraceC::add( const char* name, int64_t spanStartNs, int64_t spanEndNs, int64_t frame )
+{
+  RingC* ring = getThreadRing();
+  uint64_t head = ring->head.load( std::memory_order_relaxed );
+  FliTraceEventC& event = ring->events[head & (FLITRACE_RING_SIZE - 1)];
+  event.name = name;
+  event.startNs = spanStartNs;
+  event.durationNs = spanEndNs - spanStartNs;
+  event.frame = frame;
+  event.thread = ring->thread;
+  ring->head.store( head + 1, std::memory_order_release );
+}
+
+//--------------------------------------------------------------
+/// write the spans of all threads as Chrome trace JSON, times in us since
+/// start(), best called when the capture threads are idle
+/// return true if succeeded, false if failed
+bool FliTraceC::write( const std::string& fileName )
+{
+  FILE* out = fopen( fileName.c_str(), "w" );
+  if( out == NULL )
+    {
+      std::cerr << "FliTraceC::write() ERROR: cannot create " << fileName << std::endl;
+      return false;
+    }
+  int pid = getpid();
+  fprintf( out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+  fprintf( out, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"flictl\"}}", pid );
+  uint64_t numOverwritten = 0;
+  std::lock_guard<std::mutex> lock( mtxRings );
+  for( uint32_t thread = 1; thread <= threadNames.size(); thread++ )
+    {
+      const std::string& threadName = threadNames[thread - 1];
+      std::string name = !threadName.empty() ? threadName : "thread " + std::to_string( thread );
+      fprintf( out, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":%s}}",
+	       pid, thread, jsonString( name.c_str() ).c_str() );
+      fprintf( out, ",\n{\"ph\":\"M\",\"name\":\"thread_sort_index\",\"pid\":%d,\"tid\":%u,\"args\":{\"sort_index\":%u}}",
+	       pid, thread, thread );
+    }
+  for( size_t r = 0; r < rings.size(); r++ )
+    {
+      const RingC& ring = *rings[r];
+      uint64_t head = ring.head.load( std::memory_order_acquire );
+      uint64_t first = (head > FLITRACE_RING_SIZE) ? head - FLITRACE_RING_SIZE : 0;
+      numOverwritten += first;
+      for( uint64_t k = first; k < head; k++ )
+	{
+	  const FliTraceEventC& event = ring.events[k & (FLITRACE_RING_SIZE - 1)];
+	  fprintf( out, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+		   event.name, pid, event.thread, (event.startNs - startNs) / 1000.0, event.durationNs / 1000.0 );
+	  if( event.frame >= 0 )
+	    {
+	      fprintf( out, ",\"args\":{\"frame\":%lld}", (long long)event.frame );
+	    }
+	  fprintf( out, "}" );
+	}
+    }
+  fprintf( out, "\n]}\n" );
+  bool ok = (ferror( out ) == 0);
+  if( fclose( out ) != 0 )
+    {
+      ok = false;
+    }
+  if( !ok )
+    {
+      std::cerr << "FliTraceC::write() ERROR: writing " << fileName << " failed" << std::endl;
+    }
+  if( numOverwritten > 0 )
+    {
+      std::cerr << "WARNING: trace lost its " << numOverwritten << " oldest spans, the per thread rings hold "
+		<< FLITRACE_RING_SIZE << " each" << std::endl;
+    }
+  return ok;
+}
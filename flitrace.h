@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#define FLITRACE_RING_SIZE (16384)  // events per thread, power of two, the oldest are overwritten
+
+/// one span of a thread, "ph":"X" in the Chrome trace format
+class FliTraceEventC
+{
+ public:
+  const char* name;         // string literal
+  int64_t startNs;          // steady clock
+  int64_t durationNs;
+  int64_t frame;            // frame (stack) index, -1 ... none
+  uint32_t thread;          // id of the recording thread, rings outlive their threads
+};
+
+/// Timeline of the capture pipeline: spans like getImage, unpack or the file
+/// writes of every frame, per thread, written as Chrome trace JSON that
+/// chrome://tracing and ui.perfetto.dev open. Each thread fills its own ring
+/// (no lock, no system call besides reading the clock); rings of finished
+/// threads are handed to the next new thread, which gets a new thread id,
+/// unnamed until it calls setThreadName(). Disabled, a span costs one atomic
+/// load when it starts.
+class FliTraceC
+{
+ private:
+  class RingC
+  {
+  public:
+    FliTraceEventC events[FLITRACE_RING_SIZE];
+    std::atomic<uint64_t> head;   // next event to write, owning thread only
+    std::atomic<bool> isInUse;
+    uint32_t thread;              // id of the owning thread, new for every owner
+  };
+
+  /// returns the ring of a thread when the thread ends
+  class ThreadRingC
+  {
+  public:
+    RingC* ring = NULL;
+    ~ThreadRingC();
+  };
+
+  static std::atomic<bool> isRunning;
+  static std::mutex mtxRings;
+  static std::vector< std::unique_ptr<RingC> > rings;
+  static std::vector<std::string> threadNames;  // by thread id - 1, guarded by mtxRings
+  static thread_local ThreadRingC threadRing;
+  static std::string str_fileName;
+  static int64_t startNs;
+
+  static RingC* getThreadRing();
+
+ public:
+  static bool start( const std::string& fileName );
+  static void stop();
+  static bool write( const std::string& fileName );
+  static void setThreadName( const std::string& name );
+  static void add( const char* name, int64_t startNs, int64_t endNs, int64_t frame );
+
+  static inline bool isEnabled()
+  {
+    return isRunning.load( std::memory_order_relaxed );
+  }
+
+  static inline int64_t now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+  }
+};
+
+/// records its lifetime as a span of the calling thread if tracing is enabled
+class FliTraceScopeC
+{
+ private:
+  const char* name;
+  int64_t frame;
+  int64_t startNs;          // 0 ... not traced
+
+ public:
+  inline FliTraceScopeC( const char* spanName, int64_t frameIndex = -1 )
+    : name( spanName ), frame( frameIndex ), startNs( FliTraceC::isEnabled() ? FliTraceC::now() : 0 )
+  {
+  }
+
+  inline ~FliTraceScopeC()
+  {
+    if( startNs != 0 )
+      {
+	FliTraceC::add( name, startNs, FliTraceC::now(), frame );
+      }
+  }
+};
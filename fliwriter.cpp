@@ -0,0 +1,158 @@
+#include "fliwriter.h"
+#include "flithread.h"
+#include "flitrace.h"
+
+#include <iostream>
+
+//--------------------------------------------------------------
+
+FliWriterPoolC::FliWriterPoolC()
+{
+  uiMaxQueued = 1;
+  uiNumActive = 0;
+  isExit = false;
+  uiJobsDone = 0;
+  uiJobsFailed = 0;
+  uiMaxBacklog = 0;
+  uiBacklog = 0;
+}
+
+//--------------------------------------------------------------
+
+FliWriterPoolC::~FliWriterPoolC()
+{
+  stop();
+}
+
+//--------------------------------------------------------------
+/// start numThreads writer threads, at most maxQueued jobs wait in the queue,
+/// writer i is pinned to cpus[i % cpus.size()] unless cpus is empty,
+/// threadName names them in the trace, numbered if more than one
+/// return true if succeeded, false if failed
+bool FliWriterPoolC::start( uint32_t numThreads, uint32_t maxQueued, const std::vector<int>& cpus,
+			    const std::string& threadName )
+{
+  if( !workers.empty() )
+    {
+      std::cerr << "FliWriterPoolC::start() ERROR: already started." << std::endl;
+      return false;
+    }
+  if( (numThreads == 0) || (maxQueued == 0) )
+    {
+      std::cerr << "FliWriterPoolC::start() ERROR: need at least one thread and one queue slot." << std::endl;
+      return false;
+    }
+  uiMaxQueued = maxQueued;
+  workerCpus = cpus;
+  isExit = false;
+  for( uint32_t i = 0; i < numThreads; i++ )
+    {
+      std::string name = (numThreads > 1) ? threadName + " " + std::to_string( i ) : threadName;
+      workers.push_back( std::thread( &FliWriterPoolC::workerLoop, this, i, name ) );
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+/// finish all queued jobs and join the writer threads
+void FliWriterPoolC::stop()
+{
+  if( workers.empty() )
+    {
+      return;
+    }
+  waitIdle();
+  {
+    std::lock_guard<std::mutex> lock( mtx );
+    isExit = true;
+  }
+  cvJob.notify_all();
+  for( size_t i = 0; i < workers.size(); i++ )
+    {
+      workers[i].join();
+    }
+  workers.clear();
+}
+
+//--------------------------------------------------------------
+/// queue a job, blocks while the queue is full
+void FliWriterPoolC::submit( std::function<bool()> job )
+{
+  {
+    std::unique_lock<std::mutex> lock( mtx );
+    cvSpace.wait( lock, [this]{ return jobs.size() < uiMaxQueued; } );
+    jobs.push_back( job );
+    uint32_t backlog = jobs.size() + uiNumActive;
+    uiBacklog = backlog;
+    if( backlog > uiMaxBacklog )
+      {
+	uiMaxBacklog = backlog;
+      }
+  }
+  cvJob.notify_one();
+}
+
+//--------------------------------------------------------------
+/// wait until all queued jobs are finished
+void FliWriterPoolC::waitIdle()
+{
+  std::unique_lock<std::mutex> lock( mtx );
+  cvIdle.wait( lock, [this]{ return jobs.empty() && (uiNumActive == 0); } );
+}
+
+//--------------------------------------------------------------
+/// number of queued and running jobs
+uint32_t FliWriterPoolC::getBacklog()
+{
+  std::lock_guard<std::mutex> lock( mtx );
+  return jobs.size() + uiNumActive;
+}
+
+//--------------------------------------------------------------
+
+uint32_t FliWriterPoolC::getNumThreads()
+{
+  return workers.size();
+}
+
+//--------------------------------------------------------------
+
+void FliWriterPoolC::workerLoop( uint32_t workerIndex, std::string threadName )
+{
+  fliClearThreadPlacement();
+  if( !workerCpus.empty() )
+    {
+      fliSetThreadAffinity( workerCpus[workerIndex % workerCpus.size()] );
+    }
+  FliTraceC::setThreadName( threadName );
+  std::unique_lock<std::mutex> lock( mtx );
+  while( true )
+    {
+      cvJob.wait( lock, [this]{ return !jobs.empty() || isExit; } );
+      if( jobs.empty() )
+	{
+	  // isExit and nothing left to do
+	  return;
+	}
+      std::function<bool()> job = jobs.front();
+      jobs.pop_front();
+      uiNumActive++;
+      lock.unlock();
+      cvSpace.notify_one();
+
+      bool ok = job();
+
+      lock.lock();
+      uiNumActive--;
+      uiBacklog = jobs.size() + uiNumActive;
+      if( ok )
+	{
+	  uiJobsDone++;
+	}
+      else
+	{
+	  uiJobsFailed++;
+	}
+      cvIdle.notify_all();
+    }
+}
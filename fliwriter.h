@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+/// Pool of file writer threads shared by all cameras.
+/// Jobs are queued by the acquisition threads and executed in FIFO order.
+/// The queue is bounded: submit() blocks when it is full, which throttles the
+/// acquisition instead of growing memory without limit.
+/// The threads run with normal scheduling on any CPU (or their own one of
+/// cpus), whatever the thread that starts them uses; a single thread pool
+/// also serves as the helper thread of a capture, eg. "raw crc".
+class FliWriterPoolC
+{
+ private:
+  std::vector<std::thread> workers;
+  std::deque< std::function<bool()> > jobs;
+  std::mutex mtx;
+  std::condition_variable cvJob;    // a job was queued or exit requested
+  std::condition_variable cvSpace;  // a job was taken from the queue
+  std::condition_variable cvIdle;   // a job finished
+  uint32_t uiMaxQueued;
+  uint32_t uiNumActive;
+  bool isExit;
+
+  std::vector<int> workerCpus;
+
+  void workerLoop( uint32_t workerIndex, std::string threadName );
+
+ public:
+  // statistics
+  std::atomic<uint64_t> uiJobsDone;
+  std::atomic<uint64_t> uiJobsFailed;
+  std::atomic<uint32_t> uiMaxBacklog;
+  std::atomic<uint32_t> uiBacklog;     // queued and running jobs, readable without the lock
+
+  FliWriterPoolC();
+  ~FliWriterPoolC();
+
+  bool start( uint32_t numThreads, uint32_t maxQueued,
+	      const std::vector<int>& cpus = std::vector<int>(), const std::string& threadName = "writer" );
+  void submit( std::function<bool()> job );
+  void waitIdle();
+  uint32_t getBacklog();
+  uint32_t getNumThreads();
+  void stop();
+};
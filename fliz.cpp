@@ -0,0 +1,263 @@
+#include "flicodec.h"
+#include "flifits.h"
+#include "flichecksum.h"
+#include "flictl.h"
+
+#include <boost/program_options.hpp>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+
+namespace po = boost::program_options;
+
+#define FLIZ_APP_DESCR "Lossless codec for flictl images (fliz)"
+
+//--------------------------------------------------------------
+/// read a whole file
+/// return true if succeeded, false if failed
+static bool readWholeFile( const std::string& fileName, std::string* bytes )
+{
+  int fd = open( fileName.c_str(), O_RDONLY );
+  if( fd < 0 )
+    {
+      std::cerr << "fliz: cannot open " << fileName << ": " << strerror( errno ) << std::endl;
+      return false;
+    }
+  off_t size = lseek( fd, 0, SEEK_END );
+  bytes->resize( (size > 0) ? size : 0 );
+  bool ok = (size >= 0) && (pread( fd, &((*bytes)[0]), bytes->size(), 0 ) == (ssize_t)bytes->size());
+  close( fd );
+  if( !ok )
+    {
+      std::cerr << "fliz: cannot read " << fileName << std::endl;
+    }
+  return ok;
+}
+
+//--------------------------------------------------------------
+/// split a 16-bit image FITS file as written by flictl into its header
+/// block and the unsigned pixels
+/// return true if succeeded, false if it is not such a file
+static bool parseFits( const std::string& fileName, const std::string& bytes, std::string* header,
+		       std::vector<uint16_t>* plane, uint32_t* width, uint32_t* height )
+{
+  size_t headerSize = 0;
+  for( size_t pos = 0; (headerSize == 0) && (pos + FLIFITS_CARD_SIZE <= bytes.size()); pos += FLIFITS_CARD_SIZE )
+    {
+      if( bytes.compare( pos, 8, "END     " ) == 0 )
+	{
+	  headerSize = (pos / FLIFITS_BLOCK_SIZE + 1) * FLIFITS_BLOCK_SIZE;
+	}
+    }
+  *header = bytes.substr( 0, headerSize );
+  int64_t bitpix = 0, naxis = 0, naxis1 = 0, naxis2 = 0, bzero = 0;
+  if( (headerSize == 0)
+      || !FliFitsHeaderC::getCardInt( *header, "BITPIX", &bitpix ) || (bitpix != 16)
+      || !FliFitsHeaderC::getCardInt( *header, "NAXIS", &naxis ) || (naxis != 2)
+      || !FliFitsHeaderC::getCardInt( *header, "NAXIS1", &naxis1 )
+      || !FliFitsHeaderC::getCardInt( *header, "NAXIS2", &naxis2 )
+      || !FliFitsHeaderC::getCardInt( *header, "BZERO", &bzero ) || (bzero != 32768) )
+    {
+      std::cerr << "fliz: " << fileName << " is not a single 16-bit image with BZERO 32768" << std::endl;
+      return false;
+    }
+  *width = naxis1;
+  *height = naxis2;
+  size_t numPixels = (size_t)naxis1 * naxis2;
+  if( headerSize + numPixels * sizeof(uint16_t) > bytes.size() )
+    {
+      std::cerr << "fliz: " << fileName << " is truncated" << std::endl;
+      return false;
+    }
+  plane->resize( numPixels );
+  const uint16_t* src = (const uint16_t*)(bytes.data() + headerSize);
+  for( size_t i = 0; i < numPixels; i++ )
+    {
+      (*plane)[i] = __builtin_bswap16( src[i] ) ^ 0x8000;
+    }
+  return true;
+}
+
+//--------------------------------------------------------------
+/// file name with the extension (from the last '.') replaced
+static std::string replaceExtension( const std::string& fileName, const std::string& extension )
+{
+  size_t dot = fileName.rfind( '.' );
+  size_t slash = fileName.rfind( '/' );
+  if( (dot == std::string::npos) || ((slash != std::string::npos) && (dot < slash)) )
+    {
+      return fileName + extension;
+    }
+  return fileName.substr( 0, dot ) + extension;
+}
+
+//--------------------------------------------------------------
+/// <name>.fits -> <name>.fliz, refused if the file fails its checksums
+/// return true if succeeded, false if failed
+static bool compressFile( const std::string& fileName )
+{
+  std::string bytes, header, result;
+  std::vector<uint16_t> plane;
+  uint32_t width, height;
+  int64_t sum;
+  if( !readWholeFile( fileName, &bytes ) || !parseFits( fileName, bytes, &header, &plane, &width, &height ) )
+    {
+      return false;
+    }
+  // the .fliz gets checksums computed from the pixels as read, which would
+  // hide a file corrupted on disk
+  if( (FliFitsHeaderC::getCardInt( header, "DATASUM", &sum ) || FliFitsHeaderC::getCardInt( header, "CHECKSUM", &sum ))
+      && !fliVerifyFitsFile( fileName, &result ) )
+    {
+      std::cerr << "fliz: " << fileName << ": " << result << ", not compressed" << std::endl;
+      return false;
+    }
+  std::string outName = replaceExtension( fileName, FLICODEC_EXTENSION );
+  if( !FliCodecC::writeFile( outName.c_str(), &header, plane.data(), width, height ) )
+    {
+      return false;
+    }
+  std::cout << fileName << " -> " << outName << std::endl;
+  return true;
+}
+
+//--------------------------------------------------------------
+/// <name>.fliz -> <name>.fits
+/// return true if succeeded, false if failed
+static bool decompressFile( const std::string& fileName )
+{
+  std::string header;
+  std::vector<uint16_t> plane;
+  uint32_t width, height;
+  if( !FliCodecC::readFile( fileName.c_str(), &header, &plane, &width, &height ) )
+    {
+      return false;
+    }
+  std::string outName = replaceExtension( fileName, ".fits" );
+  int fd = open( outName.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644 );
+  if( fd < 0 )
+    {
+      std::cerr << "fliz: cannot create " << outName << ": " << strerror( errno ) << std::endl;
+      return false;
+    }
+  bool ok = fliWriteAll( fd, header.data(), header.size() )
+    && fliWriteFitsData( fd, plane.data(), plane.size(), 16 );
+  if( close( fd ) != 0 )
+    {
+      ok = false;
+    }
+  if( !ok )
+    {
+      std::cerr << "fliz: writing " << outName << " failed" << std::endl;
+      return false;
+    }
+  std::cout << fileName << " -> " << outName << std::endl;
+  return true;
+}
+
+//--------------------------------------------------------------
+/// compress and decompress a FITS file in memory with the AVX2 and the
+/// scalar kernels, check that all of them give back the same pixels and
+/// the original file, print ratio and speed
+/// return true if succeeded, false if failed
+static bool testFile( const std::string& fileName )
+{
+  std::string bytes, header;
+  std::vector<uint16_t> plane;
+  uint32_t width, height;
+  if( !readWholeFile( fileName, &bytes ) || !parseFits( fileName, bytes, &header, &plane, &width, &height ) )
+    {
+      return false;
+    }
+  double planeMB = plane.size() * sizeof(uint16_t) / 1048576.0;
+  std::vector<uint8_t> data( FliCodecC::getMaxSize( width, height ) );
+  std::vector<uint8_t> dataScalar( data.size() );
+  std::vector<uint16_t> decoded( plane.size() );
+  FliCodecC codec, scalar;
+  scalar.setAvx2( false );
+
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  FliFitsSumC sum;
+  size_t size = codec.encode( plane.data(), width, height, data.data(), &sum );
+  std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+  bool ok = codec.decode( data.data(), size, width, height, decoded.data() ) && (decoded == plane);
+  std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+  // both code paths write and read the same stream
+  size_t sizeScalar = scalar.encode( plane.data(), width, height, dataScalar.data(), NULL );
+  ok = ok && (sizeScalar == size) && (memcmp( dataScalar.data(), data.data(), size ) == 0);
+  std::fill( decoded.begin(), decoded.end(), 0 );
+  ok = ok && scalar.decode( data.data(), size, width, height, decoded.data() ) && (decoded == plane);
+
+  // the data sum taken while encoding is the one of the original data unit
+  FliFitsSumC fileSum;
+  fileSum.addBytes( (const uint8_t*)bytes.data() + header.size(), plane.size() * sizeof(uint16_t) );
+  ok = ok && (sum.get() == fileSum.get());
+
+  double encodeSec = std::chrono::duration<double>( t1 - t0 ).count();
+  double decodeSec = std::chrono::duration<double>( t2 - t1 ).count();
+  printf( "%s: %s, %ux%u, ratio %.2f (%.2f bits/pixel), encode %.0f MB/s, decode %.0f MB/s\n",
+	  fileName.c_str(), ok ? "OK" : "FAILED", width, height,
+	  (double)plane.size() * sizeof(uint16_t) / size, 8.0 * size / plane.size(),
+	  planeMB / encodeSec, planeMB / decodeSec );
+  return ok;
+}
+
+//--------------------------------------------------------------
+
+int main( int argc, const char** argv )
+{
+  try
+    {
+      std::vector<std::string> fileNames;
+      po::options_description desc( FLIZ_APP_DESCR " version " FLICTL_VERSION "\nUsage:\n fliz [-c | -d | -t] files\n\nOptions" );
+      desc.add_options()
+	("help,h", "Print help and exit")
+	("compress,c", "Compress 16-bit FITS images <name>.fits into <name>.fliz")
+	("decompress,d", "Decompress <name>.fliz into <name>.fits, the FITS file flictl would have written")
+	("test,t", "Round trip FITS images in memory: check the decoded pixels and header, print ratio and speed")
+	("files", po::value< std::vector<std::string> >(&fileNames), "Input files");
+      po::positional_options_description positional;
+      positional.add( "files", -1 );
+      po::variables_map vm;
+      po::store( po::command_line_parser( argc, argv ).options( desc ).positional( positional ).run(), vm );
+      po::notify( vm );
+
+      if( vm.count("help") || fileNames.empty() || (vm.count("compress") + vm.count("decompress") + vm.count("test") != 1) )
+	{
+	  std::cout << desc << std::endl;
+	  return vm.count("help") ? FLICTL_OK : FLICTL_ERR;
+	}
+      size_t numFailed = 0;
+      for( size_t i = 0; i < fileNames.size(); i++ )
+	{
+	  bool ok;
+	  if( vm.count("compress") )
+	    {
+	      ok = compressFile( fileNames[i] );
+	    }
+	  else if( vm.count("decompress") )
+	    {
+	      ok = decompressFile( fileNames[i] );
+	    }
+	  else
+	    {
+	      ok = testFile( fileNames[i] );
+	    }
+	  numFailed += ok ? 0 : 1;
+	}
+      return (numFailed == 0) ? FLICTL_OK : FLICTL_ERR;
+    }
+  catch( std::exception& e )
+    {
+      std::cerr << "fliz: " << e.what() << std::endl;
+      return FLICTL_ERR;
+    }
+}